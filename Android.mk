@@ -21,6 +21,7 @@ LOCAL_SRC_FILES := \
     fixPermissions.cpp \
     twrpTar.cpp \
     twrpDigest.cpp \
+    twrpDD.cpp \
 
 LOCAL_SRC_FILES += \
     data.cpp \
@@ -192,6 +193,9 @@ endif
 ifeq ($(TW_NO_EXFAT_FUSE), true)
     LOCAL_CFLAGS += -DTW_NO_EXFAT_FUSE
 endif
+ifeq ($(TW_NO_PARALLEL_PARTITIONS), true)
+    LOCAL_CFLAGS += -DTW_NO_PARALLEL_PARTITIONS
+endif
 ifeq ($(TW_INCLUDE_CRYPTO), true)
     LOCAL_CFLAGS += -DTW_INCLUDE_CRYPTO
     LOCAL_CFLAGS += -DCRYPTO_FS_TYPE=\"$(TW_CRYPTO_FS_TYPE)\"
@@ -269,6 +273,26 @@ LOCAL_STATIC_LIBRARIES := \
     libc
 include $(BUILD_EXECUTABLE)
 
+include $(CLEAR_VARS)
+LOCAL_MODULE := twrpTar_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := \
+    twrpTar_test.cpp \
+    twrpTar.cpp \
+    twrpDigest.cpp \
+    tarWrite.c \
+    digest/md5.c
+LOCAL_C_INCLUDES += bionic external/stlport/stlport
+LOCAL_STATIC_LIBRARIES := libcrecovery
+LOCAL_SHARED_LIBRARIES := \
+    libtar \
+    libz \
+    libc \
+    libstlport \
+    libcutils \
+    libstdc++
+include $(BUILD_EXECUTABLE)
+
 include $(CLEAR_VARS)
 
 LOCAL_MODULE := libaosprecovery
@@ -224,9 +224,9 @@ static int LoadPartitionContents(const char* filename, FileContents* file) {
     SHA_init(&sha_ctx);
     uint8_t parsed_sha[SHA_DIGEST_SIZE];
 
-    // allocate enough memory to hold the largest size.
-    file->data = malloc(size[index[pairs-1]]);
-    char* p = (char*)file->data;
+    // Grow the buffer one size at a time, so a match on a small
+    // (size,sha1) pair never allocates room for the largest one.
+    file->data = NULL;
     file->size = 0;                // # bytes read so far
 
     for (i = 0; i < pairs; ++i) {
@@ -236,6 +236,16 @@ static int LoadPartitionContents(const char* filename, FileContents* file) {
         size_t next = size[index[i]] - file->size;
         size_t read = 0;
         if (next > 0) {
+            unsigned char* grown = realloc(file->data, size[index[i]]);
+            if (grown == NULL) {
+                printf("failed to allocate %d bytes for partition \"%s\"\n",
+                       size[index[i]], partition);
+                free(file->data);
+                file->data = NULL;
+                return -1;
+            }
+            file->data = grown;
+            char* p = (char*)file->data + file->size;
             switch (type) {
                 case MTD:
                     read = mtd_read_data(ctx, p, next);
@@ -277,8 +287,6 @@ static int LoadPartitionContents(const char* filename, FileContents* file) {
                    size[index[i]], sha1sum[index[i]]);
             break;
         }
-
-        p += read;
     }
 
     switch (type) {
@@ -354,88 +362,203 @@ int SaveFileContents(const char* filename, const FileContents* file) {
     return 0;
 }
 
-// Write a memory buffer to 'target' partition, a string of the form
-// "MTD:<partition>[:...]" or "EMMC:<partition_device>:".  Return 0 on
-// success.
-int WriteToPartition(unsigned char* data, size_t len,
-                        const char* target) {
+// Output sink for MTD and EMMC targets.  Patched data is collected in
+// a fixed PARTITION_SINK_CHUNK sized buffer and written out whenever
+// it fills up, so patching a partition never needs a buffer the size
+// of the target.
+#define PARTITION_SINK_CHUNK (1024*1024)
+
+typedef struct {
+    enum PartitionType type;
+    char* partition;
+    MtdWriteContext* mtd;
+    int fd;
+    unsigned char* buffer;
+    size_t used;
+    size_t total;
+    size_t limit;
+} PartitionSinkInfo;
+
+static int FlushPartitionSink(PartitionSinkInfo* psi) {
+    if (psi->used == 0) return 0;
+
+    switch (psi->type) {
+        case MTD:
+            ;
+            ssize_t wrote = mtd_write_data(psi->mtd, (char*)psi->buffer, psi->used);
+            if (wrote < 0 || (size_t)wrote != psi->used) {
+                printf("only wrote %ld of %ld bytes to MTD %s\n",
+                       (long)wrote, (long)psi->used, psi->partition);
+                return -1;
+            }
+            break;
+
+        case EMMC:
+            ;
+            size_t done = 0;
+            while (done < psi->used) {
+                ssize_t w = write(psi->fd, psi->buffer + done, psi->used - done);
+                if (w <= 0) {
+                    printf("short write writing to %s (%s)\n",
+                           psi->partition, strerror(errno));
+                    return -1;
+                }
+                done += w;
+            }
+            break;
+    }
+    psi->used = 0;
+    return 0;
+}
+
+// Prepare 'target' partition, a string of the form
+// "MTD:<partition>[:...]" or "EMMC:<partition_device>:", for
+// streaming writes of at most 'limit' bytes.  Return 0 on success.
+static int OpenPartitionSink(const char* target, size_t limit,
+                             PartitionSinkInfo* psi) {
+    memset(psi, 0, sizeof(*psi));
+    psi->fd = -1;
+    psi->limit = limit;
+
     char* copy = strdup(target);
     const char* magic = strtok(copy, ":");
 
-    enum PartitionType type;
-    if (strcmp(magic, "MTD") == 0) {
-        type = MTD;
-    } else if (strcmp(magic, "EMMC") == 0) {
-        type = EMMC;
+    if (magic != NULL && strcmp(magic, "MTD") == 0) {
+        psi->type = MTD;
+    } else if (magic != NULL && strcmp(magic, "EMMC") == 0) {
+        psi->type = EMMC;
     } else {
         printf("WriteToPartition called with bad target (%s)\n", target);
+        free(copy);
         return -1;
     }
     const char* partition = strtok(NULL, ":");
 
     if (partition == NULL) {
         printf("bad partition target name \"%s\"\n", target);
+        free(copy);
         return -1;
     }
+    psi->partition = strdup(partition);
+    free(copy);
 
-    switch (type) {
+    switch (psi->type) {
         case MTD:
             if (!mtd_partitions_scanned) {
                 mtd_scan_partitions();
                 mtd_partitions_scanned = 1;
             }
 
-            const MtdPartition* mtd = mtd_find_partition_by_name(partition);
+            const MtdPartition* mtd = mtd_find_partition_by_name(psi->partition);
             if (mtd == NULL) {
                 printf("mtd partition \"%s\" not found for writing\n",
-                       partition);
-                return -1;
+                       psi->partition);
+                goto fail;
             }
 
-            MtdWriteContext* ctx = mtd_write_partition(mtd);
-            if (ctx == NULL) {
+            psi->mtd = mtd_write_partition(mtd);
+            if (psi->mtd == NULL) {
                 printf("failed to init mtd partition \"%s\" for writing\n",
-                       partition);
-                return -1;
+                       psi->partition);
+                goto fail;
             }
+            break;
 
-            size_t written = mtd_write_data(ctx, (char*)data, len);
-            if (written != len) {
-                printf("only wrote %d of %d bytes to MTD %s\n",
-                       written, len, partition);
-                mtd_write_close(ctx);
-                return -1;
+        case EMMC:
+            psi->fd = open(psi->partition, O_WRONLY);
+            if (psi->fd < 0) {
+                printf("failed to open %s for write: %s\n",
+                       psi->partition, strerror(errno));
+                goto fail;
             }
+            break;
+    }
 
-            if (mtd_erase_blocks(ctx, -1) < 0) {
-                printf("error finishing mtd write of %s\n", partition);
-                mtd_write_close(ctx);
-                return -1;
-            }
+    psi->buffer = malloc(PARTITION_SINK_CHUNK);
+    if (psi->buffer == NULL) {
+        printf("failed to alloc %d bytes for partition write\n",
+               PARTITION_SINK_CHUNK);
+        goto fail;
+    }
+    return 0;
 
-            if (mtd_write_close(ctx)) {
-                printf("error closing mtd write of %s\n", partition);
-                return -1;
+fail:
+    if (psi->mtd != NULL) mtd_write_close(psi->mtd);
+    if (psi->fd >= 0) close(psi->fd);
+    free(psi->partition);
+    psi->mtd = NULL;
+    psi->fd = -1;
+    psi->partition = NULL;
+    return -1;
+}
+
+static ssize_t PartitionSink(unsigned char* data, ssize_t len, void* token) {
+    PartitionSinkInfo* psi = (PartitionSinkInfo*)token;
+    if (psi->limit - psi->total < (size_t)len) {
+        return -1;
+    }
+
+    ssize_t done = 0;
+    while (done < len) {
+        size_t n = PARTITION_SINK_CHUNK - psi->used;
+        if (n > (size_t)(len - done)) n = len - done;
+        memcpy(psi->buffer + psi->used, data + done, n);
+        psi->used += n;
+        done += n;
+        if (psi->used == PARTITION_SINK_CHUNK && FlushPartitionSink(psi) != 0) {
+            return -1;
+        }
+    }
+    psi->total += len;
+    return len;
+}
+
+// Flush any buffered data and finish the partition write.  Return 0
+// on success.
+static int ClosePartitionSink(PartitionSinkInfo* psi) {
+    int result = FlushPartitionSink(psi);
+
+    switch (psi->type) {
+        case MTD:
+            if (result == 0 && mtd_erase_blocks(psi->mtd, -1) < 0) {
+                printf("error finishing mtd write of %s\n", psi->partition);
+                result = -1;
+            }
+            if (mtd_write_close(psi->mtd)) {
+                printf("error closing mtd write of %s\n", psi->partition);
+                result = -1;
             }
             break;
 
         case EMMC:
-            ;
-            FILE* f = fopen(partition, "wb");
-            if (fwrite(data, 1, len, f) != len) {
-                printf("short write writing to %s (%s)\n",
-                       partition, strerror(errno));
-                return -1;
-            }
-            if (fclose(f) != 0) {
-                printf("error closing %s (%s)\n", partition, strerror(errno));
-                return -1;
+            if (fsync(psi->fd) != 0 || close(psi->fd) != 0) {
+                printf("error closing %s (%s)\n", psi->partition, strerror(errno));
+                result = -1;
             }
             break;
     }
 
-    free(copy);
-    return 0;
+    free(psi->buffer);
+    free(psi->partition);
+    psi->buffer = NULL;
+    psi->partition = NULL;
+    return result;
+}
+
+// Write a memory buffer to 'target' partition, a string of the form
+// "MTD:<partition>[:...]" or "EMMC:<partition_device>:".  Return 0 on
+// success.
+int WriteToPartition(unsigned char* data, size_t len,
+                        const char* target) {
+    PartitionSinkInfo psi;
+    if (OpenPartitionSink(target, len, &psi) != 0) {
+        return -1;
+    }
+    if (PartitionSink(data, len, &psi) != (ssize_t)len) {
+        ClosePartitionSink(&psi);
+        return -1;
+    }
+    return ClosePartitionSink(&psi);
 }
 
 
@@ -717,7 +840,8 @@ static int GenerateTarget(FileContents* source_file,
     int retry = 1;
     SHA_CTX ctx;
     int output;
-    MemorySinkInfo msi;
+    PartitionSinkInfo psi;
+    int partition_output = 0;
     FileContents* source_to_use;
     char* outname;
     int made_copy = 0;
@@ -741,14 +865,10 @@ static int GenerateTarget(FileContents* source_file,
 
         if (strncmp(target_filename, "MTD:", 4) == 0 ||
             strncmp(target_filename, "EMMC:", 5) == 0) {
-            // If the target is a partition, we're actually going to
-            // write the output to /tmp and then copy it to the
-            // partition.  statfs() always returns 0 blocks free for
-            // /tmp, so instead we'll just assume that /tmp has enough
-            // space to hold the file.
-
-            // We still write the original source to cache, in case
-            // the partition write is interrupted.
+            // If the target is a partition, the output is streamed
+            // straight to it.  The original source is written to cache
+            // first, so an interrupted or bad partition write can be
+            // redone from the copy.
             if (MakeFreeSpaceOnCache(source_file->size) < 0) {
                 printf("not enough free space on /cache\n");
                 return 1;
@@ -826,17 +946,14 @@ static int GenerateTarget(FileContents* source_file,
         outname = NULL;
         if (strncmp(target_filename, "MTD:", 4) == 0 ||
             strncmp(target_filename, "EMMC:", 5) == 0) {
-            // We store the decoded output in memory.
-            msi.buffer = malloc(target_size);
-            if (msi.buffer == NULL) {
-                printf("failed to alloc %ld bytes for output\n",
-                       (long)target_size);
+            // We stream the decoded output to the partition.
+            if (OpenPartitionSink(target_filename, target_size, &psi) != 0) {
+                printf("failed to open %s for writing\n", target_filename);
                 return 1;
             }
-            msi.pos = 0;
-            msi.size = target_size;
-            sink = MemorySink;
-            token = &msi;
+            partition_output = 1;
+            sink = PartitionSink;
+            token = &psi;
         } else {
             // We write the decoded output to "<tgt-file>.patch".
             outname = (char*)malloc(strlen(target_filename) + 10);
@@ -877,6 +994,10 @@ static int GenerateTarget(FileContents* source_file,
             fsync(output);
             close(output);
         }
+        if (partition_output && ClosePartitionSink(&psi) != 0) {
+            printf("write of patched data to %s failed\n", target_filename);
+            return 1;
+        }
 
         if (result != 0) {
             if (retry == 0) {
@@ -896,18 +1017,13 @@ static int GenerateTarget(FileContents* source_file,
 
     const uint8_t* current_target_sha1 = SHA_final(&ctx);
     if (memcmp(current_target_sha1, target_sha1, SHA_DIGEST_SIZE) != 0) {
+        // For partition targets the copy in CACHE_TEMP_SOURCE is kept,
+        // so running applypatch again will redo the write from it.
         printf("patch did not produce expected sha1\n");
         return 1;
     }
 
-    if (output < 0) {
-        // Copy the temp file to the partition.
-        if (WriteToPartition(msi.buffer, msi.pos, target_filename) != 0) {
-            printf("write of patched data to %s failed\n", target_filename);
-            return 1;
-        }
-        free(msi.buffer);
-    } else {
+    if (output >= 0) {
         // Give the .patch file the same owner, group, and mode of the
         // original source file.
         if (chmod(outname, source_to_use->st.st_mode) != 0) {
@@ -86,6 +86,8 @@ cleanup() {
   run_command rm $WORK_DIR/applypatch
   run_command rm $CACHE_TEMP_SOURCE
   run_command rm /cache/bloat*.dat
+  run_command rm /data/local/tmp/big.img
+  run_command rm /data/local/tmp/big.bsdiff
 
   [ "$pid_emulator" == "" ] || kill $pid_emulator
 
@@ -103,6 +105,7 @@ BAD2_SHA1=$(printf "%040x" $RANDOM)
 OLD_SHA1=$(sha1 $DATA_DIR/old.file)
 NEW_SHA1=$(sha1 $DATA_DIR/new.file)
 NEW_SIZE=$(stat -c %s $DATA_DIR/new.file)
+OLD_SIZE=$(stat -c %s $DATA_DIR/old.file)
 
 # --------------- basic execution ----------------------
 
@@ -340,6 +343,55 @@ $ADB pull $WORK_DIR/old.file $tmpdir/patched
 diff -q $DATA_DIR/new.file $tmpdir/patched || fail
 
 
+# --------------- apply patch to partition ----------------------
+
+# A plain file stands in for the EMMC block device; the patched data
+# is streamed to it rather than collected in memory first.
+run_command rm /cache/bloat*.dat
+run_command rm $CACHE_TEMP_SOURCE
+$ADB push $DATA_DIR/old.file $WORK_DIR
+
+testname "apply bsdiff patch to emmc partition"
+run_command $WORK_DIR/applypatch EMMC:$WORK_DIR/old.file:$OLD_SIZE:$OLD_SHA1:$NEW_SIZE:$NEW_SHA1 - $NEW_SHA1 $NEW_SIZE $BAD1_SHA1:$WORK_DIR/foo $OLD_SHA1:$WORK_DIR/patch.bsdiff || fail
+$ADB pull $WORK_DIR/old.file $tmpdir/patched
+diff -q $DATA_DIR/new.file $tmpdir/patched || fail
+run_command ls $CACHE_TEMP_SOURCE && fail       # copy is deleted after a good write
+
+testname "reapply bsdiff patch to emmc partition"
+run_command $WORK_DIR/applypatch EMMC:$WORK_DIR/old.file:$OLD_SIZE:$OLD_SHA1:$NEW_SIZE:$NEW_SHA1 - $NEW_SHA1 $NEW_SIZE $BAD1_SHA1:$WORK_DIR/foo $OLD_SHA1:$WORK_DIR/patch.bsdiff || fail
+$ADB pull $WORK_DIR/old.file $tmpdir/patched
+diff -q $DATA_DIR/new.file $tmpdir/patched || fail
+
+
+# --------------- apply patch to partition with bounded memory ----------------------
+
+# The target is much larger than the address space applypatch is
+# allowed, so this only passes if the output is streamed instead of
+# being held in memory.  bsdiff is the host tool from external/bsdiff.
+BIG_DIR=/data/local/tmp
+BIG_NEW_MB=128
+MEM_LIMIT_KB=49152
+
+testname "apply bsdiff patch to large emmc partition with bounded memory"
+which bsdiff > /dev/null || fail
+dd if=/dev/urandom of=$tmpdir/big.old bs=1024 count=1024 2> /dev/null || fail
+cp $tmpdir/big.old $tmpdir/big.new || fail
+dd if=/dev/zero bs=1048576 count=$BIG_NEW_MB >> $tmpdir/big.new 2> /dev/null || fail
+bsdiff $tmpdir/big.old $tmpdir/big.new $tmpdir/big.bsdiff || fail
+BIG_OLD_SHA1=$(sha1 $tmpdir/big.old)
+BIG_NEW_SHA1=$(sha1 $tmpdir/big.new)
+BIG_OLD_SIZE=$(stat -c %s $tmpdir/big.old)
+BIG_NEW_SIZE=$(stat -c %s $tmpdir/big.new)
+BIG_TARGET=EMMC:$BIG_DIR/big.img:$BIG_OLD_SIZE:$BIG_OLD_SHA1:$BIG_NEW_SIZE:$BIG_NEW_SHA1
+
+$ADB push $tmpdir/big.old $BIG_DIR/big.img
+$ADB push $tmpdir/big.bsdiff $BIG_DIR/big.bsdiff
+run_command rm $CACHE_TEMP_SOURCE
+run_command "ulimit -v $MEM_LIMIT_KB; $WORK_DIR/applypatch $BIG_TARGET - $BIG_NEW_SHA1 $BIG_NEW_SIZE $BIG_OLD_SHA1:$BIG_DIR/big.bsdiff" || fail
+run_command $WORK_DIR/applypatch -c EMMC:$BIG_DIR/big.img:$BIG_NEW_SIZE:$BIG_NEW_SHA1 || fail
+run_command ls $CACHE_TEMP_SOURCE && fail       # copy is deleted after a good write
+
+
 # --------------- cleanup ----------------------
 
 cleanup
@@ -21,6 +21,7 @@
 // notice.
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include <unistd.h>
@@ -97,32 +98,69 @@ int FillBuffer(unsigned char* buffer, int size, bz_stream* stream) {
     return 0;
 }
 
-int ApplyBSDiffPatch(const unsigned char* old_data, ssize_t old_size,
-                     const Value* patch, ssize_t patch_offset,
-                     SinkFn sink, void* token, SHA_CTX* ctx) {
-
-    unsigned char* new_data;
-    ssize_t new_size;
-    if (ApplyBSDiffPatchMem(old_data, old_size, patch, patch_offset,
-                            &new_data, &new_size) != 0) {
-        return -1;
+// Streamed output is produced in chunks of this size, so patching a
+// partition needs memory for the source and the patch but not for the
+// whole target.
+#define BSPATCH_CHUNK (1024 * 1024)
+
+typedef struct {
+    unsigned char* buffer;
+    ssize_t size;     // capacity of buffer
+    ssize_t used;     // bytes in buffer not yet passed to sink
+    SinkFn sink;      // NULL when buffer holds the whole new file
+    void* token;
+    SHA_CTX* ctx;
+} BSDiffOutput;
+
+static int FlushOutput(BSDiffOutput* out) {
+    if (out->sink == NULL || out->used == 0) {
+        return 0;
     }
-
-    if (sink(new_data, new_size, token) < new_size) {
+    if (out->sink(out->buffer, out->used, out->token) < out->used) {
         printf("short write of output: %d (%s)\n", errno, strerror(errno));
-        return 1;
+        return -1;
     }
-    if (ctx) {
-        SHA_update(ctx, new_data, new_size);
+    if (out->ctx) {
+        SHA_update(out->ctx, out->buffer, out->used);
     }
-    free(new_data);
+    out->used = 0;
+    return 0;
+}
 
+// Decompress len bytes of new file from stream into the output.  If
+// old_data is not NULL, the old bytes starting at oldpos are added in.
+static int ReadSegment(BSDiffOutput* out, off_t len, bz_stream* stream,
+                       const unsigned char* old_data, ssize_t old_size,
+                       off_t oldpos) {
+    while (len > 0) {
+        if (out->used == out->size && FlushOutput(out) != 0) {
+            return -1;
+        }
+        off_t n = out->size - out->used;
+        if (n > len) n = len;
+
+        unsigned char* p = out->buffer + out->used;
+        if (FillBuffer(p, n, stream) != 0) {
+            return -1;
+        }
+        if (old_data != NULL) {
+            off_t i;
+            for (i = 0; i < n; ++i) {
+                if ((oldpos+i >= 0) && (oldpos+i < old_size)) {
+                    p[i] += old_data[oldpos+i];
+                }
+            }
+            oldpos += n;
+        }
+        out->used += n;
+        len -= n;
+    }
     return 0;
 }
 
-int ApplyBSDiffPatchMem(const unsigned char* old_data, ssize_t old_size,
-                        const Value* patch, ssize_t patch_offset,
-                        unsigned char** new_data, ssize_t* new_size) {
+static int ApplyBSDiffPatchOutput(const unsigned char* old_data, ssize_t old_size,
+                                  const Value* patch, ssize_t patch_offset,
+                                  ssize_t new_size, BSDiffOutput* out) {
     // Patch data format:
     //   0       8       "BSDIFF40"
     //   8       8       X
@@ -136,17 +174,11 @@ int ApplyBSDiffPatchMem(const unsigned char* old_data, ssize_t old_size,
     // extra block; seek forwards in oldfile by z bytes".
 
     unsigned char* header = (unsigned char*) patch->data + patch_offset;
-    if (memcmp(header, "BSDIFF40", 8) != 0) {
-        printf("corrupt bsdiff patch file header (magic number)\n");
-        return 1;
-    }
-
     ssize_t ctrl_len, data_len;
     ctrl_len = offtin(header+8);
     data_len = offtin(header+16);
-    *new_size = offtin(header+24);
 
-    if (ctrl_len < 0 || data_len < 0 || *new_size < 0) {
+    if (ctrl_len < 0 || data_len < 0) {
         printf("corrupt patch file header (data lengths)\n");
         return 1;
     }
@@ -183,45 +215,30 @@ int ApplyBSDiffPatchMem(const unsigned char* old_data, ssize_t old_size,
         printf("failed to bzinit extra stream (%d)\n", bzerr);
     }
 
-    *new_data = malloc(*new_size);
-    if (*new_data == NULL) {
-        printf("failed to allocate %ld bytes of memory for output file\n",
-               (long)*new_size);
-        return 1;
-    }
-
+    int result = 1;
     off_t oldpos = 0, newpos = 0;
     off_t ctrl[3];
-    off_t len_read;
-    int i;
     unsigned char buf[24];
-    while (newpos < *new_size) {
+    while (newpos < new_size) {
         // Read control data
         if (FillBuffer(buf, 24, &cstream) != 0) {
             printf("error while reading control stream\n");
-            return 1;
+            goto done;
         }
         ctrl[0] = offtin(buf);
         ctrl[1] = offtin(buf+8);
         ctrl[2] = offtin(buf+16);
 
         // Sanity check
-        if (newpos + ctrl[0] > *new_size) {
+        if (ctrl[0] < 0 || newpos + ctrl[0] > new_size) {
             printf("corrupt patch (new file overrun)\n");
-            return 1;
+            goto done;
         }
 
-        // Read diff string
-        if (FillBuffer(*new_data + newpos, ctrl[0], &dstream) != 0) {
+        // Read diff string and add old data to it
+        if (ReadSegment(out, ctrl[0], &dstream, old_data, old_size, oldpos) != 0) {
             printf("error while reading diff stream\n");
-            return 1;
-        }
-
-        // Add old data to diff string
-        for (i = 0; i < ctrl[0]; ++i) {
-            if ((oldpos+i >= 0) && (oldpos+i < old_size)) {
-                (*new_data)[newpos+i] += old_data[oldpos+i];
-            }
+            goto done;
         }
 
         // Adjust pointers
@@ -229,24 +246,93 @@ int ApplyBSDiffPatchMem(const unsigned char* old_data, ssize_t old_size,
         oldpos += ctrl[0];
 
         // Sanity check
-        if (newpos + ctrl[1] > *new_size) {
+        if (ctrl[1] < 0 || newpos + ctrl[1] > new_size) {
             printf("corrupt patch (new file overrun)\n");
-            return 1;
+            goto done;
         }
 
         // Read extra string
-        if (FillBuffer(*new_data + newpos, ctrl[1], &estream) != 0) {
+        if (ReadSegment(out, ctrl[1], &estream, NULL, 0, 0) != 0) {
             printf("error while reading extra stream\n");
-            return 1;
+            goto done;
         }
 
         // Adjust pointers
         newpos += ctrl[1];
         oldpos += ctrl[2];
     }
+    result = FlushOutput(out) == 0 ? 0 : 1;
 
+done:
     BZ2_bzDecompressEnd(&cstream);
     BZ2_bzDecompressEnd(&dstream);
     BZ2_bzDecompressEnd(&estream);
+    return result;
+}
+
+static int ReadBSDiffHeader(const Value* patch, ssize_t patch_offset,
+                            ssize_t* new_size) {
+    unsigned char* header = (unsigned char*) patch->data + patch_offset;
+    if (memcmp(header, "BSDIFF40", 8) != 0) {
+        printf("corrupt bsdiff patch file header (magic number)\n");
+        return 1;
+    }
+    *new_size = offtin(header+24);
+    if (*new_size < 0) {
+        printf("corrupt patch file header (data lengths)\n");
+        return 1;
+    }
     return 0;
 }
+
+int ApplyBSDiffPatch(const unsigned char* old_data, ssize_t old_size,
+                     const Value* patch, ssize_t patch_offset,
+                     SinkFn sink, void* token, SHA_CTX* ctx) {
+    ssize_t new_size;
+    if (ReadBSDiffHeader(patch, patch_offset, &new_size) != 0) {
+        return -1;
+    }
+
+    BSDiffOutput out;
+    out.size = new_size < BSPATCH_CHUNK ? new_size : BSPATCH_CHUNK;
+    out.buffer = malloc(out.size > 0 ? out.size : 1);
+    out.used = 0;
+    out.sink = sink;
+    out.token = token;
+    out.ctx = ctx;
+    if (out.buffer == NULL) {
+        printf("failed to allocate %ld bytes of memory for output\n",
+               (long)out.size);
+        return 1;
+    }
+
+    int result = ApplyBSDiffPatchOutput(old_data, old_size, patch, patch_offset,
+                                        new_size, &out);
+    free(out.buffer);
+    return result;
+}
+
+int ApplyBSDiffPatchMem(const unsigned char* old_data, ssize_t old_size,
+                        const Value* patch, ssize_t patch_offset,
+                        unsigned char** new_data, ssize_t* new_size) {
+    if (ReadBSDiffHeader(patch, patch_offset, new_size) != 0) {
+        return 1;
+    }
+
+    *new_data = malloc(*new_size);
+    if (*new_data == NULL) {
+        printf("failed to allocate %ld bytes of memory for output file\n",
+               (long)*new_size);
+        return 1;
+    }
+
+    BSDiffOutput out;
+    out.buffer = *new_data;
+    out.size = *new_size;
+    out.used = 0;
+    out.sink = NULL;
+    out.token = NULL;
+    out.ctx = NULL;
+    return ApplyBSDiffPatchOutput(old_data, old_size, patch, patch_offset,
+                                  *new_size, &out);
+}
@@ -18,10 +18,12 @@
 // format.
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "zlib.h"
 #include "mincrypt/sha.h"
@@ -29,15 +31,71 @@
 #include "imgdiff.h"
 #include "utils.h"
 
-/*
- * Apply the patch given in 'patch_filename' to the source data given
- * by (old_data, old_size).  Write the patched output to the 'output'
- * file, and update the SHA context with the output data as well.
- * Return 0 on success.
- */
-int ApplyImagePatch(const unsigned char* old_data, ssize_t old_size,
-                    const Value* patch,
-                    SinkFn sink, void* token, SHA_CTX* ctx) {
+// Chunks are patched on up to this many worker threads.  The
+// IMGPATCH_THREADS environment variable overrides the default (one
+// per online CPU), which is mostly useful for benchmarking.
+#define IMGPATCH_MAX_THREADS 4
+
+// How many bytes of patched output may be held by chunks that are
+// being patched or wait to be written out.  Workers only run ahead of
+// the output while their chunks fit; the chunk the output is waiting
+// for is always allowed, however big it is.
+#define IMGPATCH_MAX_BUFFERED (8 * 1024 * 1024)
+
+typedef struct {
+    int type;
+
+    // CHUNK_NORMAL and CHUNK_DEFLATE
+    size_t src_start;
+    size_t src_len;
+    size_t patch_offset;
+
+    // CHUNK_DEFLATE
+    size_t expanded_len;
+    size_t target_len;
+    int level;
+    int method;
+    int windowBits;
+    int memLevel;
+    int strategy;
+
+    // CHUNK_RAW
+    unsigned char* raw_data;
+    ssize_t raw_len;
+
+    // Output size as announced by the chunk header, 0 for CHUNK_RAW
+    // whose output points into the patch.
+    size_t output_est;
+
+    // Result of processing the chunk.  'output' is owned by the chunk
+    // unless it points into the patch (CHUNK_RAW).
+    unsigned char* output;
+    ssize_t output_len;
+    int owns_output;
+    int status;
+    int done;
+} ImageChunk;
+
+typedef struct {
+    const unsigned char* old_data;
+    ssize_t old_size;
+    const Value* patch;
+    ImageChunk* chunks;
+    int num_chunks;
+
+    int next_chunk;     // next chunk for a worker to pick up
+    int next_output;    // next chunk to be written to the sink
+    size_t buffered;    // output_est of chunks picked but not written yet
+    int failed;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} ImagePatchState;
+
+// Decode the chunk table of an IMGDIFF2 patch into *chunks.  Return 0
+// on success.
+static int ReadChunkTable(const unsigned char* old_data, ssize_t old_size,
+                          const Value* patch,
+                          ImageChunk** chunks, int* num_chunks) {
     ssize_t pos = 12;
     char* header = patch->data;
     if (patch->size < 12) {
@@ -53,167 +111,378 @@ int ApplyImagePatch(const unsigned char* old_data, ssize_t old_size,
         return -1;
     }
 
-    int num_chunks = Read4(header+8);
+    int count = Read4(header+8);
+    if (count < 0) {
+        printf("corrupt patch file header (chunk count)\n");
+        return -1;
+    }
+    *chunks = calloc(count > 0 ? count : 1, sizeof(ImageChunk));
+    if (*chunks == NULL) {
+        printf("failed to allocate %d chunk records\n", count);
+        return -1;
+    }
+    *num_chunks = count;
 
     int i;
-    for (i = 0; i < num_chunks; ++i) {
+    for (i = 0; i < count; ++i) {
+        ImageChunk* c = *chunks + i;
+
         // each chunk's header record starts with 4 bytes.
         if (pos + 4 > patch->size) {
             printf("failed to read chunk %d record\n", i);
-            return -1;
+            goto fail;
         }
-        int type = Read4(patch->data + pos);
+        c->type = Read4(patch->data + pos);
         pos += 4;
 
-        if (type == CHUNK_NORMAL) {
+        if (c->type == CHUNK_NORMAL) {
             char* normal_header = patch->data + pos;
             pos += 24;
             if (pos > patch->size) {
                 printf("failed to read chunk %d normal header data\n", i);
-                return -1;
+                goto fail;
             }
 
-            size_t src_start = Read8(normal_header);
-            size_t src_len = Read8(normal_header+8);
-            size_t patch_offset = Read8(normal_header+16);
-
-            ApplyBSDiffPatch(old_data + src_start, src_len,
-                             patch, patch_offset, sink, token, ctx);
-        } else if (type == CHUNK_RAW) {
+            c->src_start = Read8(normal_header);
+            c->src_len = Read8(normal_header+8);
+            c->patch_offset = Read8(normal_header+16);
+            // The bsdiff header ends with the size of the new data.
+            if (c->patch_offset <= (size_t)patch->size &&
+                (size_t)patch->size - c->patch_offset >= 32) {
+                c->output_est = Read8(patch->data + c->patch_offset + 24);
+            }
+        } else if (c->type == CHUNK_RAW) {
             char* raw_header = patch->data + pos;
             pos += 4;
             if (pos > patch->size) {
                 printf("failed to read chunk %d raw header data\n", i);
-                return -1;
+                goto fail;
             }
 
-            ssize_t data_len = Read4(raw_header);
+            c->raw_len = Read4(raw_header);
 
-            if (pos + data_len > patch->size) {
+            if (c->raw_len < 0 || pos + c->raw_len > patch->size) {
                 printf("failed to read chunk %d raw data\n", i);
-                return -1;
-            }
-            SHA_update(ctx, patch->data + pos, data_len);
-            if (sink((unsigned char*)patch->data + pos,
-                     data_len, token) != data_len) {
-                printf("failed to write chunk %d raw data\n", i);
-                return -1;
+                goto fail;
             }
-            pos += data_len;
-        } else if (type == CHUNK_DEFLATE) {
+            c->raw_data = (unsigned char*)patch->data + pos;
+            pos += c->raw_len;
+        } else if (c->type == CHUNK_DEFLATE) {
             // deflate chunks have an additional 60 bytes in their chunk header.
             char* deflate_header = patch->data + pos;
             pos += 60;
             if (pos > patch->size) {
                 printf("failed to read chunk %d deflate header data\n", i);
-                return -1;
+                goto fail;
             }
 
-            size_t src_start = Read8(deflate_header);
-            size_t src_len = Read8(deflate_header+8);
-            size_t patch_offset = Read8(deflate_header+16);
-            size_t expanded_len = Read8(deflate_header+24);
-            size_t target_len = Read8(deflate_header+32);
-            int level = Read4(deflate_header+40);
-            int method = Read4(deflate_header+44);
-            int windowBits = Read4(deflate_header+48);
-            int memLevel = Read4(deflate_header+52);
-            int strategy = Read4(deflate_header+56);
-
-            // Decompress the source data; the chunk header tells us exactly
-            // how big we expect it to be when decompressed.
-
-            unsigned char* expanded_source = malloc(expanded_len);
-            if (expanded_source == NULL) {
-                printf("failed to allocate %d bytes for expanded_source\n",
-                       expanded_len);
-                return -1;
-            }
+            c->src_start = Read8(deflate_header);
+            c->src_len = Read8(deflate_header+8);
+            c->patch_offset = Read8(deflate_header+16);
+            c->expanded_len = Read8(deflate_header+24);
+            c->target_len = Read8(deflate_header+32);
+            c->level = Read4(deflate_header+40);
+            c->method = Read4(deflate_header+44);
+            c->windowBits = Read4(deflate_header+48);
+            c->memLevel = Read4(deflate_header+52);
+            c->strategy = Read4(deflate_header+56);
+            c->output_est = c->target_len;
+        } else {
+            printf("patch chunk %d is unknown type %d\n", i, c->type);
+            goto fail;
+        }
 
-            z_stream strm;
-            strm.zalloc = Z_NULL;
-            strm.zfree = Z_NULL;
-            strm.opaque = Z_NULL;
-            strm.avail_in = src_len;
-            strm.next_in = (unsigned char*)(old_data + src_start);
-            strm.avail_out = expanded_len;
-            strm.next_out = expanded_source;
-
-            int ret;
-            ret = inflateInit2(&strm, -15);
-            if (ret != Z_OK) {
-                printf("failed to init source inflation: %d\n", ret);
-                return -1;
-            }
+        if (c->type != CHUNK_RAW &&
+            (c->src_start > (size_t)old_size ||
+             c->src_len > (size_t)old_size - c->src_start)) {
+            printf("chunk %d source range is outside the source data\n", i);
+            goto fail;
+        }
+    }
 
-            // Because we've provided enough room to accommodate the output
-            // data, we expect one call to inflate() to suffice.
-            ret = inflate(&strm, Z_SYNC_FLUSH);
-            if (ret != Z_STREAM_END) {
-                printf("source inflation returned %d\n", ret);
-                return -1;
-            }
-            // We should have filled the output buffer exactly.
-            if (strm.avail_out != 0) {
-                printf("source inflation short by %d bytes\n", strm.avail_out);
-                return -1;
-            }
-            inflateEnd(&strm);
-
-            // Next, apply the bsdiff patch (in memory) to the uncompressed
-            // data.
-            unsigned char* uncompressed_target_data;
-            ssize_t uncompressed_target_size;
-            if (ApplyBSDiffPatchMem(expanded_source, expanded_len,
-                                    patch, patch_offset,
-                                    &uncompressed_target_data,
-                                    &uncompressed_target_size) != 0) {
+    return 0;
+
+  fail:
+    free(*chunks);
+    *chunks = NULL;
+    return -1;
+}
+
+// Inflate the source data of a deflate chunk, bspatch it and deflate
+// the result with the original compression settings.
+static int ApplyDeflateChunk(const unsigned char* old_data,
+                             const Value* patch, ImageChunk* c) {
+    // Decompress the source data; the chunk header tells us exactly
+    // how big we expect it to be when decompressed.
+
+    unsigned char* expanded_source = malloc(c->expanded_len);
+    if (expanded_source == NULL) {
+        printf("failed to allocate %ld bytes for expanded_source\n",
+               (long)c->expanded_len);
+        return -1;
+    }
+
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.avail_in = c->src_len;
+    strm.next_in = (unsigned char*)(old_data + c->src_start);
+    strm.avail_out = c->expanded_len;
+    strm.next_out = expanded_source;
+
+    int ret;
+    ret = inflateInit2(&strm, -15);
+    if (ret != Z_OK) {
+        printf("failed to init source inflation: %d\n", ret);
+        free(expanded_source);
+        return -1;
+    }
+
+    // Because we've provided enough room to accommodate the output
+    // data, we expect one call to inflate() to suffice.
+    ret = inflate(&strm, Z_SYNC_FLUSH);
+    inflateEnd(&strm);
+    if (ret != Z_STREAM_END) {
+        printf("source inflation returned %d\n", ret);
+        free(expanded_source);
+        return -1;
+    }
+    // We should have filled the output buffer exactly.
+    if (strm.avail_out != 0) {
+        printf("source inflation short by %d bytes\n", strm.avail_out);
+        free(expanded_source);
+        return -1;
+    }
+
+    // Next, apply the bsdiff patch (in memory) to the uncompressed
+    // data.
+    unsigned char* uncompressed_target_data;
+    ssize_t uncompressed_target_size;
+    ret = ApplyBSDiffPatchMem(expanded_source, c->expanded_len,
+                              patch, c->patch_offset,
+                              &uncompressed_target_data,
+                              &uncompressed_target_size);
+    free(expanded_source);
+    if (ret != 0) {
+        return -1;
+    }
+
+    // Now compress the target data into a buffer big enough to hold
+    // the whole deflate stream.
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    ret = deflateInit2(&strm, c->level, c->method, c->windowBits,
+                       c->memLevel, c->strategy);
+    if (ret != Z_OK) {
+        printf("failed to init target deflation: %d\n", ret);
+        free(uncompressed_target_data);
+        return -1;
+    }
+
+    uLong bound = deflateBound(&strm, uncompressed_target_size);
+    if (bound < c->target_len) bound = c->target_len;
+    c->output = malloc(bound);
+    if (c->output == NULL) {
+        printf("failed to allocate %ld bytes for deflated target\n",
+               (long)bound);
+        deflateEnd(&strm);
+        free(uncompressed_target_data);
+        return -1;
+    }
+    c->owns_output = 1;
+
+    strm.avail_in = uncompressed_target_size;
+    strm.next_in = uncompressed_target_data;
+    strm.avail_out = bound;
+    strm.next_out = c->output;
+    ret = deflate(&strm, Z_FINISH);
+    c->output_len = bound - strm.avail_out;
+    deflateEnd(&strm);
+    free(uncompressed_target_data);
+
+    if (ret != Z_STREAM_END) {
+        printf("target deflation returned %d\n", ret);
+        return -1;
+    }
+    return 0;
+}
+
+static int ApplyChunk(const unsigned char* old_data, const Value* patch,
+                      ImageChunk* c) {
+    switch (c->type) {
+        case CHUNK_NORMAL:
+            if (ApplyBSDiffPatchMem(old_data + c->src_start, c->src_len,
+                                    patch, c->patch_offset,
+                                    &c->output, &c->output_len) != 0) {
                 return -1;
             }
+            c->owns_output = 1;
+            return 0;
+
+        case CHUNK_RAW:
+            c->output = c->raw_data;
+            c->output_len = c->raw_len;
+            c->owns_output = 0;
+            return 0;
+
+        case CHUNK_DEFLATE:
+            return ApplyDeflateChunk(old_data, patch, c);
+    }
+    return -1;
+}
 
-            // Now compress the target data and append it to the output.
-
-            // we're done with the expanded_source data buffer, so we'll
-            // reuse that memory to receive the output of deflate.
-            unsigned char* temp_data = expanded_source;
-            ssize_t temp_size = expanded_len;
-            if (temp_size < 32768) {
-                // ... unless the buffer is too small, in which case we'll
-                // allocate a fresh one.
-                free(temp_data);
-                temp_data = malloc(32768);
-                temp_size = 32768;
+static void* ChunkWorker(void* cookie) {
+    ImagePatchState* state = (ImagePatchState*)cookie;
+
+    pthread_mutex_lock(&state->lock);
+    for (;;) {
+        while (!state->failed && state->next_chunk < state->num_chunks &&
+               state->next_chunk != state->next_output &&
+               state->buffered + state->chunks[state->next_chunk].output_est >
+                   IMGPATCH_MAX_BUFFERED) {
+            pthread_cond_wait(&state->cond, &state->lock);
+        }
+        if (state->failed || state->next_chunk >= state->num_chunks) {
+            break;
+        }
+        ImageChunk* c = state->chunks + state->next_chunk++;
+        state->buffered += c->output_est;
+        pthread_mutex_unlock(&state->lock);
+
+        int status = ApplyChunk(state->old_data, state->patch, c);
+
+        pthread_mutex_lock(&state->lock);
+        c->status = status;
+        c->done = 1;
+        pthread_cond_broadcast(&state->cond);
+    }
+    pthread_mutex_unlock(&state->lock);
+    return NULL;
+}
+
+static int ImagePatchThreads(int num_chunks) {
+    int threads = 0;
+    const char* env = getenv("IMGPATCH_THREADS");
+    if (env != NULL) {
+        threads = atoi(env);
+    } else {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads > IMGPATCH_MAX_THREADS) threads = IMGPATCH_MAX_THREADS;
+    if (threads > num_chunks) threads = num_chunks;
+    if (threads < 1) threads = 1;
+    return threads;
+}
+
+// Write out a finished chunk and release its memory.
+static int WriteChunk(ImageChunk* c, int i, SinkFn sink, void* token,
+                      SHA_CTX* ctx) {
+    int result = 0;
+    if (c->status != 0) {
+        printf("failed to apply patch chunk %d\n", i);
+        result = -1;
+    } else if (sink(c->output, c->output_len, token) != c->output_len) {
+        printf("failed to write %ld bytes of chunk %d to output\n",
+               (long)c->output_len, i);
+        result = -1;
+    } else {
+        SHA_update(ctx, c->output, c->output_len);
+    }
+
+    if (c->owns_output) free(c->output);
+    c->output = NULL;
+    return result;
+}
+
+/*
+ * Apply the patch given in 'patch_filename' to the source data given
+ * by (old_data, old_size).  Write the patched output to the 'output'
+ * file, and update the SHA context with the output data as well.
+ * Return 0 on success.
+ *
+ * The chunks of the patch are independent of each other, so they are
+ * patched on a pool of worker threads and written out in order as
+ * they complete.
+ */
+int ApplyImagePatch(const unsigned char* old_data, ssize_t old_size,
+                    const Value* patch,
+                    SinkFn sink, void* token, SHA_CTX* ctx) {
+    ImagePatchState state;
+    memset(&state, 0, sizeof(state));
+    state.old_data = old_data;
+    state.old_size = old_size;
+    state.patch = patch;
+
+    if (ReadChunkTable(old_data, old_size, patch,
+                       &state.chunks, &state.num_chunks) != 0) {
+        return -1;
+    }
+
+    int threads = ImagePatchThreads(state.num_chunks);
+    int result = 0;
+    int i;
+
+    pthread_t workers[IMGPATCH_MAX_THREADS];
+    int started = 0;
+    if (threads > 1) {
+        pthread_mutex_init(&state.lock, NULL);
+        pthread_cond_init(&state.cond, NULL);
+        for (i = 0; i < threads; ++i) {
+            if (pthread_create(&workers[started], NULL, ChunkWorker, &state) == 0) {
+                ++started;
             }
+        }
+        if (started == 0) {
+            pthread_cond_destroy(&state.cond);
+            pthread_mutex_destroy(&state.lock);
+        }
+    }
 
-            // now the deflate stream
-            strm.zalloc = Z_NULL;
-            strm.zfree = Z_NULL;
-            strm.opaque = Z_NULL;
-            strm.avail_in = uncompressed_target_size;
-            strm.next_in = uncompressed_target_data;
-            ret = deflateInit2(&strm, level, method, windowBits, memLevel, strategy);
-            do {
-                strm.avail_out = temp_size;
-                strm.next_out = temp_data;
-                ret = deflate(&strm, Z_FINISH);
-                ssize_t have = temp_size - strm.avail_out;
-
-                if (sink(temp_data, have, token) != have) {
-                    printf("failed to write %ld compressed bytes to output\n",
-                           (long)have);
-                    return -1;
-                }
-                SHA_update(ctx, temp_data, have);
-            } while (ret != Z_STREAM_END);
-            deflateEnd(&strm);
-
-            free(temp_data);
-            free(uncompressed_target_data);
-        } else {
-            printf("patch chunk %d is unknown type %d\n", i, type);
-            return -1;
+    if (started == 0) {
+        // One chunk at a time from this thread, holding only its output.
+        for (i = 0; i < state.num_chunks && result == 0; ++i) {
+            ImageChunk* c = state.chunks + i;
+            c->status = ApplyChunk(old_data, patch, c);
+            result = WriteChunk(c, i, sink, token, ctx);
         }
+        free(state.chunks);
+        return result;
     }
 
-    return 0;
+    for (i = 0; i < state.num_chunks; ++i) {
+        ImageChunk* c = state.chunks + i;
+
+        pthread_mutex_lock(&state.lock);
+        while (!c->done) {
+            pthread_cond_wait(&state.cond, &state.lock);
+        }
+        pthread_mutex_unlock(&state.lock);
+
+        result = WriteChunk(c, i, sink, token, ctx);
+
+        pthread_mutex_lock(&state.lock);
+        if (result != 0) state.failed = 1;
+        state.buffered -= c->output_est;
+        state.next_output = i + 1;
+        pthread_cond_broadcast(&state.cond);
+        pthread_mutex_unlock(&state.lock);
+
+        if (result != 0) break;
+    }
+
+    for (i = 0; i < started; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    // Release chunks that were finished but never written out.
+    for (i = 0; i < state.num_chunks; ++i) {
+        if (state.chunks[i].owns_output) free(state.chunks[i].output);
+    }
+
+    pthread_cond_destroy(&state.cond);
+    pthread_mutex_destroy(&state.lock);
+    free(state.chunks);
+    return result;
 }
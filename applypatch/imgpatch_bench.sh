@@ -0,0 +1,99 @@
+#!/bin/bash
+#
+# A benchmark for the multithreaded chunk application in imgpatch.
+# It packs the files in testdata into a pair of zip files (several
+# deflated entries each), generates an imgdiff patch between them on
+# the host, then times applypatch on the device with different
+# IMGPATCH_THREADS settings.  Run in a client where you have done
+# envsetup, choosecombo, etc.
+
+# set to 0 to use a device instead
+USE_EMULATOR=0
+EMULATOR_PORT=5580
+
+DATA_DIR=$ANDROID_BUILD_TOP/bootable/recovery/applypatch/testdata
+
+# where on the device to do all the patching.
+WORK_DIR=/data/local/tmp
+
+# number of copies of each testdata file in the zips
+COPIES=8
+
+# ------------------------
+
+tmpdir=$(mktemp -d)
+
+if [ "$USE_EMULATOR" == 1 ]; then
+  emulator -wipe-data -noaudio -no-window -port $EMULATOR_PORT &
+  pid_emulator=$!
+  ADB="adb -s emulator-$EMULATOR_PORT "
+else
+  ADB="adb -d "
+fi
+
+echo "waiting to connect to device"
+$ADB wait-for-device
+
+# run a command on the device; exit with the exit status of the device
+# command.
+run_command() {
+  $ADB shell "$@" \; echo \$? | awk '{if (b) {print a}; a=$0; b=1} END {exit a}'
+}
+
+fail() {
+  echo
+  echo FAIL: $1
+  echo
+  [ "$pid_emulator" == "" ] || kill $pid_emulator
+  exit 1
+}
+
+sha1() {
+  sha1sum $1 | awk '{print $1}'
+}
+
+size() {
+  stat -c %s $1 | tr -d '\n'
+}
+
+# imgdiff can only reconstruct deflate streams made by zlib, so the
+# zips are written with python's zipfile rather than Info-ZIP.
+make_zip() {
+  python - "$1" "$2" $COPIES <<'PY'
+import sys, zipfile
+src, out, copies = sys.argv[1], sys.argv[2], int(sys.argv[3])
+data = open(src, "rb").read()
+z = zipfile.ZipFile(out, "w", zipfile.ZIP_DEFLATED)
+for i in range(copies):
+    # vary each copy a little so every entry needs its own patch
+    z.writestr("entry%02d" % i, data[i:] + data[:i])
+z.close()
+PY
+}
+
+make_zip $DATA_DIR/old.file $tmpdir/source || fail "making source zip"
+make_zip $DATA_DIR/new.file $tmpdir/target || fail "making target zip"
+imgdiff -z $tmpdir/source $tmpdir/target $tmpdir/patch || fail "imgdiff"
+echo "patch is $(size $tmpdir/patch) bytes for a $(size $tmpdir/target) byte target"
+
+$ADB push $ANDROID_PRODUCT_OUT/system/bin/applypatch $WORK_DIR/applypatch
+$ADB push $tmpdir/source $WORK_DIR/source || fail "source push failed"
+$ADB push $tmpdir/patch $WORK_DIR/patch || fail "patch push failed"
+
+for threads in 1 2 4; do
+  run_command rm $WORK_DIR/target
+  start=$(date +%s%N)
+  run_command IMGPATCH_THREADS=$threads $WORK_DIR/applypatch $WORK_DIR/source \
+    $WORK_DIR/target $(sha1 $tmpdir/target) $(size $tmpdir/target) \
+    $(sha1 $tmpdir/source):$WORK_DIR/patch > /dev/null \
+    || fail "applypatch with $threads threads"
+  end=$(date +%s%N)
+  echo "$threads thread(s): $(( (end - start) / 1000000 )) ms"
+done
+
+run_command rm $WORK_DIR/applypatch
+run_command rm $WORK_DIR/source
+run_command rm $WORK_DIR/target
+run_command rm $WORK_DIR/patch
+[ "$pid_emulator" == "" ] || kill $pid_emulator
+rm -rf $tmpdir
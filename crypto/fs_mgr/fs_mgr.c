@@ -609,3 +609,38 @@ int fs_mgr_get_crypt_info(char *fstab_file, char *key_loc, char *real_blk_dev, i
     return 0;
 }
 
+/* Copies the fs_type of the encryptable partition into fs_type. Since
+ * fs_mgr_do_mount() tries every entry for its mount point, fs_type is left
+ * empty when those entries do not all have the same type.
+ */
+int fs_mgr_get_crypt_fs_type(char *fstab_file, char *fs_type, int size)
+{
+    int i = 0;
+    struct fstab_rec *fstab = 0;
+    char *mnt_point = NULL, *type = NULL;
+
+    if (!(fstab = read_fstab(fstab_file))) {
+        return -1;
+    }
+    *fs_type = '\0';
+
+    for (i = 0; fstab[i].blk_dev; i++) {
+        if (fstab[i].fs_mgr_flags & MF_CRYPT) {
+            mnt_point = fstab[i].mnt_point;
+            type = fstab[i].type;
+            break;
+        }
+    }
+    for (i = 0; mnt_point && fstab[i].blk_dev; i++) {
+        if (fs_match(fstab[i].mnt_point, mnt_point) && strcmp(fstab[i].type, type)) {
+            type = NULL;
+            break;
+        }
+    }
+    if (type) {
+        strlcpy(fs_type, type, size);
+    }
+
+    free_fstab(fstab);
+    return 0;
+}
@@ -22,6 +22,7 @@ int fs_mgr_do_mount(char *fstab_file, char *n_name, char *n_blk_dev, char *tmp_m
 int fs_mgr_do_tmpfs_mount(char *n_name);
 int fs_mgr_unmount_all(char *fstab_file);
 int fs_mgr_get_crypt_info(char *fstab_file, char *key_loc, char *real_blk_dev, int size);
+int fs_mgr_get_crypt_fs_type(char *fstab_file, char *fs_type, int size);
 
 #endif /* __CORE_FS_MGR_H */
 
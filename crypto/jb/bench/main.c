@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2013 TeamWin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures the cryptfs password check.
+ *
+ * Without arguments, every key derivation function is timed on the
+ * parameters cryptfs uses (2000 iterations, 16 byte salt, 32 bytes of key
+ * and IV) and checked against OpenSSL's PBKDF2 for passwords of all
+ * lengths. Builds on the host against libcrypto:
+ *   cc -O2 -I.. main.c ../kdf.c -lcrypto -lpthread
+ *
+ * With -m <password> on a device in recovery, it also times
+ * cryptfs_check_passwd() from the password to a test-mounted /data and then
+ * removes the dm-crypt mapping again, so it can be run repeatedly. That
+ * needs libcryptfsjb and libcutils:
+ *   -DWITH_CRYPTFS main.c -lcryptfsjb -lcutils
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "kdf.h"
+#ifdef WITH_CRYPTFS
+#include "cutils/properties.h"
+#include "cryptfs.h"
+#endif
+
+#define HASH_COUNT 2000
+#define SALT_LEN 16
+#define IKEY_LEN 32
+#define RUNS 200
+
+static const struct cryptfs_kdf *kdfs[] = {
+    &cryptfs_kdf_pbkdf2_openssl,
+    &cryptfs_kdf_pbkdf2_fast,
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int check_outputs(void)
+{
+    unsigned char salt[SALT_LEN], expect[80], got[80];
+    char passwd[130];
+    size_t len, out_len, i;
+    unsigned int k;
+
+    srand(1);
+    for (i = 0; i < SALT_LEN; i++)
+        salt[i] = rand();
+    for (len = 0; len < sizeof(passwd) - 1; len++) {
+        for (i = 0; i < len; i++)
+            passwd[i] = 'a' + rand() % 26;
+        passwd[len] = 0;
+        for (out_len = 1; out_len <= sizeof(expect); out_len += 13) {
+            kdfs[0]->derive(passwd, len, salt, SALT_LEN, 1 + len % 3 * 999,
+                            expect, out_len);
+            for (k = 1; k < sizeof(kdfs) / sizeof(kdfs[0]); k++) {
+                memset(got, 0, sizeof(got));
+                if (kdfs[k]->derive(passwd, len, salt, SALT_LEN,
+                                    1 + len % 3 * 999, got, out_len) ||
+                    memcmp(got, expect, out_len)) {
+                    fprintf(stderr, "%s differs for a %zu byte password, "
+                            "%zu bytes out\n", kdfs[k]->name, len, out_len);
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static void bench_kdfs(void)
+{
+    unsigned char salt[SALT_LEN], ikey[IKEY_LEN];
+    unsigned int k, i;
+    double start, elapsed;
+
+    memset(salt, 0x5a, sizeof(salt));
+    for (k = 0; k < sizeof(kdfs) / sizeof(kdfs[0]); k++) {
+        start = now();
+        for (i = 0; i < RUNS; i++)
+            kdfs[k]->derive("correct horse battery staple", 28, salt,
+                            SALT_LEN, HASH_COUNT, ikey, IKEY_LEN);
+        elapsed = now() - start;
+        printf("%-16s %8.3f ms per derivation\n", kdfs[k]->name,
+               elapsed * 1000 / RUNS);
+    }
+}
+
+#ifdef WITH_CRYPTFS
+static int bench_mount(char *passwd)
+{
+    double start;
+    int rc;
+
+    property_set("ro.crypto.state", "encrypted");
+    start = now();
+    rc = cryptfs_check_passwd(passwd);
+    printf("cryptfs_check_passwd: %d after %.1f ms\n", rc,
+           (now() - start) * 1000);
+    if (rc == 0)
+        cryptfs_revert_volume("userdata");
+    return rc != 0;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "m:")) != -1) {
+        switch (c) {
+#ifdef WITH_CRYPTFS
+        case 'm':
+            return bench_mount(optarg);
+#endif
+        default:
+            fprintf(stderr, "Usage: %s [-m password]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (check_outputs())
+        return 1;
+    printf("all implementations agree\n");
+    bench_kdfs();
+    return 0;
+}
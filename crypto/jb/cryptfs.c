@@ -35,11 +35,13 @@
 #include <openssl/evp.h>
 #include <openssl/sha.h>
 #include <errno.h>
+#include <time.h>
 #include <cutils/android_reboot.h>
 #include <ext4.h>
 #include <linux/kdev_t.h>
 #include "../fs_mgr/include/fs_mgr.h"
 #include "cryptfs.h"
+#include "kdf.h"
 #define LOG_TAG "Cryptfs"
 #include "cutils/android_reboot.h"
 #include "cutils/log.h"
@@ -59,6 +61,11 @@
 #define EXT4_FS 1
 #define FAT_FS 2
 
+#define ESSIV_CRYPTO_TYPE "aes-cbc-essiv:sha256"
+#define EXT4_SUPER_OFFSET 1024
+#define EXT4_SUPER_MAGIC_OFFSET 0x38
+#define EXT4_SUPER_MAGIC 0xEF53
+
 char *me = "cryptfs";
 
 static unsigned char saved_master_key[KEY_LEN_BYTES];
@@ -479,11 +486,23 @@ errout:
 
 }
 
-static void pbkdf2(char *passwd, unsigned char *salt, unsigned char *ikey)
+static int pbkdf2(char *passwd, unsigned char *salt, unsigned char *ikey)
 {
     /* Turn the password into a key and IV that can decrypt the master key */
-    PKCS5_PBKDF2_HMAC_SHA1(passwd, strlen(passwd), salt, SALT_LEN,
-                           HASH_COUNT, KEY_LEN_BYTES+IV_LEN_BYTES, ikey);
+    if (cryptfs_kdf->derive(passwd, strlen(passwd), salt, SALT_LEN,
+                            HASH_COUNT, ikey, KEY_LEN_BYTES+IV_LEN_BYTES)) {
+        SLOGE("%s key derivation failed\n", cryptfs_kdf->name);
+        return -1;
+    }
+    return 0;
+}
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
 static int encrypt_master_key(char *passwd, unsigned char *salt,
@@ -495,7 +514,9 @@ static int encrypt_master_key(char *passwd, unsigned char *salt,
     int encrypted_len, final_len;
 
     /* Turn the password into a key and IV that can decrypt the master key */
-    pbkdf2(passwd, salt, ikey);
+    if (pbkdf2(passwd, salt, ikey)) {
+        return -1;
+    }
   
     /* Initialize the decryption engine */
     if (! EVP_EncryptInit(&e_ctx, EVP_aes_128_cbc(), ikey, ikey+KEY_LEN_BYTES)) {
@@ -532,7 +553,9 @@ static int decrypt_master_key(char *passwd, unsigned char *salt,
   int decrypted_len, final_len;
 
   /* Turn the password into a key and IV that can decrypt the master key */
-  pbkdf2(passwd, salt, ikey);
+  if (pbkdf2(passwd, salt, ikey)) {
+    return -1;
+  }
 
   /* Initialize the decryption engine */
   if (! EVP_DecryptInit(&d_ctx, EVP_aes_128_cbc(), ikey, ikey+KEY_LEN_BYTES)) {
@@ -555,6 +578,75 @@ static int decrypt_master_key(char *passwd, unsigned char *salt,
   }
 }
 
+/* Decrypts the sector holding the ext4 superblock with the candidate master
+ * key, the way dm-crypt would, and checks the superblock magic. This turns
+ * away a wrong password without a dm-crypt create and test mount.
+ * Returns 1 if the key is right, 0 if it is wrong and -1 if the footer or
+ * the filesystem type doesn't allow the check.
+ */
+static int check_key_with_superblock(struct crypt_mnt_ftr *crypt_ftr,
+                                     unsigned char *master_key, char *real_blkdev)
+{
+  unsigned char sector[512], plain[512];
+  unsigned char essiv_key[SHA256_DIGEST_LENGTH], iv[IV_LEN_BYTES];
+  char fs_type[PROPERTY_VALUE_MAX];
+  off64_t off = EXT4_SUPER_OFFSET;
+  EVP_CIPHER_CTX ctx;
+  int fd, len, i;
+
+  if (strcmp((char *)crypt_ftr->crypto_type_name, ESSIV_CRYPTO_TYPE) ||
+      crypt_ftr->keysize != KEY_LEN_BYTES ||
+      (crypt_ftr->flags & CRYPT_ENCRYPTION_IN_PROGRESS)) {
+    return -1;
+  }
+  /* Empty unless every fstab entry tried for /data is of the same type */
+  if (fs_mgr_get_crypt_fs_type(get_fstab_filename(), fs_type, sizeof(fs_type)) ||
+      strcmp(fs_type, "ext4")) {
+    return -1;
+  }
+
+  if ((fd = open(real_blkdev, O_RDONLY)) < 0) {
+    return -1;
+  }
+  len = pread64(fd, sector, sizeof(sector), off);
+  close(fd);
+  if (len != sizeof(sector)) {
+    return -1;
+  }
+
+  /* ESSIV: the IV is the 512 byte sector number encrypted with the SHA-256
+   * hash of the key */
+  SHA256(master_key, crypt_ftr->keysize, essiv_key);
+  memset(iv, 0, sizeof(iv));
+  for (i = 0; i < 8; i++) {
+    iv[i] = (off / 512) >> (8 * i);
+  }
+  if (! EVP_EncryptInit(&ctx, EVP_aes_256_ecb(), essiv_key, NULL)) {
+    return -1;
+  }
+  EVP_CIPHER_CTX_set_padding(&ctx, 0);
+  if (! EVP_EncryptUpdate(&ctx, iv, &len, iv, IV_LEN_BYTES)) {
+    EVP_CIPHER_CTX_cleanup(&ctx);
+    return -1;
+  }
+  EVP_CIPHER_CTX_cleanup(&ctx);
+
+  if (! EVP_DecryptInit(&ctx, EVP_aes_128_cbc(), master_key, iv)) {
+    return -1;
+  }
+  EVP_CIPHER_CTX_set_padding(&ctx, 0);
+  if (! EVP_DecryptUpdate(&ctx, plain, &len, sector, sizeof(sector)) ||
+      len != sizeof(sector)) {
+    EVP_CIPHER_CTX_cleanup(&ctx);
+    return -1;
+  }
+  EVP_CIPHER_CTX_cleanup(&ctx);
+  memset(essiv_key, 0, sizeof(essiv_key));
+
+  return (plain[EXT4_SUPER_MAGIC_OFFSET] |
+          plain[EXT4_SUPER_MAGIC_OFFSET + 1] << 8) == EXT4_SUPER_MAGIC;
+}
+
 static int create_encrypted_random_key(char *passwd, unsigned char *master_key, unsigned char *salt)
 {
     int fd;
@@ -768,8 +860,10 @@ static int test_mount_encrypted_fs(char *passwd, char *mount_point, char *label)
   char tmp_mount_point[64];
   unsigned int orig_failed_decrypt_count;
   char encrypted_state[PROPERTY_VALUE_MAX];
+  long long start, kdf_done, dm_done;
   int rc;
 
+  start = now_ms();
   property_get("ro.crypto.state", encrypted_state, "");
   if ( master_key_saved || strcmp(encrypted_state, "encrypted") ) {
     SLOGE("encrypted fs already validated or not running with encryption, aborting");
@@ -788,13 +882,22 @@ static int test_mount_encrypted_fs(char *passwd, char *mount_point, char *label)
 
   if (! (crypt_ftr.flags & CRYPT_MNT_KEY_UNENCRYPTED) ) {
     decrypt_master_key(passwd, salt, encrypted_master_key, decrypted_master_key);
+    if (check_key_with_superblock(&crypt_ftr, decrypted_master_key, real_blkdev) == 0) {
+      /* Counts as a failed mount, without the dm-crypt and mount attempt */
+      SLOGE("Password does not decrypt the superblock\n");
+      crypt_ftr.failed_decrypt_count++;
+      put_crypt_ftr_and_key(real_blkdev, &crypt_ftr, 0, 0);
+      return crypt_ftr.failed_decrypt_count;
+    }
   }
+  kdf_done = now_ms();
 
   if (create_crypto_blk_dev(&crypt_ftr, decrypted_master_key,
                                real_blkdev, crypto_blkdev, label)) {
     SLOGE("Error creating decrypted block device\n");
     return -1;
   }
+  dm_done = now_ms();
 
   /* If init detects an encrypted filesystme, it writes a file for each such
    * encrypted fs into the tmpfs /data filesystem, and then the framework finds those
@@ -816,6 +919,8 @@ static int test_mount_encrypted_fs(char *passwd, char *mount_point, char *label)
     umount(tmp_mount_point);
     crypt_ftr.failed_decrypt_count  = 0;
   }
+  SLOGI("Key check %lld ms, dm-crypt setup %lld ms, test mount %lld ms\n",
+        kdf_done - start, dm_done - kdf_done, now_ms() - dm_done);
 
   if (orig_failed_decrypt_count != crypt_ftr.failed_decrypt_count) {
     put_crypt_ftr_and_key(real_blkdev, &crypt_ftr, 0, 0);
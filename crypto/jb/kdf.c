@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2013 TeamWin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include "kdf.h"
+
+/* 80 bytes of output, enough for a 256 bit key and a 256 bit IV */
+#define MAX_LANES 4
+
+struct lane {
+    const SHA_CTX *inner;       /* state after hashing key ^ ipad */
+    const SHA_CTX *outer;       /* state after hashing key ^ opad */
+    const unsigned char *salt;
+    size_t salt_len;
+    unsigned int iterations;
+    unsigned int index;         /* PBKDF2 block number, starting at 1 */
+    unsigned char t[SHA_DIGEST_LENGTH];
+};
+
+static int pbkdf2_openssl(const char *passwd, size_t passwd_len,
+                          const unsigned char *salt, size_t salt_len,
+                          unsigned int iterations, unsigned char *out, size_t out_len)
+{
+    if (!PKCS5_PBKDF2_HMAC_SHA1(passwd, passwd_len, salt, salt_len,
+                                iterations, out_len, out))
+        return -1;
+    return 0;
+}
+
+static void put_be32(unsigned char *p, SHA_LONG v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void get_digest(const SHA_CTX *c, unsigned char *out)
+{
+    put_be32(out, c->h0);
+    put_be32(out + 4, c->h1);
+    put_be32(out + 8, c->h2);
+    put_be32(out + 12, c->h3);
+    put_be32(out + 16, c->h4);
+}
+
+static void *run_lane(void *arg)
+{
+    struct lane *l = (struct lane *) arg;
+    unsigned char block[SHA_CBLOCK], index[4];
+    unsigned int i, j;
+    SHA_CTX c;
+
+    /* U1 = HMAC(P, S || INT(index)) */
+    put_be32(index, l->index);
+    c = *l->inner;
+    SHA1_Update(&c, l->salt, l->salt_len);
+    SHA1_Update(&c, index, sizeof(index));
+    SHA1_Final(block, &c);
+    c = *l->outer;
+    SHA1_Update(&c, block, SHA_DIGEST_LENGTH);
+    SHA1_Final(block, &c);
+    memcpy(l->t, block, SHA_DIGEST_LENGTH);
+
+    /* Every later HMAC hashes one digest after the 64 byte pad, so both
+     * hashes are a single block that only differs in its first 20 bytes. */
+    memset(block + SHA_DIGEST_LENGTH, 0, SHA_CBLOCK - SHA_DIGEST_LENGTH);
+    block[SHA_DIGEST_LENGTH] = 0x80;
+    put_be32(block + SHA_CBLOCK - 4, (SHA_CBLOCK + SHA_DIGEST_LENGTH) * 8);
+    for (i = 1; i < l->iterations; i++) {
+        c = *l->inner;
+        SHA1_Transform(&c, block);
+        get_digest(&c, block);
+        c = *l->outer;
+        SHA1_Transform(&c, block);
+        get_digest(&c, block);
+        for (j = 0; j < SHA_DIGEST_LENGTH; j++)
+            l->t[j] ^= block[j];
+    }
+    OPENSSL_cleanse(block, sizeof(block));
+    OPENSSL_cleanse(&c, sizeof(c));
+    return NULL;
+}
+
+static int pbkdf2_fast(const char *passwd, size_t passwd_len,
+                       const unsigned char *salt, size_t salt_len,
+                       unsigned int iterations, unsigned char *out, size_t out_len)
+{
+    unsigned char key[SHA_CBLOCK], pad[SHA_CBLOCK];
+    struct lane lanes[MAX_LANES];
+    pthread_t threads[MAX_LANES];
+    int started[MAX_LANES];
+    SHA_CTX inner, outer;
+    size_t count, i, len;
+
+    count = (out_len + SHA_DIGEST_LENGTH - 1) / SHA_DIGEST_LENGTH;
+    if (count == 0 || count > MAX_LANES || iterations == 0)
+        return pbkdf2_openssl(passwd, passwd_len, salt, salt_len, iterations,
+                              out, out_len);
+
+    memset(key, 0, sizeof(key));
+    if (passwd_len > SHA_CBLOCK)
+        SHA1((const unsigned char *) passwd, passwd_len, key);
+    else
+        memcpy(key, passwd, passwd_len);
+    for (i = 0; i < SHA_CBLOCK; i++)
+        pad[i] = key[i] ^ 0x36;
+    SHA1_Init(&inner);
+    SHA1_Update(&inner, pad, SHA_CBLOCK);
+    for (i = 0; i < SHA_CBLOCK; i++)
+        pad[i] = key[i] ^ 0x5c;
+    SHA1_Init(&outer);
+    SHA1_Update(&outer, pad, SHA_CBLOCK);
+
+    for (i = 0; i < count; i++) {
+        lanes[i].inner = &inner;
+        lanes[i].outer = &outer;
+        lanes[i].salt = salt;
+        lanes[i].salt_len = salt_len;
+        lanes[i].iterations = iterations;
+        lanes[i].index = i + 1;
+        started[i] = i > 0 && !pthread_create(&threads[i], NULL, run_lane, &lanes[i]);
+    }
+    run_lane(&lanes[0]);
+    for (i = 1; i < count; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            run_lane(&lanes[i]);
+    }
+
+    for (i = 0; i < count; i++) {
+        len = out_len - i * SHA_DIGEST_LENGTH;
+        memcpy(out + i * SHA_DIGEST_LENGTH, lanes[i].t,
+               len < SHA_DIGEST_LENGTH ? len : SHA_DIGEST_LENGTH);
+    }
+    OPENSSL_cleanse(key, sizeof(key));
+    OPENSSL_cleanse(pad, sizeof(pad));
+    OPENSSL_cleanse(&inner, sizeof(inner));
+    OPENSSL_cleanse(&outer, sizeof(outer));
+    OPENSSL_cleanse(lanes, sizeof(lanes));
+    return 0;
+}
+
+const struct cryptfs_kdf cryptfs_kdf_pbkdf2_openssl = {
+    "pbkdf2-openssl", pbkdf2_openssl
+};
+
+const struct cryptfs_kdf cryptfs_kdf_pbkdf2_fast = {
+    "pbkdf2-fast", pbkdf2_fast
+};
+
+const struct cryptfs_kdf *cryptfs_kdf = &cryptfs_kdf_pbkdf2_fast;
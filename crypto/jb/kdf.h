@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2013 TeamWin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CRYPTFS_KDF_H
+#define __CRYPTFS_KDF_H
+
+#include <stddef.h>
+
+/* Turns a password and salt into out_len bytes of key material. Returns 0 on
+ * success. All implementations must produce identical output. */
+struct cryptfs_kdf {
+    const char *name;
+    int (*derive)(const char *passwd, size_t passwd_len,
+                  const unsigned char *salt, size_t salt_len,
+                  unsigned int iterations, unsigned char *out, size_t out_len);
+};
+
+/* PBKDF2-HMAC-SHA1 through OpenSSL's PKCS5_PBKDF2_HMAC_SHA1. */
+extern const struct cryptfs_kdf cryptfs_kdf_pbkdf2_openssl;
+
+/* PBKDF2-HMAC-SHA1 that hashes the HMAC pads once and then runs each
+ * iteration as two raw SHA-1 block transforms. Every 20 byte output block is
+ * an independent lane, and lanes after the first run on their own threads. */
+extern const struct cryptfs_kdf cryptfs_kdf_pbkdf2_fast;
+
+/* The implementation cryptfs uses. */
+extern const struct cryptfs_kdf *cryptfs_kdf;
+
+#endif /* __CRYPTFS_KDF_H */
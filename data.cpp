@@ -65,6 +65,12 @@ string                                  DataManager::mBackingFile;
 int                                     DataManager::mInitialized = 0;
 extern blanktimer blankTimer;
 
+// Startup sizes partitions and loads the theme on separate threads, so
+// lookups and inserts into mValues have to be serialized
+static pthread_mutex_t values_lock = PTHREAD_MUTEX_INITIALIZER;
+// Held for a whole SaveValues, so two threads do not write the file at once
+static pthread_mutex_t save_lock = PTHREAD_MUTEX_INITIALIZER;
+
 // Device ID functions
 void DataManager::sanitize_device_id(char* device_id) {
 	const char* whitelist ="abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ1234567890-._";
@@ -292,13 +298,21 @@ int DataManager::SaveValues()
 	string mount_path = GetSettingsStoragePath();
 	PartitionManager.Mount_By_Path(mount_path.c_str(), 1);
 
-	FILE* out = fopen(mBackingFile.c_str(), "wb");
-    if (!out)                       return -1;
+	// Written next to the settings file and renamed over it, so it is never
+	// seen half written
+	string tmp_file = mBackingFile + ".tmp";
+	pthread_mutex_lock(&save_lock);
+	FILE* out = fopen(tmp_file.c_str(), "wb");
+	if (!out) {
+		pthread_mutex_unlock(&save_lock);
+		return -1;
+	}
 
     int file_version = FILE_VERSION;
     fwrite(&file_version, 1, sizeof(int), out);
 
     map<string, TStrIntPair>::iterator iter;
+    pthread_mutex_lock(&values_lock);
     for (iter = mValues.begin(); iter != mValues.end(); ++iter)
     {
         // Save only the persisted data
@@ -312,8 +326,15 @@ int DataManager::SaveValues()
             fwrite(iter->second.first.c_str(), 1, length, out);
         }
     }
-    fclose(out);
-    return 0;
+    pthread_mutex_unlock(&values_lock);
+	int ret = 0;
+	if (fclose(out) != 0 || rename(tmp_file.c_str(), mBackingFile.c_str()) != 0) {
+		LOGERR("Unable to save settings to '%s'\n", mBackingFile.c_str());
+		unlink(tmp_file.c_str());
+		ret = -1;
+	}
+	pthread_mutex_unlock(&save_lock);
+	return ret;
 }
 
 int DataManager::GetValue(const string varName, string& value)
@@ -342,11 +363,15 @@ int DataManager::GetValue(const string varName, string& value)
     }
 
     map<string, TStrIntPair>::iterator pos;
+    pthread_mutex_lock(&values_lock);
     pos = mValues.find(localStr);
-    if (pos == mValues.end())
+    if (pos == mValues.end()) {
+        pthread_mutex_unlock(&values_lock);
         return -1;
+    }
 
     value = pos->second.first;
+    pthread_mutex_unlock(&values_lock);
     return 0;
 }
 
@@ -383,25 +408,6 @@ unsigned long long DataManager::GetValue(const string varName, unsigned long lon
     return 0;
 }
 
-// This is a dangerous function. It will create the value if it doesn't exist so it has a valid c_str
-string& DataManager::GetValueRef(const string varName)
-{
-    if (!mInitialized)
-        SetDefaultValues();
-
-    map<string, string>::iterator constPos;
-    constPos = mConstValues.find(varName);
-    if (constPos != mConstValues.end())
-        return constPos->second;
-
-    map<string, TStrIntPair>::iterator pos;
-    pos = mValues.find(varName);
-    if (pos == mValues.end())
-        pos = (mValues.insert(TNameValuePair(varName, TStrIntPair("", 0)))).first;
-
-    return pos->second.first;
-}
-
 // This function will return an empty string if the value doesn't exist
 string DataManager::GetStrValue(const string varName)
 {
@@ -435,13 +441,16 @@ int DataManager::SetValue(const string varName, string value, int persist /* = 0
         return -1;
 
     map<string, TStrIntPair>::iterator pos;
+    pthread_mutex_lock(&values_lock);
     pos = mValues.find(varName);
     if (pos == mValues.end())
         pos = (mValues.insert(TNameValuePair(varName, TStrIntPair(value, persist)))).first;
     else
         pos->second.first = value;
+    persist = pos->second.second;
+    pthread_mutex_unlock(&values_lock);
 
-    if (pos->second.second != 0)
+    if (persist != 0)
         SaveValues();
 	if (varName == "tw_screen_timeout_secs") {
 		blankTimer.setTime(atoi(value.c_str()));
@@ -514,7 +523,7 @@ void DataManager::DumpValues()
 }
 
 void DataManager::update_tz_environment_variables(void) {
-	setenv("TZ", DataManager_GetStrValue(TW_TIME_ZONE_VAR), 1);
+	setenv("TZ", GetStrValue(TW_TIME_ZONE_VAR).c_str(), 1);
     tzset();
 }
 
@@ -1055,7 +1064,7 @@ void DataManager::ReadSettingsFile(void)
 
 	memset(mkdir_path, 0, sizeof(mkdir_path));
 	memset(settings_file, 0, sizeof(settings_file));
-	sprintf(mkdir_path, "%s/TWRP", DataManager_GetSettingsStoragePath());
+	sprintf(mkdir_path, "%s/TWRP", GetSettingsStoragePath().c_str());
 	sprintf(settings_file, "%s/.twrps", mkdir_path);
 
 	if (!PartitionManager.Mount_Settings_Storage(false))
@@ -1110,21 +1119,11 @@ string DataManager::GetCurrentStoragePath(void)
 	return GetStrValue("tw_storage_path");
 }
 
-string& DataManager::CGetCurrentStoragePath()
-{
-	return GetValueRef("tw_storage_path");
-}
-
 string DataManager::GetSettingsStoragePath(void)
 {
 	return GetStrValue("tw_settings_path");
 }
 
-string& DataManager::CGetSettingsStoragePath()
-{
-	return GetValueRef("tw_settings_path");
-}
-
 extern "C" int DataManager_ResetDefaults()
 {
     return DataManager::ResetDefaults();
@@ -1156,24 +1155,6 @@ extern "C" int DataManager_GetValue(const char* varName, char* value)
     return ret;
 }
 
-extern "C" const char* DataManager_GetStrValue(const char* varName)
-{
-    string& str = DataManager::GetValueRef(varName);
-    return str.c_str();
-}
-
-extern "C" const char* DataManager_GetCurrentStoragePath(void)
-{
-    string& str = DataManager::CGetCurrentStoragePath();
-    return str.c_str();
-}
-
-extern "C" const char* DataManager_GetSettingsStoragePath(void)
-{
-    string& str = DataManager::CGetSettingsStoragePath();
-    return str.c_str();
-}
-
 extern "C" int DataManager_GetIntValue(const char* varName)
 {
     return DataManager::GetIntValue(varName);
@@ -21,9 +21,6 @@ int DataManager_ResetDefaults();
 void DataManager_LoadDefaults();
 int DataManager_LoadValues(const char* filename);
 int DataManager_Flush();
-const char* DataManager_GetStrValue(const char* varName);
-const char* DataManager_GetCurrentStoragePath();
-const char* DataManager_GetSettingsStoragePath();
 int DataManager_GetIntValue(const char* varName);
 
 int DataManager_SetStrValue(const char* varName, char* value);
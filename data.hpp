@@ -36,9 +36,6 @@ public:
 	static int GetValue(const string varName, float& value);
     static unsigned long long GetValue(const string varName, unsigned long long& value);
 
-    // This is a dangerous function. It will create the value if it doesn't exist so it has a valid c_str
-    static string& GetValueRef(const string varName);
-
     // Helper functions
     static string GetStrValue(const string varName);
     static int GetIntValue(const string varName);
@@ -59,9 +56,7 @@ public:
 	static void ReadSettingsFile(void);
 
 	static string GetCurrentStoragePath(void);
-	static string& CGetCurrentStoragePath();
 	static string GetSettingsStoragePath(void);
-	static string& CGetSettingsStoragePath();
 
 protected:
     typedef pair<string, int> TStrIntPair;
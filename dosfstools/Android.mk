@@ -3,7 +3,7 @@ LOCAL_PATH:= $(call my-dir)
 
 include $(CLEAR_VARS)
 LOCAL_SRC_FILES := src/boot.c src/check.c src/common.c \
-	src/fat.c src/file.c src/io.c src/lfn.c src/dosfsck.c
+	src/fat.c src/file.c src/io.c src/lfn.c src/verify.c src/dosfsck.c
 LOCAL_C_INCLUDES := $(KERNEL_HEADERS)
 LOCAL_SHARED_LIBRARIES := libc
 LOCAL_CFLAGS += -D_USING_BIONIC_
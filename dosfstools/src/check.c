@@ -256,7 +256,7 @@ static char *file_stat(DOS_FILE * file)
     return temp;
 }
 
-static int bad_name(DOS_FILE * file)
+int bad_name(DOS_FILE * file)
 {
     int i, spc, suspicious = 0;
     char *bad_chars = atari_format ? "*?\\/:" : "*?<>|\"\\/:";
@@ -30,6 +30,11 @@ loff_t alloc_rootdir_entry(DOS_FS * fs, DIR_ENT * de, const char *pattern);
    the 'de' structure, the rest of *de is cleared. The offset returned is to
    where in the filesystem the entry belongs. */
 
+int bad_name(DOS_FILE * file);
+
+/* Returns a non-zero integer if the short name of FILE contains characters
+   or spaces that check_dir would rename. Only looks at FILE->dir_ent. */
+
 int scan_root(DOS_FS * fs);
 
 /* Scans the root directory and recurses into all subdirectories. See check.c
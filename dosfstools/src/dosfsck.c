@@ -39,6 +39,7 @@
 #include "fat.h"
 #include "file.h"
 #include "check.h"
+#include "verify.h"
 
 int interactive = 0, rw = 0, list = 0, test = 0, verbose = 0, write_immed = 0;
 int atari_format = 0;
@@ -53,7 +54,7 @@ unsigned retandroid = 0;
 
 static void usage(char *name)
 {
-    fprintf(stderr, "usage: %s [-aAflrtvVwy] [-d path -d ...] "
+    fprintf(stderr, "usage: %s [-aAflqrtvVwy] [-d path -d ...] "
 	    "[-u path -u ...]\n%15sdevice\n", name, "");
     fprintf(stderr, "  -a       automatically repair the file system\n");
     fprintf(stderr, "  -A       toggle Atari file system format\n");
@@ -63,6 +64,8 @@ static void usage(char *name)
     fprintf(stderr,
 	    "  -n       no-op, check non-interactively without changing\n");
     fprintf(stderr, "  -p       same as -a, for compat with other *fsck\n");
+    fprintf(stderr, "  -q       quick read-only check, with -a or -r repair only if\n"
+	    "           it finds problems\n");
     fprintf(stderr, "  -r       interactively repair the file system\n");
     fprintf(stderr, "  -t       test for bad clusters\n");
     fprintf(stderr, "  -u path  try to undelete that (non-directory) file\n");
@@ -77,6 +80,49 @@ static void usage(char *name)
 	}
 }
 
+/*
+ * Runs verify_tree on a read-only, non-interactive open of PATH and returns
+ * the number of problems found. Exits if there were any and no repair was
+ * asked for; otherwise the caller goes on with the normal serial pass.
+ */
+static unsigned long quick_check(DOS_FS * fs, char *path)
+{
+    unsigned long problems, free_clusters;
+    int saved_interactive = interactive;
+    long threads;
+
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1)
+	threads = 1;
+    if (threads > 8)
+	threads = 8;
+
+    interactive = 0;
+    fs_open(path, 0);
+    read_boot(fs);
+    read_fat(fs);
+    /* read_boot and read_fat queue their fixes as changes */
+    problems = fs_changed();
+    problems += verify_tree(fs, threads, &free_clusters);
+    fs_close(0);
+    interactive = saved_interactive;
+
+    printf("%s: %u files, %lu/%lu clusters\n", path, n_files,
+	   fs->clusters - free_clusters, fs->clusters);
+    if (!problems)
+	return 0;
+    printf("%lu problem%s found.\n", problems, problems == 1 ? "" : "s");
+    if (!rw) {
+	printf("Leaving file system unchanged.\n");
+	exit(retandroid ? 4 : 1);
+    }
+    printf("Starting repair pass.\n");
+    free(fs->label);
+    fs->label = NULL;
+    n_files = 0;
+    return problems;
+}
+
 /*
  * ++roman: On m68k, check if this is an Atari; if yes, turn on Atari variant
  * of MS-DOS filesystem by default.
@@ -108,16 +154,16 @@ static void check_atari(void)
 int main(int argc, char **argv)
 {
     DOS_FS fs;
-    int salvage_files, verify, c;
+    int salvage_files, verify, quick, c;
     unsigned n_files_check = 0, n_files_verify = 0;
     unsigned long free_clusters;
 
     memset(&fs, 0, sizeof(fs));
-    rw = salvage_files = verify = 0;
+    rw = salvage_files = verify = quick = 0;
     interactive = 1;
     check_atari();
 
-    while ((c = getopt(argc, argv, "Aad:flnprtu:vVwy")) != EOF)
+    while ((c = getopt(argc, argv, "Aad:flnpqrtu:vVwy")) != EOF)
 	switch (c) {
 	case 'A':		/* toggle Atari format */
 	    atari_format = !atari_format;
@@ -142,6 +188,9 @@ int main(int argc, char **argv)
 	    rw = 0;
 	    interactive = 0;
 	    break;
+	case 'q':
+	    quick = 1;
+	    break;
 	case 'r':
 	    rw = 1;
 	    interactive = 1;
@@ -177,6 +226,8 @@ int main(int argc, char **argv)
 	usage(argv[0]);
 
     printf("dosfsck " VERSION ", " VERSION_DATE ", FAT32, LFN\n");
+    if (quick && !quick_check(&fs, argv[optind]))
+	return 0;
     fs_open(argv[optind], rw);
     read_boot(&fs);
     if (verify)
@@ -45,14 +45,38 @@
 #include "common.h"
 #include "io.h"
 
+/* Pending changes are kept in a treap ordered by position. Changes never
+   overlap: a write is merged with the changes it overlaps (and with small
+   neighbours it touches), so a read only visits the changes covering it. */
+
 typedef struct _change {
     void *data;
     loff_t pos;
     int size;
-    struct _change *next;
+    unsigned prio;
+    struct _change *left, *right;
 } CHANGE;
 
-static CHANGE *changes, *last;
+/* Touching changes are merged only while the result stays this small, so
+   that writing a long run of FAT entries doesn't copy ever larger nodes. */
+#define CHANGE_MERGE_MAX	4096
+
+/* Small reads (directory entries, boot and info sectors) go through a
+   direct-mapped cache of device blocks. Larger ones, like reading a whole
+   FAT, go straight to the device. */
+#define CACHE_BLOCK	4096
+#define CACHE_SLOTS	1024
+#define CACHE_MAX_READ	(16 * CACHE_BLOCK)
+
+typedef struct {
+    loff_t pos;			/* start of the cached block, -1 if unused */
+    int valid;			/* bytes of the block the device returned */
+    char data[CACHE_BLOCK];
+} CACHE_ENTRY;
+
+static CHANGE *changes;
+static CACHE_ENTRY *cache;
+static unsigned prio_seed = 1;
 static int fd, did_change = 0;
 
 unsigned device_no;
@@ -85,7 +109,7 @@ void fs_open(char *path, int rw)
 	perror("open");
 	exit(6);
     }
-    changes = last = NULL;
+    changes = NULL;
     did_change = 0;
 
 #ifndef _DJGPP_
@@ -108,6 +132,170 @@ void fs_open(char *path, int rw)
 #endif
 }
 
+static loff_t lmin(loff_t a, loff_t b)
+{
+    return a < b ? a : b;
+}
+
+static loff_t lmax(loff_t a, loff_t b)
+{
+    return a > b ? a : b;
+}
+
+/* Splits T into the changes ending before POS (*L) and the rest (*R). */
+
+static void split_before(CHANGE * t, loff_t pos, CHANGE ** l, CHANGE ** r)
+{
+    while (t) {
+	if (t->pos + t->size < pos) {
+	    *l = t;
+	    l = &t->right;
+	    t = t->right;
+	} else {
+	    *r = t;
+	    r = &t->left;
+	    t = t->left;
+	}
+    }
+    *l = *r = NULL;
+}
+
+/* Splits T into the changes starting at or before POS (*L) and the rest
+   (*R). */
+
+static void split_after(CHANGE * t, loff_t pos, CHANGE ** l, CHANGE ** r)
+{
+    while (t) {
+	if (t->pos <= pos) {
+	    *l = t;
+	    l = &t->right;
+	    t = t->right;
+	} else {
+	    *r = t;
+	    r = &t->left;
+	    t = t->left;
+	}
+    }
+    *l = *r = NULL;
+}
+
+/* Joins two treaps; all changes in L come before those in R. */
+
+static CHANGE *join(CHANGE * l, CHANGE * r)
+{
+    if (!l)
+	return r;
+    if (!r)
+	return l;
+    if (l->prio > r->prio) {
+	l->right = join(l->right, r);
+	return l;
+    }
+    r->left = join(l, r->left);
+    return r;
+}
+
+/* Appends the changes in T to LIST in order. */
+
+static void collect(CHANGE * t, CHANGE ** list, int *n)
+{
+    for (; t; t = t->right) {
+	collect(t->left, list, n);
+	list[(*n)++] = t;
+    }
+}
+
+static int count_changes(CHANGE * t)
+{
+    return t ? 1 + count_changes(t->left) + count_changes(t->right) : 0;
+}
+
+/* Copies the parts of the changes in T that overlap POS..POS+SIZE into
+   DATA. */
+
+static void apply_changes(CHANGE * t, loff_t pos, int size, char *data)
+{
+    while (t) {
+	loff_t lo, hi;
+
+	if (t->pos + t->size <= pos) {
+	    t = t->right;
+	    continue;
+	}
+	if (t->pos >= pos + size) {
+	    t = t->left;
+	    continue;
+	}
+	apply_changes(t->left, pos, size, data);
+	lo = lmax(pos, t->pos);
+	hi = lmin(pos + size, t->pos + t->size);
+	memcpy(data + (lo - pos), (char *)t->data + (lo - t->pos), hi - lo);
+	t = t->right;
+    }
+}
+
+static void read_device(loff_t pos, int size, void *data)
+{
+    int got;
+
+    if (llseek(fd, pos, 0) != pos)
+	pdie("Seek to %lld", pos);
+    if ((got = read(fd, data, size)) < 0)
+	pdie("Read %d bytes at %lld", size, pos);
+    if (got != size)
+	die("Got %d bytes instead of %d at %lld", got, size, pos);
+}
+
+static void read_cached(loff_t pos, int size, char *data)
+{
+    int i;
+
+    if (!cache) {
+	cache = alloc(CACHE_SLOTS * sizeof(CACHE_ENTRY));
+	for (i = 0; i < CACHE_SLOTS; i++)
+	    cache[i].pos = -1;
+    }
+    while (size > 0) {
+	loff_t block = pos - pos % CACHE_BLOCK;
+	CACHE_ENTRY *c = cache + (block / CACHE_BLOCK) % CACHE_SLOTS;
+	int offset = pos - block;
+	int len = min(size, CACHE_BLOCK - offset);
+
+	if (c->pos != block) {
+	    if (llseek(fd, block, 0) != block)
+		pdie("Seek to %lld", block);
+	    if ((c->valid = read(fd, c->data, CACHE_BLOCK)) < 0) {
+		c->pos = -1;
+		pdie("Read %d bytes at %lld", len, pos);
+	    }
+	    c->pos = block;
+	}
+	if (offset + len > c->valid)
+	    die("Got %d bytes instead of %d at %lld",
+		c->valid > offset ? c->valid - offset : 0, len, pos);
+	memcpy(data, c->data + offset, len);
+	data += len;
+	pos += len;
+	size -= len;
+    }
+}
+
+/* Drops cached blocks overlapping POS..POS+SIZE after writing there. */
+
+static void invalidate_cache(loff_t pos, int size)
+{
+    loff_t block;
+
+    if (!cache)
+	return;
+    for (block = pos - pos % CACHE_BLOCK; block < pos + size;
+	 block += CACHE_BLOCK) {
+	CACHE_ENTRY *c = cache + (block / CACHE_BLOCK) % CACHE_SLOTS;
+	if (c->pos == block)
+	    c->pos = -1;
+    }
+}
+
 /**
  * Read data from the partition, accounting for any pending updates that are
  * queued for writing.
@@ -119,27 +307,26 @@ void fs_open(char *path, int rw)
  */
 void fs_read(loff_t pos, int size, void *data)
 {
-    CHANGE *walk;
+    if (size > CACHE_MAX_READ)
+	read_device(pos, size, data);
+    else
+	read_cached(pos, size, data);
+    apply_changes(changes, pos, size, data);
+}
+
+/**
+ * Like fs_read, but uses pread and bypasses the block cache, so several
+ * threads may read at once as long as no changes are queued meanwhile.
+ */
+void fs_pread(loff_t pos, int size, void *data)
+{
     int got;
 
-    if (llseek(fd, pos, 0) != pos)
-	pdie("Seek to %lld", pos);
-    if ((got = read(fd, data, size)) < 0)
+    if ((got = pread64(fd, data, size, pos)) < 0)
 	pdie("Read %d bytes at %lld", size, pos);
     if (got != size)
 	die("Got %d bytes instead of %d at %lld", got, size, pos);
-    for (walk = changes; walk; walk = walk->next) {
-	if (walk->pos < pos + size && walk->pos + walk->size > pos) {
-	    if (walk->pos < pos)
-		memcpy(data, (char *)walk->data + pos - walk->pos, min(size,
-								       walk->size
-								       - pos +
-								       walk->pos));
-	    else
-		memcpy((char *)data + walk->pos - pos, walk->data,
-		       min(walk->size, size + pos - walk->pos));
-	}
-    }
+    apply_changes(changes, pos, size, data);
 }
 
 int fs_test(loff_t pos, int size)
@@ -157,11 +344,13 @@ int fs_test(loff_t pos, int size)
 
 void fs_write(loff_t pos, int size, void *data)
 {
-    CHANGE *new;
-    int did;
+    CHANGE *l, *m, *r, *new, **list;
+    loff_t lo, hi;
+    int did, n, first, last, i;
 
     if (write_immed) {
 	did_change = 1;
+	invalidate_cache(pos, size);
 	if (llseek(fd, pos, 0) != pos)
 	    pdie("Seek to %lld", pos);
 	if ((did = write(fd, data, size)) == size)
@@ -170,25 +359,78 @@ void fs_write(loff_t pos, int size, void *data)
 	    pdie("Write %d bytes at %lld", size, pos);
 	die("Wrote %d bytes instead of %d at %lld", did, size, pos);
     }
-    new = alloc(sizeof(CHANGE));
-    new->pos = pos;
-    memcpy(new->data = alloc(new->size = size), data, size);
-    new->next = NULL;
-    if (last)
-	last->next = new;
-    else
-	changes = new;
-    last = new;
+
+    /* Take out the changes overlapping or touching the new one. */
+    split_before(changes, pos, &l, &m);
+    split_after(m, pos + size, &m, &r);
+    n = count_changes(m);
+    list = alloc((n + 1) * sizeof(CHANGE *));
+    n = 0;
+    collect(m, list, &n);
+
+    /* Leave touching neighbours alone if merging them gets too big. */
+    first = 0;
+    last = n;
+    lo = pos;
+    hi = pos + size;
+    for (i = 0; i < n; i++) {
+	if (list[i]->pos + list[i]->size > pos && list[i]->pos < pos + size) {
+	    lo = lmin(lo, list[i]->pos);
+	    hi = lmax(hi, list[i]->pos + list[i]->size);
+	}
+    }
+    if (n && list[0]->pos + list[0]->size == pos &&
+	hi - list[0]->pos > CHANGE_MERGE_MAX) {
+	list[0]->left = list[0]->right = NULL;
+	l = join(l, list[0]);
+	first = 1;
+    }
+    if (last > first && list[last - 1]->pos == pos + size &&
+	list[last - 1]->pos + list[last - 1]->size - lo > CHANGE_MERGE_MAX) {
+	list[last - 1]->left = list[last - 1]->right = NULL;
+	r = join(list[last - 1], r);
+	last--;
+    }
+    if (first < last) {
+	lo = lmin(lo, list[first]->pos);
+	hi = lmax(hi, list[last - 1]->pos + list[last - 1]->size);
+    }
+
+    if (last - first == 1 && list[first]->pos == lo &&
+	list[first]->size == hi - lo) {
+	/* Overwriting part of an existing change. */
+	new = list[first];
+    } else {
+	new = alloc(sizeof(CHANGE));
+	new->pos = lo;
+	new->size = hi - lo;
+	new->data = alloc(new->size);
+	prio_seed = prio_seed * 1103515245 + 12345;
+	new->prio = prio_seed;
+	for (i = first; i < last; i++) {
+	    memcpy((char *)new->data + (list[i]->pos - lo), list[i]->data,
+		   list[i]->size);
+	    free(list[i]->data);
+	    free(list[i]);
+	}
+    }
+    memcpy((char *)new->data + (pos - lo), data, size);
+    new->left = new->right = NULL;
+    free(list);
+    changes = join(join(l, new), r);
 }
 
-static void fs_flush(void)
+/* Writes out and frees the changes in T, in order of position. */
+
+static void flush_changes(CHANGE * t)
 {
     CHANGE *this;
     int size;
 
-    while (changes) {
-	this = changes;
-	changes = changes->next;
+    while (t) {
+	flush_changes(t->left);
+	this = t;
+	t = t->right;
 	if (llseek(fd, this->pos, 0) != this->pos)
 	    fprintf(stderr,
 		    "Seek to %lld failed: %s\n  Did not write %d bytes.\n",
@@ -204,21 +446,31 @@ static void fs_flush(void)
     }
 }
 
-int fs_close(int write)
+static void free_changes(CHANGE * t)
 {
     CHANGE *next;
+
+    while (t) {
+	free_changes(t->left);
+	next = t->right;
+	free(t->data);
+	free(t);
+	t = next;
+    }
+}
+
+int fs_close(int write)
+{
     int changed;
 
     changed = ! !changes;
     if (write)
-	fs_flush();
+	flush_changes(changes);
     else
-	while (changes) {
-	    next = changes->next;
-	    free(changes->data);
-	    free(changes);
-	    changes = next;
-	}
+	free_changes(changes);
+    changes = NULL;
+    free(cache);
+    cache = NULL;
     if (close(fd) < 0)
 	pdie("closing file system");
     return changed || did_change;
@@ -42,6 +42,11 @@ void fs_read(loff_t pos, int size, void *data);
 /* Reads SIZE bytes starting at POS into DATA. Performs all applicable
    changes. */
 
+void fs_pread(loff_t pos, int size, void *data);
+
+/* Like fs_read, but safe to call from several threads at once as long as no
+   changes are being added meanwhile. Doesn't use the block cache. */
+
 int fs_test(loff_t pos, int size);
 
 /* Returns a non-zero integer if SIZE bytes starting at POS can be read without
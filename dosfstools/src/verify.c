@@ -0,0 +1,433 @@
+/* verify.c - Read-only parallel check of the directory tree
+
+   Copyright (C) 2013 TeamWin
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+   On Debian systems, the complete text of the GNU General Public License
+   can be found in /usr/share/common-licenses/GPL-3 file.
+*/
+
+/* Instead of building DOS_FILE trees, every directory becomes a job on a
+ * shared queue. Workers read a directory's clusters in large contiguous
+ * batches, check its entries the way check_dir/check_file would and queue
+ * its subdirectories, so independent subtrees are checked concurrently.
+ * Cluster ownership is a bitmap updated with atomic or, which catches
+ * cross-linked and looping chains no matter which thread gets there first.
+ * Nothing is written; the caller runs the normal serial pass to repair. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "dosfsck.h"
+#include "io.h"
+#include "fat.h"
+#include "check.h"
+#include "verify.h"
+
+#define BATCH_SIZE	(1024 * 1024)	/* largest directory read at once */
+#define LONG_BITS	(sizeof(unsigned long) * 8)
+
+/* get start field of a dir entry */
+#define FSTART(de,fs) \
+  ((unsigned long)CF_LE_W((de)->start) | \
+   (fs->fat_bits == 32 ? CF_LE_W((de)->starthi) << 16 : 0))
+
+typedef struct _dir_job {
+    unsigned long start;	/* first cluster, 0 for a FAT12/16 root dir */
+    unsigned long parent;	/* what ".." must point to */
+    int root;
+    char *path;
+    struct _dir_job *next;
+} DIR_JOB;
+
+typedef struct {
+    DIR_JOB *job;
+    int lfn;			/* long name slots waiting for their alias */
+    int dot, dotdot;
+    unsigned char (*names)[MSDOS_NAME];
+    int n_names, max_names;
+} DIR_STATE;
+
+static DOS_FS *vfs;
+static unsigned long *owned;
+static unsigned long problems;
+static unsigned files;
+
+static DIR_JOB *queue;
+static int busy;		/* jobs queued or being worked on */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+
+/* Marks CLUSTER as in use. Returns zero if somebody already had it. */
+
+static int claim(unsigned long cluster)
+{
+    unsigned long bit = 1UL << (cluster % LONG_BITS);
+
+    return !(__sync_fetch_and_or(&owned[cluster / LONG_BITS], bit) & bit);
+}
+
+static int claimed(unsigned long cluster)
+{
+    return ! !(owned[cluster / LONG_BITS] & (1UL << (cluster % LONG_BITS)));
+}
+
+static void report(const char *path, const char *name, const char *msg, ...)
+{
+    va_list args;
+
+    pthread_mutex_lock(&lock);
+    if (name)
+	printf("%s/%s\n  ", path, name);
+    else
+	printf("%s\n  ", *path ? path : "/");
+    va_start(args, msg);
+    vprintf(msg, args);
+    va_end(args);
+    printf("\n");
+    problems++;
+    pthread_mutex_unlock(&lock);
+}
+
+/* file_name() uses a static buffer, so workers format names themselves. */
+
+static void short_name(char *buf, const unsigned char *name)
+{
+    char *p = buf;
+    int i, end;
+
+    for (end = 8; end > 0 && name[end - 1] == ' '; end--) ;
+    for (i = 0; i < end; i++)
+	*p++ = name[i] < ' ' || name[i] == 0x7f ? '?' : name[i];
+    for (end = 11; end > 8 && name[end - 1] == ' '; end--) ;
+    if (end > 8)
+	*p++ = '.';
+    for (i = 8; i < end; i++)
+	*p++ = name[i] < ' ' || name[i] == 0x7f ? '?' : name[i];
+    *p = 0;
+}
+
+static void push(unsigned long start, unsigned long parent, int root,
+		 char *path)
+{
+    DIR_JOB *job = alloc(sizeof(DIR_JOB));
+
+    job->start = start;
+    job->parent = parent;
+    job->root = root;
+    job->path = path;
+    pthread_mutex_lock(&lock);
+    job->next = queue;
+    queue = job;
+    busy++;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Follow and claim a cluster chain, stopping where check_file would
+ * truncate it.
+ *
+ * @param[in]   start   First cluster
+ * @param[in]   limit   Number of clusters the entry's size allows,
+ *                      -1 for directories
+ * @param[out]  chain   If not NULL, receives an alloc'ed list of the clusters
+ *
+ * @return  Number of clusters in the intact part of the chain
+ */
+static unsigned long walk_chain(const char *path, const char *name,
+				unsigned long start, unsigned long limit,
+				unsigned long **chain)
+{
+    unsigned long curr, clusters = 0, size = 0;
+    FAT_ENTRY entry;
+
+    if (chain)
+	*chain = NULL;
+    for (curr = start; curr;) {
+	get_fat(&entry, vfs->fat, curr, vfs);
+	if (!entry.value || FAT_IS_BAD(vfs, entry.value)) {
+	    report(path, name, "Contains a %s cluster (%lu).",
+		   entry.value ? "bad" : "free", curr);
+	    break;
+	}
+	if (clusters == limit) {
+	    report(path, name, "Cluster chain is longer than the file size.");
+	    break;
+	}
+	if (!claim(curr)) {
+	    report(path, name, "Shares cluster %lu or loops.", curr);
+	    break;
+	}
+	if (chain) {
+	    if (clusters == size) {
+		size = size ? size * 2 : 16;
+		*chain = realloc(*chain, size * sizeof(unsigned long));
+		if (!*chain)
+		    die("Out of memory");
+	    }
+	    (*chain)[clusters] = curr;
+	}
+	clusters++;
+	curr = FAT_IS_EOF(vfs, entry.value) ? 0 : entry.value;
+    }
+    return clusters;
+}
+
+static void check_entry(DIR_STATE * st, DIR_ENT * de)
+{
+    DIR_JOB *job = st->job;
+    unsigned long start, clusters, need;
+    char name[13], *path;
+    DOS_FILE file;
+
+    if (IS_FREE(de->name)) {
+	if (st->lfn)
+	    report(job->path, NULL, "Orphaned long file name part.");
+	st->lfn = 0;
+	return;
+    }
+    if (de->attr == VFAT_LN_ATTR) {
+	/* lfn_add_slot fixes these two fields even in auto mode */
+	if (((unsigned char *)de)[12] != 0 || de->start != CT_LE_W(0))
+	    report(job->path, NULL, "Bad long file name slot.");
+	st->lfn = 1;
+	return;
+    }
+    st->lfn = 0;
+    short_name(name, de->name);
+    start = FSTART(de, vfs);
+
+    if (!strncmp((const char *)de->name, MSDOS_DOT, MSDOS_NAME) ||
+	!strncmp((const char *)de->name, MSDOS_DOTDOT, MSDOS_NAME)) {
+	int dot = de->name[1] == ' ';
+
+	if (!(de->attr & ATTR_DIR))
+	    report(job->path, name, "Is a non-directory.");
+	else if (job->root)
+	    report(job->path, name, "Root contains a dot directory.");
+	else if (CF_LE_L(de->size))
+	    report(job->path, name, "Directory has non-zero size.");
+	else if (start != (dot ? job->start : job->parent))
+	    report(job->path, name, "Start (%lu) does not point to %s (%lu)",
+		   start, dot ? "parent" : "..",
+		   dot ? job->start : job->parent);
+	if (dot)
+	    st->dot++;
+	else
+	    st->dotdot++;
+	return;
+    }
+
+    __sync_fetch_and_add(&files, 1);
+    if (!(de->attr & ATTR_VOLUME)) {
+	memcpy(&file.dir_ent, de, sizeof(DIR_ENT));
+	if (bad_name(&file))
+	    report(job->path, name, "Bad short file name.");
+	if (st->n_names == st->max_names) {
+	    st->max_names = st->max_names ? st->max_names * 2 : 64;
+	    st->names = realloc(st->names, st->max_names * MSDOS_NAME);
+	    if (!st->names)
+		die("Out of memory");
+	}
+	memcpy(st->names[st->n_names++], de->name, MSDOS_NAME);
+    }
+
+    if (de->attr & ATTR_DIR) {
+	if (CF_LE_L(de->size))
+	    report(job->path, name, "Directory has non-zero size.");
+	if (!start) {
+	    report(job->path, name, "Start does point to root directory.");
+	    return;
+	}
+    }
+    if (start >= vfs->clusters + 2 || start == 1) {
+	report(job->path, name, "Start cluster beyond limit (%lu > %lu).",
+	       start, vfs->clusters + 1);
+	return;
+    }
+
+    if (de->attr & ATTR_DIR) {
+	path = alloc(strlen(job->path) + strlen(name) + 2);
+	sprintf(path, "%s/%s", job->path, name);
+	push(start, job->root ? 0 : job->start, 0, path);
+	return;
+    }
+    need = (CF_LE_L(de->size) + (unsigned long long)vfs->cluster_size - 1) /
+	vfs->cluster_size;
+    clusters = start ? walk_chain(job->path, name, start, need, NULL) : 0;
+    if (clusters < need)
+	report(job->path, name, "File size is %u bytes, cluster chain length "
+	       "is %llu bytes.", CF_LE_L(de->size),
+	       (unsigned long long)clusters * vfs->cluster_size);
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return memcmp(a, b, MSDOS_NAME);
+}
+
+static void check_entries(DIR_STATE * st, unsigned char *data, int size)
+{
+    int i;
+
+    for (i = 0; i + (int)sizeof(DIR_ENT) <= size; i += sizeof(DIR_ENT))
+	check_entry(st, (DIR_ENT *) (data + i));
+}
+
+static void check_job(DIR_JOB * job)
+{
+    DIR_STATE st;
+    unsigned long *chain = NULL, clusters, i, j;
+    unsigned char *buf;
+    char name[13];
+    int size;
+
+    memset(&st, 0, sizeof(st));
+    st.job = job;
+    if (!job->start) {
+	size = vfs->root_entries * sizeof(DIR_ENT);
+	buf = alloc(size);
+	fs_pread(vfs->root_start, size, buf);
+	check_entries(&st, buf, size);
+    } else {
+	clusters = walk_chain(job->path, NULL, job->start, -1, &chain);
+	buf = alloc(BATCH_SIZE > vfs->cluster_size ?
+		    BATCH_SIZE : vfs->cluster_size);
+	/* read runs of adjacent clusters with one request each */
+	for (i = 0; i < clusters; i = j) {
+	    for (j = i + 1; j < clusters && chain[j] == chain[j - 1] + 1 &&
+		 (j - i + 1) * vfs->cluster_size <= BATCH_SIZE; j++) ;
+	    size = (j - i) * vfs->cluster_size;
+	    fs_pread(cluster_start(vfs, chain[i]), size, buf);
+	    check_entries(&st, buf, size);
+	}
+	free(chain);
+    }
+    free(buf);
+    if (st.lfn)
+	report(job->path, NULL, "Orphaned long file name part.");
+
+    /* check_dir compares every pair; sorting finds the same duplicates */
+    qsort(st.names, st.n_names, MSDOS_NAME, compare_names);
+    for (i = 1; i < st.n_names; i++)
+	if (!memcmp(st.names[i - 1], st.names[i], MSDOS_NAME)) {
+	    short_name(name, st.names[i]);
+	    report(job->path, name, "Duplicate directory entry.");
+	}
+    free(st.names);
+
+    if (!job->root && (!st.dot || !st.dotdot))
+	printf("%s\n  \"%s\" is missing. Can't fix this yet.\n", job->path,
+	       st.dot ? ".." : ".");
+}
+
+static void *worker(void *arg)
+{
+    DIR_JOB *job;
+
+    pthread_mutex_lock(&lock);
+    for (;;) {
+	while (!queue && busy)
+	    pthread_cond_wait(&wake, &lock);
+	if (!queue)
+	    break;
+	job = queue;
+	queue = job->next;
+	pthread_mutex_unlock(&lock);
+
+	check_job(job);
+	free(job->path);
+	free(job);
+
+	pthread_mutex_lock(&lock);
+	if (!--busy)
+	    pthread_cond_broadcast(&wake);
+    }
+    pthread_mutex_unlock(&lock);
+    return arg;
+}
+
+unsigned long verify_tree(DOS_FS * fs, int threads,
+			  unsigned long *free_clusters)
+{
+    pthread_t *tids;
+    unsigned long i, unused = 0, lost = 0;
+    FAT_ENTRY entry;
+    char *path;
+    int started;
+
+    vfs = fs;
+    problems = 0;
+    files = 0;
+    i = (fs->clusters + 2 + LONG_BITS - 1) / LONG_BITS * sizeof(unsigned long);
+    owned = alloc(i);
+    memset(owned, 0, i);
+
+    if (fs->root_cluster >= fs->clusters + 2) {
+	/* scan_root would give up here */
+	report("", NULL, "Bad FAT32 root directory! (bad start cluster)");
+	free(owned);
+	*free_clusters = 0;
+	return problems;
+    }
+    path = alloc(1);
+    *path = 0;
+    push(fs->root_cluster, 0, 1, path);
+    if (threads < 1)
+	threads = 1;
+    tids = alloc(threads * sizeof(pthread_t));
+    for (started = 0; started < threads - 1; started++)
+	if (pthread_create(&tids[started], NULL, worker, NULL))
+	    break;
+    worker(NULL);
+    while (started)
+	pthread_join(tids[--started], NULL);
+    free(tids);
+
+    /* what reclaim_free and update_free would change */
+    for (i = 2; i < fs->clusters + 2; i++) {
+	get_fat(&entry, fs->fat, i, fs);
+	if (claimed(i) || FAT_IS_BAD(fs, entry.value))
+	    continue;
+	unused++;
+	if (entry.value)
+	    lost++;
+    }
+    if (lost) {
+	printf("%lu unused cluster%s not marked as free.\n", lost,
+	       lost == 1 ? " is" : "s are");
+	problems++;
+    }
+    if (fs->fsinfo_start && fs->free_clusters != unused) {
+	if (fs->free_clusters == 0xFFFFFFFF)
+	    printf("Free cluster summary uninitialized (should be %ld)\n",
+		   unused);
+	else
+	    printf("Free cluster summary wrong (%ld vs. really %ld)\n",
+		   fs->free_clusters, unused);
+	problems++;
+    }
+
+    free(owned);
+    owned = NULL;
+    n_files = files;
+    *free_clusters = unused;
+    return problems;
+}
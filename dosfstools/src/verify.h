@@ -0,0 +1,34 @@
+/* verify.h - Read-only parallel check of the directory tree
+
+   Copyright (C) 2013 TeamWin
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+   On Debian systems, the complete text of the GNU General Public License
+   can be found in /usr/share/common-licenses/GPL-3 file.
+*/
+
+#ifndef _VERIFY_H
+#define _VERIFY_H
+
+unsigned long verify_tree(DOS_FS * fs, int threads,
+			  unsigned long *free_clusters);
+
+/* Walks the whole directory tree of FS (after read_boot and read_fat) on
+   THREADS worker threads without changing anything, and returns the number
+   of problems that a repair pass (scan_root, reclaim_free and update_free)
+   would fix. Problems are printed as they are found. Sets n_files and
+   stores the number of free clusters in *FREE_CLUSTERS. */
+
+#endif
@@ -0,0 +1,180 @@
+/*
+	main.c (19.10.13)
+	Measures exFAT file read throughput on a fragmented file.
+
+	Copyright (C) 2013  TeamWin
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <exfat.h>
+
+#define BENCH_FILE_A "/exfatbench.a"
+#define BENCH_FILE_B "/exfatbench.b"
+#define SEQ_BLOCK (128 * 1024)
+#define RANDOM_BLOCK 4096
+#define RANDOM_READS 4096
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct exfat_node* create(struct exfat* ef, const char* path)
+{
+	struct exfat_node* node;
+
+	if (exfat_mknod(ef, path) != 0)
+		return NULL;
+	if (exfat_lookup(ef, &node, path) != 0)
+		return NULL;
+	return node;
+}
+
+static void destroy(struct exfat* ef, struct exfat_node* node)
+{
+	exfat_unlink(ef, node);
+	exfat_put_node(ef, node);
+}
+
+/*
+ * Grows both files by one cluster in turn, so that their clusters
+ * interleave on disk and neither file is contiguous.
+ */
+static int fill_interleaved(struct exfat* ef, struct exfat_node* a,
+		struct exfat_node* b, uint64_t size)
+{
+	const size_t cluster_size = CLUSTER_SIZE(*ef->sb);
+	char* buffer = malloc(cluster_size);
+	uint64_t offset;
+	int rc = 0;
+
+	if (buffer == NULL)
+		return 1;
+	for (offset = 0; offset < size && rc == 0; offset += cluster_size)
+	{
+		memset(buffer, (int) (offset / cluster_size), cluster_size);
+		if (exfat_generic_pwrite(ef, a, buffer, cluster_size, offset) < 0 ||
+				exfat_generic_pwrite(ef, b, buffer, cluster_size, offset) < 0)
+			rc = 1;
+	}
+	free(buffer);
+	return rc;
+}
+
+static int bench_sequential(struct exfat* ef, struct exfat_node* node)
+{
+	char* buffer = malloc(SEQ_BLOCK);
+	uint64_t offset = 0;
+	ssize_t len;
+	double start;
+
+	if (buffer == NULL)
+		return 1;
+	start = now();
+	while ((len = exfat_generic_pread(ef, node, buffer, SEQ_BLOCK, offset)) > 0)
+		offset += len;
+	printf("sequential: %"PRIu64" bytes in %.3f s, %.1f MB/s\n", offset,
+			now() - start, offset / (now() - start) / 1048576);
+	free(buffer);
+	return len < 0;
+}
+
+static int bench_random(struct exfat* ef, struct exfat_node* node)
+{
+	char buffer[RANDOM_BLOCK];
+	uint64_t blocks = node->size / RANDOM_BLOCK;
+	double start, elapsed;
+	int i;
+
+	if (blocks == 0)
+		return 1;
+	srand(1);
+	start = now();
+	for (i = 0; i < RANDOM_READS; i++)
+	{
+		uint64_t block = ((uint64_t) rand() * RAND_MAX + rand()) % blocks;
+		if (exfat_generic_pread(ef, node, buffer, RANDOM_BLOCK,
+				block * RANDOM_BLOCK) < 0)
+			return 1;
+	}
+	elapsed = now() - start;
+	printf("random: %d reads of %d bytes in %.3f s, %.0f reads/s\n",
+			RANDOM_READS, RANDOM_BLOCK, elapsed, RANDOM_READS / elapsed);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	char** pp;
+	struct exfat ef;
+	struct exfat_node* a;
+	struct exfat_node* b;
+	uint64_t size = 64;
+	int rc = 0;
+
+	for (pp = argv + 1; *pp; pp++)
+		if (strcmp(*pp, "-v") == 0)
+		{
+			printf("exfatbench %u.%u.%u\n", EXFAT_VERSION_MAJOR,
+					EXFAT_VERSION_MINOR, EXFAT_VERSION_PATCH);
+			puts("Copyright (C) 2013  TeamWin");
+			return 0;
+		}
+
+	if (argc != 2 && argc != 3)
+	{
+		fprintf(stderr, "Usage: %s [-v] <device> [file-size-MB]\n", argv[0]);
+		return 1;
+	}
+	if (argc == 3)
+		size = strtoull(argv[2], NULL, 10);
+	size *= 1024 * 1024;
+
+	if (exfat_mount(&ef, argv[1], "") != 0)
+		return 1;
+
+	a = create(&ef, BENCH_FILE_A);
+	b = create(&ef, BENCH_FILE_B);
+	if (a == NULL || b == NULL)
+	{
+		exfat_error("failed to create benchmark files");
+		exfat_unmount(&ef);
+		return 1;
+	}
+
+	rc = fill_interleaved(&ef, a, b, size);
+	if (rc == 0)
+	{
+		/* start from a cold cluster map, as after opening the file */
+		exfat_reset_extents(a);
+		rc = bench_sequential(&ef, a);
+		printf("fragments: %u\n", a->extents_count);
+		exfat_reset_extents(a);
+		rc |= bench_random(&ef, a);
+	}
+
+	destroy(&ef, a);
+	destroy(&ef, b);
+	exfat_unmount(&ef);
+	return rc;
+}
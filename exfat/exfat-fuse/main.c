@@ -31,6 +31,7 @@
 #include <sys/types.h>
 #include <pwd.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #define exfat_debug(format, ...)
 
@@ -53,6 +54,22 @@ static void set_node(struct fuse_file_info* fi, struct exfat_node* node)
 	fi->fh = (uint64_t) (size_t) node;
 }
 
+/*
+ * Requests are handled by several threads. Anything that walks or changes
+ * the directory tree or node reference counts runs under ef.lock, while
+ * reads and writes of an open file only take that node's lock, so I/O on
+ * different files proceeds in parallel.
+ */
+static void lock_tree(void)
+{
+	pthread_mutex_lock(&ef.lock);
+}
+
+static void unlock_tree(void)
+{
+	pthread_mutex_unlock(&ef.lock);
+}
+
 static int fuse_exfat_getattr(const char* path, struct stat* stbuf)
 {
 	struct exfat_node* node;
@@ -60,12 +77,19 @@ static int fuse_exfat_getattr(const char* path, struct stat* stbuf)
 
 	exfat_debug("[%s] %s", __func__, path);
 
+	lock_tree();
 	rc = exfat_lookup(&ef, &node, path);
 	if (rc != 0)
+	{
+		unlock_tree();
 		return rc;
+	}
 
+	pthread_mutex_lock(&node->lock);
 	exfat_stat(&ef, node, stbuf);
+	pthread_mutex_unlock(&node->lock);
 	exfat_put_node(&ef, node);
+	unlock_tree();
 	return 0;
 }
 
@@ -76,12 +100,19 @@ static int fuse_exfat_truncate(const char* path, off64_t size)
 
 	exfat_debug("[%s] %s, %"PRId64, __func__, path, size);
 
+	lock_tree();
 	rc = exfat_lookup(&ef, &node, path);
 	if (rc != 0)
+	{
+		unlock_tree();
 		return rc;
+	}
 
+	pthread_mutex_lock(&node->lock);
 	rc = exfat_truncate(&ef, node, size, true);
+	pthread_mutex_unlock(&node->lock);
 	exfat_put_node(&ef, node);
+	unlock_tree();
 	return rc;
 }
 
@@ -91,17 +122,23 @@ static int fuse_exfat_readdir(const char* path, void* buffer,
 	struct exfat_node* parent;
 	struct exfat_node* node;
 	struct exfat_iterator it;
+	struct stat stbuf;
 	int rc;
 	char name[EXFAT_NAME_MAX + 1];
 
 	exfat_debug("[%s] %s", __func__, path);
 
+	lock_tree();
 	rc = exfat_lookup(&ef, &parent, path);
 	if (rc != 0)
+	{
+		unlock_tree();
 		return rc;
+	}
 	if (!(parent->flags & EXFAT_ATTRIB_DIR))
 	{
 		exfat_put_node(&ef, parent);
+		unlock_tree();
 		exfat_error("`%s' is not a directory (0x%x)", path, parent->flags);
 		return -ENOTDIR;
 	}
@@ -113,20 +150,26 @@ static int fuse_exfat_readdir(const char* path, void* buffer,
 	if (rc != 0)
 	{
 		exfat_put_node(&ef, parent);
+		unlock_tree();
 		exfat_error("failed to open directory `%s'", path);
 		return rc;
 	}
 	while ((node = exfat_readdir(&ef, &it)))
 	{
+		/* a writer on this child may be changing its size and clusters */
+		pthread_mutex_lock(&node->lock);
 		exfat_get_name(node, name, EXFAT_NAME_MAX);
+		exfat_stat(&ef, node, &stbuf);
 		exfat_debug("[%s] %s: %s, %"PRId64" bytes, cluster 0x%x", __func__,
 				name, IS_CONTIGUOUS(*node) ? "contiguous" : "fragmented",
 				node->size, node->start_cluster);
-		filler(buffer, name, NULL, 0);
+		pthread_mutex_unlock(&node->lock);
+		filler(buffer, name, &stbuf, 0);
 		exfat_put_node(&ef, node);
 	}
 	exfat_closedir(&ef, &it);
 	exfat_put_node(&ef, parent);
+	unlock_tree();
 	return 0;
 }
 
@@ -137,7 +180,9 @@ static int fuse_exfat_open(const char* path, struct fuse_file_info* fi)
 
 	exfat_debug("[%s] %s", __func__, path);
 
+	lock_tree();
 	rc = exfat_lookup(&ef, &node, path);
+	unlock_tree();
 	if (rc != 0)
 		return rc;
 	set_node(fi, node);
@@ -148,17 +193,22 @@ static int fuse_exfat_open(const char* path, struct fuse_file_info* fi)
 static int fuse_exfat_release(const char* path, struct fuse_file_info* fi)
 {
 	exfat_debug("[%s] %s", __func__, path);
+	lock_tree();
 	exfat_put_node(&ef, get_node(fi));
+	unlock_tree();
 	return 0;
 }
 
 static int fuse_exfat_read(const char* path, char* buffer, size_t size,
 		off64_t offset, struct fuse_file_info* fi)
 {
+	struct exfat_node* node = get_node(fi);
 	ssize_t ret;
 
 	exfat_debug("[%s] %s (%zu bytes)", __func__, path, size);
-	ret = exfat_generic_pread(&ef, get_node(fi), buffer, size, offset);
+	pthread_mutex_lock(&node->lock);
+	ret = exfat_generic_pread(&ef, node, buffer, size, offset);
+	pthread_mutex_unlock(&node->lock);
 	if (ret < 0)
 		return -EIO;
 	return ret;
@@ -167,10 +217,13 @@ static int fuse_exfat_read(const char* path, char* buffer, size_t size,
 static int fuse_exfat_write(const char* path, const char* buffer, size_t size,
 		off64_t offset, struct fuse_file_info* fi)
 {
+	struct exfat_node* node = get_node(fi);
 	ssize_t ret;
 
 	exfat_debug("[%s] %s (%zu bytes)", __func__, path, size);
-	ret = exfat_generic_pwrite(&ef, get_node(fi), buffer, size, offset);
+	pthread_mutex_lock(&node->lock);
+	ret = exfat_generic_pwrite(&ef, node, buffer, size, offset);
+	pthread_mutex_unlock(&node->lock);
 	if (ret < 0)
 		return -EIO;
 	return ret;
@@ -183,12 +236,17 @@ static int fuse_exfat_unlink(const char* path)
 
 	exfat_debug("[%s] %s", __func__, path);
 
+	lock_tree();
 	rc = exfat_lookup(&ef, &node, path);
 	if (rc != 0)
+	{
+		unlock_tree();
 		return rc;
+	}
 
 	rc = exfat_unlink(&ef, node);
 	exfat_put_node(&ef, node);
+	unlock_tree();
 	return rc;
 }
 
@@ -199,31 +257,54 @@ static int fuse_exfat_rmdir(const char* path)
 
 	exfat_debug("[%s] %s", __func__, path);
 
+	lock_tree();
 	rc = exfat_lookup(&ef, &node, path);
 	if (rc != 0)
+	{
+		unlock_tree();
 		return rc;
+	}
 
 	rc = exfat_rmdir(&ef, node);
 	exfat_put_node(&ef, node);
+	unlock_tree();
 	return rc;
 }
 
 static int fuse_exfat_mknod(const char* path, mode_t mode, dev_t dev)
 {
+	int rc;
+
 	exfat_debug("[%s] %s 0%ho", __func__, path, mode);
-	return exfat_mknod(&ef, path);
+
+	lock_tree();
+	rc = exfat_mknod(&ef, path);
+	unlock_tree();
+	return rc;
 }
 
 static int fuse_exfat_mkdir(const char* path, mode_t mode)
 {
+	int rc;
+
 	exfat_debug("[%s] %s 0%ho", __func__, path, mode);
-	return exfat_mkdir(&ef, path);
+
+	lock_tree();
+	rc = exfat_mkdir(&ef, path);
+	unlock_tree();
+	return rc;
 }
 
 static int fuse_exfat_rename(const char* old_path, const char* new_path)
 {
+	int rc;
+
 	exfat_debug("[%s] %s => %s", __func__, old_path, new_path);
-	return exfat_rename(&ef, old_path, new_path);
+
+	lock_tree();
+	rc = exfat_rename(&ef, old_path, new_path);
+	unlock_tree();
+	return rc;
 }
 
 static int fuse_exfat_utimens(const char* path, const struct timespec tv[2])
@@ -233,12 +314,19 @@ static int fuse_exfat_utimens(const char* path, const struct timespec tv[2])
 
 	exfat_debug("[%s] %s", __func__, path);
 
+	lock_tree();
 	rc = exfat_lookup(&ef, &node, path);
 	if (rc != 0)
+	{
+		unlock_tree();
 		return rc;
+	}
 
+	pthread_mutex_lock(&node->lock);
 	exfat_utimes(node, tv);
+	pthread_mutex_unlock(&node->lock);
 	exfat_put_node(&ef, node);
+	unlock_tree();
 	return 0;
 }
 
@@ -292,7 +380,8 @@ static void fuse_exfat_destroy(void* unused)
 
 static void usage(const char* prog)
 {
-	fprintf(stderr, "Usage: %s [-d] [-o options] [-v] <device> <dir>\n", prog);
+	fprintf(stderr, "Usage: %s [-d] [-s] [-o options] [-v] <device> <dir>\n",
+			prog);
 	exit(1);
 }
 
@@ -396,6 +485,7 @@ int main(int argc, char* argv[])
 	const char* mount_point = NULL;
 	char* mount_options;
 	int debug = 0;
+	int single_thread = 0;
 	struct fuse_chan* fc = NULL;
 	struct fuse* fh = NULL;
 	char** pp;
@@ -423,6 +513,8 @@ int main(int argc, char* argv[])
 		}
 		else if (strcmp(*pp, "-d") == 0)
 			debug = 1;
+		else if (strcmp(*pp, "-s") == 0)
+			single_thread = 1;
 		else if (strcmp(*pp, "-v") == 0)
 		{
 			free(mount_options);
@@ -523,7 +615,7 @@ int main(int argc, char* argv[])
 	   main loop */
 	if (fuse_daemonize(debug) == 0)
 	{
-		if (fuse_loop(fh) != 0)
+		if ((single_thread ? fuse_loop(fh) : fuse_loop_mt(fh)) != 0)
 			exfat_error("FUSE loop failure");
 	}
 	else
@@ -22,6 +22,9 @@
 #include <errno.h>
 #include <string.h>
 
+/* shortest free run a new or relocated file starts in, when there is one */
+#define CMAP_MIN_RUN 256
+
 /*
  * Sector to absolute offset.
  */
@@ -84,54 +87,413 @@ cluster_t exfat_next_cluster(const struct exfat* ef,
 	return le32_to_cpu(next);
 }
 
-cluster_t exfat_advance_cluster(const struct exfat* ef,
-		struct exfat_node* node, uint32_t count)
+/*
+ * A window of FAT entries, so walking a chain reads the FAT in blocks
+ * instead of one entry at a time.
+ */
+#define FAT_WINDOW_ENTRIES 1024
+
+struct fat_window
 {
-	uint32_t i;
+	cluster_t first;
+	uint32_t count;
+	le32_t entries[FAT_WINDOW_ENTRIES];
+};
+
+static cluster_t window_next_cluster(const struct exfat* ef,
+		struct fat_window* window, cluster_t cluster)
+{
+	const uint32_t fat_entries = (le32_to_cpu(ef->sb->fat_sector_count) <<
+			ef->sb->sector_bits) / sizeof(cluster_t);
+
+	if (cluster >= fat_entries)
+		return EXFAT_CLUSTER_BAD;
+	if (cluster < window->first || cluster >= window->first + window->count)
+	{
+		window->first = cluster & ~(FAT_WINDOW_ENTRIES - 1);
+		window->count = MIN(FAT_WINDOW_ENTRIES, fat_entries - window->first);
+		exfat_pread(ef->dev, window->entries,
+				window->count * sizeof(cluster_t),
+				s2o(ef, le32_to_cpu(ef->sb->fat_sector_start)) +
+				(off64_t) window->first * sizeof(cluster_t));
+	}
+	return le32_to_cpu(window->entries[cluster - window->first]);
+}
+
+void exfat_reset_extents(struct exfat_node* node)
+{
+	free(node->extents);
+	node->extents = NULL;
+	node->extents_count = 0;
+	node->extents_alloc = 0;
+	node->extents_mapped = 0;
+}
+
+/*
+ * Appends the disk cluster of file cluster extents_mapped to the map.
+ */
+static int add_extent(struct exfat_node* node, cluster_t cluster)
+{
+	struct exfat_extent* last = NULL;
+
+	if (node->extents_count != 0)
+		last = &node->extents[node->extents_count - 1];
+	if (last != NULL && last->disk_cluster + last->count == cluster)
+	{
+		last->count++;
+		node->extents_mapped++;
+		return 0;
+	}
+
+	if (node->extents_count == node->extents_alloc)
+	{
+		uint32_t alloc = MAX(8, node->extents_alloc * 2);
+		struct exfat_extent* extents = realloc(node->extents,
+				alloc * sizeof(struct exfat_extent));
+		if (extents == NULL)
+			return -ENOMEM;
+		node->extents = extents;
+		node->extents_alloc = alloc;
+	}
+	last = &node->extents[node->extents_count++];
+	last->file_cluster = node->extents_mapped++;
+	last->disk_cluster = cluster;
+	last->count = 1;
+	return 0;
+}
+
+/*
+ * Forgets the mapping of file clusters starting from "count".
+ */
+static void truncate_extents(struct exfat_node* node, uint32_t count)
+{
+	while (node->extents_count != 0 &&
+			node->extents[node->extents_count - 1].file_cluster >= count)
+		node->extents_count--;
+	if (node->extents_count != 0)
+	{
+		struct exfat_extent* last = &node->extents[node->extents_count - 1];
+		last->count = MIN(last->count, count - last->file_cluster);
+		node->extents_mapped = last->file_cluster + last->count;
+	}
+	else
+		exfat_reset_extents(node);
+}
+
+/*
+ * Walks the FAT chain until the map covers file cluster "index" and the
+ * run of contiguous clusters containing it is complete, so the caller can
+ * do a single I/O for the whole run.
+ */
+static int map_clusters(const struct exfat* ef, struct exfat_node* node,
+		uint32_t index)
+{
+	struct fat_window window;
+	const uint32_t cluster_count = le32_to_cpu(ef->sb->cluster_count);
+	struct exfat_extent* last;
+	cluster_t cluster;
 
-	if (node->fptr_index > count)
+	if (node->extents_mapped == 0)
 	{
-		node->fptr_index = 0;
-		node->fptr_cluster = node->start_cluster;
+		if (CLUSTER_INVALID(node->start_cluster))
+			return -EIO;
+		if (add_extent(node, node->start_cluster) != 0)
+			return -ENOMEM;
 	}
+	last = &node->extents[node->extents_count - 1];
+	cluster = last->disk_cluster + last->count - 1;
 
-	for (i = node->fptr_index; i < count; i++)
+	window.first = 0;
+	window.count = 0;
+	while (node->extents_mapped <= cluster_count)
 	{
-		node->fptr_cluster = exfat_next_cluster(ef, node, node->fptr_cluster);
-		if (CLUSTER_INVALID(node->fptr_cluster))
-			break; /* the caller should handle this and print appropriate 
-			          error message */
+		cluster_t next = window_next_cluster(ef, &window, cluster);
+
+		if (CLUSTER_INVALID(next))
+			break;
+		if (node->extents_mapped > index && next != cluster + 1)
+			break;
+		if (add_extent(node, next) != 0)
+			return -ENOMEM;
+		cluster = next;
 	}
+	return node->extents_mapped > index ? 0 : -EIO;
+}
+
+/*
+ * Returns the disk cluster of file cluster "index" and stores the number of
+ * clusters that follow it contiguously on disk (including itself) in *run.
+ */
+cluster_t exfat_map_cluster(const struct exfat* ef, struct exfat_node* node,
+		uint32_t index, uint32_t* run)
+{
+	uint32_t lo, hi;
+
+	*run = 1;
+	if (IS_CONTIGUOUS(*node))
+	{
+		uint32_t clusters = bytes2clusters(ef, node->size);
+		if (CLUSTER_INVALID(node->start_cluster))
+			return node->start_cluster;
+		if (clusters > index)
+			*run = clusters - index;
+		return node->start_cluster + index;
+	}
+
+	if (index >= node->extents_mapped && map_clusters(ef, node, index) != 0)
+		return EXFAT_CLUSTER_BAD;
+
+	/* find the last extent starting at or before index */
+	lo = 0;
+	hi = node->extents_count;
+	while (hi - lo > 1)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (node->extents[mid].file_cluster <= index)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	index -= node->extents[lo].file_cluster;
+	*run = node->extents[lo].count - index;
+	return node->extents[lo].disk_cluster + index;
+}
+
+cluster_t exfat_advance_cluster(const struct exfat* ef,
+		struct exfat_node* node, uint32_t count)
+{
+	uint32_t run;
+
+	/* the caller should handle invalid clusters and print appropriate
+	   error message */
+	node->fptr_cluster = exfat_map_cluster(ef, node, count, &run);
 	node->fptr_index = count;
 	return node->fptr_cluster;
 }
 
-static cluster_t find_bit_and_set(uint8_t* bitmap, size_t start, size_t end)
+/*
+ * Returns 64 bits of the clusters bitmap starting at "index" (a multiple
+ * of 64). Bits past the end of the bitmap are reported as used.
+ */
+static uint64_t cmap_word(const struct exfat* ef, uint32_t index)
 {
-	const size_t start_index = start / 8;
-	const size_t end_index = DIV_ROUND_UP(end, 8);
-	size_t i;
-	size_t c;
+	uint64_t word = le64_to_cpu(((const le64_t*) ef->cmap.chunk)[index / 64]);
 
-	for (i = start_index; i < end_index; i++)
+	if (ef->cmap.chunk_size - index < 64)
+		word |= ~UINT64_C(0) << (ef->cmap.chunk_size - index);
+	return word;
+}
+
+static uint32_t group_bits(const struct exfat* ef, uint32_t group)
+{
+	return MIN(CMAP_GROUP_BITS,
+			ef->cmap.chunk_size - group * CMAP_GROUP_BITS);
+}
+
+/*
+ * Returns the first free bit in [start, end) or "end" if there is none.
+ * Groups without free clusters are skipped using the summary counts.
+ */
+static uint32_t find_free_bit(const struct exfat* ef, uint32_t start,
+		uint32_t end)
+{
+	uint64_t i = start;
+	uint64_t free_bits;
+
+	while (i < end)
 	{
-		if (bitmap[i] == 0xff)
+		if (ef->cmap.group_free[i / CMAP_GROUP_BITS] == 0)
+		{
+			i = ROUND_UP(i + 1, CMAP_GROUP_BITS);
 			continue;
-		for (c = MAX(i * 8, start); c < MIN((i + 1) * 8, end); c++)
-			if (BMAP_GET(bitmap, c) == 0)
-			{
-				BMAP_SET(bitmap, c);
-				return c + EXFAT_FIRST_DATA_CLUSTER;
-			}
+		}
+		free_bits = ~cmap_word(ef, i - i % 64) & (~UINT64_C(0) << (i % 64));
+		if (free_bits != 0)
+			return MIN(i - i % 64 + __builtin_ctzll(free_bits), end);
+		i = ROUND_UP(i + 1, 64);
+	}
+	return end;
+}
+
+/*
+ * Returns the first used bit in [start, end) or "end" if there is none.
+ */
+static uint32_t find_used_bit(const struct exfat* ef, uint32_t start,
+		uint32_t end)
+{
+	uint64_t i = start;
+	uint64_t used_bits;
+
+	while (i < end)
+	{
+		if (ef->cmap.group_free[i / CMAP_GROUP_BITS] ==
+				group_bits(ef, i / CMAP_GROUP_BITS))
+		{
+			i = ROUND_UP(i + 1, CMAP_GROUP_BITS);
+			continue;
+		}
+		used_bits = cmap_word(ef, i - i % 64) & (~UINT64_C(0) << (i % 64));
+		if (used_bits != 0)
+			return MIN(i - i % 64 + __builtin_ctzll(used_bits), end);
+		i = ROUND_UP(i + 1, 64);
+	}
+	return end;
+}
+
+/*
+ * Finds a run of free clusters in [start, end) that is at least "want"
+ * clusters long. If there is no such run, the longest one is returned.
+ */
+static uint32_t find_free_run(const struct exfat* ef, uint32_t start,
+		uint32_t end, uint32_t want, uint32_t* length)
+{
+	uint32_t best = end;
+	uint32_t a, b;
+
+	*length = 0;
+	while ((a = find_free_bit(ef, start, end)) < end)
+	{
+		b = find_used_bit(ef, a, MIN((uint64_t) a + want, end));
+		if (b - a >= want)
+		{
+			*length = want;
+			return a;
+		}
+		if (b - a > *length)
+		{
+			best = a;
+			*length = b - a;
+		}
+		start = b;
+	}
+	return best;
+}
+
+/*
+ * Sets or clears "count" bits starting at "index", all of which must be in
+ * the opposite state, and keeps the free counts and dirty groups in step.
+ */
+static void cmap_mark(struct exfat* ef, uint32_t index, uint32_t count,
+		bool used)
+{
+	uint8_t* bitmap = ef->cmap.chunk;
+
+	while (count != 0)
+	{
+		const uint32_t group = index / CMAP_GROUP_BITS;
+		const uint32_t n = MIN(count,
+				CMAP_GROUP_BITS - index % CMAP_GROUP_BITS);
+		const uint32_t end = index + n;
+		uint32_t i = index;
+
+		for (; i < end && i % 8 != 0; i++)
+			if (used)
+				BMAP_SET(bitmap, i);
+			else
+				BMAP_CLR(bitmap, i);
+		memset(bitmap + i / 8, used ? 0xff : 0, (end - i) / 8);
+		for (i += (end - i) & ~7u; i < end; i++)
+			if (used)
+				BMAP_SET(bitmap, i);
+			else
+				BMAP_CLR(bitmap, i);
+
+		if (used)
+		{
+			ef->cmap.group_free[group] -= n;
+			ef->cmap.free_count -= n;
+		}
+		else
+		{
+			ef->cmap.group_free[group] += n;
+			ef->cmap.free_count += n;
+		}
+		BMAP_SET(ef->cmap.group_dirty, group);
+		index = end;
+		count -= n;
+	}
+	ef->cmap.dirty = true;
+}
+
+int exfat_init_cmap(struct exfat* ef)
+{
+	const uint32_t groups = DIV_ROUND_UP(ef->cmap.chunk_size,
+			CMAP_GROUP_BITS);
+	uint32_t group;
+	uint32_t i;
+
+	ef->cmap.group_free = malloc(groups * sizeof(uint16_t));
+	ef->cmap.group_dirty = calloc(DIV_ROUND_UP(groups, 8), 1);
+	if (ef->cmap.group_free == NULL || ef->cmap.group_dirty == NULL)
+	{
+		exfat_error("failed to allocate clusters bitmap summary "
+				"(%u groups)", groups);
+		free(ef->cmap.group_free);
+		ef->cmap.group_free = NULL;
+		free(ef->cmap.group_dirty);
+		ef->cmap.group_dirty = NULL;
+		return -ENOMEM;
+	}
+
+	ef->cmap.free_count = 0;
+	for (group = 0; group < groups; group++)
+	{
+		const uint32_t first = group * CMAP_GROUP_BITS;
+		uint32_t free_clusters = 0;
+
+		for (i = first; i < first + group_bits(ef, group); i += 64)
+			free_clusters += __builtin_popcountll(~cmap_word(ef, i));
+		ef->cmap.group_free[group] = free_clusters;
+		ef->cmap.free_count += free_clusters;
 	}
-	return EXFAT_CLUSTER_END;
+	ef->cmap.dirty = false;
+	return 0;
 }
 
+void exfat_free_cmap(struct exfat* ef)
+{
+	free(ef->cmap.chunk);
+	ef->cmap.chunk = NULL;
+	free(ef->cmap.group_free);
+	ef->cmap.group_free = NULL;
+	free(ef->cmap.group_dirty);
+	ef->cmap.group_dirty = NULL;
+}
+
+/*
+ * Writes back only the groups of the bitmap changed since the last flush,
+ * merging adjacent ones into a single write.
+ */
 void exfat_flush_cmap(struct exfat* ef)
 {
-	exfat_pwrite(ef->dev, ef->cmap.chunk, (ef->cmap.chunk_size + 7) / 8,
-			exfat_c2o(ef, ef->cmap.start_cluster));
+	const uint32_t groups = DIV_ROUND_UP(ef->cmap.chunk_size,
+			CMAP_GROUP_BITS);
+	const size_t bytes = DIV_ROUND_UP(ef->cmap.chunk_size, 8);
+	const size_t group_bytes = CMAP_GROUP_BITS / 8;
+	uint32_t first, last;
+	size_t offset;
+
+	pthread_mutex_lock(&ef->cmap.lock);
+	if (!ef->cmap.dirty)
+	{
+		pthread_mutex_unlock(&ef->cmap.lock);
+		return;
+	}
+	for (first = 0; first < groups; first = last)
+	{
+		last = first + 1;
+		if (BMAP_GET(ef->cmap.group_dirty, first) == 0)
+			continue;
+		while (last < groups && BMAP_GET(ef->cmap.group_dirty, last))
+			last++;
+		offset = (size_t) first * group_bytes;
+		exfat_pwrite(ef->dev, ef->cmap.chunk + offset,
+				MIN((size_t) last * group_bytes, bytes) - offset,
+				exfat_c2o(ef, ef->cmap.start_cluster) + offset);
+	}
+	memset(ef->cmap.group_dirty, 0, DIV_ROUND_UP(groups, 8));
 	ef->cmap.dirty = false;
+	pthread_mutex_unlock(&ef->cmap.lock);
 }
 
 static void set_next_cluster(const struct exfat* ef, bool contiguous,
@@ -148,25 +510,56 @@ static void set_next_cluster(const struct exfat* ef, bool contiguous,
 	exfat_pwrite(ef->dev, &next_le32, sizeof(next_le32), fat_offset);
 }
 
-static cluster_t allocate_cluster(struct exfat* ef, cluster_t hint)
+/*
+ * Allocates up to "count" clusters that follow each other on disk and
+ * returns the first one, storing the number allocated in "allocated".
+ * Allocation continues at "hint" when that cluster is free. Otherwise the
+ * first free run of at least MAX(count, CMAP_MIN_RUN) clusters is taken, so
+ * that a file which keeps growing a little at a time stays contiguous; on a
+ * fragmented volume the longest free run is used instead.
+ */
+static cluster_t allocate_run(struct exfat* ef, cluster_t hint,
+		uint32_t count, uint32_t* allocated)
 {
-	cluster_t cluster;
+	const uint32_t end = ef->cmap.chunk_size;
+	const uint32_t want = MIN(MAX(count, CMAP_MIN_RUN), end);
+	uint32_t index, length;
+	uint32_t other_index, other_length;
 
+	pthread_mutex_lock(&ef->cmap.lock);
 	hint -= EXFAT_FIRST_DATA_CLUSTER;
-	if (hint >= ef->cmap.chunk_size)
-		hint = 0;
-
-	cluster = find_bit_and_set(ef->cmap.chunk, hint, ef->cmap.chunk_size);
-	if (cluster == EXFAT_CLUSTER_END)
-		cluster = find_bit_and_set(ef->cmap.chunk, 0, hint);
-	if (cluster == EXFAT_CLUSTER_END)
+	if (hint < end && BMAP_GET(ef->cmap.chunk, hint) == 0)
+	{
+		index = hint;
+		length = find_used_bit(ef, hint, MIN((uint64_t) hint + count, end))
+				- hint;
+	}
+	else
 	{
-		exfat_error("no free space left");
-		return EXFAT_CLUSTER_END;
+		if (hint >= end)
+			hint = 0;
+		index = find_free_run(ef, hint, end, want, &length);
+		if (length < want)
+		{
+			other_index = find_free_run(ef, 0, hint, want, &other_length);
+			if (other_length > length)
+			{
+				index = other_index;
+				length = other_length;
+			}
+		}
+		if (length == 0)
+		{
+			pthread_mutex_unlock(&ef->cmap.lock);
+			exfat_error("no free space left");
+			return EXFAT_CLUSTER_END;
+		}
 	}
 
-	ef->cmap.dirty = true;
-	return cluster;
+	*allocated = MIN(length, count);
+	cmap_mark(ef, index, *allocated, true);
+	pthread_mutex_unlock(&ef->cmap.lock);
+	return index + EXFAT_FIRST_DATA_CLUSTER;
 }
 
 static void free_cluster(struct exfat* ef, cluster_t cluster)
@@ -177,8 +570,12 @@ static void free_cluster(struct exfat* ef, cluster_t cluster)
 		exfat_bug("freeing non-existing cluster 0x%x (0x%x)", cluster,
 				ef->cmap.size);
 
-	BMAP_CLR(ef->cmap.chunk, cluster - EXFAT_FIRST_DATA_CLUSTER);
-	ef->cmap.dirty = true;
+	pthread_mutex_lock(&ef->cmap.lock);
+	if (BMAP_GET(ef->cmap.chunk, cluster - EXFAT_FIRST_DATA_CLUSTER) == 0)
+		exfat_warn("freeing free cluster 0x%x", cluster);
+	else
+		cmap_mark(ef, cluster - EXFAT_FIRST_DATA_CLUSTER, 1, false);
+	pthread_mutex_unlock(&ef->cmap.lock);
 }
 
 static void make_noncontiguous(const struct exfat* ef, cluster_t first,
@@ -199,6 +596,7 @@ static int grow_file(struct exfat* ef, struct exfat_node* node,
 	cluster_t previous;
 	cluster_t next;
 	uint32_t allocated = 0;
+	uint32_t run = 0;
 
 	if (difference == 0)
 		exfat_bug("zero clusters count passed");
@@ -219,25 +617,33 @@ static int grow_file(struct exfat* ef, struct exfat_node* node,
 			exfat_bug("non-zero pointer index (%u)", node->fptr_index);
 		/* file does not have clusters (i.e. is empty), allocate
 		   the first one for it */
-		previous = allocate_cluster(ef, 0);
+		previous = allocate_run(ef, 0, difference, &run);
 		if (CLUSTER_INVALID(previous))
 			return -ENOSPC;
 		node->fptr_cluster = node->start_cluster = previous;
 		allocated = 1;
+		run--;
 		/* file consists of only one cluster, so it's contiguous */
 		node->flags |= EXFAT_ATTRIB_CONTIGUOUS;
 	}
 
 	while (allocated < difference)
 	{
-		next = allocate_cluster(ef, previous + 1);
-		if (CLUSTER_INVALID(next))
+		if (run == 0)
 		{
-			if (allocated != 0)
-				shrink_file(ef, node, current + allocated, allocated);
-			return -ENOSPC;
+			next = allocate_run(ef, previous + 1, difference - allocated,
+					&run);
+			if (CLUSTER_INVALID(next))
+			{
+				if (allocated != 0)
+					shrink_file(ef, node, current + allocated, allocated);
+				return -ENOSPC;
+			}
 		}
-		if (next != previous - 1 && IS_CONTIGUOUS(*node))
+		else
+			next = previous + 1;
+		run--;
+		if (next != previous + 1 && IS_CONTIGUOUS(*node))
 		{
 			/* it's a pity, but we are not able to keep the file contiguous
 			   anymore */
@@ -246,6 +652,11 @@ static int grow_file(struct exfat* ef, struct exfat_node* node,
 			node->flags |= EXFAT_ATTRIB_DIRTY;
 		}
 		set_next_cluster(ef, IS_CONTIGUOUS(*node), previous, next);
+		/* keep the cluster map in step if it reaches the end of the file */
+		if (!IS_CONTIGUOUS(*node) &&
+				node->extents_mapped == current + allocated &&
+				add_extent(node, next) != 0)
+			exfat_reset_extents(node);
 		previous = next;
 		allocated++;
 	}
@@ -287,6 +698,7 @@ static int shrink_file(struct exfat* ef, struct exfat_node* node,
 	}
 	node->fptr_index = 0;
 	node->fptr_cluster = node->start_cluster;
+	truncate_extents(node, current - difference);
 
 	/* free remaining clusters */
 	while (difference--)
@@ -315,14 +727,15 @@ static int erase_range(struct exfat* ef, struct exfat_node* node,
 		uint64_t begin, uint64_t end)
 {
 	uint64_t cluster_boundary;
+	uint32_t index = begin / CLUSTER_SIZE(*ef->sb);
+	uint32_t run;
 	cluster_t cluster;
 
 	if (begin >= end)
 		return 0;
 
 	cluster_boundary = (begin | (CLUSTER_SIZE(*ef->sb) - 1)) + 1;
-	cluster = exfat_advance_cluster(ef, node,
-			begin / CLUSTER_SIZE(*ef->sb));
+	cluster = exfat_map_cluster(ef, node, index, &run);
 	if (CLUSTER_INVALID(cluster))
 	{
 		exfat_error("invalid cluster 0x%x while erasing", cluster);
@@ -334,7 +747,7 @@ static int erase_range(struct exfat* ef, struct exfat_node* node,
 	/* erase whole clusters */
 	while (cluster_boundary < end)
 	{
-		cluster = exfat_next_cluster(ef, node, cluster);
+		cluster = exfat_map_cluster(ef, node, ++index, &run);
 		/* the cluster cannot be invalid because we have just allocated it */
 		if (CLUSTER_INVALID(cluster))
 			exfat_bug("invalid cluster 0x%x after allocation", cluster);
@@ -380,35 +793,23 @@ int exfat_truncate(struct exfat* ef, struct exfat_node* node, uint64_t size,
 
 uint32_t exfat_count_free_clusters(const struct exfat* ef)
 {
-	uint32_t free_clusters = 0;
-	uint32_t i;
-
-	for (i = 0; i < ef->cmap.size; i++)
-		if (BMAP_GET(ef->cmap.chunk, i) == 0)
-			free_clusters++;
-	return free_clusters;
+	return ef->cmap.free_count;
 }
 
 static int find_used_clusters(const struct exfat* ef,
 		cluster_t* a, cluster_t* b)
 {
-	const cluster_t end = le32_to_cpu(ef->sb->cluster_count);
+	const uint32_t end = ef->cmap.chunk_size;
+	uint32_t first;
 
 	/* find first used cluster */
-	for (*a = *b + 1; *a < end; (*a)++)
-		if (BMAP_GET(ef->cmap.chunk, *a - EXFAT_FIRST_DATA_CLUSTER))
-			break;
-	if (*a >= end)
+	first = find_used_bit(ef, *b + 1 - EXFAT_FIRST_DATA_CLUSTER, end);
+	if (first >= end)
 		return 1;
 
 	/* find last contiguous used cluster */
-	for (*b = *a; *b < end; (*b)++)
-		if (BMAP_GET(ef->cmap.chunk, *b - EXFAT_FIRST_DATA_CLUSTER) == 0)
-		{
-			(*b)--;
-			break;
-		}
-
+	*a = first + EXFAT_FIRST_DATA_CLUSTER;
+	*b = find_free_bit(ef, first, end) - 1 + EXFAT_FIRST_DATA_CLUSTER;
 	return 0;
 }
 
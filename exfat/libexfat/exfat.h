@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "exfatfs.h"
@@ -47,6 +48,10 @@
 #define DIV_ROUND_UP(x, d) (((x) + (d) - 1) / (d))
 #define ROUND_UP(x, d) (DIV_ROUND_UP(x, d) * (d))
 
+/* clusters covered by one free-count and dirty-tracking group of the
+   clusters bitmap (one 512-byte sector of the bitmap) */
+#define CMAP_GROUP_BITS 4096
+
 #define BMAP_GET(bitmap, index) \
 	(((uint8_t*) bitmap)[(index) / 8] & (1u << ((index) % 8)))
 #define BMAP_SET(bitmap, index) \
@@ -54,6 +59,14 @@
 #define BMAP_CLR(bitmap, index) \
 	((uint8_t*) bitmap)[(index) / 8] &= ~(1u << ((index) % 8))
 
+/* run of physically contiguous clusters of a fragmented file */
+struct exfat_extent
+{
+	uint32_t file_cluster;
+	cluster_t disk_cluster;
+	uint32_t count;
+};
+
 struct exfat_node
 {
 	struct exfat_node* parent;
@@ -71,6 +84,20 @@ struct exfat_node
 	uint64_t size;
 	time_t mtime, atime;
 	le16_t name[EXFAT_NAME_MAX + 1];
+	/* cluster map of the first extents_mapped clusters of a non-contiguous
+	   node, sorted by file_cluster */
+	struct exfat_extent* extents;
+	uint32_t extents_count;
+	uint32_t extents_alloc;
+	uint32_t extents_mapped;
+	/* children of a cached directory hashed by upcased name */
+	struct exfat_node** hash;
+	uint32_t hash_size;			/* buckets, a power of two */
+	uint32_t hash_count;
+	struct exfat_node* hash_next;
+	uint16_t name_hash;
+	/* serializes data access (size, cluster map, times) to the node */
+	pthread_mutex_t lock;
 };
 
 enum exfat_mode
@@ -96,8 +123,15 @@ struct exfat
 		uint8_t* chunk;
 		uint32_t chunk_size;		/* in bits */
 		bool dirty;
+		uint32_t free_count;		/* free clusters in the whole bitmap */
+		uint16_t* group_free;		/* free clusters per CMAP_GROUP_BITS */
+		uint8_t* group_dirty;		/* groups to write back on flush */
+		pthread_mutex_t lock;
 	}
 	cmap;
+	/* held by multithreaded users around lookups and other operations on
+	   the directory tree; nests outside node and cmap locks */
+	pthread_mutex_t lock;
 	char label[EXFAT_ENAME_MAX * 6 + 1]; /* a character can occupy up to
 											6 bytes in UTF-8 */
 	void* zero_cluster;
@@ -157,12 +191,22 @@ int exfat_lookup(struct exfat* ef, struct exfat_node** node,
 		const char* path);
 int exfat_split(struct exfat* ef, struct exfat_node** parent,
 		struct exfat_node** node, le16_t* name, const char* path);
+void exfat_index_directory(struct exfat* ef, struct exfat_node* dir);
+void exfat_index_add(struct exfat* ef, struct exfat_node* dir,
+		struct exfat_node* node);
+void exfat_index_remove(struct exfat_node* dir, struct exfat_node* node);
+void exfat_reset_index(struct exfat_node* dir);
 
 off64_t exfat_c2o(const struct exfat* ef, cluster_t cluster);
 cluster_t exfat_next_cluster(const struct exfat* ef,
 		const struct exfat_node* node, cluster_t cluster);
 cluster_t exfat_advance_cluster(const struct exfat* ef,
 		struct exfat_node* node, uint32_t count);
+cluster_t exfat_map_cluster(const struct exfat* ef, struct exfat_node* node,
+		uint32_t index, uint32_t* run);
+void exfat_reset_extents(struct exfat_node* node);
+int exfat_init_cmap(struct exfat* ef);
+void exfat_free_cmap(struct exfat* ef);
 void exfat_flush_cmap(struct exfat* ef);
 int exfat_truncate(struct exfat* ef, struct exfat_node* node, uint64_t size,
 		bool erase);
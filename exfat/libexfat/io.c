@@ -308,6 +308,7 @@ ssize_t exfat_generic_pread(const struct exfat* ef, struct exfat_node* node,
 		void* buffer, size_t size, off64_t offset)
 {
 	cluster_t cluster;
+	uint32_t index, run;
 	char* bufp = buffer;
 	off64_t lsize, loffset, remainder;
 
@@ -316,28 +317,24 @@ ssize_t exfat_generic_pread(const struct exfat* ef, struct exfat_node* node,
 	if (size == 0)
 		return 0;
 
-	cluster = exfat_advance_cluster(ef, node, offset / CLUSTER_SIZE(*ef->sb));
-	if (CLUSTER_INVALID(cluster))
-	{
-		exfat_error("invalid cluster 0x%x while reading", cluster);
-		return -1;
-	}
-
+	index = offset / CLUSTER_SIZE(*ef->sb);
 	loffset = offset % CLUSTER_SIZE(*ef->sb);
 	remainder = MIN(size, node->size - offset);
 	while (remainder > 0)
 	{
+		/* read the whole run of contiguous clusters at once */
+		cluster = exfat_map_cluster(ef, node, index, &run);
 		if (CLUSTER_INVALID(cluster))
 		{
 			exfat_error("invalid cluster 0x%x while reading", cluster);
 			return -1;
 		}
-		lsize = MIN(CLUSTER_SIZE(*ef->sb) - loffset, remainder);
+		lsize = MIN((off64_t) run * CLUSTER_SIZE(*ef->sb) - loffset, remainder);
 		exfat_pread(ef->dev, bufp, lsize, exfat_c2o(ef, cluster) + loffset);
 		bufp += lsize;
+		index += (loffset + lsize) / CLUSTER_SIZE(*ef->sb);
 		loffset = 0;
 		remainder -= lsize;
-		cluster = exfat_next_cluster(ef, node, cluster);
 	}
 	if (!ef->ro && !ef->noatime)
 		exfat_update_atime(node);
@@ -348,6 +345,7 @@ ssize_t exfat_generic_pwrite(struct exfat* ef, struct exfat_node* node,
 		const void* buffer, size_t size, off64_t offset)
 {
 	cluster_t cluster;
+	uint32_t index, run;
 	const char* bufp = buffer;
 	off64_t lsize, loffset, remainder;
 
@@ -360,28 +358,24 @@ ssize_t exfat_generic_pwrite(struct exfat* ef, struct exfat_node* node,
 	if (size == 0)
 		return 0;
 
-	cluster = exfat_advance_cluster(ef, node, offset / CLUSTER_SIZE(*ef->sb));
-	if (CLUSTER_INVALID(cluster))
-	{
-		exfat_error("invalid cluster 0x%x while writing", cluster);
-		return -1;
-	}
-
+	index = offset / CLUSTER_SIZE(*ef->sb);
 	loffset = offset % CLUSTER_SIZE(*ef->sb);
 	remainder = size;
 	while (remainder > 0)
 	{
+		/* write the whole run of contiguous clusters at once */
+		cluster = exfat_map_cluster(ef, node, index, &run);
 		if (CLUSTER_INVALID(cluster))
 		{
 			exfat_error("invalid cluster 0x%x while writing", cluster);
 			return -1;
 		}
-		lsize = MIN(CLUSTER_SIZE(*ef->sb) - loffset, remainder);
+		lsize = MIN((off64_t) run * CLUSTER_SIZE(*ef->sb) - loffset, remainder);
 		exfat_pwrite(ef->dev, bufp, lsize, exfat_c2o(ef, cluster) + loffset);
 		bufp += lsize;
+		index += (loffset + lsize) / CLUSTER_SIZE(*ef->sb);
 		loffset = 0;
 		remainder -= lsize;
-		cluster = exfat_next_cluster(ef, node, cluster);
 	}
 	exfat_update_mtime(node);
 	return size - remainder;
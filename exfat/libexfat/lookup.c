@@ -78,6 +78,122 @@ static int compare_name(struct exfat* ef, const le16_t* a, const le16_t* b)
 	return compare_char(ef, le16_to_cpu(*a), le16_to_cpu(*b));
 }
 
+/*
+ * Children of a cached directory are also kept in a hash table keyed by
+ * the upcased name hash, so that resolving a path component does not scan
+ * the whole directory. If the table could not be allocated, lookups fall
+ * back to the linear scan.
+ */
+#define INDEX_MIN_SIZE 16
+#define INDEX_MAX_SIZE 65536	/* name hashes are 16 bits wide */
+
+static void index_insert(struct exfat_node* dir, struct exfat_node* node)
+{
+	struct exfat_node** bucket =
+			&dir->hash[node->name_hash & (dir->hash_size - 1)];
+
+	node->hash_next = *bucket;
+	*bucket = node;
+	dir->hash_count++;
+}
+
+static int index_resize(struct exfat_node* dir, uint32_t size)
+{
+	struct exfat_node** old = dir->hash;
+	const uint32_t old_size = dir->hash_size;
+	struct exfat_node* node;
+	uint32_t i;
+
+	dir->hash = calloc(size, sizeof(struct exfat_node*));
+	if (dir->hash == NULL)
+	{
+		dir->hash = old;
+		return -ENOMEM;
+	}
+	dir->hash_size = size;
+	dir->hash_count = 0;
+	for (i = 0; i < old_size; i++)
+		while ((node = old[i]) != NULL)
+		{
+			old[i] = node->hash_next;
+			index_insert(dir, node);
+		}
+	free(old);
+	return 0;
+}
+
+void exfat_index_directory(struct exfat* ef, struct exfat_node* dir)
+{
+	struct exfat_node* node;
+	uint32_t count = 0;
+	uint32_t size = INDEX_MIN_SIZE;
+
+	for (node = dir->child; node; node = node->next)
+		count++;
+	while (size < count && size < INDEX_MAX_SIZE)
+		size *= 2;
+
+	exfat_reset_index(dir);
+	dir->hash = calloc(size, sizeof(struct exfat_node*));
+	if (dir->hash == NULL)
+		return;
+	dir->hash_size = size;
+	for (node = dir->child; node; node = node->next)
+	{
+		node->name_hash = le16_to_cpu(exfat_calc_name_hash(ef, node->name));
+		index_insert(dir, node);
+	}
+}
+
+void exfat_index_add(struct exfat* ef, struct exfat_node* dir,
+		struct exfat_node* node)
+{
+	if (dir->hash == NULL)
+		return;
+	node->name_hash = le16_to_cpu(exfat_calc_name_hash(ef, node->name));
+	if (dir->hash_count >= dir->hash_size && dir->hash_size < INDEX_MAX_SIZE)
+		index_resize(dir, dir->hash_size * 2); /* keep chaining on failure */
+	index_insert(dir, node);
+}
+
+void exfat_index_remove(struct exfat_node* dir, struct exfat_node* node)
+{
+	struct exfat_node** p;
+
+	if (dir->hash == NULL)
+		return;
+	for (p = &dir->hash[node->name_hash & (dir->hash_size - 1)]; *p;
+			p = &(*p)->hash_next)
+		if (*p == node)
+		{
+			*p = node->hash_next;
+			node->hash_next = NULL;
+			dir->hash_count--;
+			return;
+		}
+}
+
+void exfat_reset_index(struct exfat_node* dir)
+{
+	free(dir->hash);
+	dir->hash = NULL;
+	dir->hash_size = 0;
+	dir->hash_count = 0;
+}
+
+static struct exfat_node* index_find(struct exfat* ef,
+		const struct exfat_node* dir, const le16_t* name)
+{
+	const uint16_t hash = le16_to_cpu(exfat_calc_name_hash(ef, name));
+	struct exfat_node* node;
+
+	for (node = dir->hash[hash & (dir->hash_size - 1)]; node;
+			node = node->hash_next)
+		if (node->name_hash == hash && compare_name(ef, name, node->name) == 0)
+			return node;
+	return NULL;
+}
+
 static int lookup_name(struct exfat* ef, struct exfat_node* parent,
 		struct exfat_node** node, const char* name, size_t n)
 {
@@ -94,6 +210,14 @@ static int lookup_name(struct exfat* ef, struct exfat_node* parent,
 	rc = exfat_opendir(ef, parent, &it);
 	if (rc != 0)
 		return rc;
+	if (parent->hash != NULL)
+	{
+		*node = index_find(ef, parent, buffer);
+		if (*node != NULL)
+			exfat_get_node(*node);
+		exfat_closedir(ef, &it);
+		return *node != NULL ? 0 : -ENOENT;
+	}
 	while ((*node = exfat_readdir(ef, &it)))
 	{
 		if (compare_name(ef, buffer, (*node)->name) == 0)
@@ -140,6 +140,8 @@ int exfat_mount(struct exfat* ef, const char* spec, const char* options)
 
 	exfat_tzset();
 	memset(ef, 0, sizeof(struct exfat));
+	pthread_mutex_init(&ef->lock, NULL);
+	pthread_mutex_init(&ef->cmap.lock, NULL);
 
 	parse_options(ef, options);
 
@@ -231,6 +233,7 @@ int exfat_mount(struct exfat* ef, const char* spec, const char* options)
 		return -ENOMEM;
 	}
 	memset(ef->root, 0, sizeof(struct exfat_node));
+	pthread_mutex_init(&ef->root->lock, NULL);
 	ef->root->flags = EXFAT_ATTRIB_DIR;
 	ef->root->start_cluster = le32_to_cpu(ef->sb->rootdir_cluster);
 	ef->root->fptr_cluster = ef->root->start_cluster;
@@ -264,7 +267,9 @@ int exfat_mount(struct exfat* ef, const char* spec, const char* options)
 error:
 	exfat_put_node(ef, ef->root);
 	exfat_reset_cache(ef);
+	exfat_reset_extents(ef->root);
 	free(ef->root);
+	exfat_free_cmap(ef);
 	free(ef->zero_cluster);
 	exfat_close(ef->dev);
 	free(ef->sb);
@@ -297,6 +302,7 @@ void exfat_unmount(struct exfat* ef)
 {
 	exfat_put_node(ef, ef->root);
 	exfat_reset_cache(ef);
+	exfat_reset_extents(ef->root);
 	free(ef->root);
 	ef->root = NULL;
 	finalize_super_block(ef);
@@ -304,8 +310,7 @@ void exfat_unmount(struct exfat* ef)
 	ef->dev = NULL;
 	free(ef->zero_cluster);
 	ef->zero_cluster = NULL;
-	free(ef->cmap.chunk);
-	ef->cmap.chunk = NULL;
+	exfat_free_cmap(ef);
 	free(ef->sb);
 	ef->sb = NULL;
 	free(ef->upcase);
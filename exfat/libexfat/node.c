@@ -34,8 +34,8 @@ struct iterator
 
 struct exfat_node* exfat_get_node(struct exfat_node* node)
 {
-	/* if we switch to multi-threaded mode we will need atomic
-	   increment here and atomic decrement in exfat_put_node() */
+	/* multithreaded users hold ef->lock around both this and
+	   exfat_put_node() */
 	node->references++;
 	return node;
 }
@@ -51,16 +51,21 @@ void exfat_put_node(struct exfat* ef, struct exfat_node* node)
 
 	if (node->references == 0)
 	{
+		pthread_mutex_lock(&node->lock);
 		if (node->flags & EXFAT_ATTRIB_DIRTY)
 			exfat_flush_node(ef, node);
 		if (node->flags & EXFAT_ATTRIB_UNLINKED)
 		{
 			/* free all clusters and node structure itself */
 			exfat_truncate(ef, node, 0, true);
+			pthread_mutex_unlock(&node->lock);
+			exfat_reset_extents(node);
+			exfat_reset_index(node);
 			free(node);
 		}
-		if (ef->cmap.dirty)
-			exfat_flush_cmap(ef);
+		else
+			pthread_mutex_unlock(&node->lock);
+		exfat_flush_cmap(ef);
 	}
 }
 
@@ -134,6 +139,7 @@ static struct exfat_node* allocate_node(void)
 		return NULL;
 	}
 	memset(node, 0, sizeof(struct exfat_node));
+	pthread_mutex_init(&node->lock, NULL);
 	return node;
 }
 
@@ -368,7 +374,9 @@ static int readdir(struct exfat* ef, const struct exfat_node* parent,
 			}
 			/* FIXME bitmap can be rather big, up to 512 MB */
 			ef->cmap.chunk_size = ef->cmap.size;
-			ef->cmap.chunk = malloc(le64_to_cpu(bitmap->size));
+			/* rounded up to whole 64-bit words for the allocator */
+			ef->cmap.chunk = calloc(ROUND_UP(le64_to_cpu(bitmap->size), 8),
+					1);
 			if (ef->cmap.chunk == NULL)
 			{
 				exfat_error("failed to allocate clusters bitmap chunk "
@@ -379,6 +387,9 @@ static int readdir(struct exfat* ef, const struct exfat_node* parent,
 
 			exfat_pread(ef->dev, ef->cmap.chunk, le64_to_cpu(bitmap->size),
 					exfat_c2o(ef, ef->cmap.start_cluster));
+			rc = exfat_init_cmap(ef);
+			if (rc != 0)
+				goto error;
 			break;
 
 		case EXFAT_ENTRY_LABEL:
@@ -447,17 +458,20 @@ int exfat_cache_directory(struct exfat* ef, struct exfat_node* dir)
 		for (current = dir->child; current; current = node)
 		{
 			node = current->next;
+			exfat_reset_extents(current);
 			free(current);
 		}
 		dir->child = NULL;
 		return rc;
 	}
 
+	exfat_index_directory(ef, dir);
 	dir->flags |= EXFAT_ATTRIB_CACHED;
 	return 0;
 }
 
-static void tree_attach(struct exfat_node* dir, struct exfat_node* node)
+static void tree_attach(struct exfat* ef, struct exfat_node* dir,
+		struct exfat_node* node)
 {
 	node->parent = dir;
 	if (dir->child)
@@ -466,10 +480,12 @@ static void tree_attach(struct exfat_node* dir, struct exfat_node* node)
 		node->next = dir->child;
 	}
 	dir->child = node;
+	exfat_index_add(ef, dir, node);
 }
 
 static void tree_detach(struct exfat_node* node)
 {
+	exfat_index_remove(node->parent, node);
 	if (node->prev)
 		node->prev->next = node->next;
 	else /* this is the first node in the list */
@@ -488,9 +504,11 @@ static void reset_cache(struct exfat* ef, struct exfat_node* node)
 		struct exfat_node* p = node->child;
 		reset_cache(ef, p);
 		tree_detach(p);
+		exfat_reset_extents(p);
 		free(p);
 	}
 	node->flags &= ~EXFAT_ATTRIB_CACHED;
+	exfat_reset_index(node);
 	if (node->references != 0)
 	{
 		char buffer[EXFAT_NAME_MAX + 1];
@@ -646,7 +664,9 @@ static int delete(struct exfat* ef, struct exfat_node* node)
 	rc = shrink_directory(ef, parent, deleted_offset);
 	exfat_put_node(ef, parent);
 	/* file clusters will be freed when node reference counter becomes 0 */
+	pthread_mutex_lock(&node->lock);
 	node->flags |= EXFAT_ATTRIB_UNLINKED;
+	pthread_mutex_unlock(&node->lock);
 	return rc;
 }
 
@@ -773,7 +793,7 @@ static int write_entry(struct exfat* ef, struct exfat_node* dir,
 	init_node_meta1(node, &meta1);
 	init_node_meta2(node, &meta2);
 
-	tree_attach(dir, node);
+	tree_attach(ef, dir, node);
 	exfat_update_mtime(dir);
 	return 0;
 }
@@ -882,7 +902,7 @@ static void rename_entry(struct exfat* ef, struct exfat_node* dir,
 
 	memcpy(node->name, name, (EXFAT_NAME_MAX + 1) * sizeof(le16_t));
 	tree_detach(node);
-	tree_attach(dir, node);
+	tree_attach(ef, dir, node);
 }
 
 int exfat_rename(struct exfat* ef, const char* old_path, const char* new_path)
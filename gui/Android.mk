@@ -22,6 +22,7 @@ LOCAL_SRC_FILES := \
     keyboard.cpp \
     input.cpp \
     blanktimer.cpp \
+    jobscheduler.cpp \
     partitionlist.cpp \
     ../minuitwrp/graphics.c
 
@@ -61,6 +62,10 @@ endif
 ifneq ($(TW_NO_SCREEN_BLANK),)
 	LOCAL_CFLAGS += -DTW_NO_SCREEN_BLANK
 endif
+# Always parse ui.xml instead of using the theme compiled on an earlier boot
+ifeq ($(TW_NO_COMPILED_THEME), true)
+	LOCAL_CFLAGS += -DTW_NO_COMPILED_THEME
+endif
 
 LOCAL_C_INCLUDES += bionic external/stlport/stlport $(commands_recovery_local_path)/gui/devices/$(DEVICE_RESOLUTION)
 
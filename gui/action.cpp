@@ -40,6 +40,7 @@
 
 #include "../adb_install.h"
 #include "blanktimer.hpp"
+#include "jobscheduler.hpp"
 #include "../multirom.h"
 
 extern "C" {
@@ -65,6 +66,30 @@ extern blanktimer blankTimer;
 
 void curtainClose(void);
 
+// Shared by every action: the zip queue and the terminal command thread
+static string zip_queue[10];
+static int zip_queue_index;
+static pthread_t terminal_command;
+
+std::map<std::string, GUIAction::ActionHandler> GUIAction::mHandlers;
+
+// A list of actions that runs on a jobScheduler worker
+class GUIAction::Job : public jobscheduler::job
+{
+public:
+	Job(GUIAction* owner, const std::vector<Action>& actions, const std::string& name, int priority, bool heavy)
+		: jobscheduler::job(name, priority, heavy, owner), mOwner(owner), mActions(actions) {}
+
+	virtual void run(void)
+	{
+		mOwner->runActions(mActions, jobscheduler::now_ms() - queued_ms);
+	}
+
+private:
+	GUIAction* mOwner;
+	std::vector<Action> mActions;
+};
+
 GUIAction::GUIAction(xml_node<>* node)
     : Conditional(node)
 {
@@ -73,6 +98,7 @@ GUIAction::GUIAction(xml_node<>* node)
     xml_attribute<>* attr;
 
     mKey = 0;
+    initHandlers();
 
     if (!node)  return;
 
@@ -92,6 +118,10 @@ GUIAction::GUIAction(xml_node<>* node)
     
         action.mFunction = attr->value();
         action.mArg = child->value();
+        action.mHandler = findHandler(action.mFunction);
+        // Names with variables can only be checked when they run
+        if (!action.mHandler && action.mFunction.find('%') == std::string::npos)
+            LOGERR("Unknown action function '%s' in theme\n", action.mFunction.c_str());
         mActions.push_back(action);
 
         child = child->next_sibling("action");
@@ -126,6 +156,111 @@ GUIAction::GUIAction(xml_node<>* node)
     }
 }
 
+GUIAction::~GUIAction()
+{
+	jobScheduler.cancelOwner(this);
+}
+
+void GUIAction::addHandler(const char* name, execFunction func, int flags, int priority)
+{
+	ActionHandler handler;
+
+	handler.name = name;
+	handler.func = func;
+	handler.flags = flags;
+	handler.priority = priority;
+	mHandlers[name] = handler;
+}
+
+// Builds the table of action functions the first time a theme is loaded.
+// Quick actions run on the thread that triggered them. Threaded actions run
+// as jobs, and heavy ones wait for each other instead of running together.
+void GUIAction::initHandlers(void)
+{
+	if (!mHandlers.empty())
+		return;
+
+	addHandler("reboot", &GUIAction::reboot);
+	addHandler("home", &GUIAction::home);
+	addHandler("key", &GUIAction::key);
+	addHandler("page", &GUIAction::page);
+	addHandler("reload", &GUIAction::reload);
+	addHandler("readBackup", &GUIAction::readBackup);
+	addHandler("set", &GUIAction::set);
+	addHandler("clear", &GUIAction::clear);
+	addHandler("mount", &GUIAction::mount);
+	addHandler("umount", &GUIAction::unmount);
+	addHandler("unmount", &GUIAction::unmount);
+	addHandler("restoredefaultsettings", &GUIAction::restoredefaultsettings);
+	addHandler("copylog", &GUIAction::copylog);
+	addHandler("compute", &GUIAction::compute);
+	addHandler("addsubtract", &GUIAction::compute);
+	addHandler("setguitimezone", &GUIAction::setguitimezone);
+	addHandler("togglestorage", &GUIAction::togglestorage);
+	addHandler("overlay", &GUIAction::overlay);
+	addHandler("queuezip", &GUIAction::queuezip);
+	addHandler("cancelzip", &GUIAction::cancelzip);
+	addHandler("queueclear", &GUIAction::queueclear);
+	addHandler("sleep", &GUIAction::sleep);
+	addHandler("multirom", &GUIAction::multirom);
+	addHandler("multirom_list", &GUIAction::multirom_list);
+	addHandler("multirom_rename", &GUIAction::multirom_rename);
+	addHandler("multirom_manage", &GUIAction::multirom_manage);
+	addHandler("multirom_settings", &GUIAction::multirom_settings);
+	addHandler("multirom_settings_save", &GUIAction::multirom_settings_save);
+	addHandler("multirom_add", &GUIAction::multirom_add);
+	addHandler("multirom_add_second", &GUIAction::multirom_add_second);
+	addHandler("multirom_add_file_selected", &GUIAction::multirom_add_file_selected);
+	addHandler("multirom_change_img_size", &GUIAction::multirom_change_img_size);
+	addHandler("multirom_change_img_size_act", &GUIAction::multirom_change_img_size_act);
+	addHandler("multirom_set_list_loc", &GUIAction::multirom_set_list_loc);
+	addHandler("multirom_list_loc_selected", &GUIAction::multirom_list_loc_selected);
+	addHandler("canceljobs", &GUIAction::canceljobs);
+	addHandler("jobstats", &GUIAction::jobstats);
+
+	addHandler("timeout", &GUIAction::timeout, ACTION_THREADED);
+	addHandler("multirom_delete", &GUIAction::multirom_delete, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("multirom_flash_zip", &GUIAction::multirom_flash_zip, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("multirom_inject", &GUIAction::multirom_inject, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("multirom_inject_curr_boot", &GUIAction::multirom_inject_curr_boot, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("multirom_add_rom", &GUIAction::multirom_add_rom, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("multirom_ubuntu_patch_init", &GUIAction::multirom_ubuntu_patch_init, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("multirom_wipe", &GUIAction::multirom_wipe, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("multirom_disable_flash_kernel", &GUIAction::multirom_disable_flash_kernel, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("fileexists", &GUIAction::fileexists, ACTION_THREADED);
+	addHandler("flash", &GUIAction::flash, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("wipe", &GUIAction::wipe, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("refreshsizes", &GUIAction::refreshsizes, ACTION_THREADED);
+	addHandler("nandroid", &GUIAction::nandroid, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("fixpermissions", &GUIAction::fixpermissions, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("dd", &GUIAction::dd, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("partitionsd", &GUIAction::partitionsd, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("installhtcdumlock", &GUIAction::installhtcdumlock, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("htcdumlockrestoreboot", &GUIAction::htcdumlockrestoreboot, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("htcdumlockreflashrecovery", &GUIAction::htcdumlockreflashrecovery, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("cmd", &GUIAction::cmd, ACTION_THREADED);
+	addHandler("terminalcommand", &GUIAction::terminalcommand, ACTION_THREADED);
+	addHandler("killterminal", &GUIAction::killterminal, ACTION_THREADED);
+	addHandler("reinjecttwrp", &GUIAction::reinjecttwrp, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("checkbackupname", &GUIAction::checkbackupname, ACTION_THREADED);
+	// Everything else on /data has to wait for it
+	addHandler("decrypt", &GUIAction::decrypt, ACTION_THREADED | ACTION_HEAVY, jobscheduler::PRIORITY_HIGH);
+	addHandler("adbsideload", &GUIAction::adbsideload, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("adbsideloadcancel", &GUIAction::adbsideloadcancel, ACTION_THREADED);
+	addHandler("openrecoveryscript", &GUIAction::openrecoveryscript, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("installsu", &GUIAction::installsu, ACTION_THREADED | ACTION_HEAVY);
+	addHandler("fixsu", &GUIAction::fixsu, ACTION_THREADED | ACTION_HEAVY);
+}
+
+const GUIAction::ActionHandler* GUIAction::findHandler(const std::string& function)
+{
+	std::map<std::string, ActionHandler>::iterator it = mHandlers.find(function);
+
+	if (it == mHandlers.end())
+		return NULL;
+	return &it->second;
+}
+
 int GUIAction::NotifyTouch(TOUCH_STATE state, int x, int y)
 {
     if (state == TOUCH_RELEASE)
@@ -161,7 +296,7 @@ int GUIAction::NotifyVarChange(std::string varName, std::string value)
 void GUIAction::simulate_progress_bar(void)
 {
 	gui_print("Simulating actions...\n");
-	for (int i = 0; i < 5; i++)
+	for (int i = 0; i < 5 && !jobScheduler.isCancelled(); i++)
 	{
 		usleep(500000);
 		DataManager::SetValue("ui_progress", i * 20);
@@ -247,69 +382,78 @@ int GUIAction::flash_zip(std::string filename, std::string pageName, const int s
 
 int GUIAction::doActions()
 {
+	std::vector<Action>::iterator iter;
+	std::vector<Action> actions;
+	const ActionHandler* handler;
+	std::string name;
+	int threaded = 0, heavy = 0, priority = jobscheduler::PRIORITY_NORMAL;
+
 	if (mActions.size() < 1)    return -1;
-    if (mActions.size() == 1)
+	if (mActions.size() == 1)
 		return doAction(mActions.at(0), 0);
 
-    // For multi-action, we always use a thread
-    pthread_t t;
-	pthread_attr_t tattr;
-
-	if (pthread_attr_init(&tattr)) {
-		LOGERR("Unable to pthread_attr_init\n");
-		return -1;
-	}
-	if (pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_JOINABLE)) {
-		LOGERR("Error setting pthread_attr_setdetachstate\n");
-		return -1;
-	}
-	if (pthread_attr_setscope(&tattr, PTHREAD_SCOPE_SYSTEM)) {
-		LOGERR("Error setting pthread_attr_setscope\n");
-		return -1;
-	}
-	/*if (pthread_attr_setstacksize(&tattr, 524288)) {
-		LOGERR("Error setting pthread_attr_setstacksize\n");
-		return -1;
+	actions = resolveActions(mActions);
+	for (iter = actions.begin(); iter != actions.end(); iter++) {
+		handler = iter->mHandler;
+		if (!handler || !(handler->flags & ACTION_THREADED))
+			continue;
+		if (!threaded)
+			name = handler->name;
+		threaded = 1;
+		if (handler->flags & ACTION_HEAVY)
+			heavy = 1;
+		if (handler->priority > priority)
+			priority = handler->priority;
 	}
-	*/
-	int ret = pthread_create(&t, &tattr, thread_start, this);
-    if (ret) {
-		LOGERR("Unable to create more threads for actions... continuing in same thread! %i\n", ret);
-		thread_start(this);
-	} else {
-		if (pthread_join(t, NULL)) {
-			LOGERR("Error joining threads\n");
-		}
-	}
-	if (pthread_attr_destroy(&tattr)) {
-		LOGERR("Failed to pthread_attr_destroy\n");
-		return -1;
+
+	// Lists of quick actions, and lists triggered from a job that is already
+	// running, are run right away on this thread
+	if (!threaded || jobScheduler.isWorker()) {
+		runActions(actions, 0);
+		return 0;
 	}
 
-    return 0;
+	jobScheduler.submit(new Job(this, actions, name, priority, heavy));
+	return 0;
 }
 
-void* GUIAction::thread_start(void *cookie)
+// Replaces the variables in functions like %tw_action% and in their
+// arguments now, so a queued job runs what was on screen when it was
+// triggered. Other arguments are still parsed when they run, as an
+// earlier set in the same list may change them.
+std::vector<GUIAction::Action> GUIAction::resolveActions(const std::vector<Action>& actions)
 {
-    GUIAction* ourThis = (GUIAction*) cookie;
+	std::vector<Action> resolved(actions);
+	std::vector<Action>::iterator iter;
+
+	for (iter = resolved.begin(); iter != resolved.end(); iter++) {
+		if (iter->mHandler)
+			continue;
+		iter->mHandler = getHandler(*iter);
+		iter->mFunction = gui_parse_text(iter->mFunction);
+		iter->mArg = gui_parse_text(iter->mArg);
+		iter->mResolved = true;
+	}
+	return resolved;
+}
+
+void GUIAction::runActions(const std::vector<Action>& actions, unsigned long long wait_ms)
+{
+	std::vector<Action>::const_iterator iter;
+	const ActionHandler* handler;
 
 	DataManager::SetValue(TW_ACTION_BUSY, 1);
 
-    if (ourThis->mActions.size() > 1)
-    {
-        std::vector<Action>::iterator iter;
-        for (iter = ourThis->mActions.begin(); iter != ourThis->mActions.end(); iter++)
-            ourThis->doAction(*iter, 1);
-    }
-    else
-    {
-        ourThis->doAction(ourThis->mActions.at(0), 1);
-    }
+	for (iter = actions.begin(); iter != actions.end(); iter++) {
+		handler = getHandler(*iter);
+		if (handler)
+			callHandler(*iter, handler, iter == actions.begin() ? wait_ms : 0);
+	}
+
 	int check = 0;
 	DataManager::GetValue("tw_background_thread_running", check);
-	if (check == 0)
+	if (check == 0 && jobScheduler.otherJobs() == 0)
 		DataManager::SetValue(TW_ACTION_BUSY, 0);
-    return NULL;
 }
 
 void GUIAction::operation_start(const string operation_name)
@@ -340,1229 +484,1320 @@ void GUIAction::operation_end(const int operation_status, const int simulate)
 		}
 	}
 	DataManager::SetValue("tw_operation_state", 1);
-	DataManager::SetValue(TW_ACTION_BUSY, 0);
+	// Queued heavy jobs keep the GUI busy until they have run
+	if (jobScheduler.otherJobs() == 0)
+		DataManager::SetValue(TW_ACTION_BUSY, 0);
 	blankTimer.resetTimerAndUnblank();
 }
 
-int GUIAction::doAction(Action action, int isThreaded /* = 0 */)
+const GUIAction::ActionHandler* GUIAction::getHandler(const Action& action)
 {
-	static string zip_queue[10];
-	static int zip_queue_index;
-	static pthread_t terminal_command;
-	int simulate;
-
-	std::string arg = gui_parse_text(action.mArg);
+	if (action.mHandler || action.mResolved)
+		return action.mHandler;
 
+	// Function names that use variables are looked up when they run
 	std::string function = gui_parse_text(action.mFunction);
+	const ActionHandler* handler = findHandler(function);
+	if (!handler)
+		LOGINFO("Unknown action function '%s'\n", function.c_str());
+	return handler;
+}
 
+int GUIAction::callHandler(const Action& action, const ActionHandler* handler, unsigned long long wait_ms)
+{
+	unsigned long long start;
+	int ret, simulate;
+
+	// Read per call, a job keeps the setting it started with
 	DataManager::GetValue(TW_SIMULATE_ACTIONS, simulate);
+	std::string arg = action.mResolved ? action.mArg : gui_parse_text(action.mArg);
 
-	if (function == "reboot")
-	{
-	        //curtainClose(); this sometimes causes a crash
+	start = jobscheduler::now_ms();
+	ret = (this->*(handler->func))(arg, simulate);
+	// The handler may have reloaded the theme and deleted this object
+	jobScheduler.recordLatency(handler->name, jobscheduler::now_ms() - start, wait_ms);
+	return ret;
+}
 
-		sync();
-		DataManager::SetValue("tw_gui_done", 1);
-		DataManager::SetValue("tw_reboot_arg", arg);
+int GUIAction::doAction(Action action, int isThreaded /* = 0 */)
+{
+	const ActionHandler* handler;
+
+	if (!isThreaded)
+		action = resolveActions(std::vector<Action>(1, action)).front();
+	handler = getHandler(action);
+	if (!handler)
+		return -1;
 
+	if ((handler->flags & ACTION_THREADED) && !isThreaded) {
+		std::vector<Action> actions(1, action);
+		jobScheduler.submit(new Job(this, actions, handler->name, handler->priority,
+			(handler->flags & ACTION_HEAVY) != 0));
 		return 0;
 	}
-    if (function == "home")
-    {
-        PageManager::SelectPackage("TWRP");
-        gui_changePage("main");
-        return 0;
-    }
+	return callHandler(action, handler, 0);
+}
 
-    if (function == "key")
-    {
-        PageManager::NotifyKey(getKeyByName(arg));
-        return 0;
-    }
+int GUIAction::reboot(std::string arg, const int simulate)
+{
+        //curtainClose(); this sometimes causes a crash
 
-    if (function == "page") {
-		std::string page_name = gui_parse_text(arg);
-        return gui_changePage(page_name);
-	}
+	sync();
+	DataManager::SetValue("tw_gui_done", 1);
+	DataManager::SetValue("tw_reboot_arg", arg);
 
-    if (function == "reload") {
-		int check = 0, ret_val = 0;
-		std::string theme_path;
+	return 0;
+}
 
-		operation_start("Reload Theme");
-		theme_path = DataManager::GetSettingsStoragePath();
-		if (PartitionManager.Mount_By_Path(theme_path.c_str(), 1) < 0) {
-			LOGERR("Unable to mount %s during reload function startup.\n", theme_path.c_str());
-			check = 1;
-		}
+int GUIAction::home(std::string arg, const int simulate)
+{
+    PageManager::SelectPackage("TWRP");
+    gui_changePage("main");
+    return 0;
+}
+
+int GUIAction::key(std::string arg, const int simulate)
+{
+    PageManager::NotifyKey(getKeyByName(arg));
+    return 0;
+}
+
+int GUIAction::page(std::string arg, const int simulate)
+{
+	std::string page_name = gui_parse_text(arg);
+    return gui_changePage(page_name);
+}
+
+int GUIAction::reload(std::string arg, const int simulate)
+{
+	int check = 0, ret_val = 0;
+	std::string theme_path;
+
+	operation_start("Reload Theme");
+	theme_path = DataManager::GetSettingsStoragePath();
+	if (PartitionManager.Mount_By_Path(theme_path.c_str(), 1) < 0) {
+		LOGERR("Unable to mount %s during reload function startup.\n", theme_path.c_str());
+		check = 1;
+	}
 
-		theme_path += "/TWRP/theme/ui.zip";
-		if (check != 0 || PageManager::ReloadPackage("TWRP", theme_path) != 0)
+	theme_path += "/TWRP/theme/ui.zip";
+	if (check != 0 || PageManager::ReloadPackage("TWRP", theme_path) != 0)
+	{
+		// Loading the custom theme failed - try loading the stock theme
+		LOGINFO("Attempting to reload stock theme...\n");
+		if (PageManager::ReloadPackage("TWRP", "/res/ui.xml"))
 		{
-			// Loading the custom theme failed - try loading the stock theme
-			LOGINFO("Attempting to reload stock theme...\n");
-			if (PageManager::ReloadPackage("TWRP", "/res/ui.xml"))
-			{
-				LOGERR("Failed to load base packages.\n");
-				ret_val = 1;
-			}
+			LOGERR("Failed to load base packages.\n");
+			ret_val = 1;
 		}
-        operation_end(ret_val, simulate);
 	}
+    operation_end(ret_val, simulate);
+	return 0;
+}
 
-    if (function == "readBackup")
-    {
-		string Restore_Name;
-		DataManager::GetValue("tw_restore", Restore_Name);
-		PartitionManager.Set_Restore_Files(Restore_Name);
-        return 0;
-    }
+int GUIAction::readBackup(std::string arg, const int simulate)
+{
+	string Restore_Name;
+	DataManager::GetValue("tw_restore", Restore_Name);
+	PartitionManager.Set_Restore_Files(Restore_Name);
+	return 0;
+}
 
-    if (function == "set")
+int GUIAction::set(std::string arg, const int simulate)
+{
+    if (arg.find('=') != string::npos)
     {
-        if (arg.find('=') != string::npos)
-        {
-            string varName = arg.substr(0, arg.find('='));
-            string value = arg.substr(arg.find('=') + 1, string::npos);
+        string varName = arg.substr(0, arg.find('='));
+        string value = arg.substr(arg.find('=') + 1, string::npos);
 
-            DataManager::GetValue(value, value);
-            DataManager::SetValue(varName, value);
-        }
-        else
-            DataManager::SetValue(arg, "1");
-        return 0;
-    }
-    if (function == "clear")
-    {
-        DataManager::SetValue(arg, "0");
-        return 0;
+        DataManager::GetValue(value, value);
+        DataManager::SetValue(varName, value);
     }
+    else
+        DataManager::SetValue(arg, "1");
+    return 0;
+}
+
+int GUIAction::clear(std::string arg, const int simulate)
+{
+    DataManager::SetValue(arg, "0");
+    return 0;
+}
 
-    if (function == "mount")
+int GUIAction::mount(std::string arg, const int simulate)
+{
+    if (arg == "usb")
     {
-        if (arg == "usb")
-        {
-            DataManager::SetValue(TW_ACTION_BUSY, 1);
-			if (!simulate)
-				PartitionManager.usb_storage_enable();
-			else
-				gui_print("Simulating actions...\n");
-        }
-        else if (!simulate)
-        {
-            string cmd;
-			if (arg == "EXTERNAL")
-				PartitionManager.Mount_By_Path(DataManager::GetStrValue(TW_EXTERNAL_MOUNT), true);
-			else if (arg == "INTERNAL")
-				PartitionManager.Mount_By_Path(DataManager::GetStrValue(TW_INTERNAL_MOUNT), true);
-			else
-				PartitionManager.Mount_By_Path(arg, true);
-        } else
+        DataManager::SetValue(TW_ACTION_BUSY, 1);
+		if (!simulate)
+			PartitionManager.usb_storage_enable();
+		else
 			gui_print("Simulating actions...\n");
-        return 0;
     }
+    else if (!simulate)
+    {
+        string cmd;
+		if (arg == "EXTERNAL")
+			PartitionManager.Mount_By_Path(DataManager::GetStrValue(TW_EXTERNAL_MOUNT), true);
+		else if (arg == "INTERNAL")
+			PartitionManager.Mount_By_Path(DataManager::GetStrValue(TW_INTERNAL_MOUNT), true);
+		else
+			PartitionManager.Mount_By_Path(arg, true);
+    } else
+		gui_print("Simulating actions...\n");
+    return 0;
+}
 
-    if (function == "umount" || function == "unmount")
+int GUIAction::unmount(std::string arg, const int simulate)
+{
+    if (arg == "usb")
     {
-        if (arg == "usb")
-        {
-            if (!simulate)
-				PartitionManager.usb_storage_disable();
-			else
-				gui_print("Simulating actions...\n");
-			DataManager::SetValue(TW_ACTION_BUSY, 0);
-        }
-        else if (!simulate)
-        {
-            string cmd;
-			if (arg == "EXTERNAL")
-				PartitionManager.UnMount_By_Path(DataManager::GetStrValue(TW_EXTERNAL_MOUNT), true);
-			else if (arg == "INTERNAL")
-				PartitionManager.UnMount_By_Path(DataManager::GetStrValue(TW_INTERNAL_MOUNT), true);
-			else
-				PartitionManager.UnMount_By_Path(arg, true);
-        } else
+        if (!simulate)
+			PartitionManager.usb_storage_disable();
+		else
 			gui_print("Simulating actions...\n");
-        return 0;
+		DataManager::SetValue(TW_ACTION_BUSY, 0);
     }
-	
-	if (function == "restoredefaultsettings")
-	{
-		operation_start("Restore Defaults");
-		if (simulate) // Simulated so that people don't accidently wipe out the "simulation is on" setting
-			gui_print("Simulating actions...\n");
-		else {
-			DataManager::ResetDefaults();
-			PartitionManager.Update_System_Details();
-			PartitionManager.Mount_Current_Storage(true);
-		}
-		operation_end(0, simulate);
+    else if (!simulate)
+    {
+        string cmd;
+		if (arg == "EXTERNAL")
+			PartitionManager.UnMount_By_Path(DataManager::GetStrValue(TW_EXTERNAL_MOUNT), true);
+		else if (arg == "INTERNAL")
+			PartitionManager.UnMount_By_Path(DataManager::GetStrValue(TW_INTERNAL_MOUNT), true);
+		else
+			PartitionManager.UnMount_By_Path(arg, true);
+    } else
+		gui_print("Simulating actions...\n");
+    return 0;
+}
+
+int GUIAction::restoredefaultsettings(std::string arg, const int simulate)
+{
+	operation_start("Restore Defaults");
+	if (simulate) // Simulated so that people don't accidently wipe out the "simulation is on" setting
+		gui_print("Simulating actions...\n");
+	else {
+		DataManager::ResetDefaults();
+		PartitionManager.Update_System_Details();
+		PartitionManager.Mount_Current_Storage(true);
 	}
-	
-	if (function == "copylog")
+	operation_end(0, simulate);
+	return 0;
+}
+
+int GUIAction::copylog(std::string arg, const int simulate)
+{
+	operation_start("Copy Log");
+	if (!simulate)
 	{
-		operation_start("Copy Log");
-		if (!simulate)
-		{
-			string dst;
-			PartitionManager.Mount_Current_Storage(true);
-			dst = DataManager::GetCurrentStoragePath() + "/recovery.log";
-			TWFunc::copy_file("/tmp/recovery.log", dst.c_str(), 0755);
-			sync();
-			gui_print("Copied recovery log to %s.\n", DataManager::GetCurrentStoragePath().c_str());
-		} else
-			simulate_progress_bar();
-		operation_end(0, simulate);
+		string dst;
+		PartitionManager.Mount_Current_Storage(true);
+		dst = DataManager::GetCurrentStoragePath() + "/recovery.log";
+		TWFunc::copy_file("/tmp/recovery.log", dst.c_str(), 0755);
+		sync();
+		gui_print("Copied recovery log to %s.\n", DataManager::GetCurrentStoragePath().c_str());
+	} else
+		simulate_progress_bar();
+	operation_end(0, simulate);
+	return 0;
+}
+
+int GUIAction::compute(std::string arg, const int simulate)
+{
+	if (arg.find("+") != string::npos)
+    {
+        string varName = arg.substr(0, arg.find('+'));
+        string string_to_add = arg.substr(arg.find('+') + 1, string::npos);
+		int amount_to_add = atoi(string_to_add.c_str());
+		int value;
+
+		DataManager::GetValue(varName, value);
+        DataManager::SetValue(varName, value + amount_to_add);
 		return 0;
-	}
-	
-	if (function == "compute" || function == "addsubtract")
+    }
+	if (arg.find("-") != string::npos)
+    {
+        string varName = arg.substr(0, arg.find('-'));
+        string string_to_subtract = arg.substr(arg.find('-') + 1, string::npos);
+		int amount_to_subtract = atoi(string_to_subtract.c_str());
+		int value;
+
+		DataManager::GetValue(varName, value);
+		value -= amount_to_subtract;
+		if (value <= 0)
+			value = 0;
+        DataManager::SetValue(varName, value);
+		return 0;
+    }
+	if (arg.find("*") != string::npos)
 	{
-		if (arg.find("+") != string::npos)
-        {
-            string varName = arg.substr(0, arg.find('+'));
-            string string_to_add = arg.substr(arg.find('+') + 1, string::npos);
-			int amount_to_add = atoi(string_to_add.c_str());
-			int value;
+		string varName = arg.substr(0, arg.find('*'));
+		string multiply_by_str = gui_parse_text(arg.substr(arg.find('*') + 1, string::npos));
+		int multiply_by = atoi(multiply_by_str.c_str());
+		int value;
 
-			DataManager::GetValue(varName, value);
-            DataManager::SetValue(varName, value + amount_to_add);
-			return 0;
-        }
-		if (arg.find("-") != string::npos)
-        {
-            string varName = arg.substr(0, arg.find('-'));
-            string string_to_subtract = arg.substr(arg.find('-') + 1, string::npos);
-			int amount_to_subtract = atoi(string_to_subtract.c_str());
-			int value;
+		DataManager::GetValue(varName, value);
+		DataManager::SetValue(varName, value*multiply_by);
+		return 0;
+	}
+	if (arg.find("/") != string::npos)
+	{
+		string varName = arg.substr(0, arg.find('/'));
+		string divide_by_str = gui_parse_text(arg.substr(arg.find('/') + 1, string::npos));
+		int divide_by = atoi(divide_by_str.c_str());
+		int value;
 
-			DataManager::GetValue(varName, value);
-			value -= amount_to_subtract;
-			if (value <= 0)
-				value = 0;
-            DataManager::SetValue(varName, value);
-			return 0;
-        }
-		if (arg.find("*") != string::npos)
+		if(divide_by != 0)
 		{
-			string varName = arg.substr(0, arg.find('*'));
-			string multiply_by_str = gui_parse_text(arg.substr(arg.find('*') + 1, string::npos));
-			int multiply_by = atoi(multiply_by_str.c_str());
-			int value;
-
 			DataManager::GetValue(varName, value);
-			DataManager::SetValue(varName, value*multiply_by);
-			return 0;
-		}
-		if (arg.find("/") != string::npos)
-		{
-			string varName = arg.substr(0, arg.find('/'));
-			string divide_by_str = gui_parse_text(arg.substr(arg.find('/') + 1, string::npos));
-			int divide_by = atoi(divide_by_str.c_str());
-			int value;
-
-			if(divide_by != 0)
-			{
-				DataManager::GetValue(varName, value);
-				DataManager::SetValue(varName, value/divide_by);
-			}
-			return 0;
+			DataManager::SetValue(varName, value/divide_by);
 		}
-		LOGERR("Unable to perform compute '%s'\n", arg.c_str());
-		return -1;
-	}
-	
-	if (function == "setguitimezone")
-	{
-		string SelectedZone;
-		DataManager::GetValue(TW_TIME_ZONE_GUISEL, SelectedZone); // read the selected time zone into SelectedZone
-		string Zone = SelectedZone.substr(0, SelectedZone.find(';')); // parse to get time zone
-		string DSTZone = SelectedZone.substr(SelectedZone.find(';') + 1, string::npos); // parse to get DST component
-		
-		int dst;
-		DataManager::GetValue(TW_TIME_ZONE_GUIDST, dst); // check wether user chose to use DST
-		
-		string offset;
-		DataManager::GetValue(TW_TIME_ZONE_GUIOFFSET, offset); // pull in offset
-		
-		string NewTimeZone = Zone;
-		if (offset != "0")
-			NewTimeZone += ":" + offset;
-		
-		if (dst != 0)
-			NewTimeZone += DSTZone;
-		
-		DataManager::SetValue(TW_TIME_ZONE_VAR, NewTimeZone);
-		DataManager::update_tz_environment_variables();
 		return 0;
 	}
+	LOGERR("Unable to perform compute '%s'\n", arg.c_str());
+	return -1;
+}
+
+int GUIAction::setguitimezone(std::string arg, const int simulate)
+{
+	string SelectedZone;
+	DataManager::GetValue(TW_TIME_ZONE_GUISEL, SelectedZone); // read the selected time zone into SelectedZone
+	string Zone = SelectedZone.substr(0, SelectedZone.find(';')); // parse to get time zone
+	string DSTZone = SelectedZone.substr(SelectedZone.find(';') + 1, string::npos); // parse to get DST component
+
+	int dst;
+	DataManager::GetValue(TW_TIME_ZONE_GUIDST, dst); // check wether user chose to use DST
+
+	string offset;
+	DataManager::GetValue(TW_TIME_ZONE_GUIOFFSET, offset); // pull in offset
+
+	string NewTimeZone = Zone;
+	if (offset != "0")
+		NewTimeZone += ":" + offset;
+
+	if (dst != 0)
+		NewTimeZone += DSTZone;
+
+	DataManager::SetValue(TW_TIME_ZONE_VAR, NewTimeZone);
+	DataManager::update_tz_environment_variables();
+	return 0;
+}
 
-	if (function == "togglestorage") {
+int GUIAction::togglestorage(std::string arg, const int simulate)
+{
+	if (arg == "internal") {
+		DataManager::SetValue(TW_USE_EXTERNAL_STORAGE, 0);
+	} else if (arg == "external") {
+		DataManager::SetValue(TW_USE_EXTERNAL_STORAGE, 1);
+	}
+	if (PartitionManager.Mount_Current_Storage(true)) {
 		if (arg == "internal") {
-			DataManager::SetValue(TW_USE_EXTERNAL_STORAGE, 0);
-		} else if (arg == "external") {
-			DataManager::SetValue(TW_USE_EXTERNAL_STORAGE, 1);
-		}
-		if (PartitionManager.Mount_Current_Storage(true)) {
-			if (arg == "internal") {
-				string zip_path, zip_root;
-				DataManager::GetValue(TW_ZIP_INTERNAL_VAR, zip_path);
-				zip_root = TWFunc::Get_Root_Path(zip_path);
+			string zip_path, zip_root;
+			DataManager::GetValue(TW_ZIP_INTERNAL_VAR, zip_path);
+			zip_root = TWFunc::Get_Root_Path(zip_path);
 #ifdef RECOVERY_SDCARD_ON_DATA
-	#ifndef TW_EXTERNAL_STORAGE_PATH
+#ifndef TW_EXTERNAL_STORAGE_PATH
+			if (zip_root != "/sdcard")
+				DataManager::SetValue(TW_ZIP_INTERNAL_VAR, "/sdcard");
+#else
+			if (strcmp(EXPAND(TW_EXTERNAL_STORAGE_PATH), "/sdcard") == 0) {
+				if (zip_root != "/emmc")
+					DataManager::SetValue(TW_ZIP_INTERNAL_VAR, "/emmc");
+			} else {
 				if (zip_root != "/sdcard")
 					DataManager::SetValue(TW_ZIP_INTERNAL_VAR, "/sdcard");
-	#else
-				if (strcmp(EXPAND(TW_EXTERNAL_STORAGE_PATH), "/sdcard") == 0) {
-					if (zip_root != "/emmc")
-						DataManager::SetValue(TW_ZIP_INTERNAL_VAR, "/emmc");
-				} else {
-					if (zip_root != "/sdcard")
-						DataManager::SetValue(TW_ZIP_INTERNAL_VAR, "/sdcard");
-				}
-	#endif
+			}
+#endif
 #else
-				if (zip_root != DataManager::GetCurrentStoragePath())
-					DataManager::SetValue(TW_ZIP_LOCATION_VAR, DataManager::GetCurrentStoragePath());
+			if (zip_root != DataManager::GetCurrentStoragePath())
+				DataManager::SetValue(TW_ZIP_LOCATION_VAR, DataManager::GetCurrentStoragePath());
 #endif
-				// Save the current zip location to the external variable
-				DataManager::SetValue(TW_ZIP_EXTERNAL_VAR, DataManager::GetStrValue(TW_ZIP_LOCATION_VAR));
-				// Change the current zip location to the internal variable
-				DataManager::SetValue(TW_ZIP_LOCATION_VAR, DataManager::GetStrValue(TW_ZIP_INTERNAL_VAR));
-			} else if (arg == "external") {
-				string zip_path, zip_root;
-				DataManager::GetValue(TW_ZIP_EXTERNAL_VAR, zip_path);
-				zip_root = TWFunc::Get_Root_Path(zip_path);
-				if (zip_root != DataManager::GetCurrentStoragePath()) {
-					DataManager::SetValue(TW_ZIP_EXTERNAL_VAR, DataManager::GetCurrentStoragePath());
-				}
-				// Save the current zip location to the internal variable
-				DataManager::SetValue(TW_ZIP_INTERNAL_VAR, DataManager::GetStrValue(TW_ZIP_LOCATION_VAR));
-				// Change the current zip location to the external variable
-				DataManager::SetValue(TW_ZIP_LOCATION_VAR, DataManager::GetStrValue(TW_ZIP_EXTERNAL_VAR));
-			}
-		} else {
-			// We weren't able to toggle for some reason, restore original setting
-			if (arg == "internal") {
-				DataManager::SetValue(TW_USE_EXTERNAL_STORAGE, 1);
-			} else if (arg == "external") {
-				DataManager::SetValue(TW_USE_EXTERNAL_STORAGE, 0);
+			// Save the current zip location to the external variable
+			DataManager::SetValue(TW_ZIP_EXTERNAL_VAR, DataManager::GetStrValue(TW_ZIP_LOCATION_VAR));
+			// Change the current zip location to the internal variable
+			DataManager::SetValue(TW_ZIP_LOCATION_VAR, DataManager::GetStrValue(TW_ZIP_INTERNAL_VAR));
+		} else if (arg == "external") {
+			string zip_path, zip_root;
+			DataManager::GetValue(TW_ZIP_EXTERNAL_VAR, zip_path);
+			zip_root = TWFunc::Get_Root_Path(zip_path);
+			if (zip_root != DataManager::GetCurrentStoragePath()) {
+				DataManager::SetValue(TW_ZIP_EXTERNAL_VAR, DataManager::GetCurrentStoragePath());
 			}
+			// Save the current zip location to the internal variable
+			DataManager::SetValue(TW_ZIP_INTERNAL_VAR, DataManager::GetStrValue(TW_ZIP_LOCATION_VAR));
+			// Change the current zip location to the external variable
+			DataManager::SetValue(TW_ZIP_LOCATION_VAR, DataManager::GetStrValue(TW_ZIP_EXTERNAL_VAR));
 		}
-		return 0;
-	}
-	
-	if (function == "overlay")
-        return gui_changeOverlay(arg);
-
-	if (function == "queuezip")
-    {
-        if (zip_queue_index >= 10) {
-			gui_print("Maximum zip queue reached!\n");
-			return 0;
-		}
-		DataManager::GetValue("tw_filename", zip_queue[zip_queue_index]);
-		if (strlen(zip_queue[zip_queue_index].c_str()) > 0) {
-			zip_queue_index++;
-			DataManager::SetValue(TW_ZIP_QUEUE_COUNT, zip_queue_index);
+	} else {
+		// We weren't able to toggle for some reason, restore original setting
+		if (arg == "internal") {
+			DataManager::SetValue(TW_USE_EXTERNAL_STORAGE, 1);
+		} else if (arg == "external") {
+			DataManager::SetValue(TW_USE_EXTERNAL_STORAGE, 0);
 		}
-		return 0;
 	}
+	return 0;
+}
 
-	if (function == "cancelzip")
-    {
-        if (zip_queue_index <= 0) {
-			gui_print("Minimum zip queue reached!\n");
-			return 0;
-		} else {
-			zip_queue_index--;
-			DataManager::SetValue(TW_ZIP_QUEUE_COUNT, zip_queue_index);
-		}
+int GUIAction::overlay(std::string arg, const int simulate)
+{
+	return gui_changeOverlay(arg);
+}
+
+int GUIAction::queuezip(std::string arg, const int simulate)
+{
+    if (zip_queue_index >= 10) {
+		gui_print("Maximum zip queue reached!\n");
 		return 0;
 	}
-
-	if (function == "queueclear")
-	{
-		zip_queue_index = 0;
+	DataManager::GetValue("tw_filename", zip_queue[zip_queue_index]);
+	if (strlen(zip_queue[zip_queue_index].c_str()) > 0) {
+		zip_queue_index++;
 		DataManager::SetValue(TW_ZIP_QUEUE_COUNT, zip_queue_index);
-		return 0;
 	}
+	return 0;
+}
 
-	if (function == "sleep")
-	{
-		operation_start("Sleep");
-		usleep(atoi(arg.c_str()));
-		operation_end(0, simulate);
+int GUIAction::cancelzip(std::string arg, const int simulate)
+{
+    if (zip_queue_index <= 0) {
+		gui_print("Minimum zip queue reached!\n");
 		return 0;
+	} else {
+		zip_queue_index--;
+		DataManager::SetValue(TW_ZIP_QUEUE_COUNT, zip_queue_index);
 	}
+	return 0;
+}
 
-	if (function == "multirom")
-	{
-		if(MultiROM::folderExists())
-			return gui_changePage("multirom_main");
-		else
-		{
-			DataManager::SetValue("tw_mrom_title", "MultiROM is not installed!");
-			DataManager::SetValue("tw_mrom_text1", "/data/media/multirom not found.");
-			DataManager::SetValue("tw_mrom_text2", "/data/media/0/multirom not found.");
-			DataManager::SetValue("tw_mrom_back", "advanced");
-			return gui_changePage("multirom_msg");
-		}
-	}
+int GUIAction::queueclear(std::string arg, const int simulate)
+{
+	zip_queue_index = 0;
+	DataManager::SetValue(TW_ZIP_QUEUE_COUNT, zip_queue_index);
+	return 0;
+}
+
+int GUIAction::sleep(std::string arg, const int simulate)
+{
+	operation_start("Sleep");
+	usleep(atoi(arg.c_str()));
+	operation_end(0, simulate);
+	return 0;
+}
 
-	if (function == "multirom_list")
+int GUIAction::multirom(std::string arg, const int simulate)
+{
+	if(MultiROM::folderExists())
+		return gui_changePage("multirom_main");
+	else
 	{
-		MultiROM::setRomsPath(INTERNAL_MEM_LOC_TXT);
-		DataManager::SetValue("tw_multirom_folder", MultiROM::getRomsPath());
-		DataManager::SetValue("tw_multirom_install_loc", INTERNAL_MEM_LOC_TXT);
-		return gui_changePage("multirom_list");
+		DataManager::SetValue("tw_mrom_title", "MultiROM is not installed!");
+		DataManager::SetValue("tw_mrom_text1", "/data/media/multirom not found.");
+		DataManager::SetValue("tw_mrom_text2", "/data/media/0/multirom not found.");
+		DataManager::SetValue("tw_mrom_back", "advanced");
+		return gui_changePage("multirom_msg");
 	}
+	return 0;
+}
 
-	if (function == "multirom_rename")
-	{
-		MultiROM::move(DataManager::GetStrValue("tw_multirom_rom_name"), arg);
-		return gui_changePage("multirom_list");
-	}
+int GUIAction::multirom_list(std::string arg, const int simulate)
+{
+	MultiROM::setRomsPath(INTERNAL_MEM_LOC_TXT);
+	DataManager::SetValue("tw_multirom_folder", MultiROM::getRomsPath());
+	DataManager::SetValue("tw_multirom_install_loc", INTERNAL_MEM_LOC_TXT);
+	return gui_changePage("multirom_list");
+}
 
-	if (function == "multirom_manage")
-	{
-		int type = MultiROM::getType(DataManager::GetStrValue("tw_multirom_rom_name"));
-		DataManager::SetValue("tw_multirom_is_android", (M(type) & MASK_ANDROID) != 0);
-		return gui_changePage("multirom_manage");
-	}
+int GUIAction::multirom_rename(std::string arg, const int simulate)
+{
+	MultiROM::move(DataManager::GetStrValue("tw_multirom_rom_name"), arg);
+	return gui_changePage("multirom_list");
+}
 
-	if (function == "multirom_settings")
-	{
-		MultiROM::config cfg = MultiROM::loadConfig();
-		DataManager::SetValue("tw_multirom_enable_auto_boot", cfg.auto_boot_seconds > 0);
-		if(cfg.auto_boot_seconds <= 0)
-			DataManager::SetValue("tw_multirom_delay", 5);
-		else
-			DataManager::SetValue("tw_multirom_delay", cfg.auto_boot_seconds);
-		DataManager::SetValue("tw_multirom_current", cfg.current_rom);
-		DataManager::SetValue("tw_multirom_auto_boot_rom", cfg.auto_boot_rom);
-		DataManager::SetValue("tw_multirom_colors", cfg.colors);
-		DataManager::SetValue("tw_multirom_brightness", cfg.brightness);
-		DataManager::SetValue("tw_multirom_enable_adb", cfg.enable_adb);
-
-		DataManager::SetValue("tw_multirom_roms", MultiROM::listRoms());
-		return gui_changePage("multirom_settings");
-	}
+int GUIAction::multirom_manage(std::string arg, const int simulate)
+{
+	int type = MultiROM::getType(DataManager::GetStrValue("tw_multirom_rom_name"));
+	DataManager::SetValue("tw_multirom_is_android", (M(type) & MASK_ANDROID) != 0);
+	return gui_changePage("multirom_manage");
+}
 
-	if (function == "multirom_settings_save")
-	{
-		MultiROM::config cfg;
-		cfg.current_rom = DataManager::GetStrValue("tw_multirom_current");
-		if(DataManager::GetIntValue("tw_multirom_enable_auto_boot"))
-			cfg.auto_boot_seconds = DataManager::GetIntValue("tw_multirom_delay");
-		else
-			cfg.auto_boot_seconds = 0;
-		cfg.auto_boot_rom = DataManager::GetStrValue("tw_multirom_auto_boot_rom");
-		cfg.colors = DataManager::GetIntValue("tw_multirom_colors");
-		cfg.brightness = DataManager::GetIntValue("tw_multirom_brightness");
-		cfg.enable_adb = DataManager::GetIntValue("tw_multirom_enable_adb");
+int GUIAction::multirom_settings(std::string arg, const int simulate)
+{
+	MultiROM::config cfg = MultiROM::loadConfig();
+	DataManager::SetValue("tw_multirom_enable_auto_boot", cfg.auto_boot_seconds > 0);
+	if(cfg.auto_boot_seconds <= 0)
+		DataManager::SetValue("tw_multirom_delay", 5);
+	else
+		DataManager::SetValue("tw_multirom_delay", cfg.auto_boot_seconds);
+	DataManager::SetValue("tw_multirom_current", cfg.current_rom);
+	DataManager::SetValue("tw_multirom_auto_boot_rom", cfg.auto_boot_rom);
+	DataManager::SetValue("tw_multirom_colors", cfg.colors);
+	DataManager::SetValue("tw_multirom_brightness", cfg.brightness);
+	DataManager::SetValue("tw_multirom_enable_adb", cfg.enable_adb);
+
+	DataManager::SetValue("tw_multirom_roms", MultiROM::listRoms());
+	return gui_changePage("multirom_settings");
+}
 
-		MultiROM::saveConfig(cfg);
-		return gui_changePage("multirom_main");
-	}
+int GUIAction::multirom_settings_save(std::string arg, const int simulate)
+{
+	MultiROM::config cfg;
+	cfg.current_rom = DataManager::GetStrValue("tw_multirom_current");
+	if(DataManager::GetIntValue("tw_multirom_enable_auto_boot"))
+		cfg.auto_boot_seconds = DataManager::GetIntValue("tw_multirom_delay");
+	else
+		cfg.auto_boot_seconds = 0;
+	cfg.auto_boot_rom = DataManager::GetStrValue("tw_multirom_auto_boot_rom");
+	cfg.colors = DataManager::GetIntValue("tw_multirom_colors");
+	cfg.brightness = DataManager::GetIntValue("tw_multirom_brightness");
+	cfg.enable_adb = DataManager::GetIntValue("tw_multirom_enable_adb");
+
+	MultiROM::saveConfig(cfg);
+	return gui_changePage("multirom_main");
+}
 
-	if (function == "multirom_add")
-	{
-		DataManager::SetValue("tw_multirom_install_loc_list", MultiROM::listInstallLocations());
-		DataManager::SetValue("tw_multirom_install_loc", INTERNAL_MEM_LOC_TXT);
-		return gui_changePage("multirom_add");
-	}
+int GUIAction::multirom_add(std::string arg, const int simulate)
+{
+	DataManager::SetValue("tw_multirom_install_loc_list", MultiROM::listInstallLocations());
+	DataManager::SetValue("tw_multirom_install_loc", INTERNAL_MEM_LOC_TXT);
+	return gui_changePage("multirom_add");
+}
 
-	if (function == "multirom_add_second")
-	{
-		if(DataManager::GetIntValue("tw_multirom_type") == 1)
-			return gui_changePage("multirom_add_source");
-		else
-			return gui_changePage("multirom_add_select");
-	}
+int GUIAction::multirom_add_second(std::string arg, const int simulate)
+{
+	if(DataManager::GetIntValue("tw_multirom_type") == 1)
+		return gui_changePage("multirom_add_source");
+	else
+		return gui_changePage("multirom_add_select");
+}
 
-	if (function == "multirom_add_file_selected")
-	{
-		std::string loc = DataManager::GetStrValue("tw_multirom_install_loc");
-		bool images = loc.compare(INTERNAL_MEM_LOC_TXT) != 0 && loc.find("(ext") == std::string::npos;
-		int type = DataManager::GetIntValue("tw_multirom_type");
+int GUIAction::multirom_add_file_selected(std::string arg, const int simulate)
+{
+	std::string loc = DataManager::GetStrValue("tw_multirom_install_loc");
+	bool images = loc.compare(INTERNAL_MEM_LOC_TXT) != 0 && loc.find("(ext") == std::string::npos;
+	int type = DataManager::GetIntValue("tw_multirom_type");
 
-		MultiROM::clearBaseFolders();
+	MultiROM::clearBaseFolders();
 
-		if(type == 1 || type == 2)
+	if(type == 1 || type == 2)
+	{
+		if(type == 1)
 		{
-			if(type == 1)
-			{
-				MultiROM::addBaseFolder("data", 150, 1024);
-				MultiROM::addBaseFolder("system", 450, 640);
-				MultiROM::addBaseFolder("cache", 50, 436);
-			}
-			else
-				MultiROM::addBaseFolder("root", 2000, 4095);
+			MultiROM::addBaseFolder("data", 150, 1024);
+			MultiROM::addBaseFolder("system", 450, 640);
+			MultiROM::addBaseFolder("cache", 50, 436);
+		}
+		else
+			MultiROM::addBaseFolder("root", 2000, 4095);
 
-			MultiROM::updateImageVariables();
+		MultiROM::updateImageVariables();
 
-			if(images)
-				return gui_changePage("multirom_add_image_size");
-			else
-				return gui_changePage("multirom_add_start_process");
-		}
-		else if(type == 3)
-		{
-			DataManager::SetValue("tw_mrom_back", "multirom_add");
-			DataManager::SetValue("tw_mrom_text2", "");
-
-			std:string ex;
-			MROMInstaller *i = new MROMInstaller();
-
-			DataManager::SetValue("tw_mrom_title", "Bad installer");
-			if(!(ex = i->open(DataManager::GetStrValue("tw_filename"))).empty())
-				return i->destroyWithErrorMsg(ex);
-
-			DataManager::SetValue("tw_mrom_title", "Unsupported device");
-			if(!(ex = i->checkDevices()).empty())
-				return i->destroyWithErrorMsg(ex);
-
-			DataManager::SetValue("tw_mrom_title", "Old MultiROM");
-			if(!(ex = i->checkVersion()).empty())
-				return i->destroyWithErrorMsg(ex);
-
-			DataManager::SetValue("tw_mrom_title", "Unsupported install location");
-			if(!(ex = i->setInstallLoc(loc, images)).empty())
-				return i->destroyWithErrorMsg(ex);
-			
-			if(!(ex = i->parseBaseFolders(loc.find("ntfs") != std::string::npos)).empty())
-				return i->destroyWithErrorMsg(ex);
-
-			MultiROM::updateImageVariables();
-			MultiROM::setInstaller(i);
-
-			if(images)
-				return gui_changePage("multirom_add_image_size");
-			else
-				return gui_changePage("multirom_add_start_process");
-		}
+		if(images)
+			return gui_changePage("multirom_add_image_size");
+		else
+			return gui_changePage("multirom_add_start_process");
 	}
-
-	if (function == "multirom_change_img_size")
+	else if(type == 3)
 	{
-		DataManager::SetValue("tw_multirom_image_too_small", 0);
-		DataManager::SetValue("tw_multirom_image_too_big", 0);
-		DataManager::SetValue("tw_multirom_image_name", arg);
+		DataManager::SetValue("tw_mrom_back", "multirom_add");
+		DataManager::SetValue("tw_mrom_text2", "");
 
-		base_folder *b = MultiROM::getBaseFolder(arg);
-		if(b != NULL)
-			DataManager::SetValue("tw_multirom_image_size", b->size);
+		std:string ex;
+		MROMInstaller *i = new MROMInstaller();
 
-		return gui_changePage("multirom_change_img_size");
-	}
+		DataManager::SetValue("tw_mrom_title", "Bad installer");
+		if(!(ex = i->open(DataManager::GetStrValue("tw_filename"))).empty())
+			return i->destroyWithErrorMsg(ex);
 
-	if (function == "multirom_change_img_size_act")
-	{
-		int value = DataManager::GetIntValue("tw_multirom_image_size");
+		DataManager::SetValue("tw_mrom_title", "Unsupported device");
+		if(!(ex = i->checkDevices()).empty())
+			return i->destroyWithErrorMsg(ex);
+
+		DataManager::SetValue("tw_mrom_title", "Old MultiROM");
+		if(!(ex = i->checkVersion()).empty())
+			return i->destroyWithErrorMsg(ex);
+
+		DataManager::SetValue("tw_mrom_title", "Unsupported install location");
+		if(!(ex = i->setInstallLoc(loc, images)).empty())
+			return i->destroyWithErrorMsg(ex);
+
+		if(!(ex = i->parseBaseFolders(loc.find("ntfs") != std::string::npos)).empty())
+			return i->destroyWithErrorMsg(ex);
 
-		base_folder *b = MultiROM::getBaseFolder(DataManager::GetStrValue("tw_multirom_image_name"));
-		if(!b)
+		MultiROM::updateImageVariables();
+		MultiROM::setInstaller(i);
+
+		if(images)
 			return gui_changePage("multirom_add_image_size");
+		else
+			return gui_changePage("multirom_add_start_process");
+	}
+	return 0;
+}
+
+int GUIAction::multirom_change_img_size(std::string arg, const int simulate)
+{
+	DataManager::SetValue("tw_multirom_image_too_small", 0);
+	DataManager::SetValue("tw_multirom_image_too_big", 0);
+	DataManager::SetValue("tw_multirom_image_name", arg);
 
-		DataManager::SetValue("tw_multirom_image_too_small", 0);
-		DataManager::SetValue("tw_multirom_image_too_big", 0);
+	base_folder *b = MultiROM::getBaseFolder(arg);
+	if(b != NULL)
+		DataManager::SetValue("tw_multirom_image_size", b->size);
 
-		if(value < b->min_size)
-		{
-			DataManager::SetValue("tw_multirom_image_too_small", 1);
-			DataManager::SetValue("tw_multirom_min_size", b->min_size);
-			return gui_changePage("multirom_change_img_size");
-		}
+	return gui_changePage("multirom_change_img_size");
+}
 
-		if(value > 4095 &&
-			DataManager::GetStrValue("tw_multirom_install_loc").find("(vfat") != std::string::npos)
-		{
-			DataManager::SetValue("tw_multirom_image_too_big", 1);
-			return gui_changePage("multirom_change_img_size");
-		}
+int GUIAction::multirom_change_img_size_act(std::string arg, const int simulate)
+{
+	int value = DataManager::GetIntValue("tw_multirom_image_size");
 
-		b->size = value;
-		MultiROM::updateImageVariables();
+	base_folder *b = MultiROM::getBaseFolder(DataManager::GetStrValue("tw_multirom_image_name"));
+	if(!b)
 		return gui_changePage("multirom_add_image_size");
-	}
 
-	if (function == "multirom_set_list_loc")
+	DataManager::SetValue("tw_multirom_image_too_small", 0);
+	DataManager::SetValue("tw_multirom_image_too_big", 0);
+
+	if(value < b->min_size)
 	{
-		DataManager::SetValue("tw_multirom_install_loc_list", MultiROM::listInstallLocations());
-		return gui_changePage("multirom_set_list_loc");
+		DataManager::SetValue("tw_multirom_image_too_small", 1);
+		DataManager::SetValue("tw_multirom_min_size", b->min_size);
+		return gui_changePage("multirom_change_img_size");
 	}
 
-	if (function == "multirom_list_loc_selected")
+	if(value > 4095 &&
+		DataManager::GetStrValue("tw_multirom_install_loc").find("(vfat") != std::string::npos)
 	{
-		std::string loc = DataManager::GetStrValue("tw_multirom_install_loc");
-		MultiROM::setRomsPath(loc);
-		DataManager::SetValue("tw_multirom_folder", MultiROM::getRomsPath());
-		return gui_changePage("multirom_list");
+		DataManager::SetValue("tw_multirom_image_too_big", 1);
+		return gui_changePage("multirom_change_img_size");
 	}
 
-    if (isThreaded)
-    {
-		if (function == "timeout")
-		{
-			blankTimer.blankScreen();
-			return 0;
-		}
-	
-		if (function == "multirom_delete")
-		{
-			int op_status = 0;
-			operation_start("Delete ROM");
-			if(!MultiROM::erase(DataManager::GetStrValue("tw_multirom_rom_name")))
-				op_status = 1;
-			PartitionManager.Update_System_Details();
-			operation_end(op_status, simulate);
-			return 0;
-		}
+	b->size = value;
+	MultiROM::updateImageVariables();
+	return gui_changePage("multirom_add_image_size");
+}
 
-		if (function == "multirom_flash_zip")
-		{
-			operation_start("Flashing");
-			int op_status = 0;
+int GUIAction::multirom_set_list_loc(std::string arg, const int simulate)
+{
+	DataManager::SetValue("tw_multirom_install_loc_list", MultiROM::listInstallLocations());
+	return gui_changePage("multirom_set_list_loc");
+}
 
-			if(!MultiROM::flashZip(DataManager::GetStrValue("tw_multirom_rom_name"),
-									DataManager::GetStrValue("tw_filename")))
-			{
-				op_status = 1;
-			}
+int GUIAction::multirom_list_loc_selected(std::string arg, const int simulate)
+{
+	std::string loc = DataManager::GetStrValue("tw_multirom_install_loc");
+	MultiROM::setRomsPath(loc);
+	DataManager::SetValue("tw_multirom_folder", MultiROM::getRomsPath());
+	return gui_changePage("multirom_list");
+}
 
-			PartitionManager.Update_System_Details();
-			operation_end(op_status, simulate);
-		}
+int GUIAction::timeout(std::string arg, const int simulate)
+{
+	blankTimer.blankScreen();
+	return 0;
+}
 
-		if (function == "multirom_inject")
-		{
-			operation_start("Injecting");
-			int op_status = 0;
-			std::string path = DataManager::GetStrValue("tw_filename");
-			if(DataManager::GetIntValue("tw_multirom_add_bootimg"))
-				op_status = MultiROM::copyBoot(path, DataManager::GetStrValue("tw_multirom_rom_name"));
-
-			if(!op_status)
-				op_status = !MultiROM::injectBoot(path);
-			operation_end(op_status, simulate);
-		}
+int GUIAction::multirom_delete(std::string arg, const int simulate)
+{
+	int op_status = 0;
+	operation_start("Delete ROM");
+	if(!MultiROM::erase(DataManager::GetStrValue("tw_multirom_rom_name")))
+		op_status = 1;
+	PartitionManager.Update_System_Details();
+	operation_end(op_status, simulate);
+	return 0;
+}
 
-		if (function == "multirom_inject_curr_boot")
-		{
-			operation_start("Injecting");
-			int op_status = !MultiROM::folderExists();
-			if(op_status)
-				gui_print("MultiROM is not installed!\n");
-			else
-				op_status = !MultiROM::injectBoot("/dev/block/mmcblk0p2");
-			operation_end(op_status, simulate);
-		}
+int GUIAction::multirom_flash_zip(std::string arg, const int simulate)
+{
+	operation_start("Flashing");
+	int op_status = 0;
 
-		if (function == "multirom_add_rom")
-		{
-			operation_start("Installing");
+	if(!MultiROM::flashZip(DataManager::GetStrValue("tw_multirom_rom_name"),
+							DataManager::GetStrValue("tw_filename")))
+	{
+		op_status = 1;
+	}
 
-			int op_status = !MultiROM::addROM(DataManager::GetStrValue("tw_filename"),
-											  DataManager::GetIntValue("tw_multirom_type"),
-											  DataManager::GetStrValue("tw_multirom_install_loc"));
-			PartitionManager.Update_System_Details();
-			operation_end(op_status, simulate);
-		}
+	PartitionManager.Update_System_Details();
+	operation_end(op_status, simulate);
+	return 0;
+}
 
-		if (function == "multirom_ubuntu_patch_init")
-		{
-			operation_start("Patching");
-			int op_status = !MultiROM::patchInit(DataManager::GetStrValue("tw_multirom_rom_name"));
-			operation_end(op_status, simulate);
-		}
+int GUIAction::multirom_inject(std::string arg, const int simulate)
+{
+	operation_start("Injecting");
+	int op_status = 0;
+	std::string path = DataManager::GetStrValue("tw_filename");
+	if(DataManager::GetIntValue("tw_multirom_add_bootimg"))
+		op_status = MultiROM::copyBoot(path, DataManager::GetStrValue("tw_multirom_rom_name"));
+
+	if(!op_status)
+		op_status = !MultiROM::injectBoot(path);
+	operation_end(op_status, simulate);
+	return 0;
+}
 
-		if (function == "multirom_wipe")
-		{
-			operation_start("Wiping");
-			int op_status = !MultiROM::wipe(DataManager::GetStrValue("tw_multirom_rom_name"),
-											DataManager::GetStrValue("tw_multirom_wipe"));
-			operation_end(op_status, simulate);
-		}
+int GUIAction::multirom_inject_curr_boot(std::string arg, const int simulate)
+{
+	operation_start("Injecting");
+	int op_status = !MultiROM::folderExists();
+	if(op_status)
+		gui_print("MultiROM is not installed!\n");
+	else
+		op_status = !MultiROM::injectBoot("/dev/block/mmcblk0p2");
+	operation_end(op_status, simulate);
+	return 0;
+}
 
-		if (function == "multirom_disable_flash_kernel")
-		{
-			operation_start("working");
-			int op_status = !MultiROM::disableFlashKernelAct(DataManager::GetStrValue("tw_multirom_rom_name"),
-															 DataManager::GetStrValue("tw_multirom_install_loc"));
-			operation_end(op_status, simulate);
-		}
+int GUIAction::multirom_add_rom(std::string arg, const int simulate)
+{
+	operation_start("Installing");
 
-        if (function == "fileexists")
-		{
-			struct stat st;
-			string newpath = arg + "/.";
+	int op_status = !MultiROM::addROM(DataManager::GetStrValue("tw_filename"),
+									  DataManager::GetIntValue("tw_multirom_type"),
+									  DataManager::GetStrValue("tw_multirom_install_loc"));
+	PartitionManager.Update_System_Details();
+	operation_end(op_status, simulate);
+	return 0;
+}
 
-			operation_start("FileExists");
-			if (stat(arg.c_str(), &st) == 0 || stat(newpath.c_str(), &st) == 0)
-				operation_end(0, simulate);
-			else
-				operation_end(1, simulate);
-		}
+int GUIAction::multirom_ubuntu_patch_init(std::string arg, const int simulate)
+{
+	operation_start("Patching");
+	int op_status = !MultiROM::patchInit(DataManager::GetStrValue("tw_multirom_rom_name"));
+	operation_end(op_status, simulate);
+	return 0;
+}
 
-		if (function == "flash")
-        {
-			int i, ret_val = 0, wipe_cache = 0;
-
-			for (i=0; i<zip_queue_index; i++) {
-				operation_start("Flashing");
-		        DataManager::SetValue("tw_filename", zip_queue[i]);
-		        DataManager::SetValue(TW_ZIP_INDEX, (i + 1));
-
-				ret_val = flash_zip(zip_queue[i], arg, simulate, &wipe_cache);
-				if (ret_val != 0) {
-					gui_print("Error flashing zip '%s'\n", zip_queue[i].c_str());
-					i = 10; // Error flashing zip - exit queue
-					ret_val = 1;
-				}
-			}
-			zip_queue_index = 0;
-			DataManager::SetValue(TW_ZIP_QUEUE_COUNT, zip_queue_index);
+int GUIAction::multirom_wipe(std::string arg, const int simulate)
+{
+	operation_start("Wiping");
+	int op_status = !MultiROM::wipe(DataManager::GetStrValue("tw_multirom_rom_name"),
+									DataManager::GetStrValue("tw_multirom_wipe"));
+	operation_end(op_status, simulate);
+	return 0;
+}
 
-			if (wipe_cache)
-				PartitionManager.Wipe_By_Path("/cache");
-			string result;
-			if (DataManager::GetIntValue(TW_HAS_INJECTTWRP) == 1 && DataManager::GetIntValue(TW_INJECT_AFTER_ZIP) == 1) {
-				operation_start("ReinjectTWRP");
-				gui_print("Injecting TWRP into boot image...\n");
-				if (simulate) {
-					simulate_progress_bar();
-				} else {
-					TWPartition* Boot = PartitionManager.Find_Partition_By_Path("/boot");
-					if (Boot == NULL || Boot->Current_File_System != "emmc")
-						TWFunc::Exec_Cmd("injecttwrp --dump /tmp/backup_recovery_ramdisk.img /tmp/injected_boot.img --flash", result);
-					else {
-						string injectcmd = "injecttwrp --dump /tmp/backup_recovery_ramdisk.img /tmp/injected_boot.img --flash bd=" + Boot->Actual_Block_Device;
-						TWFunc::Exec_Cmd(injectcmd, result);
-					}
-					gui_print("TWRP injection complete.\n");
-				}
+int GUIAction::multirom_disable_flash_kernel(std::string arg, const int simulate)
+{
+	operation_start("working");
+	int op_status = !MultiROM::disableFlashKernelAct(DataManager::GetStrValue("tw_multirom_rom_name"),
+													 DataManager::GetStrValue("tw_multirom_install_loc"));
+	operation_end(op_status, simulate);
+	return 0;
+}
+
+int GUIAction::fileexists(std::string arg, const int simulate)
+{
+	struct stat st;
+	string newpath = arg + "/.";
+
+	operation_start("FileExists");
+	if (stat(arg.c_str(), &st) == 0 || stat(newpath.c_str(), &st) == 0)
+		operation_end(0, simulate);
+	else
+		operation_end(1, simulate);
+	return 0;
+}
+
+int GUIAction::flash(std::string arg, const int simulate)
+{
+	int i, ret_val = 0, wipe_cache = 0;
+
+	for (i=0; i<zip_queue_index; i++) {
+		operation_start("Flashing");
+        DataManager::SetValue("tw_filename", zip_queue[i]);
+        DataManager::SetValue(TW_ZIP_INDEX, (i + 1));
+
+		ret_val = flash_zip(zip_queue[i], arg, simulate, &wipe_cache);
+		if (ret_val != 0) {
+			gui_print("Error flashing zip '%s'\n", zip_queue[i].c_str());
+			i = 10; // Error flashing zip - exit queue
+			ret_val = 1;
+		} else if (i + 1 < zip_queue_index && jobScheduler.isCancelled()) {
+			gui_print("Zip queue cancelled.\n");
+			i = 10;
+			ret_val = 1;
+		}
+	}
+	zip_queue_index = 0;
+	DataManager::SetValue(TW_ZIP_QUEUE_COUNT, zip_queue_index);
+
+	if (wipe_cache)
+		PartitionManager.Wipe_By_Path("/cache");
+	string result;
+	if (DataManager::GetIntValue(TW_HAS_INJECTTWRP) == 1 && DataManager::GetIntValue(TW_INJECT_AFTER_ZIP) == 1) {
+		operation_start("ReinjectTWRP");
+		gui_print("Injecting TWRP into boot image...\n");
+		if (simulate) {
+			simulate_progress_bar();
+		} else {
+			TWPartition* Boot = PartitionManager.Find_Partition_By_Path("/boot");
+			if (Boot == NULL || Boot->Current_File_System != "emmc")
+				TWFunc::Exec_Cmd("injecttwrp --dump /tmp/backup_recovery_ramdisk.img /tmp/injected_boot.img --flash", result);
+			else {
+				string injectcmd = "injecttwrp --dump /tmp/backup_recovery_ramdisk.img /tmp/injected_boot.img --flash bd=" + Boot->Actual_Block_Device;
+				TWFunc::Exec_Cmd(injectcmd, result);
 			}
-			PartitionManager.Update_System_Details();
-			operation_end(ret_val, simulate);
-            return 0;
-        }
-        if (function == "wipe")
-        {
-            operation_start("Format");
-            DataManager::SetValue("tw_partition", arg);
+			gui_print("TWRP injection complete.\n");
+		}
+	}
+	PartitionManager.Update_System_Details();
+	operation_end(ret_val, simulate);
+    return 0;
+}
 
-			int ret_val = false;
+int GUIAction::wipe(std::string arg, const int simulate)
+{
+    operation_start("Format");
+    DataManager::SetValue("tw_partition", arg);
 
-			if (simulate) {
-				simulate_progress_bar();
+	int ret_val = false;
+
+	if (simulate) {
+		simulate_progress_bar();
+	} else {
+		if (arg == "data")
+			ret_val = PartitionManager.Factory_Reset();
+		else if (arg == "battery")
+			ret_val = PartitionManager.Wipe_Battery_Stats();
+		else if (arg == "rotate")
+			ret_val = PartitionManager.Wipe_Rotate_Data();
+		else if (arg == "dalvik")
+			ret_val = PartitionManager.Wipe_Dalvik_Cache();
+		else if (arg == "DATAMEDIA") {
+			ret_val = PartitionManager.Format_Data();
+		} else if (arg == "INTERNAL") {
+			int has_datamedia, dual_storage;
+
+			DataManager::GetValue(TW_HAS_DATA_MEDIA, has_datamedia);
+			if (has_datamedia) {
+				ret_val = PartitionManager.Wipe_Media_From_Data();
 			} else {
-				if (arg == "data")
-					ret_val = PartitionManager.Factory_Reset();
-				else if (arg == "battery")
-					ret_val = PartitionManager.Wipe_Battery_Stats();
-				else if (arg == "rotate")
-					ret_val = PartitionManager.Wipe_Rotate_Data();
-				else if (arg == "dalvik")
-					ret_val = PartitionManager.Wipe_Dalvik_Cache();
-				else if (arg == "DATAMEDIA") {
-					ret_val = PartitionManager.Format_Data();
-				} else if (arg == "INTERNAL") {
-					int has_datamedia, dual_storage;
-
-					DataManager::GetValue(TW_HAS_DATA_MEDIA, has_datamedia);
-					if (has_datamedia) {
-						ret_val = PartitionManager.Wipe_Media_From_Data();
-					} else {
-						ret_val = PartitionManager.Wipe_By_Path(DataManager::GetSettingsStoragePath());
-					}
-				} else if (arg == "EXTERNAL") {
-					string External_Path;
-
-					DataManager::GetValue(TW_EXTERNAL_PATH, External_Path);
-					ret_val = PartitionManager.Wipe_By_Path(External_Path);
-				} else if (arg == "ANDROIDSECURE") {
-					ret_val = PartitionManager.Wipe_Android_Secure();
-				} else if (arg == "LIST") {
-					string Wipe_List, wipe_path;
-					bool skip = false;
-					ret_val = true;
-					TWPartition* wipe_part = NULL;
-
-					DataManager::GetValue("tw_wipe_list", Wipe_List);
-					LOGINFO("wipe list '%s'\n", Wipe_List.c_str());
-					if (!Wipe_List.empty()) {
-						size_t start_pos = 0, end_pos = Wipe_List.find(";", start_pos);
-						while (end_pos != string::npos && start_pos < Wipe_List.size()) {
-							wipe_path = Wipe_List.substr(start_pos, end_pos - start_pos);
-							LOGINFO("wipe_path '%s'\n", wipe_path.c_str());
-							if (wipe_path == "/and-sec") {
-								if (!PartitionManager.Wipe_Android_Secure()) {
-									LOGERR("Unable to wipe android secure\n");
-									ret_val = false;
-									break;
-								} else {
-									skip = true;
-								}
-							} else if (wipe_path == "DALVIK") {
-								if (!PartitionManager.Wipe_Dalvik_Cache()) {
-									LOGERR("Failed to wipe dalvik\n");
-									ret_val = false;
-									break;
-								} else {
-									skip = true;
-								}
-							}
-							if (!skip) {
-								if (!PartitionManager.Wipe_By_Path(wipe_path)) {
-									LOGERR("Unable to wipe '%s'\n", wipe_path.c_str());
-									ret_val = false;
-									break;
-								} else if (wipe_path == DataManager::GetSettingsStoragePath()) {
-									arg = wipe_path;
-								}
-							} else {
-								skip = false;
-							}
-							start_pos = end_pos + 1;
-							end_pos = Wipe_List.find(";", start_pos);
+				ret_val = PartitionManager.Wipe_By_Path(DataManager::GetSettingsStoragePath());
+			}
+		} else if (arg == "EXTERNAL") {
+			string External_Path;
+
+			DataManager::GetValue(TW_EXTERNAL_PATH, External_Path);
+			ret_val = PartitionManager.Wipe_By_Path(External_Path);
+		} else if (arg == "ANDROIDSECURE") {
+			ret_val = PartitionManager.Wipe_Android_Secure();
+		} else if (arg == "LIST") {
+			string Wipe_List, wipe_path;
+			bool skip = false;
+			ret_val = true;
+			TWPartition* wipe_part = NULL;
+
+			DataManager::GetValue("tw_wipe_list", Wipe_List);
+			LOGINFO("wipe list '%s'\n", Wipe_List.c_str());
+			if (!Wipe_List.empty()) {
+				size_t start_pos = 0, end_pos = Wipe_List.find(";", start_pos);
+				while (end_pos != string::npos && start_pos < Wipe_List.size()) {
+					wipe_path = Wipe_List.substr(start_pos, end_pos - start_pos);
+					LOGINFO("wipe_path '%s'\n", wipe_path.c_str());
+					if (wipe_path == "/and-sec") {
+						if (!PartitionManager.Wipe_Android_Secure()) {
+							LOGERR("Unable to wipe android secure\n");
+							ret_val = false;
+							break;
+						} else {
+							skip = true;
+						}
+					} else if (wipe_path == "DALVIK") {
+						if (!PartitionManager.Wipe_Dalvik_Cache()) {
+							LOGERR("Failed to wipe dalvik\n");
+							ret_val = false;
+							break;
+						} else {
+							skip = true;
 						}
 					}
-				} else
-					ret_val = PartitionManager.Wipe_By_Path(arg);
-
-				if (arg == DataManager::GetSettingsStoragePath()) {
-					// If we wiped the settings storage path, recreate the TWRP folder and dump the settings
-					string Storage_Path = DataManager::GetSettingsStoragePath();
-
-					if (PartitionManager.Mount_By_Path(Storage_Path, true)) {
-						LOGINFO("Making TWRP folder and saving settings.\n");
-						Storage_Path += "/TWRP";
-						mkdir(Storage_Path.c_str(), 0777);
-						DataManager::Flush();
+					if (!skip) {
+						if (!PartitionManager.Wipe_By_Path(wipe_path)) {
+							LOGERR("Unable to wipe '%s'\n", wipe_path.c_str());
+							ret_val = false;
+							break;
+						} else if (wipe_path == DataManager::GetSettingsStoragePath()) {
+							arg = wipe_path;
+						}
 					} else {
-						LOGERR("Unable to recreate TWRP folder and save settings.\n");
+						skip = false;
 					}
+					start_pos = end_pos + 1;
+					end_pos = Wipe_List.find(";", start_pos);
 				}
 			}
-			PartitionManager.Update_System_Details();
-			if (ret_val)
-				ret_val = 0; // 0 is success
-			else
-				ret_val = 1; // 1 is failure
-            operation_end(ret_val, simulate);
-            return 0;
-        }
-		if (function == "refreshsizes")
-		{
-			operation_start("Refreshing Sizes");
-			if (simulate) {
-				simulate_progress_bar();
-			} else
-				PartitionManager.Update_System_Details();
-			operation_end(0, simulate);
-		}
-        if (function == "nandroid")
-        {
-            operation_start("Nandroid");
-			int ret = 0;
+		} else
+			ret_val = PartitionManager.Wipe_By_Path(arg);
 
-			if (simulate) {
-				DataManager::SetValue("tw_partition", "Simulation");
-				simulate_progress_bar();
-			} else {
-				if (arg == "backup") {
-					string Backup_Name;
-					DataManager::GetValue(TW_BACKUP_NAME, Backup_Name);
-					if (Backup_Name == "(Current Date)" || Backup_Name == "0" || Backup_Name == "(" || PartitionManager.Check_Backup_Name(true) == 0) {
-						ret = PartitionManager.Run_Backup();
-					}
-					else {
-						operation_end(1, simulate);
-						return -1;
-					}
-					DataManager::SetValue(TW_BACKUP_NAME, "(Current Date)");
-				} else if (arg == "restore") {
-					string Restore_Name;
-					DataManager::GetValue("tw_restore", Restore_Name);
-					ret = PartitionManager.Run_Restore(Restore_Name);
-				} else {
-					operation_end(1, simulate);
-					return -1;
-				}
-			}
-			if (ret == false)
-				ret = 1; // 1 for failure
-			else
-				ret = 0; // 0 for success
-            	operation_end(ret, simulate);
-		return 0;
-        }
-		if (function == "fixpermissions")
-		{
-			operation_start("Fix Permissions");
-            LOGINFO("fix permissions started!\n");
-			if (simulate) {
-				simulate_progress_bar();
+		if (arg == DataManager::GetSettingsStoragePath()) {
+			// If we wiped the settings storage path, recreate the TWRP folder and dump the settings
+			string Storage_Path = DataManager::GetSettingsStoragePath();
+
+			if (PartitionManager.Mount_By_Path(Storage_Path, true)) {
+				LOGINFO("Making TWRP folder and saving settings.\n");
+				Storage_Path += "/TWRP";
+				mkdir(Storage_Path.c_str(), 0777);
+				DataManager::Flush();
 			} else {
-				int op_status = PartitionManager.Fix_Permissions();
-				if (op_status != 0)
-					op_status = 1; // failure
-				operation_end(op_status, simulate);
+				LOGERR("Unable to recreate TWRP folder and save settings.\n");
 			}
-			return 0;
 		}
-        if (function == "dd")
-        {
-            operation_start("imaging");
+	}
+	PartitionManager.Update_System_Details();
+	if (ret_val)
+		ret_val = 0; // 0 is success
+	else
+		ret_val = 1; // 1 is failure
+    operation_end(ret_val, simulate);
+    return 0;
+}
 
-			if (simulate) {
-				simulate_progress_bar();
-			} else {
-				string result;
-				string cmd = "dd " + arg;
-				TWFunc::Exec_Cmd(cmd, result);
-			}
-            operation_end(0, simulate);
-            return 0;
-        }
-		if (function == "partitionsd")
-		{
-			operation_start("Partition SD Card");
-			int ret_val = 0;
+int GUIAction::refreshsizes(std::string arg, const int simulate)
+{
+	operation_start("Refreshing Sizes");
+	if (simulate) {
+		simulate_progress_bar();
+	} else
+		PartitionManager.Update_System_Details();
+	operation_end(0, simulate);
+	return 0;
+}
 
-			if (simulate) {
-				simulate_progress_bar();
-			} else {
-				int allow_partition;
-				DataManager::GetValue(TW_ALLOW_PARTITION_SDCARD, allow_partition);
-				if (allow_partition == 0) {
-					gui_print("This device does not have a real SD Card!\nAborting!\n");
-				} else {
-					if (!PartitionManager.Partition_SDCard())
-						ret_val = 1; // failed
-				}
+int GUIAction::nandroid(std::string arg, const int simulate)
+{
+    operation_start("Nandroid");
+	int ret = 0;
+
+	if (simulate) {
+		DataManager::SetValue("tw_partition", "Simulation");
+		simulate_progress_bar();
+	} else {
+		if (arg == "backup") {
+			string Backup_Name;
+			DataManager::GetValue(TW_BACKUP_NAME, Backup_Name);
+			if (Backup_Name == "(Current Date)" || Backup_Name == "0" || Backup_Name == "(" || PartitionManager.Check_Backup_Name(true) == 0) {
+				ret = PartitionManager.Run_Backup();
 			}
-			operation_end(ret_val, simulate);
-			return 0;
+			else {
+				operation_end(1, simulate);
+				return -1;
+			}
+			DataManager::SetValue(TW_BACKUP_NAME, "(Current Date)");
+		} else if (arg == "restore") {
+			string Restore_Name;
+			DataManager::GetValue("tw_restore", Restore_Name);
+			ret = PartitionManager.Run_Restore(Restore_Name);
+		} else if (arg == "restorepath") {
+			// Restore the file or folder picked in tw_restore_path from the backup in tw_restore
+			string Restore_Name;
+			vector<string> Paths;
+			DataManager::GetValue("tw_restore", Restore_Name);
+			Paths.push_back(DataManager::GetStrValue("tw_restore_path"));
+			ret = PartitionManager.Run_Restore_Paths(Restore_Name, Paths);
+		} else {
+			operation_end(1, simulate);
+			return -1;
 		}
-		if (function == "installhtcdumlock")
-		{
-			operation_start("Install HTC Dumlock");
-			if (simulate) {
-				simulate_progress_bar();
-			} else
-				TWFunc::install_htc_dumlock();
+	}
+	if (ret == false)
+		ret = 1; // 1 for failure
+	else
+		ret = 0; // 0 for success
+    	operation_end(ret, simulate);
+return 0;
+}
 
-			operation_end(0, simulate);
-			return 0;
-		}
-		if (function == "htcdumlockrestoreboot")
-		{
-			operation_start("HTC Dumlock Restore Boot");
-			if (simulate) {
-				simulate_progress_bar();
-			} else
-				TWFunc::htc_dumlock_restore_original_boot();
+int GUIAction::fixpermissions(std::string arg, const int simulate)
+{
+	operation_start("Fix Permissions");
+    LOGINFO("fix permissions started!\n");
+	if (simulate) {
+		simulate_progress_bar();
+	} else {
+		int op_status = PartitionManager.Fix_Permissions();
+		if (op_status != 0)
+			op_status = 1; // failure
+		operation_end(op_status, simulate);
+	}
+	return 0;
+}
 
-			operation_end(0, simulate);
-			return 0;
-		}
-		if (function == "htcdumlockreflashrecovery")
-		{
-			operation_start("HTC Dumlock Reflash Recovery");
-			if (simulate) {
-				simulate_progress_bar();
-			} else
-				TWFunc::htc_dumlock_reflash_recovery_to_boot();
+int GUIAction::dd(std::string arg, const int simulate)
+{
+    operation_start("imaging");
 
-			operation_end(0, simulate);
-			return 0;
-		}
-		if (function == "cmd")
-		{
-			int op_status = 0;
-			string result;
+	if (simulate) {
+		simulate_progress_bar();
+	} else {
+		string result;
+		string cmd = "dd " + arg;
+		TWFunc::Exec_Cmd(cmd, result);
+	}
+    operation_end(0, simulate);
+    return 0;
+}
 
-			operation_start("Command");
-			LOGINFO("Running command: '%s'\n", arg.c_str());
-			if (simulate) {
-				simulate_progress_bar();
-			} else {
-				op_status = TWFunc::Exec_Cmd(arg, result);
-				if (op_status != 0)
-					op_status = 1;
-			}
+int GUIAction::partitionsd(std::string arg, const int simulate)
+{
+	operation_start("Partition SD Card");
+	int ret_val = 0;
 
-			operation_end(op_status, simulate);
-			return 0;
+	if (simulate) {
+		simulate_progress_bar();
+	} else {
+		int allow_partition;
+		DataManager::GetValue(TW_ALLOW_PARTITION_SDCARD, allow_partition);
+		if (allow_partition == 0) {
+			gui_print("This device does not have a real SD Card!\nAborting!\n");
+		} else {
+			if (!PartitionManager.Partition_SDCard())
+				ret_val = 1; // failed
 		}
-		if (function == "terminalcommand")
-		{
-			int op_status = 0;
-			string cmdpath, command;
+	}
+	operation_end(ret_val, simulate);
+	return 0;
+}
 
-			DataManager::GetValue("tw_terminal_location", cmdpath);
-			operation_start("CommandOutput");
-			gui_print("%s # %s\n", cmdpath.c_str(), arg.c_str());
-			if (simulate) {
-				simulate_progress_bar();
-				operation_end(op_status, simulate);
-			} else {
-				command = "cd \"" + cmdpath + "\" && " + arg + " 2>&1";;
-				LOGINFO("Actual command is: '%s'\n", command.c_str());
-				DataManager::SetValue("tw_terminal_command_thread", command);
-				DataManager::SetValue("tw_terminal_state", 1);
-				DataManager::SetValue("tw_background_thread_running", 1);
-				op_status = pthread_create(&terminal_command, NULL, command_thread, NULL);
-				if (op_status != 0) {
-					LOGERR("Error starting terminal command thread, %i.\n", op_status);
-					DataManager::SetValue("tw_terminal_state", 0);
-					DataManager::SetValue("tw_background_thread_running", 0);
-					operation_end(1, simulate);
-				}
-			}
-			return 0;
-		}
-		if (function == "killterminal")
-		{
-			int op_status = 0;
+int GUIAction::installhtcdumlock(std::string arg, const int simulate)
+{
+	operation_start("Install HTC Dumlock");
+	if (simulate) {
+		simulate_progress_bar();
+	} else
+		TWFunc::install_htc_dumlock();
 
-			LOGINFO("Sending kill command...\n");
-			operation_start("KillCommand");
-			DataManager::SetValue("tw_operation_status", 0);
-			DataManager::SetValue("tw_operation_state", 1);
+	operation_end(0, simulate);
+	return 0;
+}
+
+int GUIAction::htcdumlockrestoreboot(std::string arg, const int simulate)
+{
+	operation_start("HTC Dumlock Restore Boot");
+	if (simulate) {
+		simulate_progress_bar();
+	} else
+		TWFunc::htc_dumlock_restore_original_boot();
+
+	operation_end(0, simulate);
+	return 0;
+}
+
+int GUIAction::htcdumlockreflashrecovery(std::string arg, const int simulate)
+{
+	operation_start("HTC Dumlock Reflash Recovery");
+	if (simulate) {
+		simulate_progress_bar();
+	} else
+		TWFunc::htc_dumlock_reflash_recovery_to_boot();
+
+	operation_end(0, simulate);
+	return 0;
+}
+
+int GUIAction::cmd(std::string arg, const int simulate)
+{
+	int op_status = 0;
+	string result;
+
+	operation_start("Command");
+	LOGINFO("Running command: '%s'\n", arg.c_str());
+	if (simulate) {
+		simulate_progress_bar();
+	} else {
+		op_status = TWFunc::Exec_Cmd(arg, result);
+		if (op_status != 0)
+			op_status = 1;
+	}
+
+	operation_end(op_status, simulate);
+	return 0;
+}
+
+int GUIAction::terminalcommand(std::string arg, const int simulate)
+{
+	int op_status = 0;
+	string cmdpath, command;
+
+	DataManager::GetValue("tw_terminal_location", cmdpath);
+	operation_start("CommandOutput");
+	gui_print("%s # %s\n", cmdpath.c_str(), arg.c_str());
+	if (simulate) {
+		simulate_progress_bar();
+		operation_end(op_status, simulate);
+	} else {
+		command = "cd \"" + cmdpath + "\" && " + arg + " 2>&1";;
+		LOGINFO("Actual command is: '%s'\n", command.c_str());
+		DataManager::SetValue("tw_terminal_command_thread", command);
+		DataManager::SetValue("tw_terminal_state", 1);
+		DataManager::SetValue("tw_background_thread_running", 1);
+		op_status = pthread_create(&terminal_command, NULL, command_thread, NULL);
+		if (op_status != 0) {
+			LOGERR("Error starting terminal command thread, %i.\n", op_status);
 			DataManager::SetValue("tw_terminal_state", 0);
 			DataManager::SetValue("tw_background_thread_running", 0);
-			DataManager::SetValue(TW_ACTION_BUSY, 0);
-			return 0;
+			operation_end(1, simulate);
 		}
-		if (function == "reinjecttwrp")
-		{
-			int op_status = 0;
-			string result;
-			operation_start("ReinjectTWRP");
-			gui_print("Injecting TWRP into boot image...\n");
-			if (simulate) {
-				simulate_progress_bar();
-			} else {
-				TWFunc::Exec_Cmd("injecttwrp --dump /tmp/backup_recovery_ramdisk.img /tmp/injected_boot.img --flash", result);
-				gui_print("TWRP injection complete.\n");
-			}
+	}
+	return 0;
+}
 
-			operation_end(op_status, simulate);
-			return 0;
-		}
-		if (function == "checkbackupname")
-		{
-			int op_status = 0;
+int GUIAction::killterminal(std::string arg, const int simulate)
+{
+	int op_status = 0;
 
-			operation_start("CheckBackupName");
-			if (simulate) {
-				simulate_progress_bar();
-			} else {
-				op_status = PartitionManager.Check_Backup_Name(true);
-				if (op_status != 0)
-					op_status = 1;
-			}
+	LOGINFO("Sending kill command...\n");
+	operation_start("KillCommand");
+	DataManager::SetValue("tw_operation_status", 0);
+	DataManager::SetValue("tw_operation_state", 1);
+	DataManager::SetValue("tw_terminal_state", 0);
+	DataManager::SetValue("tw_background_thread_running", 0);
+	DataManager::SetValue(TW_ACTION_BUSY, 0);
+	return 0;
+}
 
-			operation_end(op_status, simulate);
-			return 0;
-		}
-		if (function == "decrypt")
-		{
-			int op_status = 0;
+int GUIAction::reinjecttwrp(std::string arg, const int simulate)
+{
+	int op_status = 0;
+	string result;
+	operation_start("ReinjectTWRP");
+	gui_print("Injecting TWRP into boot image...\n");
+	if (simulate) {
+		simulate_progress_bar();
+	} else {
+		TWFunc::Exec_Cmd("injecttwrp --dump /tmp/backup_recovery_ramdisk.img /tmp/injected_boot.img --flash", result);
+		gui_print("TWRP injection complete.\n");
+	}
 
-			operation_start("Decrypt");
-			if (simulate) {
-				simulate_progress_bar();
-			} else {
-				string Password;
-				DataManager::GetValue("tw_crypto_password", Password);
-				op_status = PartitionManager.Decrypt_Device(Password);
-				if (op_status != 0)
-					op_status = 1;
-				else {
-					int load_theme = 1;
+	operation_end(op_status, simulate);
+	return 0;
+}
 
-					DataManager::SetValue(TW_IS_ENCRYPTED, 0);
+int GUIAction::checkbackupname(std::string arg, const int simulate)
+{
+	int op_status = 0;
 
-					if (load_theme) {
-						int has_datamedia;
+	operation_start("CheckBackupName");
+	if (simulate) {
+		simulate_progress_bar();
+	} else {
+		op_status = PartitionManager.Check_Backup_Name(true);
+		if (op_status != 0)
+			op_status = 1;
+	}
 
-						// Check for a custom theme and load it if exists
-						DataManager::GetValue(TW_HAS_DATA_MEDIA, has_datamedia);
-						if (has_datamedia != 0) {
-							struct stat st;
-							int check = 0;
-							std::string theme_path;
+	operation_end(op_status, simulate);
+	return 0;
+}
 
-							theme_path = DataManager::GetSettingsStoragePath();
-							if (PartitionManager.Mount_By_Path(theme_path.c_str(), 1) < 0) {
-								LOGERR("Unable to mount %s during reload function startup.\n", theme_path.c_str());
-								check = 1;
-							}
+int GUIAction::decrypt(std::string arg, const int simulate)
+{
+	int op_status = 0;
+
+	operation_start("Decrypt");
+	if (simulate) {
+		simulate_progress_bar();
+	} else {
+		string Password;
+		DataManager::GetValue("tw_crypto_password", Password);
+		op_status = PartitionManager.Decrypt_Device(Password);
+		if (op_status != 0)
+			op_status = 1;
+		else {
+			int load_theme = 1;
+
+			DataManager::SetValue(TW_IS_ENCRYPTED, 0);
+
+			if (load_theme) {
+				int has_datamedia;
 
-							theme_path += "/TWRP/theme/ui.zip";
-							if (check == 0 && stat(theme_path.c_str(), &st) == 0) {
-								if (PageManager::ReloadPackage("TWRP", theme_path) != 0)
-								{
-									// Loading the custom theme failed - try loading the stock theme
-									LOGINFO("Attempting to reload stock theme...\n");
-									if (PageManager::ReloadPackage("TWRP", "/res/ui.xml"))
-									{
-										LOGERR("Failed to load base packages.\n");
-									}
-								}
+				// Check for a custom theme and load it if exists
+				DataManager::GetValue(TW_HAS_DATA_MEDIA, has_datamedia);
+				if (has_datamedia != 0) {
+					struct stat st;
+					int check = 0;
+					std::string theme_path;
+
+					theme_path = DataManager::GetSettingsStoragePath();
+					if (PartitionManager.Mount_By_Path(theme_path.c_str(), 1) < 0) {
+						LOGERR("Unable to mount %s during reload function startup.\n", theme_path.c_str());
+						check = 1;
+					}
+
+					theme_path += "/TWRP/theme/ui.zip";
+					if (check == 0 && stat(theme_path.c_str(), &st) == 0) {
+						if (PageManager::ReloadPackage("TWRP", theme_path) != 0)
+						{
+							// Loading the custom theme failed - try loading the stock theme
+							LOGINFO("Attempting to reload stock theme...\n");
+							if (PageManager::ReloadPackage("TWRP", "/res/ui.xml"))
+							{
+								LOGERR("Failed to load base packages.\n");
 							}
 						}
 					}
 				}
 			}
-
-			operation_end(op_status, simulate);
-			return 0;
 		}
-		if (function == "adbsideload")
-		{
-			int ret = 0;
+	}
 
-			operation_start("Sideload");
-			if (simulate) {
-				simulate_progress_bar();
-			} else {
-				int wipe_cache = 0;
-				int wipe_dalvik = 0;
-				string result, Sideload_File;
+	operation_end(op_status, simulate);
+	return 0;
+}
 
-				if (!PartitionManager.Mount_Current_Storage(true)) {
-					operation_end(1, simulate);
-					return 0;
-				}
-				Sideload_File = DataManager::GetCurrentStoragePath() + "/sideload.zip";
-				if (TWFunc::Path_Exists(Sideload_File)) {
-					unlink(Sideload_File.c_str());
-				}
-				gui_print("Starting ADB sideload feature...\n");
-				DataManager::GetValue("tw_wipe_dalvik", wipe_dalvik);
-				ret = apply_from_adb(Sideload_File.c_str());
-				DataManager::SetValue("tw_has_cancel", 0); // Remove cancel button from gui now that the zip install is going to start
-				if (ret != 0) {
-					ret = 1; // failure
-				} else if (TWinstall_zip(Sideload_File.c_str(), &wipe_cache) == 0) {
-					if (wipe_cache || DataManager::GetIntValue("tw_wipe_cache"))
-						PartitionManager.Wipe_By_Path("/cache");
-					if (wipe_dalvik)
-						PartitionManager.Wipe_Dalvik_Cache();
-				} else {
-					ret = 1; // failure
-				}
-				if (DataManager::GetIntValue(TW_HAS_INJECTTWRP) == 1 && DataManager::GetIntValue(TW_INJECT_AFTER_ZIP) == 1) {
-					operation_start("ReinjectTWRP");
-					gui_print("Injecting TWRP into boot image...\n");
-					if (simulate) {
-						simulate_progress_bar();
-					} else {
-						TWPartition* Boot = PartitionManager.Find_Partition_By_Path("/boot");
-						if (Boot == NULL || Boot->Current_File_System != "emmc")
-							TWFunc::Exec_Cmd("injecttwrp --dump /tmp/backup_recovery_ramdisk.img /tmp/injected_boot.img --flash", result);
-						else {
-							string injectcmd = "injecttwrp --dump /tmp/backup_recovery_ramdisk.img /tmp/injected_boot.img --flash bd=" + Boot->Actual_Block_Device;
-							TWFunc::Exec_Cmd(injectcmd, result);
-						}
-						gui_print("TWRP injection complete.\n");
-					}
-				}
-			}
-			operation_end(ret, simulate);
+int GUIAction::adbsideload(std::string arg, const int simulate)
+{
+	int ret = 0;
+
+	operation_start("Sideload");
+	if (simulate) {
+		simulate_progress_bar();
+	} else {
+		int wipe_cache = 0;
+		int wipe_dalvik = 0;
+		string result, Sideload_File;
+
+		if (!PartitionManager.Mount_Current_Storage(true)) {
+			operation_end(1, simulate);
 			return 0;
 		}
-		if (function == "adbsideloadcancel")
-		{
-			int child_pid;
-			char child_prop[PROPERTY_VALUE_MAX];
-			string Sideload_File;
-			Sideload_File = DataManager::GetCurrentStoragePath() + "/sideload.zip";
+		Sideload_File = DataManager::GetCurrentStoragePath() + "/sideload.zip";
+		if (TWFunc::Path_Exists(Sideload_File)) {
 			unlink(Sideload_File.c_str());
-			property_get("tw_child_pid", child_prop, "error");
-			if (strcmp(child_prop, "error") == 0) {
-				LOGERR("Unable to get child ID from prop\n");
-				return 0;
-			}
-			child_pid = atoi(child_prop);
-			gui_print("Cancelling ADB sideload...\n");
-			kill(child_pid, SIGTERM);
-			DataManager::SetValue("tw_page_done", "1"); // For OpenRecoveryScript support
-			return 0;
 		}
-		if (function == "openrecoveryscript") {
-			operation_start("OpenRecoveryScript");
+		gui_print("Starting ADB sideload feature...\n");
+		DataManager::GetValue("tw_wipe_dalvik", wipe_dalvik);
+		ret = apply_from_adb(Sideload_File.c_str());
+		DataManager::SetValue("tw_has_cancel", 0); // Remove cancel button from gui now that the zip install is going to start
+		if (ret != 0) {
+			ret = 1; // failure
+		} else if (TWinstall_zip(Sideload_File.c_str(), &wipe_cache) == 0) {
+			if (wipe_cache || DataManager::GetIntValue("tw_wipe_cache"))
+				PartitionManager.Wipe_By_Path("/cache");
+			if (wipe_dalvik)
+				PartitionManager.Wipe_Dalvik_Cache();
+		} else {
+			ret = 1; // failure
+		}
+		if (DataManager::GetIntValue(TW_HAS_INJECTTWRP) == 1 && DataManager::GetIntValue(TW_INJECT_AFTER_ZIP) == 1) {
+			operation_start("ReinjectTWRP");
+			gui_print("Injecting TWRP into boot image...\n");
 			if (simulate) {
 				simulate_progress_bar();
 			} else {
-				// Check for the SCRIPT_FILE_TMP first as these are AOSP recovery commands
-				// that we converted to ORS commands during boot in recovery.cpp.
-				// Run those first.
-				int reboot = 0;
-				if (TWFunc::Path_Exists(SCRIPT_FILE_TMP)) {
-					gui_print("Processing AOSP recovery commands...\n");
-					if (OpenRecoveryScript::run_script_file() == 0) {
-						reboot = 1;
-					}
-				}
-				// Check for the ORS file in /cache and attempt to run those commands.
-				if (OpenRecoveryScript::check_for_script_file()) {
-					gui_print("Processing OpenRecoveryScript file...\n");
-					if (OpenRecoveryScript::run_script_file() == 0) {
-						reboot = 1;
-					}
-				}
-				if (reboot) {
-					usleep(2000000); // Sleep for 2 seconds before rebooting
-					TWFunc::tw_reboot(rb_system);
-				} else {
-					DataManager::SetValue("tw_page_done", 1);
+				TWPartition* Boot = PartitionManager.Find_Partition_By_Path("/boot");
+				if (Boot == NULL || Boot->Current_File_System != "emmc")
+					TWFunc::Exec_Cmd("injecttwrp --dump /tmp/backup_recovery_ramdisk.img /tmp/injected_boot.img --flash", result);
+				else {
+					string injectcmd = "injecttwrp --dump /tmp/backup_recovery_ramdisk.img /tmp/injected_boot.img --flash bd=" + Boot->Actual_Block_Device;
+					TWFunc::Exec_Cmd(injectcmd, result);
 				}
+				gui_print("TWRP injection complete.\n");
 			}
 		}
-		if (function == "installsu")
-		{
-			int op_status = 0;
+	}
+	operation_end(ret, simulate);
+	return 0;
+}
 
-			operation_start("Install SuperSU");
-			if (simulate) {
-				simulate_progress_bar();
-			} else {
-				if (!TWFunc::Install_SuperSU())
-					op_status = 1;
-			}
+int GUIAction::adbsideloadcancel(std::string arg, const int simulate)
+{
+	int child_pid;
+	char child_prop[PROPERTY_VALUE_MAX];
+	string Sideload_File;
+	Sideload_File = DataManager::GetCurrentStoragePath() + "/sideload.zip";
+	unlink(Sideload_File.c_str());
+	property_get("tw_child_pid", child_prop, "error");
+	if (strcmp(child_prop, "error") == 0) {
+		LOGERR("Unable to get child ID from prop\n");
+		return 0;
+	}
+	child_pid = atoi(child_prop);
+	gui_print("Cancelling ADB sideload...\n");
+	kill(child_pid, SIGTERM);
+	DataManager::SetValue("tw_page_done", "1"); // For OpenRecoveryScript support
+	return 0;
+}
 
-			operation_end(op_status, simulate);
-			return 0;
+int GUIAction::openrecoveryscript(std::string arg, const int simulate)
+{
+	operation_start("OpenRecoveryScript");
+	if (simulate) {
+		simulate_progress_bar();
+	} else {
+		// Check for the SCRIPT_FILE_TMP first as these are AOSP recovery commands
+		// that we converted to ORS commands during boot in recovery.cpp.
+		// Run those first.
+		int reboot = 0;
+		if (TWFunc::Path_Exists(SCRIPT_FILE_TMP)) {
+			gui_print("Processing AOSP recovery commands...\n");
+			if (OpenRecoveryScript::run_script_file() == 0) {
+				reboot = 1;
+			}
 		}
-		if (function == "fixsu")
-		{
-			int op_status = 0;
-
-			operation_start("Fixing Superuser Permissions");
-			if (simulate) {
-				simulate_progress_bar();
-			} else {
-				if (!TWFunc::Fix_su_Perms())
-					op_status = 1;
+		// Check for the ORS file in /cache and attempt to run those commands.
+		if (OpenRecoveryScript::check_for_script_file()) {
+			gui_print("Processing OpenRecoveryScript file...\n");
+			if (OpenRecoveryScript::run_script_file() == 0) {
+				reboot = 1;
 			}
-
-			operation_end(op_status, simulate);
-			return 0;
 		}
-    }
-    else
-    {
-        pthread_t t;
-        pthread_create(&t, NULL, thread_start, this);
-        return 0;
-    }
-    return -1;
+		if (reboot) {
+			usleep(2000000); // Sleep for 2 seconds before rebooting
+			TWFunc::tw_reboot(rb_system);
+		} else {
+			DataManager::SetValue("tw_page_done", 1);
+		}
+	}
+	return 0;
+}
+
+int GUIAction::installsu(std::string arg, const int simulate)
+{
+	int op_status = 0;
+
+	operation_start("Install SuperSU");
+	if (simulate) {
+		simulate_progress_bar();
+	} else {
+		if (!TWFunc::Install_SuperSU())
+			op_status = 1;
+	}
+
+	operation_end(op_status, simulate);
+	return 0;
+}
+
+int GUIAction::fixsu(std::string arg, const int simulate)
+{
+	int op_status = 0;
+
+	operation_start("Fixing Superuser Permissions");
+	if (simulate) {
+		simulate_progress_bar();
+	} else {
+		if (!TWFunc::Fix_su_Perms())
+			op_status = 1;
+	}
+
+	operation_end(op_status, simulate);
+	return 0;
+}
+
+int GUIAction::canceljobs(std::string arg, const int simulate)
+{
+	jobScheduler.cancelAll();
+	return 0;
+}
+
+int GUIAction::jobstats(std::string arg, const int simulate)
+{
+	jobScheduler.printStats();
+	return 0;
 }
 
 int GUIAction::getKeyByName(std::string key)
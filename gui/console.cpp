@@ -14,6 +14,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include <string>
 
@@ -27,24 +28,19 @@ extern "C" {
 
 
 static std::vector<std::string> gConsole;
+static pthread_mutex_t gConsoleLock = PTHREAD_MUTEX_INITIALIZER;
 
-extern "C" void gui_print(const char *fmt, ...)
+// Splits buf into lines and appends them to the console. gui_print can be
+// called from several threads at once during startup, so the console is
+// only modified while holding gConsoleLock.
+static void console_append(char* buf, int overwrite)
 {
-    char buf[512];          // We're going to limit a single request to 512 bytes
-
-    va_list ap;
-    va_start(ap, fmt);
-    vsnprintf(buf, 512, fmt, ap);
-    va_end(ap);
-
-	fputs(buf, stdout);
-
     char *start, *next;
 
-	if (buf[0] == '\n' && strlen(buf) < 2) {
-		// This prevents the double lines bug seen in the console during zip installs
-		return;
-	}
+    pthread_mutex_lock(&gConsoleLock);
+
+    // Pop the last line, and we can continue
+    if (overwrite && !gConsole.empty())   gConsole.pop_back();
 
     for (start = next = buf; *next != '\0'; next++)
     {
@@ -59,15 +55,15 @@ extern "C" void gui_print(const char *fmt, ...)
 
 			// Handle the normal \n\0 case
             if (*next == '\0')
-				return;
+				goto done;
         }
     }
-    std::string line = start;
-    gConsole.push_back(line);
-    return;
+    gConsole.push_back(std::string(start));
+done:
+    pthread_mutex_unlock(&gConsoleLock);
 }
 
-extern "C" void gui_print_overwrite(const char *fmt, ...)
+extern "C" void gui_print(const char *fmt, ...)
 {
     char buf[512];          // We're going to limit a single request to 512 bytes
 
@@ -78,29 +74,26 @@ extern "C" void gui_print_overwrite(const char *fmt, ...)
 
 	fputs(buf, stdout);
 
-    // Pop the last line, and we can continue
-    if (!gConsole.empty())   gConsole.pop_back();
+	if (buf[0] == '\n' && strlen(buf) < 2) {
+		// This prevents the double lines bug seen in the console during zip installs
+		return;
+	}
 
-    char *start, *next;
-    for (start = next = buf; *next != '\0'; next++)
-    {
-        if (*next == '\n')
-        {
-            *next = '\0';
-            next++;
-            
-            std::string line = start;
-            gConsole.push_back(line);
-            start = next;
+    console_append(buf, 0);
+}
 
-            // Handle the normal \n\0 case
-            if (*next == '\0')
-				return;
-        }
-    }
-    std::string line = start;
-    gConsole.push_back(line);
-    return;
+extern "C" void gui_print_overwrite(const char *fmt, ...)
+{
+    char buf[512];          // We're going to limit a single request to 512 bytes
+
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, 512, fmt, ap);
+    va_end(ap);
+
+	fputs(buf, stdout);
+
+    console_append(buf, 1);
 }
 
 GUIConsole::GUIConsole(xml_node<>* node)
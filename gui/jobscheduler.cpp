@@ -0,0 +1,276 @@
+/*
+        Copyright 2013 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include <list>
+#include <map>
+#include "jobscheduler.hpp"
+#include "../data.hpp"
+extern "C" {
+#include "../twcommon.h"
+}
+
+jobscheduler jobScheduler;
+
+jobscheduler::job::job(const string& job_name, int job_priority, bool job_heavy, const void* job_owner)
+	: name(job_name), priority(job_priority), heavy(job_heavy), owner(job_owner),
+	  id(0), cancelled(false), queued_ms(0)
+{
+}
+
+jobscheduler::jobscheduler(void) {
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&wake, NULL);
+	pthread_key_create(&current, NULL);
+	idle = 0;
+	heavy_running = false;
+	next_id = 1;
+}
+
+unsigned long long jobscheduler::now_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+unsigned jobscheduler::submit(job* j) {
+	list<job*>::iterator pos;
+	bool start_worker = false;
+	unsigned id;
+	pthread_t thread;
+
+	pthread_mutex_lock(&lock);
+	id = j->id = next_id++;
+	j->queued_ms = now_ms();
+	// Keep the queue ordered by priority, first come first served within one
+	for (pos = pending.begin(); pos != pending.end(); pos++) {
+		if ((*pos)->priority < j->priority)
+			break;
+	}
+	pending.insert(pos, j);
+	if (idle == 0 && (!j->heavy || !heavy_running))
+		start_worker = true;
+	else
+		pthread_cond_broadcast(&wake);
+	pthread_mutex_unlock(&lock);
+
+	if (start_worker && pthread_create(&thread, NULL, worker_thread, this) == 0)
+		pthread_detach(thread);
+	else if (start_worker)
+		LOGERR("Unable to start a worker for '%s'\n", j->name.c_str());
+	publish();
+	return id;
+}
+
+int jobscheduler::cancel(unsigned id) {
+	list<job*>::iterator it;
+	job* found = NULL;
+
+	pthread_mutex_lock(&lock);
+	for (it = pending.begin(); it != pending.end(); it++) {
+		if ((*it)->id == id) {
+			found = *it;
+			pending.erase(it);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (!found)
+		return -1;
+	LOGINFO("Cancelled job %u '%s' before it started\n", id, found->name.c_str());
+	delete found;
+	publish();
+	return 0;
+}
+
+void jobscheduler::cancelOwner(const void* owner) {
+	list<job*> dropped;
+	list<job*>::iterator it;
+
+	pthread_mutex_lock(&lock);
+	for (it = pending.begin(); it != pending.end();) {
+		if ((*it)->owner == owner) {
+			dropped.push_back(*it);
+			it = pending.erase(it);
+		} else
+			it++;
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (dropped.empty())
+		return;
+	for (it = dropped.begin(); it != dropped.end(); it++)
+		delete *it;
+	publish();
+}
+
+void jobscheduler::cancelAll(void) {
+	list<job*> dropped;
+	list<job*>::iterator it;
+
+	pthread_mutex_lock(&lock);
+	dropped.swap(pending);
+	for (it = running.begin(); it != running.end(); it++)
+		(*it)->cancelled = true;
+	pthread_mutex_unlock(&lock);
+
+	for (it = dropped.begin(); it != dropped.end(); it++) {
+		LOGINFO("Cancelled job %u '%s' before it started\n", (*it)->id, (*it)->name.c_str());
+		delete *it;
+	}
+	publish();
+}
+
+bool jobscheduler::isCancelled(void) {
+	job* j = (job*)pthread_getspecific(current);
+	bool cancelled;
+
+	if (j == NULL)
+		return false;
+	pthread_mutex_lock(&lock);
+	cancelled = j->cancelled;
+	pthread_mutex_unlock(&lock);
+	return cancelled;
+}
+
+bool jobscheduler::isWorker(void) {
+	return pthread_getspecific(current) != NULL;
+}
+
+int jobscheduler::otherJobs(void) {
+	int count;
+
+	pthread_mutex_lock(&lock);
+	count = running.size() + pending.size();
+	pthread_mutex_unlock(&lock);
+	if (isWorker())
+		count--;
+	return count;
+}
+
+void jobscheduler::recordLatency(const string& name, unsigned long long run_ms, unsigned long long wait_ms) {
+	pthread_mutex_lock(&lock);
+	stats& s = latency[name];
+	s.count++;
+	s.total_ms += run_ms;
+	if (run_ms > s.max_ms)
+		s.max_ms = run_ms;
+	s.wait_ms += wait_ms;
+	pthread_mutex_unlock(&lock);
+}
+
+void jobscheduler::printStats(void) {
+	map<string, stats> copy;
+	map<string, stats>::iterator it;
+
+	pthread_mutex_lock(&lock);
+	copy = latency;
+	pthread_mutex_unlock(&lock);
+
+	gui_print("%-28s %6s %8s %8s %8s\n", "action", "runs", "avg ms", "max ms", "wait ms");
+	for (it = copy.begin(); it != copy.end(); it++) {
+		gui_print("%-28s %6u %8llu %8llu %8llu\n", it->first.c_str(), it->second.count,
+			it->second.total_ms / it->second.count, it->second.max_ms,
+			it->second.wait_ms / it->second.count);
+	}
+}
+
+// Publishes the queue state for the theme: the number of jobs waiting and
+// the name of the heavy job that is running, if any.
+void jobscheduler::publish(void) {
+	list<job*>::iterator it;
+	string heavy_name;
+	int waiting;
+
+	pthread_mutex_lock(&lock);
+	waiting = pending.size();
+	for (it = running.begin(); it != running.end(); it++) {
+		if ((*it)->heavy)
+			heavy_name = (*it)->name;
+	}
+	pthread_mutex_unlock(&lock);
+
+	DataManager::SetValue("tw_jobs_pending", waiting);
+	DataManager::SetValue("tw_job_running", heavy_name);
+}
+
+// Called with the lock held
+jobscheduler::job* jobscheduler::takeRunnable(void) {
+	list<job*>::iterator it;
+	job* j;
+
+	for (it = pending.begin(); it != pending.end(); it++) {
+		if (!(*it)->heavy || !heavy_running) {
+			j = *it;
+			pending.erase(it);
+			if (j->heavy)
+				heavy_running = true;
+			running.push_back(j);
+			return j;
+		}
+	}
+	return NULL;
+}
+
+void* jobscheduler::worker_thread(void* cookie) {
+	((jobscheduler*)cookie)->worker();
+	return NULL;
+}
+
+void jobscheduler::worker(void) {
+	unsigned long long start, wait;
+	job* j;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		j = takeRunnable();
+		if (j == NULL) {
+			idle++;
+			pthread_cond_wait(&wake, &lock);
+			idle--;
+			continue;
+		}
+		pthread_mutex_unlock(&lock);
+
+		publish();
+		start = now_ms();
+		wait = start - j->queued_ms;
+		pthread_setspecific(current, j);
+		j->run();
+		pthread_setspecific(current, NULL);
+
+		pthread_mutex_lock(&lock);
+		LOGINFO("Job %u '%s' finished in %llu ms after waiting %llu ms%s\n", j->id,
+			j->name.c_str(), now_ms() - start, wait, j->cancelled ? " (cancelled)" : "");
+		running.remove(j);
+		if (j->heavy) {
+			heavy_running = false;
+			// Another worker may be waiting on the next heavy job
+			pthread_cond_broadcast(&wake);
+		}
+		pthread_mutex_unlock(&lock);
+		delete j;
+		publish();
+		pthread_mutex_lock(&lock);
+	}
+}
@@ -0,0 +1,102 @@
+/*
+        Copyright 2013 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __JOBSCHEDULER_HEADER_HPP
+#define __JOBSCHEDULER_HEADER_HPP
+
+#include <pthread.h>
+#include <list>
+#include <map>
+#include <string>
+
+using namespace std;
+
+// Runs the long GUI operations on a pool of worker threads. Light jobs start
+// right away; heavy jobs (backup, wipe, install...) wait in a priority queue
+// so only one of them runs at a time.
+class jobscheduler {
+	public:
+		enum {
+			PRIORITY_NORMAL = 0,
+			PRIORITY_HIGH = 1,
+		};
+
+		class job {
+			public:
+				job(const string& job_name, int job_priority, bool job_heavy, const void* job_owner);
+				virtual ~job(void) {}
+				virtual void run(void) = 0;
+
+				string name;
+				int priority;
+				bool heavy;
+				const void* owner;
+				unsigned id;
+				bool cancelled;
+				unsigned long long queued_ms;
+		};
+
+		jobscheduler(void);
+		// Takes ownership of j and returns its id
+		unsigned submit(job* j);
+		// Drops a job that has not started yet, returns 0 if it was found
+		int cancel(unsigned id);
+		// Drops every pending job with this owner
+		void cancelOwner(const void* owner);
+		// Drops every pending job and flags the running ones as cancelled
+		void cancelAll(void);
+		// True if the job running on the calling thread has been cancelled
+		bool isCancelled(void);
+		// True when called from a scheduler worker thread
+		bool isWorker(void);
+		// Number of jobs waiting to start or running on other threads than the caller's
+		int otherJobs(void);
+		// Adds one run of an action to the latency statistics
+		void recordLatency(const string& name, unsigned long long run_ms, unsigned long long wait_ms);
+		// Prints count, average and worst case run time and queue wait per action
+		void printStats(void);
+
+		static unsigned long long now_ms(void);
+
+	private:
+		struct stats {
+			unsigned count;
+			unsigned long long total_ms;
+			unsigned long long max_ms;
+			unsigned long long wait_ms;
+		};
+
+		static void* worker_thread(void* cookie);
+		void worker(void);
+		job* takeRunnable(void);
+		void publish(void);
+
+		pthread_mutex_t lock;
+		pthread_cond_t wake;
+		pthread_key_t current;
+		list<job*> pending;
+		list<job*> running;
+		map<string, stats> latency;
+		int idle;
+		bool heavy_running;
+		unsigned next_id;
+};
+
+extern jobscheduler jobScheduler;
+
+#endif // __JOBSCHEDULER_HEADER_HPP
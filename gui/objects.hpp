@@ -255,6 +255,7 @@ class GUIAction : public ActionObject, public Conditional
 {
 public:
     GUIAction(xml_node<>* node);
+    virtual ~GUIAction();
 
 public:
     virtual int NotifyTouch(TOUCH_STATE state, int x, int y);
@@ -263,25 +264,124 @@ public:
 	virtual int doActions();
 
 protected:
+    typedef int (GUIAction::*execFunction)(std::string arg, const int simulate);
+
+    enum {
+        ACTION_THREADED = 1,    // runs as a job, never on the input thread
+        ACTION_HEAVY = 2,       // never runs at the same time as another heavy job
+    };
+
+    class ActionHandler
+    {
+    public:
+        const char* name;
+        execFunction func;
+        int flags;
+        int priority;
+    };
+
     class Action
     {
     public:
+        Action() : mHandler(NULL), mResolved(false) {}
+
         std::string mFunction;
         std::string mArg;
+        const ActionHandler* mHandler;  // NULL if mFunction uses variables
+        bool mResolved;                 // mFunction and mArg had their variables replaced when queued
     };
 
+    class Job;
+
     std::vector<Action> mActions;
     int mKey;
 
+    // Action functions by name, filled in once when the first theme loads
+    static std::map<std::string, ActionHandler> mHandlers;
+
 protected:
     int getKeyByName(std::string key);
     virtual int doAction(Action action, int isThreaded = 0);
-    static void* thread_start(void *cookie);
+    static void initHandlers(void);
+    static void addHandler(const char* name, execFunction func, int flags = 0, int priority = 0);
+    static const ActionHandler* findHandler(const std::string& function);
+    const ActionHandler* getHandler(const Action& action);
+    std::vector<Action> resolveActions(const std::vector<Action>& actions);
+    int callHandler(const Action& action, const ActionHandler* handler, unsigned long long wait_ms);
+    void runActions(const std::vector<Action>& actions, unsigned long long wait_ms);
 	void simulate_progress_bar(void);
     int flash_zip(std::string filename, std::string pageName, const int simulate, int* wipe_cache);
 	void operation_start(const string operation_name);
 	void operation_end(const int operation_status, const int simulate);
 	static void* command_thread(void *cookie);
+
+	// Action functions
+	int reboot(std::string arg, const int simulate);
+	int home(std::string arg, const int simulate);
+	int key(std::string arg, const int simulate);
+	int page(std::string arg, const int simulate);
+	int reload(std::string arg, const int simulate);
+	int readBackup(std::string arg, const int simulate);
+	int set(std::string arg, const int simulate);
+	int clear(std::string arg, const int simulate);
+	int mount(std::string arg, const int simulate);
+	int unmount(std::string arg, const int simulate);
+	int restoredefaultsettings(std::string arg, const int simulate);
+	int copylog(std::string arg, const int simulate);
+	int compute(std::string arg, const int simulate);
+	int setguitimezone(std::string arg, const int simulate);
+	int togglestorage(std::string arg, const int simulate);
+	int overlay(std::string arg, const int simulate);
+	int queuezip(std::string arg, const int simulate);
+	int cancelzip(std::string arg, const int simulate);
+	int queueclear(std::string arg, const int simulate);
+	int sleep(std::string arg, const int simulate);
+	int multirom(std::string arg, const int simulate);
+	int multirom_list(std::string arg, const int simulate);
+	int multirom_rename(std::string arg, const int simulate);
+	int multirom_manage(std::string arg, const int simulate);
+	int multirom_settings(std::string arg, const int simulate);
+	int multirom_settings_save(std::string arg, const int simulate);
+	int multirom_add(std::string arg, const int simulate);
+	int multirom_add_second(std::string arg, const int simulate);
+	int multirom_add_file_selected(std::string arg, const int simulate);
+	int multirom_change_img_size(std::string arg, const int simulate);
+	int multirom_change_img_size_act(std::string arg, const int simulate);
+	int multirom_set_list_loc(std::string arg, const int simulate);
+	int multirom_list_loc_selected(std::string arg, const int simulate);
+	int timeout(std::string arg, const int simulate);
+	int multirom_delete(std::string arg, const int simulate);
+	int multirom_flash_zip(std::string arg, const int simulate);
+	int multirom_inject(std::string arg, const int simulate);
+	int multirom_inject_curr_boot(std::string arg, const int simulate);
+	int multirom_add_rom(std::string arg, const int simulate);
+	int multirom_ubuntu_patch_init(std::string arg, const int simulate);
+	int multirom_wipe(std::string arg, const int simulate);
+	int multirom_disable_flash_kernel(std::string arg, const int simulate);
+	int fileexists(std::string arg, const int simulate);
+	int flash(std::string arg, const int simulate);
+	int wipe(std::string arg, const int simulate);
+	int refreshsizes(std::string arg, const int simulate);
+	int nandroid(std::string arg, const int simulate);
+	int fixpermissions(std::string arg, const int simulate);
+	int dd(std::string arg, const int simulate);
+	int partitionsd(std::string arg, const int simulate);
+	int installhtcdumlock(std::string arg, const int simulate);
+	int htcdumlockrestoreboot(std::string arg, const int simulate);
+	int htcdumlockreflashrecovery(std::string arg, const int simulate);
+	int cmd(std::string arg, const int simulate);
+	int terminalcommand(std::string arg, const int simulate);
+	int killterminal(std::string arg, const int simulate);
+	int reinjecttwrp(std::string arg, const int simulate);
+	int checkbackupname(std::string arg, const int simulate);
+	int decrypt(std::string arg, const int simulate);
+	int adbsideload(std::string arg, const int simulate);
+	int adbsideloadcancel(std::string arg, const int simulate);
+	int openrecoveryscript(std::string arg, const int simulate);
+	int installsu(std::string arg, const int simulate);
+	int fixsu(std::string arg, const int simulate);
+	int canceljobs(std::string arg, const int simulate);
+	int jobstats(std::string arg, const int simulate);
 };
 
 class GUIConsole : public RenderObject, public ActionObject
@@ -31,8 +31,10 @@
 #include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include <string>
+#include <sstream>
 
 extern "C" {
 #include "../twcommon.h"
@@ -41,12 +43,27 @@ extern "C" {
 
 #include "rapidxml.hpp"
 #include "objects.hpp"
+#include "../twrp-functions.hpp"
+
+// Compiled themes are stored here, relative to the settings storage
+#define COMPILED_THEME_DIR      "/TWRP/theme/"
+#define COMPILED_THEME_MAGIC    "TWRPUI01"
+#define COMPILED_THEME_MAX_DEPTH 64
 
 extern int gGuiRunning;
 
 std::map<std::string, PageSet*> PageManager::mPageSets;
 PageSet* PageManager::mCurrentSet;
 PageSet* PageManager::mBaseSet = NULL;
+PageSet* PageManager::mLoadingSet = NULL;
+pthread_t PageManager::mLoadingThread;
+
+// Serializes creating pages on first use, which may happen from the
+// input thread as well as from action threads
+static pthread_mutex_t page_create_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Guards mLoadingSet, which other threads read while a page is created
+static pthread_mutex_t loading_set_lock = PTHREAD_MUTEX_INITIALIZER;
 
 
 // Helper routine to convert a string to a color declaration
@@ -495,14 +512,276 @@ int Page::NotifyVarChange(std::string varName, std::string value)
     return 0;
 }
 
-PageSet::PageSet(char* xmlFile)
+// A compiled theme is the element tree of ui.xml after parsing, so it can
+// be turned back into a document without scanning or unescaping any text:
+//
+//   header | nodes (pre-order, node 0 is the document) | attributes | strings
+//
+// Nodes list their attributes in order, so the n-th node's attributes
+// follow those of all nodes before it. Strings are NULL-terminated and
+// used in place, which is why the buffer lives as long as the PageSet.
+struct compiled_theme_header
+{
+    char magic[8];
+    unsigned long long key;
+    unsigned int nodes;
+    unsigned int attrs;
+    unsigned int strings;
+};
+
+struct compiled_theme_node
+{
+    unsigned int name;
+    unsigned int value;
+    unsigned int attrs;
+    unsigned int children;
+};
+
+struct compiled_theme_attr
+{
+    unsigned int name;
+    unsigned int value;
+};
+
+struct compiled_theme
+{
+    const compiled_theme_node* nodes;
+    const compiled_theme_attr* attrs;
+    char* strings;
+    unsigned int node_count;
+    unsigned int attr_count;
+    unsigned int string_size;
+    unsigned int next_node;
+    unsigned int next_attr;
+};
+
+static bool CompiledThemeSetup(compiled_theme* theme, char* data, size_t len)
+{
+    compiled_theme_header hdr;
+
+    if (len < sizeof(hdr))
+        return false;
+    memcpy(&hdr, data, sizeof(hdr));
+    if (hdr.nodes == 0 || hdr.nodes > len || hdr.attrs > len || hdr.strings == 0 ||
+        len != sizeof(hdr) + (size_t) hdr.nodes * sizeof(compiled_theme_node) +
+               (size_t) hdr.attrs * sizeof(compiled_theme_attr) + hdr.strings)
+        return false;
+
+    theme->nodes = (const compiled_theme_node*) (data + sizeof(hdr));
+    theme->attrs = (const compiled_theme_attr*) (theme->nodes + hdr.nodes);
+    theme->strings = (char*) (theme->attrs + hdr.attrs);
+    theme->node_count = hdr.nodes;
+    theme->attr_count = hdr.attrs;
+    theme->string_size = hdr.strings;
+    theme->next_node = 0;
+    theme->next_attr = 0;
+    return theme->strings[hdr.strings - 1] == 0;
+}
+
+// Walks the tree the same way BuildCompiledNode does, checking every index
+static bool CheckCompiledNode(compiled_theme* theme, int depth)
+{
+    if (depth > COMPILED_THEME_MAX_DEPTH || theme->next_node >= theme->node_count)
+        return false;
+
+    const compiled_theme_node& node = theme->nodes[theme->next_node++];
+    if (node.name >= theme->string_size || node.value >= theme->string_size ||
+        node.attrs > theme->attr_count - theme->next_attr)
+        return false;
+
+    for (unsigned int i = 0; i < node.attrs; i++)
+    {
+        const compiled_theme_attr& attr = theme->attrs[theme->next_attr++];
+        if (attr.name >= theme->string_size || attr.value >= theme->string_size)
+            return false;
+    }
+    for (unsigned int i = 0; i < node.children; i++)
+    {
+        if (!CheckCompiledNode(theme, depth + 1))
+            return false;
+    }
+    return true;
+}
+
+static void BuildCompiledNode(compiled_theme* theme, xml_document<>& doc, xml_node<>* parent)
+{
+    const compiled_theme_node& node = theme->nodes[theme->next_node++];
+    xml_node<>* element = parent;
+
+    // Node 0 is the document itself
+    if (parent != &doc || theme->next_node > 1)
+    {
+        char* name = theme->strings + node.name;
+        char* value = theme->strings + node.value;
+        element = doc.allocate_node(node_element, name, value, strlen(name), strlen(value));
+        parent->append_node(element);
+    }
+
+    for (unsigned int i = 0; i < node.attrs; i++)
+    {
+        const compiled_theme_attr& attr = theme->attrs[theme->next_attr++];
+        char* name = theme->strings + attr.name;
+        char* value = theme->strings + attr.value;
+        element->append_attribute(doc.allocate_attribute(name, value, strlen(name), strlen(value)));
+    }
+    for (unsigned int i = 0; i < node.children; i++)
+        BuildCompiledNode(theme, doc, element);
+}
+
+// Returns the compiled theme at path if it is valid and matches key
+static char* ReadCompiledTheme(std::string path, unsigned long long key, size_t* len)
+{
+    compiled_theme theme;
+    compiled_theme_header hdr;
+    struct stat st;
+    char* data;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(hdr))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    data = (char*) malloc(st.st_size);
+    if (!data || read(fd, data, st.st_size) != st.st_size)
+    {
+        close(fd);
+        free(data);
+        return NULL;
+    }
+    close(fd);
+
+    memcpy(&hdr, data, sizeof(hdr));
+    if (memcmp(hdr.magic, COMPILED_THEME_MAGIC, sizeof(hdr.magic)) != 0 || hdr.key != key ||
+        !CompiledThemeSetup(&theme, data, st.st_size) || !CheckCompiledNode(&theme, 0) ||
+        theme.next_node != theme.node_count || theme.next_attr != theme.attr_count)
+    {
+        LOGINFO("Compiled theme '%s' is stale or invalid\n", path.c_str());
+        free(data);
+        return NULL;
+    }
+    *len = st.st_size;
+    return data;
+}
+
+struct compiled_theme_writer
+{
+    std::vector<compiled_theme_node> nodes;
+    std::vector<compiled_theme_attr> attrs;
+    std::string strings;
+    std::map<std::string, unsigned int> offsets;
+};
+
+static unsigned int CompileString(compiled_theme_writer& writer, const char* str, size_t len)
+{
+    std::string value(str, len);
+    std::map<std::string, unsigned int>::iterator it = writer.offsets.find(value);
+
+    if (it != writer.offsets.end())
+        return it->second;
+
+    unsigned int offset = writer.strings.size();
+    writer.strings.append(value);
+    writer.strings.push_back('\0');
+    writer.offsets.insert(std::pair<std::string, unsigned int>(value, offset));
+    return offset;
+}
+
+static void CompileNode(compiled_theme_writer& writer, xml_node<>* node)
+{
+    size_t index = writer.nodes.size();
+    compiled_theme_node entry;
+
+    entry.name = CompileString(writer, node->name(), node->name_size());
+    entry.value = CompileString(writer, node->value(), node->value_size());
+    entry.attrs = 0;
+    entry.children = 0;
+    for (xml_attribute<>* attr = node->first_attribute(); attr; attr = attr->next_attribute())
+    {
+        compiled_theme_attr a;
+        a.name = CompileString(writer, attr->name(), attr->name_size());
+        a.value = CompileString(writer, attr->value(), attr->value_size());
+        writer.attrs.push_back(a);
+        entry.attrs++;
+    }
+    writer.nodes.push_back(entry);
+
+    // Only elements are kept, their text is already in their value
+    for (xml_node<>* child = node->first_node(); child; child = child->next_sibling())
+    {
+        if (child->type() != node_element)
+            continue;
+        CompileNode(writer, child);
+        writer.nodes[index].children++;
+    }
+}
+
+static unsigned long long CompiledThemeKey(std::string package, const ZipEntry* ui_xml)
+{
+    std::ostringstream desc;
+    struct stat st;
+    unsigned long long key = 14695981039346656037ULL; // FNV-1a
+
+    desc << COMPILED_THEME_MAGIC << '|' << package << '|';
+    if (ui_xml)
+        desc << mzGetZipEntryCrc32(ui_xml) << '|' << mzGetZipEntryUncompLen(ui_xml);
+    else if (stat(package.c_str(), &st) == 0)
+        desc << st.st_size << '|' << st.st_mtime;
+
+    std::string str = desc.str();
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        key ^= (unsigned char) str[i];
+        key *= 1099511628211ULL;
+    }
+    return key;
+}
+
+// Compiled themes only live on real storage, which isn't mounted yet
+// while the decrypt page is shown
+static std::string CompiledThemePath(std::string name)
+{
+#ifndef TW_NO_COMPILED_THEME
+    std::string storage = DataManager::GetSettingsStoragePath();
+    if (!storage.empty() && PartitionManager.Is_Mounted_By_Path(storage))
+        return storage + COMPILED_THEME_DIR + "." + name + ".ui";
+#endif
+    return "";
+}
+
+static long ResidentKB(void)
+{
+    long pages = 0, resident = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+
+    if (fp)
+    {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        fclose(fp);
+    }
+    return resident * (getpagesize() / 1024);
+}
+
+PageSet::PageSet(char* xmlFile, size_t compiledLen /* = 0 */)
 {
     mResources = NULL;
     mCurrentPage = NULL;
     mOverlayPage = NULL;
+    mTemplates = NULL;
 
     mXmlFile = xmlFile;
-    if (xmlFile)
+    if (xmlFile && compiledLen)
+    {
+        // ReadCompiledTheme already checked the whole tree
+        compiled_theme theme;
+        if (CompiledThemeSetup(&theme, xmlFile, compiledLen))
+            BuildCompiledNode(&theme, mDoc, &mDoc);
+    }
+    else if (xmlFile)
         mDoc.parse<0>(mXmlFile);
     else
         mCurrentPage = new Page(NULL);
@@ -523,6 +802,8 @@ int PageSet::Load(ZipArchive* package)
     parent = mDoc.first_node("recovery");
     if (!parent)
         parent = mDoc.first_node("install");
+    if (!parent)
+        return -1;
 
     // Now, let's parse the XML
     LOGINFO("Loading resources...\n");
@@ -576,6 +857,47 @@ int PageSet::SetOverlay(Page* page)
     return 0;
 }
 
+int PageSet::SaveCompiled(std::string path, unsigned long long key)
+{
+    compiled_theme_writer writer;
+    compiled_theme_header hdr;
+    std::string tmp = path + ".tmp";
+
+    CompileNode(writer, &mDoc);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, COMPILED_THEME_MAGIC, sizeof(hdr.magic));
+    hdr.key = key;
+    hdr.nodes = writer.nodes.size();
+    hdr.attrs = writer.attrs.size();
+    hdr.strings = writer.strings.size();
+
+    TWFunc::Recursive_Mkdir(TWFunc::Get_Path(path));
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        LOGINFO("Unable to create compiled theme '%s'\n", tmp.c_str());
+        return -1;
+    }
+
+    size_t nodes_len = writer.nodes.size() * sizeof(compiled_theme_node);
+    size_t attrs_len = writer.attrs.size() * sizeof(compiled_theme_attr);
+    bool ok = write(fd, &hdr, sizeof(hdr)) == (ssize_t) sizeof(hdr) &&
+              write(fd, &writer.nodes[0], nodes_len) == (ssize_t) nodes_len &&
+              (attrs_len == 0 || write(fd, &writer.attrs[0], attrs_len) == (ssize_t) attrs_len) &&
+              write(fd, writer.strings.data(), writer.strings.size()) == (ssize_t) writer.strings.size();
+    close(fd);
+
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        LOGINFO("Unable to write compiled theme '%s'\n", path.c_str());
+        unlink(tmp.c_str());
+        return -1;
+    }
+    LOGINFO("Compiled theme written to '%s' (%u nodes)\n", path.c_str(), hdr.nodes);
+    return 0;
+}
+
 Resource* PageSet::FindResource(std::string name)
 {
     return mResources ? mResources->FindResource(name) : NULL;
@@ -584,13 +906,41 @@ Resource* PageSet::FindResource(std::string name)
 Page* PageSet::FindPage(std::string name)
 {
     std::vector<Page*>::iterator iter;
+    Page* page = NULL;
 
+    pthread_mutex_lock(&page_create_lock);
     for (iter = mPages.begin(); iter != mPages.end(); iter++)
     {
         if (name == (*iter)->GetName())
-            return (*iter);
+        {
+            page = (*iter);
+            break;
+        }
     }
-    return NULL;
+
+    // Pages are only created the first time they are shown. Their objects
+    // look up resources through PageManager, which has to see this set
+    // even when it isn't the current one (e.g. overlays from the base set).
+    std::map<std::string, xml_node<>*>::iterator node = mPageNodes.find(name);
+    if (!page && node != mPageNodes.end())
+    {
+        pthread_mutex_lock(&loading_set_lock);
+        PageSet* loading = PageManager::mLoadingSet;
+        PageManager::mLoadingSet = this;
+        PageManager::mLoadingThread = pthread_self();
+        pthread_mutex_unlock(&loading_set_lock);
+
+        page = new Page(node->second, mTemplates);
+
+        pthread_mutex_lock(&loading_set_lock);
+        PageManager::mLoadingSet = loading;
+        pthread_mutex_unlock(&loading_set_lock);
+
+        mPages.push_back(page);
+        mPageNodes.erase(node);
+    }
+    pthread_mutex_unlock(&page_create_lock);
+    return page;
 }
 
 int PageSet::LoadVariables(xml_node<>* vars)
@@ -617,22 +967,21 @@ int PageSet::LoadPages(xml_node<>* pages, xml_node<>* templates /* = NULL */)
 
     if (!pages)    return -1;
 
+    mTemplates = templates;
     child = pages->first_node("page");
     while (child != NULL)
     {
-        Page* page = new Page(child, templates);
-        if (page->GetName().empty())
-        {
+        xml_attribute<>* name = child->first_attribute("name");
+        if (!name || !*name->value())
             LOGERR("Unable to process load page\n");
-            delete page;
-        }
         else
         {
-            mPages.push_back(page);
+            // The first page with a given name wins, as before
+            mPageNodes.insert(std::pair<std::string, xml_node<>*>(name->value(), child));
         }
         child = child->next_sibling("page");
     }
-    if (mPages.size() > 0)
+    if (mPageNodes.size() > 0)
         return 0;
     return -1;
 }
@@ -698,12 +1047,43 @@ int PageManager::LoadPackage(std::string name, std::string package, std::string
     ZipArchive zip, *pZip = NULL;
     long len;
     char* xmlFile = NULL;
+    size_t compiledLen = 0;
+    const ZipEntry* ui_xml = NULL;
+    std::string compiledPath;
+    unsigned long long key = 0;
     PageSet* pageSet = NULL;
+    timespec start, end, diff;
+    long rss = ResidentKB();
     int ret;
 
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
     // Open the XML file
     LOGINFO("Loading package: %s (%s)\n", name.c_str(), package.c_str());
-    if (mzOpenZipArchive(package.c_str(), &zip))
+    if (mzOpenZipArchive(package.c_str(), &zip) == 0)
+    {
+        pZip = &zip;
+        ui_xml = mzFindZipEntry(&zip, "ui.xml");
+        if (ui_xml == NULL)
+        {
+            LOGERR("Unable to locate ui.xml in zip file\n");
+            goto error;
+        }
+    }
+
+    // Use the compiled theme from an earlier boot if ui.xml hasn't changed
+    compiledPath = CompiledThemePath(name);
+    if (!compiledPath.empty())
+    {
+        key = CompiledThemeKey(package, ui_xml);
+        xmlFile = ReadCompiledTheme(compiledPath, key, &compiledLen);
+    }
+
+    if (xmlFile)
+    {
+        // Nothing to extract
+    }
+    else if (!pZip)
     {
         // We can try to load the XML directly...
         struct stat st;
@@ -719,17 +1099,12 @@ int PageManager::LoadPackage(std::string name, std::string package, std::string
 
         read(fd, xmlFile, len);
         close(fd);
+
+        // NULL-terminate the string
+        xmlFile[len] = 0x00;
     }
     else
     {
-        pZip = &zip;
-        const ZipEntry* ui_xml = mzFindZipEntry(&zip, "ui.xml");
-        if (ui_xml == NULL)
-        {
-            LOGERR("Unable to locate ui.xml in zip file\n");
-            goto error;
-        }
-    
         // Allocate the buffer for the file
         len = mzGetZipEntryUncompLen(ui_xml);
         xmlFile = (char*) malloc(len + 1);
@@ -740,18 +1115,21 @@ int PageManager::LoadPackage(std::string name, std::string package, std::string
             LOGERR("Unable to extract ui.xml\n");
             goto error;
         }
-    }
 
-    // NULL-terminate the string
-    xmlFile[len] = 0x00;
+        // NULL-terminate the string
+        xmlFile[len] = 0x00;
+    }
 
     // Before loading, mCurrentSet must be the loading package so we can find resources
     pageSet = mCurrentSet;
-    mCurrentSet = new PageSet(xmlFile);
+    mCurrentSet = new PageSet(xmlFile, compiledLen);
 
     ret = mCurrentSet->Load(pZip);
     if (ret == 0)
     {
+        if (!compiledLen && !compiledPath.empty())
+            mCurrentSet->SaveCompiled(compiledPath, key);
+
         mCurrentSet->SetPage(startpage);
         mPageSets.insert(std::pair<std::string, PageSet*>(name, mCurrentSet));
     }
@@ -767,6 +1145,13 @@ int PageManager::LoadPackage(std::string name, std::string package, std::string
     mCurrentSet = pageSet;
 
     if (pZip)   mzCloseZipArchive(pZip);
+
+    // Compare these between a boot that compiles the theme and the next one
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    diff = TWFunc::timespec_diff(start, end);
+    LOGINFO("Package %s loaded from %s in %ld ms, resident memory +%ld kB\n", name.c_str(),
+            compiledLen ? "compiled theme" : "ui.xml",
+            (long) (diff.tv_sec * 1000 + diff.tv_nsec / 1000000), ResidentKB() - rss);
     return ret;
 
 error:
@@ -859,6 +1244,17 @@ int PageManager::ChangeOverlay(std::string name)
 
 Resource* PageManager::FindResource(std::string name)
 {
+    PageSet* set;
+
+    // Only the thread creating a page looks in the set it belongs to
+    pthread_mutex_lock(&loading_set_lock);
+    set = mLoadingSet;
+    if (set && !pthread_equal(mLoadingThread, pthread_self()))
+        set = NULL;
+    pthread_mutex_unlock(&loading_set_lock);
+
+    if (set)
+        return set->FindResource(name);
     return (mCurrentSet ? mCurrentSet->FindResource(name) : NULL);
 }
 
@@ -3,6 +3,8 @@
 #ifndef _PAGES_HEADER_HPP
 #define _PAGES_HEADER_HPP
 
+#include <pthread.h>
+
 typedef struct {
     unsigned char red;
     unsigned char green;
@@ -58,11 +60,13 @@ protected:
 class PageSet
 {
 public:
-    PageSet(char* xmlFile);
+    // With compiledLen set, xmlFile holds a compiled theme instead of XML
+    PageSet(char* xmlFile, size_t compiledLen = 0);
     virtual ~PageSet();
 
 public:
     int Load(ZipArchive* package);
+    int SaveCompiled(std::string path, unsigned long long key);
 
     Page* FindPage(std::string name);
     int SetPage(std::string page);
@@ -90,6 +94,8 @@ protected:
     xml_document<> mDoc;
     ResourceManager* mResources;
     std::vector<Page*> mPages;
+    std::map<std::string, xml_node<>*> mPageNodes;   // Pages not instantiated until first used
+    xml_node<>* mTemplates;
     Page* mCurrentPage;
 	Page* mOverlayPage;     // This is a special case, used for "locking" the screen
 };
@@ -128,8 +134,12 @@ protected:
     static PageSet* FindPackage(std::string name);
 
 protected:
+    friend class PageSet;
+
     static std::map<std::string, PageSet*> mPageSets;
     static PageSet* mCurrentSet;
+    static PageSet* mLoadingSet;    // Set whose page is being created, for resource lookups
+    static pthread_t mLoadingThread; // Thread creating that page
 	static PageSet* mBaseSet;
 };
 
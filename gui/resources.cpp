@@ -14,6 +14,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include <string>
 #include <sstream>
@@ -27,9 +28,18 @@ extern "C" {
 
 #include "rapidxml.hpp"
 #include "objects.hpp"
+#include "../twrp-functions.hpp"
 
 #define TMP_RESOURCE_NAME   "/tmp/extract.bin"
 
+// Images are decoded on up to this many threads
+#define RESOURCE_DECODE_MAX_THREADS 4
+
+// Raw pixels of every decoded image are cached here, relative to the
+// settings storage, so later boots don't have to decode them again
+#define SURFACE_CACHE_FILE  "/TWRP/theme/.surface_cache"
+#define SURFACE_CACHE_MAGIC "TWRPSRF1"
+
 Resource::Resource(xml_node<>* node, ZipArchive* pZip)
 {
     if (node && node->first_attribute("name"))
@@ -65,6 +75,51 @@ int Resource::ExtractResource(ZipArchive* pZip,
     return ret;
 }
 
+// Queues a zip entry for decoding. It is decoded straight from the
+// archive's mapping, without extracting it to a file first.
+bool Resource::QueueZipSurface(ZipArchive* pZip,
+                               std::string src,
+                               gr_surface* surface,
+                               std::vector<SurfaceRequest>& requests)
+{
+    if (!pZip)  return false;
+
+    const ZipEntry* entry = mzFindZipEntry(pZip, src.c_str());
+    if (entry == NULL)
+        return false;
+
+    SurfaceRequest request;
+    request.file = src;
+    request.entry = entry;
+    request.surface = surface;
+    requests.push_back(request);
+    return true;
+}
+
+// Queues an image from the filesystem, looked up the same way
+// res_create_surface() does
+bool Resource::QueueFileSurface(std::string fileName,
+                                gr_surface* surface,
+                                std::vector<SurfaceRequest>& requests)
+{
+    SurfaceRequest request;
+    struct stat st;
+
+    if (stat(fileName.c_str(), &st) == 0)
+        request.file = fileName;
+    else if (stat(("/res/images/" + fileName + ".png").c_str(), &st) == 0)
+        request.file = "/res/images/" + fileName + ".png";
+    else if (stat(("/res/images/" + fileName).c_str(), &st) == 0)
+        request.file = "/res/images/" + fileName;
+    else
+        return false;
+
+    request.entry = NULL;
+    request.surface = surface;
+    requests.push_back(request);
+    return true;
+}
+
 FontResource::FontResource(xml_node<>* node, ZipArchive* pZip)
  : Resource(node, pZip)
 {
@@ -91,7 +146,7 @@ FontResource::~FontResource()
 {
 }
 
-ImageResource::ImageResource(xml_node<>* node, ZipArchive* pZip)
+ImageResource::ImageResource(xml_node<>* node, ZipArchive* pZip, std::vector<SurfaceRequest>& requests)
  : Resource(node, pZip)
 {
     std::string file;
@@ -102,18 +157,10 @@ ImageResource::ImageResource(xml_node<>* node, ZipArchive* pZip)
     if (node->first_attribute("filename"))
         file = node->first_attribute("filename")->value();
 
-    if (ExtractResource(pZip, "images", file, ".png", TMP_RESOURCE_NAME) == 0)
-    {
-        res_create_surface(TMP_RESOURCE_NAME, &mSurface);
-        unlink(TMP_RESOURCE_NAME);
-    } else if (ExtractResource(pZip, "images", file, "", TMP_RESOURCE_NAME) == 0)
-    {
-        // JPG includes the .jpg extension in the filename so extension should be blank
-		res_create_surface(TMP_RESOURCE_NAME, &mSurface);
-        unlink(TMP_RESOURCE_NAME);
-    }
-    else
-		res_create_surface(file.c_str(), &mSurface);
+    // JPG includes the .jpg extension in the filename so extension should be blank
+    if (!QueueZipSurface(pZip, "images/" + file + ".png", &mSurface, requests) &&
+        !QueueZipSurface(pZip, "images/" + file, &mSurface, requests))
+        QueueFileSurface(file, &mSurface, requests);
 }
 
 ImageResource::~ImageResource()
@@ -122,41 +169,59 @@ ImageResource::~ImageResource()
         res_free_surface(mSurface);
 }
 
-AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip)
+AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip, std::vector<SurfaceRequest>& requests)
  : Resource(node, pZip)
 {
     std::string file;
     int fileNum = 1;
+    std::vector<SurfaceRequest> frames;
 
     if (!node)  return;
 
     if (node->first_attribute("filename"))
         file = node->first_attribute("filename")->value();
 
+    // Count the frames first so the surface vector doesn't move after the
+    // decode requests point into it
     for ( ; ; )
     {
         std::ostringstream fileName;
         fileName << file << std::setfill ('0') << std::setw (3) << fileNum;
 
-        gr_surface surface;
+        bool found;
         if (pZip)
-        {
-            if (ExtractResource(pZip, "images", fileName.str(), ".png", TMP_RESOURCE_NAME) != 0)
-                break;
-    
-            if (res_create_surface(TMP_RESOURCE_NAME, &surface))
-                break;
-
-            unlink(TMP_RESOURCE_NAME);
-        }
+            found = QueueZipSurface(pZip, "images/" + fileName.str() + ".png", NULL, frames);
         else
-        {
-            if (res_create_surface(fileName.str().c_str(), &surface))
-                break;
-        }
-        mSurfaces.push_back(surface);
+            found = QueueFileSurface(fileName.str(), NULL, frames);
+        if (!found)
+            break;
         fileNum++;
     }
+
+    mSurfaces.resize(frames.size(), NULL);
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        frames[i].surface = &mSurfaces[i];
+        requests.push_back(frames[i]);
+    }
+}
+
+// Like before, the animation ends at the first frame that fails to load
+void AnimationResource::SurfacesLoaded(void)
+{
+    std::vector<gr_surface>::iterator it;
+
+    for (it = mSurfaces.begin(); it != mSurfaces.end(); ++it)
+    {
+        if (*it == NULL)
+            break;
+    }
+    for (std::vector<gr_surface>::iterator rest = it; rest != mSurfaces.end(); ++rest)
+    {
+        if (*rest)
+            res_free_surface(*rest);
+    }
+    mSurfaces.erase(it, mSurfaces.end());
 }
 
 AnimationResource::~AnimationResource()
@@ -182,9 +247,244 @@ Resource* ResourceManager::FindResource(std::string name)
     return NULL;
 }
 
+struct SurfaceDecodeQueue
+{
+    std::vector<SurfaceRequest>* requests;
+    ZipArchive* zip;
+    size_t next;
+    pthread_mutex_t lock;
+};
+
+static void DecodeSurface(SurfaceRequest& request, ZipArchive* pZip)
+{
+    if (!request.entry)
+    {
+        if (res_create_surface(request.file.c_str(), request.surface) < 0)
+            *request.surface = NULL;
+        return;
+    }
+
+    // Stored entries are decoded in place, deflated ones are inflated
+    // into memory first
+    const unsigned char* data = mzGetZipEntryMappedData(pZip, request.entry);
+    unsigned char* buffer = NULL;
+    size_t len = mzGetZipEntryUncompLen(request.entry);
+
+    if (data && mzIsZipEntryStored(request.entry))
+    {
+        // Only compLen bytes are known to lie inside the mapping
+        if (mzGetZipEntryCompLen(request.entry) != (long) len)
+            data = NULL;
+    }
+    else if (data)
+    {
+        buffer = (unsigned char*) malloc(len);
+        if (buffer && mzExtractZipEntryToBufferMapped(pZip, request.entry, buffer))
+            data = buffer;
+        else
+            data = NULL;
+    }
+    if (!data || res_create_surface_mem(request.file.c_str(), data, len, request.surface) < 0)
+        *request.surface = NULL;
+    free(buffer);
+}
+
+static void* DecodeThread(void* cookie)
+{
+    SurfaceDecodeQueue* queue = (SurfaceDecodeQueue*) cookie;
+
+    for ( ; ; )
+    {
+        pthread_mutex_lock(&queue->lock);
+        size_t index = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (index >= queue->requests->size())
+            break;
+        DecodeSurface((*queue->requests)[index], queue->zip);
+    }
+    return NULL;
+}
+
+// The cache key covers where every image comes from and its zip CRC or
+// file size and time, so any change to the theme invalidates the cache
+static unsigned long long SurfaceCacheKey(std::vector<SurfaceRequest>& requests)
+{
+    unsigned long long key = 14695981039346656037ULL; // FNV-1a
+    std::vector<SurfaceRequest>::iterator it;
+
+    for (it = requests.begin(); it != requests.end(); ++it)
+    {
+        std::ostringstream desc;
+        struct stat st;
+
+        desc << it->file << '|';
+        if (it->entry)
+            desc << it->entry->crc32 << '|' << it->entry->uncompLen;
+        else if (stat(it->file.c_str(), &st) == 0)
+            desc << st.st_size << '|' << st.st_mtime;
+        desc << ';';
+
+        std::string str = desc.str();
+        for (size_t i = 0; i < str.size(); i++)
+        {
+            key ^= (unsigned char) str[i];
+            key *= 1099511628211ULL;
+        }
+    }
+    return key;
+}
+
+struct SurfaceCacheHeader
+{
+    char magic[8];
+    unsigned long long key;
+    unsigned int count;
+};
+
+static bool ReadSurfaceCache(std::string path, unsigned long long key, std::vector<SurfaceRequest>& requests)
+{
+    struct stat st;
+    SurfaceCacheHeader hdr;
+    size_t pos, i;
+    bool ret = false;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(hdr))
+    {
+        close(fd);
+        return false;
+    }
+
+    unsigned char* data = (unsigned char*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    memcpy(&hdr, data, sizeof(hdr));
+    if (memcmp(hdr.magic, SURFACE_CACHE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.key != key || hdr.count != requests.size())
+        goto done;
+
+    pos = sizeof(hdr);
+    for (i = 0; i < requests.size(); i++)
+    {
+        size_t used;
+        if (res_read_raw_surface(data + pos, st.st_size - pos, &used, requests[i].surface) != 0)
+            break;
+        pos += used;
+    }
+    if (i == requests.size())
+        ret = true;
+    else
+    {
+        // Throw away what was read from the truncated or corrupt cache
+        while (i-- > 0)
+        {
+            if (*requests[i].surface)
+                res_free_surface(*requests[i].surface);
+            *requests[i].surface = NULL;
+        }
+    }
+
+done:
+    munmap(data, st.st_size);
+    return ret;
+}
+
+static void WriteSurfaceCache(std::string path, unsigned long long key, std::vector<SurfaceRequest>& requests)
+{
+    std::string tmp = path + ".tmp";
+    SurfaceCacheHeader hdr;
+    std::vector<SurfaceRequest>::iterator it;
+
+    TWFunc::Recursive_Mkdir(TWFunc::Get_Path(path));
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        LOGINFO("Unable to create theme image cache '%s'\n", tmp.c_str());
+        return;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SURFACE_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.key = key;
+    hdr.count = requests.size();
+    bool ok = (write(fd, &hdr, sizeof(hdr)) == sizeof(hdr));
+    for (it = requests.begin(); ok && it != requests.end(); ++it)
+        ok = (res_write_raw_surface(fd, *it->surface) == 0);
+    close(fd);
+
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        LOGINFO("Unable to write theme image cache '%s'\n", path.c_str());
+        unlink(tmp.c_str());
+    }
+}
+
+void ResourceManager::LoadSurfaces(std::vector<SurfaceRequest>& requests, ZipArchive* pZip)
+{
+    std::string cache_path;
+    unsigned long long key = 0;
+    bool use_cache = false;
+
+    if (requests.empty())
+        return;
+
+    // Only cache on real storage; it isn't mounted yet on encrypted devices
+    std::string storage = DataManager::GetSettingsStoragePath();
+    if (!storage.empty() && PartitionManager.Is_Mounted_By_Path(storage))
+    {
+        use_cache = true;
+        cache_path = storage + SURFACE_CACHE_FILE;
+        key = SurfaceCacheKey(requests);
+        if (ReadSurfaceCache(cache_path, key, requests))
+        {
+            LOGINFO("Loaded %u theme images from cache\n", (unsigned) requests.size());
+            return;
+        }
+    }
+
+    SurfaceDecodeQueue queue;
+    queue.requests = &requests;
+    queue.zip = pZip;
+    queue.next = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1)
+        threads = 1;
+    if (threads > RESOURCE_DECODE_MAX_THREADS)
+        threads = RESOURCE_DECODE_MAX_THREADS;
+    if ((size_t) threads > requests.size())
+        threads = requests.size();
+
+    // The calling thread decodes too, so start one thread less
+    std::vector<pthread_t> workers;
+    for (long i = 1; i < threads; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, DecodeThread, &queue) == 0)
+            workers.push_back(thread);
+    }
+    DecodeThread(&queue);
+    for (size_t i = 0; i < workers.size(); i++)
+        pthread_join(workers[i], NULL);
+    pthread_mutex_destroy(&queue.lock);
+    LOGINFO("Decoded %u theme images on %u threads\n", (unsigned) requests.size(), (unsigned) workers.size() + 1);
+
+    if (use_cache)
+        WriteSurfaceCache(cache_path, key, requests);
+}
+
 ResourceManager::ResourceManager(xml_node<>* resList, ZipArchive* pZip)
 {
     xml_node<>* child;
+    std::vector<Resource*> loaded;
+    std::vector<std::string> types;
+    std::vector<SurfaceRequest> requests;
 
     if (!resList)       return;
 
@@ -196,73 +496,49 @@ ResourceManager::ResourceManager(xml_node<>* resList, ZipArchive* pZip)
             break;
 
 		std::string type = attr->value();
+        Resource* res = NULL;
 
+        // Fonts are loaded right away, images are only queued here and
+        // decoded all at once by LoadSurfaces below
         if (type == "font")
+            res = new FontResource(child, pZip);
+        else if (type == "image")
+            res = new ImageResource(child, pZip, requests);
+        else if (type == "animation")
+            res = new AnimationResource(child, pZip, requests);
+        else
         {
-            FontResource* res = new FontResource(child, pZip);
-            if (res == NULL || res->GetResource() == NULL)
-            {
-                xml_attribute<>* attr_name = child->first_attribute("name");
-
-				if (!attr_name) {
-					std::string res_name = attr_name->value();
-					LOGERR("Resource (%s)-(%s) failed to load\n", type.c_str(), res_name.c_str());
-				} else
-					LOGERR("Resource type (%s) failed to load\n", type.c_str());
-
-                delete res;
-            }
-            else
-            {
-                mResources.push_back((Resource*) res);
-            }
+            LOGERR("Resource type (%s) not supported.\n", type.c_str());
         }
-        else if (type == "image")
+
+        if (res)
         {
-			ImageResource* res = new ImageResource(child, pZip);
-            if (res == NULL || res->GetResource() == NULL)
-            {
-                xml_attribute<>* attr_name = child->first_attribute("name");
-
-				if (!attr_name) {
-					std::string res_name = attr_name->value();
-					LOGERR("Resource (%s)-(%s) failed to load\n", type.c_str(), res_name.c_str());
-				} else
-					LOGERR("Resource type (%s) failed to load\n", type.c_str());
-
-                delete res;
-            }
-            else
-            {
-				mResources.push_back((Resource*) res);
-            }
+            loaded.push_back(res);
+            types.push_back(type);
         }
-        else if (type == "animation")
+        child = child->next_sibling("resource");
+    }
+
+    LoadSurfaces(requests, pZip);
+
+    for (size_t i = 0; i < loaded.size(); i++)
+    {
+        Resource* res = loaded[i];
+
+        res->SurfacesLoaded();
+        if (res->GetResource() == NULL)
         {
-            AnimationResource* res = new AnimationResource(child, pZip);
-            if (res == NULL || res->GetResource() == NULL)
-            {
-                xml_attribute<>* attr_name = child->first_attribute("name");
-
-				if (!attr_name) {
-					std::string res_name = attr_name->value();
-					LOGERR("Resource (%s)-(%s) failed to load\n", type.c_str(), res_name.c_str());
-				} else
-					LOGERR("Resource type (%s) failed to load\n", type.c_str());
-
-                delete res;
-            }
+            if (!res->GetName().empty())
+                LOGERR("Resource (%s)-(%s) failed to load\n", types[i].c_str(), res->GetName().c_str());
             else
-            {
-                mResources.push_back((Resource*) res);
-            }
+                LOGERR("Resource type (%s) failed to load\n", types[i].c_str());
+
+            delete res;
         }
         else
         {
-            LOGERR("Resource type (%s) not supported.\n", type.c_str());
+            mResources.push_back(res);
         }
-
-        child = child->next_sibling("resource");
     }
 }
 
@@ -3,6 +3,15 @@
 #ifndef _RESOURCE_HEADER
 #define _RESOURCE_HEADER
 
+// An image waiting to be decoded into *surface, either from a theme zip
+// entry or from a file. ResourceManager decodes these on worker threads.
+struct SurfaceRequest
+{
+    std::string file;
+    const ZipEntry* entry;
+    gr_surface* surface;
+};
+
 // Base Objects
 class Resource
 {
@@ -12,6 +21,7 @@ public:
 
 public:
     virtual void* GetResource(void) = 0;
+    virtual void SurfacesLoaded(void)   {}
     std::string GetName(void) { return mName; }
 
 private:
@@ -19,6 +29,8 @@ private:
 
 protected:
     static int ExtractResource(ZipArchive* pZip, std::string folderName, std::string fileName, std::string fileExtn, std::string destFile);
+    static bool QueueZipSurface(ZipArchive* pZip, std::string src, gr_surface* surface, std::vector<SurfaceRequest>& requests);
+    static bool QueueFileSurface(std::string fileName, gr_surface* surface, std::vector<SurfaceRequest>& requests);
 };
 
 typedef enum {
@@ -45,7 +57,7 @@ protected:
 class ImageResource : public Resource
 {
 public:
-    ImageResource(xml_node<>* node, ZipArchive* pZip);
+    ImageResource(xml_node<>* node, ZipArchive* pZip, std::vector<SurfaceRequest>& requests);
     virtual ~ImageResource();
 
 public:
@@ -58,13 +70,14 @@ protected:
 class AnimationResource : public Resource
 {
 public:
-    AnimationResource(xml_node<>* node, ZipArchive* pZip);
+    AnimationResource(xml_node<>* node, ZipArchive* pZip, std::vector<SurfaceRequest>& requests);
     virtual ~AnimationResource();
 
 public:
-    virtual void* GetResource(void)         { return mSurfaces.at(0); }
+    virtual void* GetResource(void)         { return mSurfaces.empty() ? NULL : mSurfaces.at(0); }
     virtual void* GetResource(int entry)    { return mSurfaces.at(entry); }
     virtual int GetResourceCount(void)      { return mSurfaces.size(); }
+    virtual void SurfacesLoaded(void);
 
 protected:
     std::vector<gr_surface> mSurfaces;
@@ -79,6 +92,9 @@ public:
 public:
     Resource* FindResource(std::string name);
 
+private:
+    void LoadSurfaces(std::vector<SurfaceRequest>& requests, ZipArchive* pZip);
+
 private:
     std::vector<Resource*> mResources;
 };
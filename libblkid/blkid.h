@@ -231,6 +231,7 @@ extern void blkid_reset_probe(blkid_probe pr);
 
 extern int blkid_probe_set_device(blkid_probe pr, int fd,
 	                blkid_loff_t off, blkid_loff_t size);
+extern int blkid_probe_enable_prefetch(blkid_probe pr, int enable);
 
 extern dev_t blkid_probe_get_devno(blkid_probe pr)
 			__ul_attribute__((nonnull))
@@ -406,6 +407,8 @@ extern blkid_partition blkid_parttable_get_parent(blkid_parttable tab)
 extern int blkid_do_probe(blkid_probe pr);
 extern int blkid_do_safeprobe(blkid_probe pr);
 extern int blkid_do_fullprobe(blkid_probe pr);
+extern int blkid_probe_devices_types(const char **devices, char **types,
+			size_t count, int nthreads);
 
 extern int blkid_probe_numof_values(blkid_probe pr)
 			__ul_attribute__((warn_unused_result));
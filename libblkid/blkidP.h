@@ -221,6 +221,16 @@ struct blkid_struct_probe
 #define BLKID_FL_PRIVATE_FD	(1 << 1)	/* see blkid_new_probe_from_filename() */
 #define BLKID_FL_TINY_DEV	(1 << 2)	/* <= 1.47MiB (floppy or so) */
 #define BLKID_FL_CDROM_DEV	(1 << 3)	/* is a CD/DVD drive */
+#define BLKID_FL_PREFETCH	(1 << 4)	/* see blkid_probe_enable_prefetch() */
+#define BLKID_FL_PREFETCHED	(1 << 5)	/* current buffers include the prefetch */
+
+/*
+ * Areas read in one go when prefetching. The head covers the magics of
+ * nearly all filesystems and partition tables (btrfs sits at 64KiB), the
+ * tail covers RAID metadata and backup GPT headers.
+ */
+#define BLKID_PREFETCH_HEAD	(68 * 1024)
+#define BLKID_PREFETCH_TAIL	(64 * 1024)
 
 /* private per-probing flags */
 #define BLKID_PROBE_FL_IGNORE_PT (1 << 1)	/* ignore partition table */
@@ -103,6 +103,7 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 #ifdef HAVE_LIBUUID
 # include <uuid.h>
@@ -523,10 +524,101 @@ int __blkid_probe_filter_types(blkid_probe pr, int chain, int flag, char *names[
 	return 0;
 }
 
-unsigned char *blkid_probe_get_buffer(blkid_probe pr,
+static struct blkid_bufinfo *blkid_probe_find_buffer(blkid_probe pr,
 				blkid_loff_t off, blkid_loff_t len)
 {
 	struct list_head *p;
+
+	list_for_each(p, &pr->buffers) {
+		struct blkid_bufinfo *x =
+				list_entry(p, struct blkid_bufinfo, bufs);
+
+		if (x->off <= off && off + len <= x->off + x->len) {
+			DBG(DEBUG_LOWPROBE,
+				printf("\treuse buffer: off=%jd len=%jd pr=%p\n",
+							x->off, x->len, pr));
+			return x;
+		}
+	}
+	return NULL;
+}
+
+static struct blkid_bufinfo *blkid_probe_read_buffer(blkid_probe pr,
+				blkid_loff_t off, blkid_loff_t len)
+{
+	struct blkid_bufinfo *bf;
+	ssize_t ret;
+
+	if (blkid_llseek(pr->fd, pr->off + off, SEEK_SET) < 0)
+		return NULL;
+
+	/* allocate info and space for data by why call */
+	bf = calloc(1, sizeof(struct blkid_bufinfo) + len);
+	if (!bf)
+		return NULL;
+
+	bf->data = ((unsigned char *) bf) + sizeof(struct blkid_bufinfo);
+	bf->len = len;
+	bf->off = off;
+	INIT_LIST_HEAD(&bf->bufs);
+
+	DBG(DEBUG_LOWPROBE,
+		printf("\tbuffer read: off=%jd len=%jd pr=%p\n",
+			off, len, pr));
+
+	ret = read_all(pr->fd, (char *) bf->data, len);
+	if (ret != (ssize_t) len) {
+		free(bf);
+		return NULL;
+	}
+	list_add_tail(&bf->bufs, &pr->buffers);
+	return bf;
+}
+
+/*
+ * Reads the areas most probers look at with two large reads, so that the
+ * many small superblock reads of the probing chains are served from memory
+ * rather than each seeking the device.
+ */
+static void blkid_probe_prefetch(blkid_probe pr)
+{
+	blkid_loff_t head = BLKID_PREFETCH_HEAD, tail = BLKID_PREFETCH_TAIL;
+
+	pr->flags |= BLKID_FL_PREFETCHED;
+
+	if (head > pr->size)
+		head = pr->size;
+	blkid_probe_read_buffer(pr, 0, head);
+
+	if (pr->size - head >= tail)
+		blkid_probe_read_buffer(pr, pr->size - tail, tail);
+}
+
+/**
+ * blkid_probe_enable_prefetch:
+ * @pr: probe
+ * @enable: TRUE/FALSE
+ *
+ * Enables batched reading of the superblock areas for the probe. The head
+ * and tail of the device are read once, before the first buffer request
+ * that they can serve.
+ *
+ * Returns: 0 on success, or -1 in case of error.
+ */
+int blkid_probe_enable_prefetch(blkid_probe pr, int enable)
+{
+	if (!pr)
+		return -1;
+	if (enable)
+		pr->flags |= BLKID_FL_PREFETCH;
+	else
+		pr->flags &= ~BLKID_FL_PREFETCH;
+	return 0;
+}
+
+unsigned char *blkid_probe_get_buffer(blkid_probe pr,
+				blkid_loff_t off, blkid_loff_t len)
+{
 	struct blkid_bufinfo *bf = NULL;
 
 	if (pr->size <= 0)
@@ -547,45 +639,16 @@ unsigned char *blkid_probe_get_buffer(blkid_probe pr,
 				pr->off + off - pr->parent->off, len);
 	}
 
-	list_for_each(p, &pr->buffers) {
-		struct blkid_bufinfo *x =
-				list_entry(p, struct blkid_bufinfo, bufs);
-
-		if (x->off <= off && off + len <= x->off + x->len) {
-			DBG(DEBUG_LOWPROBE,
-				printf("\treuse buffer: off=%jd len=%jd pr=%p\n",
-							x->off, x->len, pr));
-			bf = x;
-			break;
-		}
-	}
-	if (!bf) {
-		ssize_t ret;
-
-		if (blkid_llseek(pr->fd, pr->off + off, SEEK_SET) < 0)
-			return NULL;
-
-		/* allocate info and space for data by why call */
-		bf = calloc(1, sizeof(struct blkid_bufinfo) + len);
-		if (!bf)
-			return NULL;
-
-		bf->data = ((unsigned char *) bf) + sizeof(struct blkid_bufinfo);
-		bf->len = len;
-		bf->off = off;
-		INIT_LIST_HEAD(&bf->bufs);
-
-		DBG(DEBUG_LOWPROBE,
-			printf("\tbuffer read: off=%jd len=%jd pr=%p\n",
-				off, len, pr));
-
-		ret = read(pr->fd, bf->data, len);
-		if (ret != (ssize_t) len) {
-			free(bf);
-			return NULL;
-		}
-		list_add_tail(&bf->bufs, &pr->buffers);
+	bf = blkid_probe_find_buffer(pr, off, len);
+	if (!bf && (pr->flags & BLKID_FL_PREFETCH) &&
+	    !(pr->flags & BLKID_FL_PREFETCHED)) {
+		blkid_probe_prefetch(pr);
+		bf = blkid_probe_find_buffer(pr, off, len);
 	}
+	if (!bf)
+		bf = blkid_probe_read_buffer(pr, off, len);
+	if (!bf)
+		return NULL;
 
 	return off ? bf->data + (off - bf->off) : bf->data;
 }
@@ -600,6 +663,8 @@ static void blkid_probe_reset_buffer(blkid_probe pr)
 
 	DBG(DEBUG_LOWPROBE, printf("reseting probing buffers pr=%p\n", pr));
 
+	pr->flags &= ~BLKID_FL_PREFETCHED;
+
 	while (!list_empty(&pr->buffers)) {
 		struct blkid_bufinfo *bf = list_entry(pr->buffers.next,
 						struct blkid_bufinfo, bufs);
@@ -1166,6 +1231,114 @@ done:
 	return count ? 0 : 1;
 }
 
+struct blkid_types_job {
+	const char	**devices;
+	char		**types;
+	size_t		count;
+	size_t		next;
+	int		found;
+	pthread_mutex_t	lock;
+};
+
+static char *blkid_probe_device_type(const char *devname)
+{
+	blkid_probe pr;
+	const char *type;
+	char *res = NULL;
+
+	pr = blkid_new_probe_from_filename(devname);
+	if (!pr)
+		return NULL;
+
+	blkid_probe_enable_prefetch(pr, TRUE);
+	if (blkid_do_fullprobe(pr) == 0 &&
+	    blkid_probe_lookup_value(pr, "TYPE", &type, NULL) == 0)
+		res = strdup(type);
+
+	blkid_free_probe(pr);
+	return res;
+}
+
+static void *blkid_types_worker(void *data)
+{
+	struct blkid_types_job *job = data;
+
+	for (;;) {
+		size_t i;
+		char *type;
+
+		pthread_mutex_lock(&job->lock);
+		i = job->next++;
+		pthread_mutex_unlock(&job->lock);
+		if (i >= job->count)
+			break;
+
+		type = job->devices[i] ? blkid_probe_device_type(job->devices[i]) : NULL;
+
+		pthread_mutex_lock(&job->lock);
+		job->types[i] = type;
+		if (type)
+			job->found++;
+		pthread_mutex_unlock(&job->lock);
+	}
+	return NULL;
+}
+
+/**
+ * blkid_probe_devices_types:
+ * @devices: array of device names, NULL entries are skipped
+ * @types: array of @count pointers, receives the TYPE of every device
+ * @count: number of devices
+ * @nthreads: number of probing threads, <= 0 for one per online CPU
+ *
+ * Probes the superblocks of all @devices concurrently, with prefetching
+ * enabled for each of them (see blkid_probe_enable_prefetch()). Each
+ * detected type is allocated by strdup() and has to be freed by the
+ * caller; devices that can't be probed get NULL.
+ *
+ * Returns: number of devices with a detected type, or -1 in case of error.
+ */
+int blkid_probe_devices_types(const char **devices, char **types,
+			size_t count, int nthreads)
+{
+	struct blkid_types_job job;
+	pthread_t *threads;
+	int i, started = 0;
+
+	if (!devices || !types)
+		return -1;
+
+	memset(types, 0, count * sizeof(char *));
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads <= 0)
+		nthreads = 1;
+	if ((size_t) nthreads > count)
+		nthreads = count;
+
+	job.devices = devices;
+	job.types = types;
+	job.count = count;
+	job.next = 0;
+	job.found = 0;
+	pthread_mutex_init(&job.lock, NULL);
+
+	/* the calling thread probes as well */
+	threads = calloc(nthreads, sizeof(pthread_t));
+	for (i = 1; threads && i < nthreads; i++) {
+		if (pthread_create(&threads[started], NULL,
+				   blkid_types_worker, &job) == 0)
+			started++;
+	}
+	blkid_types_worker(&job);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	pthread_mutex_destroy(&job.lock);
+	return job.found;
+}
+
 /**
  * blkid_do_fullprobe:
  * @pr: prober
@@ -41,6 +41,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <paths.h>
+#include <pthread.h>
 
 #include "defines.h"
 
@@ -50,6 +51,9 @@ static struct pid {
 	pid_t pid;
 } *pidlist;
 
+/* pidlist is shared by every thread that runs commands */
+static pthread_mutex_t pidlist_lock = PTHREAD_MUTEX_INITIALIZER;
+
 FILE *
 __popen(const char *program, const char *type)
 {
@@ -71,8 +75,10 @@ __popen(const char *program, const char *type)
 		return (NULL);
 	}
 
+	pthread_mutex_lock(&pidlist_lock);
 	switch (pid = vfork()) {
 	case -1:			/* Error. */
+		pthread_mutex_unlock(&pidlist_lock);
 		(void)close(pdes[0]);
 		(void)close(pdes[1]);
 		free(cur);
@@ -128,6 +134,7 @@ __popen(const char *program, const char *type)
 	cur->pid =  pid;
 	cur->next = pidlist;
 	pidlist = cur;
+	pthread_mutex_unlock(&pidlist_lock);
 
 	return (iop);
 }
@@ -145,12 +152,22 @@ __pclose(FILE *iop)
 	pid_t pid;
 
 	/* Find the appropriate file pointer. */
+	pthread_mutex_lock(&pidlist_lock);
 	for (last = NULL, cur = pidlist; cur; last = cur, cur = cur->next)
 		if (cur->fp == iop)
 			break;
 
-	if (cur == NULL)
+	if (cur == NULL) {
+		pthread_mutex_unlock(&pidlist_lock);
 		return (-1);
+	}
+
+	/* Remove the entry from the linked list. */
+	if (last == NULL)
+		pidlist = cur->next;
+	else
+		last->next = cur->next;
+	pthread_mutex_unlock(&pidlist_lock);
 
 	(void)fclose(iop);
 
@@ -158,11 +175,6 @@ __pclose(FILE *iop)
 		pid = waitpid(cur->pid, &pstat, 0);
 	} while (pid == -1 && errno == EINTR);
 
-	/* Remove the entry from the linked list. */
-	if (last == NULL)
-		pidlist = cur->next;
-	else
-		last->next = cur->next;
 	free(cur);
 
 	return (pid == -1 ? -1 : pstat);
@@ -27,6 +27,7 @@ LOCAL_MODULE_TAGS := eng
 LOCAL_MODULE := libminadbd
 
 LOCAL_SHARED_LIBRARIES := libcutils libc
+LOCAL_STATIC_LIBRARIES := libmincrypt
 include $(BUILD_SHARED_LIBRARY)
 
 
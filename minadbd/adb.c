@@ -130,16 +130,45 @@ void  adb_trace_init(void)
 }
 
 
+/* Every packet has room for MAX_PAYLOAD, so released packets are kept on
+** a short free list and handed out again instead of going back to malloc.
+*/
+#define APACKET_POOL_MAX 8
+
+ADB_MUTEX_DEFINE( apacket_lock );
+static apacket *apacket_pool;
+static int apacket_pool_count;
+
 apacket *get_apacket(void)
 {
-    apacket *p = malloc(sizeof(apacket));
-    if(p == 0) fatal("failed to allocate an apacket");
+    apacket *p;
+
+    adb_mutex_lock(&apacket_lock);
+    p = apacket_pool;
+    if(p) {
+        apacket_pool = p->next;
+        apacket_pool_count--;
+    }
+    adb_mutex_unlock(&apacket_lock);
+
+    if(p == 0) {
+        p = malloc(sizeof(apacket));
+        if(p == 0) fatal("failed to allocate an apacket");
+    }
     memset(p, 0, sizeof(apacket) - MAX_PAYLOAD);
     return p;
 }
 
 void put_apacket(apacket *p)
 {
+    adb_mutex_lock(&apacket_lock);
+    if(apacket_pool_count < APACKET_POOL_MAX) {
+        p->next = apacket_pool;
+        apacket_pool = p;
+        apacket_pool_count++;
+        p = 0;
+    }
+    adb_mutex_unlock(&apacket_lock);
     free(p);
 }
 
@@ -308,6 +337,12 @@ void handle_packet(apacket *p, atransport *t)
 
     case A_CNXN: /* CONNECT(version, maxdata, "system-id-string") */
             /* XXX verify version, etc */
+        t->max_payload = p->msg.arg1;
+        if(t->max_payload > MAX_PAYLOAD)
+            t->max_payload = MAX_PAYLOAD;
+        if(t->max_payload < MAX_PAYLOAD_V1)
+            t->max_payload = MAX_PAYLOAD_V1;
+        D("%s: max payload %d\n", t->serial, (int) t->max_payload);
         if(t->connection_state != CS_OFFLINE) {
             t->connection_state = CS_OFFLINE;
             handle_offline(t);
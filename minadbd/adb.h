@@ -18,11 +18,19 @@
 #define __ADB_H
 
 #include <limits.h>
+#include <stdint.h>
+
+#include "mincrypt/sha.h"
 
 #include "transport.h"  /* readx(), writex() */
 #include "fdevent.h"
 
-#define MAX_PAYLOAD 4096
+/* Payloads of up to MAX_PAYLOAD are accepted and advertised in CONNECT.
+** Hosts that predate larger payloads advertise and accept MAX_PAYLOAD_V1,
+** so outgoing data is sized by atransport.max_payload instead.
+*/
+#define MAX_PAYLOAD_V1 4096
+#define MAX_PAYLOAD (256*1024)
 
 #define A_SYNC 0x434e5953
 #define A_CNXN 0x4e584e43
@@ -190,6 +198,9 @@ struct atransport
         /* a list of adisconnect callbacks called when the transport is kicked */
     int          kicked;
     adisconnect  disconnects;
+
+        /* largest payload the remote accepts, from its CONNECT message */
+    size_t max_payload;
 };
 
 
@@ -416,4 +427,20 @@ int handle_host_request(char *service, transport_type ttype, char* serial, int r
 //#define ADB_SIDELOAD_FILENAME "/tmp/update.zip"
 extern char ADB_SIDELOAD_FILENAME[255];
 
+// The sideload service hashes the package while it is being received and
+// leaves the result here, so that the signature check does not have to
+// read the whole package back from storage.
+#define ADB_SIDELOAD_DIGEST "/tmp/sideload.digest"
+
+typedef struct sideload_digest {
+    char path[255];
+    uint64_t size;          // bytes received
+    int64_t mtime;          // of the package once it was written
+    int64_t ctime;
+    uint64_t dev;           // the package must still be this very file
+    uint64_t ino;
+    uint64_t signed_len;    // bytes covered by the whole-file signature
+    uint8_t sha1[SHA_DIGEST_SIZE];
+} sideload_digest;
+
 #endif
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2013 TeamWin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures sideload throughput through the minadbd packet path.
+ *
+ * A forked child runs minadbd's transport, socket and sideload code on one
+ * end of a socketpair, registered as a socket transport, while the parent
+ * plays the host: it connects, opens "sideload:<size>" and streams the data
+ * in WRTE packets, waiting for each OKAY like adb does. This is run once
+ * with a host that only takes MAX_PAYLOAD_V1 and once with one that takes
+ * MAX_PAYLOAD, and reports MB/s for each. Builds against the minadbd
+ * sources and the socket transport from system/core:
+ *   cc -O2 -DADB_HOST=0 -D_GNU_SOURCE -I.. -I$TOP/system/core/include \
+ *      main.c ../adb.c ../fdevent.c ../sockets.c ../services.c \
+ *      ../transport.c ../transport_usb.c ../usb_linux_client.c ../utils.c \
+ *      $TOP/system/core/adb/transport_local.c -lmincrypt -lpthread
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "sysdeps.h"
+#include "adb.h"
+
+#define LOCAL_ID 1
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int send_msg(int fd, unsigned command, unsigned arg0, unsigned arg1,
+                    const void *data, unsigned len)
+{
+    const unsigned char *x = data;
+    amessage msg;
+    unsigned i;
+
+    msg.command = command;
+    msg.arg0 = arg0;
+    msg.arg1 = arg1;
+    msg.data_length = len;
+    msg.data_check = 0;
+    for (i = 0; i < len; i++)
+        msg.data_check += x[i];
+    msg.magic = command ^ 0xffffffff;
+    if (writex(fd, &msg, sizeof(msg)))
+        return -1;
+    return len ? writex(fd, data, len) : 0;
+}
+
+static int recv_msg(int fd, amessage *msg, unsigned char *data)
+{
+    if (readx(fd, msg, sizeof(*msg)))
+        return -1;
+    if (msg->magic != (msg->command ^ 0xffffffff) ||
+        msg->data_length > MAX_PAYLOAD)
+        return -1;
+    return msg->data_length ? readx(fd, data, msg->data_length) : 0;
+}
+
+static void run_device(int fd, const char *path)
+{
+    strcpy(ADB_SIDELOAD_FILENAME, path);
+    init_transport_registration();
+    register_socket_transport(fd, "bench", 0, 0);
+    fdevent_loop();
+    exit(1);
+}
+
+/* Plays the host side of one sideload of size bytes, offering host_payload
+ * in CONNECT. Returns the elapsed seconds, or a negative value on failure.
+ */
+static double run_host(int fd, unsigned size, unsigned host_payload,
+                       unsigned *device_payload)
+{
+    unsigned char *data = malloc(MAX_PAYLOAD);
+    unsigned remote = 0, sent = 0, chunk;
+    char service[32];
+    amessage msg;
+    double start = 0;
+    int ready = 0;
+
+    memset(data, 0xa5, MAX_PAYLOAD);
+    if (send_msg(fd, A_CNXN, A_VERSION, host_payload, "host::", 7))
+        goto fail;
+    do {
+        if (recv_msg(fd, &msg, data))
+            goto fail;
+    } while (msg.command != A_CNXN);
+    *device_payload = msg.arg1;
+
+    snprintf(service, sizeof(service), "sideload:%u", size);
+    start = now();
+    if (send_msg(fd, A_OPEN, LOCAL_ID, 0, service, strlen(service) + 1))
+        goto fail;
+
+    for (;;) {
+        if (recv_msg(fd, &msg, data))
+            goto fail;
+        if (msg.command == A_OKAY) {
+            remote = msg.arg0;
+            ready = 1;
+        } else if (msg.command == A_WRTE) {
+            /* the service answers "OKAY" or "FAIL" once it has everything */
+            if (msg.data_length < 4 || memcmp(data, "OKAY", 4))
+                goto fail;
+            break;
+        } else if (msg.command == A_CLSE) {
+            goto fail;
+        }
+        if (ready && sent < size) {
+            chunk = size - sent < host_payload ? size - sent : host_payload;
+            memset(data, 0xa5, chunk);
+            if (send_msg(fd, A_WRTE, LOCAL_ID, remote, data, chunk))
+                goto fail;
+            sent += chunk;
+            ready = 0;
+        }
+    }
+    free(data);
+    return now() - start;
+
+fail:
+    free(data);
+    return -1;
+}
+
+static int bench(unsigned size, unsigned host_payload, const char *path)
+{
+    unsigned device_payload = 0;
+    double elapsed;
+    int s[2];
+    pid_t pid;
+
+    if (adb_socketpair(s)) {
+        perror("socketpair");
+        return 1;
+    }
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        adb_close(s[1]);
+        run_device(s[0], path);
+    }
+    adb_close(s[0]);
+
+    elapsed = run_host(s[1], size, host_payload, &device_payload);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    adb_close(s[1]);
+    adb_unlink(path);
+
+    if (elapsed < 0) {
+        fprintf(stderr, "sideload with a %u byte host payload failed\n",
+                host_payload);
+        return 1;
+    }
+    printf("host payload %6u, device payload %6u: %8.1f MB/s\n",
+           host_payload, device_payload, size / elapsed / (1024 * 1024));
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = "/tmp/minadbd-bench.zip";
+    unsigned size = 64;
+    int c;
+
+    while ((c = getopt(argc, argv, "s:o:")) != -1) {
+        switch (c) {
+        case 's':
+            size = atoi(optarg);
+            break;
+        case 'o':
+            path = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-s MiB] [-o file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    size *= 1024 * 1024;
+    if (bench(size, MAX_PAYLOAD_V1, path) || bench(size, MAX_PAYLOAD, path))
+        return 1;
+    return 0;
+}
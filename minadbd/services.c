@@ -19,6 +19,8 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
 
 #include "sysdeps.h"
 #include "fdevent.h"
@@ -43,33 +45,147 @@ void *service_bootstrap_func(void *x)
     return 0;
 }
 
+// Reads are sized to take a whole transport packet at a time.
+#define SIDELOAD_BUFFER_SIZE MAX_PAYLOAD
+
+// The whole-file signature covers everything but the zip comment (at most
+// 65535 bytes) and its 2-byte length, so that much of the end of the stream
+// is held back from the hash until the footer has arrived.
+#define SIDELOAD_TAIL_SIZE (65535 + 2)
+// A read must not overwrite the held-back tail before it has been hashed.
+#define SIDELOAD_RING_SIZE (SIDELOAD_TAIL_SIZE + SIDELOAD_BUFFER_SIZE)
+
+static void sideload_hash(SHA_CTX* ctx, const unsigned char* ring,
+                          uint64_t from, uint64_t to)
+{
+    while (from < to) {
+        size_t off = from % SIDELOAD_RING_SIZE;
+        size_t len = SIDELOAD_RING_SIZE - off;
+        if (len > to - from) len = to - from;
+        SHA_update(ctx, ring + off, len);
+        from += len;
+    }
+}
+
+// Finishes the hash over the signed part of the package, using the footer
+// the signing tool appends to the zip comment, and records it for
+// verify_file_digest(). Unsigned packages get no digest.
+static void sideload_finish_digest(SHA_CTX* ctx, const unsigned char* ring,
+                                   uint64_t hashed, uint64_t total,
+                                   int package_fd)
+{
+    unsigned char footer[6];
+    sideload_digest digest;
+    unsigned comment_size;
+    struct stat st;
+    int i, fd;
+
+    if (total < sizeof(footer) || fstat(package_fd, &st) != 0)
+        return;
+    for (i = 0; i < (int) sizeof(footer); i++)
+        footer[i] = ring[(total - sizeof(footer) + i) % SIDELOAD_RING_SIZE];
+    if (footer[2] != 0xff || footer[3] != 0xff)
+        return;
+    comment_size = footer[4] + (footer[5] << 8);
+    if (comment_size + 2 > total)
+        return;
+
+    memset(&digest, 0, sizeof(digest));
+    strncpy(digest.path, ADB_SIDELOAD_FILENAME, sizeof(digest.path) - 1);
+    digest.size = total;
+    digest.mtime = st.st_mtime;
+    digest.ctime = st.st_ctime;
+    digest.dev = st.st_dev;
+    digest.ino = st.st_ino;
+    digest.signed_len = total - comment_size - 2;
+    sideload_hash(ctx, ring, hashed, digest.signed_len);
+    memcpy(digest.sha1, SHA_final(ctx), SHA_DIGEST_SIZE);
+
+    fd = adb_creat(ADB_SIDELOAD_DIGEST, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "failed to create %s\n", ADB_SIDELOAD_DIGEST);
+        return;
+    }
+    if (writex(fd, &digest, sizeof(digest)))
+        adb_unlink(ADB_SIDELOAD_DIGEST);
+    adb_close(fd);
+}
+
+static int sideload_has_space(unsigned count)
+{
+    char dir[sizeof(ADB_SIDELOAD_FILENAME)];
+    struct statfs st;
+    char* slash;
+
+    strcpy(dir, ADB_SIDELOAD_FILENAME);
+    slash = strrchr(dir, '/');
+    if (slash == NULL)
+        return 1;
+    *(slash == dir ? slash + 1 : slash) = '\0';
+    if (statfs(dir, &st) != 0)
+        return 1; // let the writes report the problem
+    if ((uint64_t) st.f_bavail * st.f_bsize < count) {
+        fprintf(stderr, "not enough space in %s for %u byte package\n",
+                dir, count);
+        return 0;
+    }
+    return 1;
+}
+
 static void sideload_service(int s, void *cookie)
 {
-    unsigned char buf[4096];
     unsigned count = (unsigned) cookie;
+    unsigned char* ring;
+    uint64_t received = 0, hashed = 0;
+    SHA_CTX ctx;
     int fd;
 
     fprintf(stderr, "sideload_service invoked\n");
 
+    ring = malloc(SIDELOAD_RING_SIZE);
+    if (ring == NULL || !sideload_has_space(count)) {
+        free(ring);
+        writex(s, "FAIL", 4);
+        adb_close(s);
+        return;
+    }
+
+    adb_unlink(ADB_SIDELOAD_DIGEST);
     fd = adb_creat(ADB_SIDELOAD_FILENAME, 0644);
     if(fd < 0) {
         fprintf(stderr, "failed to create %s\n", ADB_SIDELOAD_FILENAME);
+        free(ring);
         adb_close(s);
         return;
     }
 
+    SHA_init(&ctx);
     while(count > 0) {
-        unsigned xfer = (count > 4096) ? 4096 : count;
-        if(readx(s, buf, xfer)) break;
-        if(writex(fd, buf, xfer)) break;
-        count -= xfer;
+        size_t off = received % SIDELOAD_RING_SIZE;
+        size_t xfer = SIDELOAD_BUFFER_SIZE;
+        int r;
+
+        if (xfer > SIDELOAD_RING_SIZE - off) xfer = SIDELOAD_RING_SIZE - off;
+        if (xfer > count) xfer = count;
+        r = adb_read(s, ring + off, xfer);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        if(writex(fd, ring + off, r)) break;
+        count -= r;
+        received += r;
+        if (received > hashed + SIDELOAD_TAIL_SIZE) {
+            sideload_hash(&ctx, ring, hashed, received - SIDELOAD_TAIL_SIZE);
+            hashed = received - SIDELOAD_TAIL_SIZE;
+        }
     }
 
     if(count == 0) {
+        sideload_finish_digest(&ctx, ring, hashed, received, fd);
         writex(s, "OKAY", 4);
     } else {
         writex(s, "FAIL", 4);
     }
+    free(ring);
     adb_close(fd);
     adb_close(s);
 
@@ -78,6 +194,8 @@ static void sideload_service(int s, void *cookie)
         sleep(1);
         exit(0);
     }
+    // don't leave a partial package behind on storage
+    adb_unlink(ADB_SIDELOAD_FILENAME);
 }
 
 
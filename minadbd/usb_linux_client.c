@@ -94,16 +94,27 @@ int usb_write(usb_handle *h, const void *data, int len)
     return 0;
 }
 
+/* The f_adb gadget driver refuses reads larger than its bulk buffer, so
+** payloads above MAX_PAYLOAD_V1 are read straight into place in pieces.
+*/
+#define USB_READ_MAX 4096
+
 int usb_read(usb_handle *h, void *data, int len)
 {
-    int n;
+    char *p = data;
+    int n, want;
 
     D("about to read (fd=%d, len=%d)\n", h->fd, len);
-    n = adb_read(h->fd, data, len);
-    if(n != len) {
-        D("ERROR: fd = %d, n = %d, errno = %d (%s)\n",
-            h->fd, n, errno, strerror(errno));
-        return -1;
+    while(len > 0) {
+        want = len < USB_READ_MAX ? len : USB_READ_MAX;
+        n = adb_read(h->fd, p, want);
+        if(n != want) {
+            D("ERROR: fd = %d, n = %d, errno = %d (%s)\n",
+                h->fd, n, errno, strerror(errno));
+            return -1;
+        }
+        p += n;
+        len -= n;
     }
     D("[ done fd=%d ]\n", h->fd);
     return 0;
@@ -17,6 +17,8 @@
 #ifndef _MINUI_H_
 #define _MINUI_H_
 
+#include <stddef.h>
+
 typedef void* gr_surface;
 typedef unsigned short gr_pixel;
 
@@ -63,8 +65,16 @@ int ev_get(struct input_event *ev, unsigned dont_wait);
 
 // Returns 0 if no error, else negative.
 int res_create_surface(const char* name, gr_surface* pSurface);
+// Decodes a PNG or JPG image that is already in memory. name is only used
+// for error messages. Safe to call from several threads at once.
+int res_create_surface_mem(const char* name, const unsigned char* data, size_t len, gr_surface* pSurface);
 void res_free_surface(gr_surface surface);
 
+// Raw pixel dumps of decoded surfaces, used to cache theme images.
+// A NULL surface is written as an empty record and read back as NULL.
+int res_write_raw_surface(int fd, gr_surface surface);
+int res_read_raw_surface(const unsigned char* data, size_t len, size_t* used, gr_surface* pSurface);
+
 // Needed for AOSP:
 int ev_wait(int timeout);
 void ev_dispatch(void);
@@ -15,6 +15,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <fcntl.h>
@@ -31,6 +32,11 @@
 
 #include <png.h>
 #include "../libjpegtwrp/jpeglib.h"
+#include "../libjpegtwrp/jerror.h"
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
 
 #include "minui.h"
 
@@ -42,59 +48,53 @@ double pow(double x, double y) {
     return x;
 }
 
-int res_create_surface_png(const char* name, gr_surface* pSurface) {
-    GGLSurface* surface = NULL;
-    int result = 0;
-    unsigned char header[8];
-    png_structp png_ptr = NULL;
-    png_infop info_ptr = NULL;
-
-    FILE* fp = fopen(name, "rb");
-    if (fp == NULL) {
-        char resPath[256];
-
-        snprintf(resPath, sizeof(resPath)-1, "/res/images/%s.png", name);
-        resPath[sizeof(resPath)-1] = '\0';
-        fp = fopen(resPath, "rb");
-        if (fp == NULL)
-        {
-            result = -1;
-            goto exit;
-        }
-    }
-
-    size_t bytesRead = fread(header, 1, sizeof(header), fp);
-    if (bytesRead != sizeof(header)) {
-        result = -2;
-        goto exit;
-    }
-
-    if (png_sig_cmp(header, 0, sizeof(header))) {
-        result = -3;
-        goto exit;
+// Expands a row of packed RGB pixels to RGBX in place. The row buffer
+// must be 4 * width bytes long. Pixels are moved from the end of the row
+// backwards, so every source pixel is read before it can be overwritten.
+static void expand_rgb_row(unsigned char* pRow, int width) {
+    int x = width - 1;
+
+#ifdef __ARM_NEON__
+    // Handle the pixels past the last multiple of 8 one at a time, then
+    // let NEON de-interleave and re-interleave 8 pixels per iteration
+    for (; x >= 0 && ((x + 1) & 7); x--) {
+        pRow[x * 4 + 2] = pRow[x * 3 + 2];
+        pRow[x * 4 + 1] = pRow[x * 3 + 1];
+        pRow[x * 4    ] = pRow[x * 3    ];
+        pRow[x * 4 + 3] = 0xff;
     }
-
-    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (!png_ptr) {
-        result = -4;
-        goto exit;
+    for (x -= 7; x >= 0; x -= 8) {
+        uint8x8x3_t rgb = vld3_u8(pRow + x * 3);
+        uint8x8x4_t rgbx;
+        rgbx.val[0] = rgb.val[0];
+        rgbx.val[1] = rgb.val[1];
+        rgbx.val[2] = rgb.val[2];
+        rgbx.val[3] = vdup_n_u8(0xff);
+        vst4_u8(pRow + x * 4, rgbx);
     }
-
-    info_ptr = png_create_info_struct(png_ptr);
-    if (!info_ptr) {
-        result = -5;
-        goto exit;
+#else
+    for(; x >= 0; x--) {
+        int sx = x * 3;
+        int dx = x * 4;
+        unsigned char r = pRow[sx];
+        unsigned char g = pRow[sx + 1];
+        unsigned char b = pRow[sx + 2];
+        unsigned char a = 0xff;
+        pRow[dx    ] = r; // r
+        pRow[dx + 1] = g; // g
+        pRow[dx + 2] = b; // b
+        pRow[dx + 3] = a;
     }
+#endif
+}
 
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        result = -6;
-        goto exit;
-    }
+// Reads the image described by an already initialized libpng reader into
+// a new surface. The surface is stored in *pSurface as soon as it is
+// allocated so that the caller can free it if libpng longjmps out.
+static int png_read_surface(png_structp png_ptr, png_infop info_ptr, GGLSurface** pSurface) {
+    GGLSurface* surface;
 
     png_set_packing(png_ptr);
-
-    png_init_io(png_ptr, fp);
-    png_set_sig_bytes(png_ptr, sizeof(header));
     png_read_info(png_ptr, info_ptr);
 
     size_t width = info_ptr->width;
@@ -110,14 +110,13 @@ int res_create_surface_png(const char* name, gr_surface* pSurface) {
            (channels == 4 && color_type == PNG_COLOR_TYPE_RGBA) ||
            (channels == 1 && color_type == PNG_COLOR_TYPE_PALETTE)))) {
         return -7;
-        goto exit;
     }
 
     surface = malloc(sizeof(GGLSurface) + pixelSize);
     if (surface == NULL) {
-        result = -8;
-        goto exit;
+        return -8;
     }
+    *pSurface = surface;
     unsigned char* pData = (unsigned char*) (surface + 1);
     surface->version = sizeof(GGLSurface);
     surface->width = width;
@@ -136,20 +135,7 @@ int res_create_surface_png(const char* name, gr_surface* pSurface) {
         for (y = 0; y < (int) height; ++y) {
             unsigned char* pRow = pData + y * stride;
             png_read_row(png_ptr, pRow, NULL);
-
-            int x;
-            for(x = width - 1; x >= 0; x--) {
-                int sx = x * 3;
-                int dx = x * 4;
-                unsigned char r = pRow[sx];
-                unsigned char g = pRow[sx + 1];
-                unsigned char b = pRow[sx + 2];
-                unsigned char a = 0xff;
-                pRow[dx    ] = r; // r
-                pRow[dx + 1] = g; // g
-                pRow[dx + 2] = b; // b
-                pRow[dx + 3] = a;
-            }
+            expand_rgb_row(pRow, width);
         }
     } else {
         for (y = 0; y < (int) height; ++y) {
@@ -157,8 +143,63 @@ int res_create_surface_png(const char* name, gr_surface* pSurface) {
             png_read_row(png_ptr, pRow, NULL);
         }
     }
+    return 0;
+}
 
-    *pSurface = (gr_surface) surface;
+int res_create_surface_png(const char* name, gr_surface* pSurface) {
+    GGLSurface* surface = NULL;
+    int result = 0;
+    unsigned char header[8];
+    png_structp png_ptr = NULL;
+    png_infop info_ptr = NULL;
+
+    FILE* fp = fopen(name, "rb");
+    if (fp == NULL) {
+        char resPath[256];
+
+        snprintf(resPath, sizeof(resPath)-1, "/res/images/%s.png", name);
+        resPath[sizeof(resPath)-1] = '\0';
+        fp = fopen(resPath, "rb");
+        if (fp == NULL)
+        {
+            result = -1;
+            goto exit;
+        }
+    }
+
+    size_t bytesRead = fread(header, 1, sizeof(header), fp);
+    if (bytesRead != sizeof(header)) {
+        result = -2;
+        goto exit;
+    }
+
+    if (png_sig_cmp(header, 0, sizeof(header))) {
+        result = -3;
+        goto exit;
+    }
+
+    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png_ptr) {
+        result = -4;
+        goto exit;
+    }
+
+    info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr) {
+        result = -5;
+        goto exit;
+    }
+
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        result = -6;
+        goto exit;
+    }
+
+    png_init_io(png_ptr, fp);
+    png_set_sig_bytes(png_ptr, sizeof(header));
+    result = png_read_surface(png_ptr, info_ptr, &surface);
+    if (result == 0)
+        *pSurface = (gr_surface) surface;
 
 exit:
     png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
@@ -174,48 +215,83 @@ exit:
     return result;
 }
 
-int res_create_surface_jpg(const char* name, gr_surface* pSurface) {
+typedef struct {
+    const unsigned char* data;
+    size_t len;
+    size_t pos;
+} png_mem_source;
+
+static void png_read_mem(png_structp png_ptr, png_bytep out, png_size_t count) {
+    png_mem_source* src = (png_mem_source*) png_get_io_ptr(png_ptr);
+
+    if (count > src->len - src->pos)
+        png_error(png_ptr, "read past end of data");
+    memcpy(out, src->data + src->pos, count);
+    src->pos += count;
+}
+
+static int res_create_surface_png_mem(const unsigned char* data, size_t len, gr_surface* pSurface) {
     GGLSurface* surface = NULL;
     int result = 0;
-    struct jpeg_decompress_struct cinfo;
-    struct jpeg_error_mgr jerr;
+    png_structp png_ptr = NULL;
+    png_infop info_ptr = NULL;
+    png_mem_source src = { data, len, 8 };
 
-    FILE* fp = fopen(name, "rb");
-    if (fp == NULL) {
-        char resPath[256];
+    if (len < 8 || png_sig_cmp((png_bytep) data, 0, 8)) {
+        return -3;
+    }
 
-        snprintf(resPath, sizeof(resPath)-1, "/res/images/%s", name);
-        resPath[sizeof(resPath)-1] = '\0';
-        fp = fopen(resPath, "rb");
-        if (fp == NULL) {
-            result = -1;
-            goto exit;
-        }
+    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png_ptr) {
+        return -4;
     }
 
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_decompress(&cinfo);
+    info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr) {
+        result = -5;
+        goto exit;
+    }
 
-    /* Specify data source for decompression */
-    jpeg_stdio_src(&cinfo, fp);
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        result = -6;
+        goto exit;
+    }
+
+    png_set_read_fn(png_ptr, &src, png_read_mem);
+    png_set_sig_bytes(png_ptr, 8);
+    result = png_read_surface(png_ptr, info_ptr, &surface);
+    if (result == 0)
+        *pSurface = (gr_surface) surface;
+
+exit:
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    if (result < 0 && surface) {
+        free(surface);
+    }
+    return result;
+}
+
+// Decodes an image from a JPEG reader whose source is already set up
+static int jpg_read_surface(struct jpeg_decompress_struct* cinfo, GGLSurface** pSurface) {
+    GGLSurface* surface;
 
     /* Read file header, set default decompression parameters */
-    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK)
-        goto exit;
+    if (jpeg_read_header(cinfo, TRUE) != JPEG_HEADER_OK)
+        return 0;
 
     /* Start decompressor */
-    (void) jpeg_start_decompress(&cinfo);
+    (void) jpeg_start_decompress(cinfo);
 
-    size_t width = cinfo.image_width;
-    size_t height = cinfo.image_height;
+    size_t width = cinfo->image_width;
+    size_t height = cinfo->image_height;
     size_t stride = 4 * width;
     size_t pixelSize = stride * height;
 
     surface = malloc(sizeof(GGLSurface) + pixelSize);
     if (surface == NULL) {
-        result = -8;
-        goto exit;
+        return -8;
     }
+    *pSurface = surface;
 
     unsigned char* pData = (unsigned char*) (surface + 1);
     surface->version = sizeof(GGLSurface);
@@ -228,23 +304,40 @@ int res_create_surface_jpg(const char* name, gr_surface* pSurface) {
     int y;
     for (y = 0; y < (int) height; ++y) {
         unsigned char* pRow = pData + y * stride;
-        jpeg_read_scanlines(&cinfo, &pRow, 1);
-
-        int x;
-        for(x = width - 1; x >= 0; x--) {
-            int sx = x * 3;
-            int dx = x * 4;
-            unsigned char r = pRow[sx];
-            unsigned char g = pRow[sx + 1];
-            unsigned char b = pRow[sx + 2];
-            unsigned char a = 0xff;
-            pRow[dx    ] = r; // r
-            pRow[dx + 1] = g; // g
-            pRow[dx + 2] = b; // b
-            pRow[dx + 3] = a;
+        jpeg_read_scanlines(cinfo, &pRow, 1);
+        expand_rgb_row(pRow, width);
+    }
+    return 0;
+}
+
+int res_create_surface_jpg(const char* name, gr_surface* pSurface) {
+    GGLSurface* surface = NULL;
+    int result = 0;
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+
+    FILE* fp = fopen(name, "rb");
+    if (fp == NULL) {
+        char resPath[256];
+
+        snprintf(resPath, sizeof(resPath)-1, "/res/images/%s", name);
+        resPath[sizeof(resPath)-1] = '\0';
+        fp = fopen(resPath, "rb");
+        if (fp == NULL) {
+            result = -1;
+            goto exit;
         }
     }
-    *pSurface = (gr_surface) surface;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+
+    /* Specify data source for decompression */
+    jpeg_stdio_src(&cinfo, fp);
+
+    result = jpg_read_surface(&cinfo, &surface);
+    if (result == 0 && surface)
+        *pSurface = (gr_surface) surface;
 
 exit:
     if (fp != NULL)
@@ -263,6 +356,71 @@ exit:
     return result;
 }
 
+static void jpg_mem_init_source(j_decompress_ptr cinfo) {
+}
+
+static boolean jpg_mem_fill_input_buffer(j_decompress_ptr cinfo) {
+    static const JOCTET eoi[2] = { (JOCTET) 0xFF, (JOCTET) JPEG_EOI };
+
+    // All of the data was handed over up front, so running out means the
+    // image is truncated. Insert a fake EOI marker like jdatasrc.c does.
+    WARNMS(cinfo, JWRN_JPEG_EOF);
+    cinfo->src->next_input_byte = eoi;
+    cinfo->src->bytes_in_buffer = 2;
+    return TRUE;
+}
+
+static void jpg_mem_skip_input_data(j_decompress_ptr cinfo, long num_bytes) {
+    struct jpeg_source_mgr* src = cinfo->src;
+
+    if (num_bytes <= 0)
+        return;
+    if ((size_t) num_bytes > src->bytes_in_buffer) {
+        jpg_mem_fill_input_buffer(cinfo);
+        return;
+    }
+    src->next_input_byte += num_bytes;
+    src->bytes_in_buffer -= num_bytes;
+}
+
+static void jpg_mem_term_source(j_decompress_ptr cinfo) {
+}
+
+static int res_create_surface_jpg_mem(const unsigned char* data, size_t len, gr_surface* pSurface) {
+    GGLSurface* surface = NULL;
+    int result;
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    struct jpeg_source_mgr src;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+
+    memset(&src, 0, sizeof(src));
+    src.next_input_byte = data;
+    src.start_input_byte = data;
+    src.bytes_in_buffer = len;
+    src.init_source = jpg_mem_init_source;
+    src.fill_input_buffer = jpg_mem_fill_input_buffer;
+    src.skip_input_data = jpg_mem_skip_input_data;
+    src.resync_to_restart = jpeg_resync_to_restart; /* use default method */
+    src.term_source = jpg_mem_term_source;
+    cinfo.src = &src;
+
+    result = jpg_read_surface(&cinfo, &surface);
+    if (surface) {
+        (void) jpeg_finish_decompress(&cinfo);
+        if (result < 0)
+            free(surface);
+        else
+            *pSurface = (gr_surface) surface;
+    } else if (result == 0) {
+        result = -3;
+    }
+    jpeg_destroy_decompress(&cinfo);
+    return result;
+}
+
 int res_create_surface(const char* name, gr_surface* pSurface) {
     int ret;
 
@@ -278,6 +436,91 @@ int res_create_surface(const char* name, gr_surface* pSurface) {
     return ret;
 }
 
+int res_create_surface_mem(const char* name, const unsigned char* data, size_t len, gr_surface* pSurface) {
+    if (!data || !len)  return -1;
+
+    if (len >= 8 && png_sig_cmp((png_bytep) data, 0, 8) == 0)
+        return res_create_surface_png_mem(data, len, pSurface);
+    if (len >= 2 && data[0] == 0xFF && data[1] == 0xD8)
+        return res_create_surface_jpg_mem(data, len, pSurface);
+
+    printf("Unknown image format for '%s'\n", name ? name : "(null)");
+    return -3;
+}
+
+// Decoded surfaces can be written out and read back as raw pixels, which
+// is much cheaper than decoding the PNG/JPG again. The record is a small
+// header followed by width * height RGBX/RGBA pixels.
+typedef struct {
+    unsigned int width;
+    unsigned int height;
+    unsigned int format;
+} raw_surface_header;
+
+int res_write_raw_surface(int fd, gr_surface surface) {
+    GGLSurface* pSurface = (GGLSurface*) surface;
+    raw_surface_header hdr;
+    size_t len, done = 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    if (pSurface) {
+        hdr.width = pSurface->width;
+        hdr.height = pSurface->height;
+        hdr.format = pSurface->format;
+    }
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+        return -1;
+    if (!pSurface)
+        return 0;
+
+    len = (size_t) hdr.width * hdr.height * 4;
+    while (done < len) {
+        ssize_t w = write(fd, (unsigned char*) pSurface->data + done, len - done);
+        if (w <= 0)
+            return -1;
+        done += w;
+    }
+    return 0;
+}
+
+int res_read_raw_surface(const unsigned char* data, size_t len, size_t* used, gr_surface* pSurface) {
+    raw_surface_header hdr;
+    GGLSurface* surface;
+    size_t pixelSize;
+
+    if (len < sizeof(hdr))
+        return -1;
+    memcpy(&hdr, data, sizeof(hdr));
+    *used = sizeof(hdr);
+    if (hdr.width == 0 || hdr.height == 0) {
+        // The image failed to load when the cache was written
+        *pSurface = NULL;
+        return 0;
+    }
+    if (hdr.width > 8192 || hdr.height > 8192 ||
+        (hdr.format != GGL_PIXEL_FORMAT_RGBX_8888 && hdr.format != GGL_PIXEL_FORMAT_RGBA_8888))
+        return -1;
+
+    pixelSize = (size_t) hdr.width * hdr.height * 4;
+    if (len - sizeof(hdr) < pixelSize)
+        return -1;
+
+    surface = malloc(sizeof(GGLSurface) + pixelSize);
+    if (surface == NULL)
+        return -8;
+    surface->version = sizeof(GGLSurface);
+    surface->width = hdr.width;
+    surface->height = hdr.height;
+    surface->stride = hdr.width; /* Yes, pixels, not bytes */
+    surface->data = (unsigned char*) (surface + 1);
+    surface->format = hdr.format;
+    memcpy(surface->data, data + sizeof(hdr), pixelSize);
+
+    *used += pixelSize;
+    *pSurface = (gr_surface) surface;
+    return 0;
+}
+
 void res_free_surface(gr_surface surface) {
     GGLSurface* pSurface = (GGLSurface*) surface;
     if (pSurface) {
@@ -22,7 +22,9 @@
 #include <unistd.h>
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "DirUtil.h"
 
@@ -297,3 +299,385 @@ dirSetHierarchyPermissions(const char *path,
 
     return 0;
 }
+
+/*
+ * Batched chown/chmod.  The rules are applied in one walk over the
+ * trees they cover; the rule with the highest index that covers an
+ * inode decides its owner and mode, so the result is the same as
+ * applying the rules one after the other.
+ */
+
+/* Directories are walked on up to this many threads.  A thread hands a
+ * subdirectory to the others only while some of them are idle, so small
+ * trees stay on one thread.
+ */
+#define DIR_PERM_MAX_THREADS 4
+
+typedef struct {
+    char *path;                 // canonical path of the rule's target
+    const DirPermissionRule *rule;
+    int index;
+    bool visited;
+} PermTarget;
+
+typedef struct PermDir {
+    struct PermDir *next;
+    char *path;
+    int inherit;                // recursive rule covering this directory
+} PermDir;
+
+typedef struct {
+    const DirPermissionRule *rules;
+    PermTarget *targets;        // sorted by path
+    int numTargets;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    PermDir *pending;
+    int idle;
+    int active;
+    int threads;
+    int failed;                 // non-recursive rules that failed
+} PermWalk;
+
+static int
+comparePermTargets(const void *a, const void *b)
+{
+    const PermTarget *ta = (const PermTarget *)a;
+    const PermTarget *tb = (const PermTarget *)b;
+    int diff = strcmp(ta->path, tb->path);
+    return diff != 0 ? diff : ta->index - tb->index;
+}
+
+/* Resolve everything but the last component, which the rules apply to
+ * without following it.
+ */
+static char *
+canonicalRulePath(const char *path, bool followLast)
+{
+    char resolved[PATH_MAX];
+    char *dir, *slash, *ret;
+
+    if (followLast) {
+        return realpath(path, resolved) ? strdup(resolved) : NULL;
+    }
+    dir = strdup(path);
+    if (dir == NULL) {
+        return NULL;
+    }
+    while ((slash = strrchr(dir, '/')) != NULL && slash[1] == '\0' &&
+            slash != dir) {
+        *slash = '\0';
+    }
+    slash = strrchr(dir, '/');
+    if (slash == NULL || slash == dir) {
+        ret = slash == NULL ? NULL : strdup(dir);
+        free(dir);
+        return ret;
+    }
+    *slash = '\0';
+    if (realpath(dir, resolved) == NULL ||
+            strlen(resolved) + strlen(slash + 1) + 2 > PATH_MAX) {
+        free(dir);
+        return NULL;
+    }
+    if (strcmp(resolved, "/") != 0) {
+        strcat(resolved, "/");
+    }
+    strcat(resolved, slash + 1);
+    free(dir);
+    return strdup(resolved);
+}
+
+/* Find the rules targeting path and fold them into the covering
+ * recursive rule (*inherit) and the rule for path itself (returned).
+ */
+static int
+lookupPermTargets(PermWalk *w, const char *path, int *inherit)
+{
+    int low = 0, high = w->numTargets;
+    int best = -1;
+
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (strcmp(w->targets[mid].path, path) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    for (; low < w->numTargets && !strcmp(w->targets[low].path, path);
+            low++) {
+        PermTarget *t = w->targets + low;
+        t->visited = true;
+        if (t->rule->recursive && t->index > *inherit) {
+            *inherit = t->index;
+        }
+        best = t->index;        // sorted by index within a path
+    }
+    return best > *inherit ? best : *inherit;
+}
+
+/* chown/chmod one inode unless it already has the rule's owner and mode.
+ * Changing the owner clears the set-id bits, so the mode is always
+ * rewritten after a chown.
+ */
+static int
+applyPermRule(int dfd, const char *name, const struct stat *st,
+        const DirPermissionRule *rule)
+{
+    mode_t mode = (S_ISDIR(st->st_mode) ? rule->dirMode : rule->fileMode)
+            & 07777;
+    bool chowned = false;
+
+    if (st->st_uid != (uid_t)rule->uid || st->st_gid != (gid_t)rule->gid) {
+        if (fchownat(dfd, name, rule->uid, rule->gid, AT_SYMLINK_NOFOLLOW)) {
+            return -1;
+        }
+        chowned = true;
+    }
+    if (chowned || (st->st_mode & 07777) != mode) {
+        if (fchmodat(dfd, name, mode, 0)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void
+queuePermDir(PermWalk *w, const char *path, int inherit)
+{
+    PermDir *d = (PermDir *)malloc(sizeof(PermDir));
+    if (d == NULL || (d->path = strdup(path)) == NULL) {
+        free(d);
+        return;
+    }
+    d->inherit = inherit;
+    pthread_mutex_lock(&w->lock);
+    d->next = w->pending;
+    w->pending = d;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* Walk the directory open on dfd, whose path is in path[0..len).
+ * Takes ownership of dfd.
+ */
+static void
+walkPermDir(PermWalk *w, int dfd, char *path, size_t len, int inherit)
+{
+    DIR *dir = fdopendir(dfd);
+    const struct dirent *de;
+
+    if (dir == NULL) {
+        close(dfd);
+        return;
+    }
+    while ((de = readdir(dir)) != NULL) {
+        struct stat st;
+        size_t nameLen;
+        int here, best;
+
+        if (!strcmp(de->d_name, "..") || !strcmp(de->d_name, ".")) {
+            continue;
+        }
+        nameLen = strlen(de->d_name);
+        if (len + 1 + nameLen >= PATH_MAX) {
+            continue;
+        }
+        if (fstatat(dfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) ||
+                S_ISLNK(st.st_mode)) {
+            continue;
+        }
+        path[len] = '/';
+        memcpy(path + len + 1, de->d_name, nameLen + 1);
+
+        here = inherit;
+        best = lookupPermTargets(w, path, &here);
+        if (best >= 0 && applyPermRule(dfd, de->d_name, &st,
+                w->rules + best) && !w->rules[best].recursive) {
+            pthread_mutex_lock(&w->lock);
+            w->failed++;
+            pthread_mutex_unlock(&w->lock);
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            if (w->idle > 0) {
+                queuePermDir(w, path, here);
+            } else {
+                int cfd = openat(dfd, de->d_name,
+                        O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+                if (cfd >= 0) {
+                    walkPermDir(w, cfd, path, len + 1 + nameLen, here);
+                }
+            }
+        }
+        path[len] = '\0';
+    }
+    closedir(dir);
+}
+
+static void *
+permWorker(void *cookie)
+{
+    PermWalk *w = (PermWalk *)cookie;
+    char path[PATH_MAX];
+
+    pthread_mutex_lock(&w->lock);
+    while (true) {
+        PermDir *d;
+
+        while (w->pending == NULL && w->active > 0) {
+            w->idle++;
+            pthread_cond_wait(&w->cond, &w->lock);
+            w->idle--;
+        }
+        d = w->pending;
+        if (d == NULL) {
+            break;
+        }
+        w->pending = d->next;
+        w->active++;
+        pthread_mutex_unlock(&w->lock);
+
+        int dfd = open(d->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        if (dfd >= 0) {
+            size_t len = strlen(d->path);
+            memcpy(path, d->path, len + 1);
+            if (len == 1) {
+                len = 0;        // the root, don't double the slash
+            }
+            walkPermDir(w, dfd, path, len, d->inherit);
+        }
+        free(d->path);
+        free(d);
+
+        pthread_mutex_lock(&w->lock);
+        w->active--;
+        if (w->active == 0 && w->pending == NULL) {
+            pthread_cond_broadcast(&w->cond);
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/* Apply the rule for one of the targets itself, then queue its
+ * directory if a recursive rule covers it.
+ */
+static void
+startPermTarget(PermWalk *w, PermTarget *t)
+{
+    struct stat st;
+    int here = -1, best;
+
+    if (t->visited) {
+        return;
+    }
+    if (t->rule->recursive) {
+        if (lstat(t->path, &st) || S_ISLNK(st.st_mode)) {
+            t->visited = true;
+            return;
+        }
+    } else if (stat(t->path, &st)) {
+        t->visited = true;
+        w->failed++;
+        return;
+    }
+    best = lookupPermTargets(w, t->path, &here);
+    if (applyPermRule(AT_FDCWD, t->path, &st, w->rules + best) &&
+            !w->rules[best].recursive) {
+        w->failed++;
+    }
+    if (here >= 0 && S_ISDIR(st.st_mode)) {
+        queuePermDir(w, t->path, here);
+    }
+}
+
+static int
+permThreads(void)
+{
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > DIR_PERM_MAX_THREADS) threads = DIR_PERM_MAX_THREADS;
+    if (threads < 1) threads = 1;
+    return threads;
+}
+
+static void
+runPermWalk(PermWalk *w)
+{
+    pthread_t workers[DIR_PERM_MAX_THREADS];
+    int i, started = 0;
+
+    for (i = 1; i < w->threads; i++) {
+        if (pthread_create(&workers[started], NULL, permWorker, w) == 0) {
+            started++;
+        }
+    }
+    permWorker(w);
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+}
+
+int
+dirSetHierarchyPermissionsBatch(const DirPermissionRule *rules, int count)
+{
+    PermWalk w;
+    int i, n = 0;
+
+    memset(&w, 0, sizeof(w));
+    w.rules = rules;
+    w.targets = (PermTarget *)calloc(count, sizeof(PermTarget));
+    if (w.targets == NULL) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        PermTarget *t = w.targets + n;
+        t->path = canonicalRulePath(rules[i].path, !rules[i].recursive);
+        t->rule = rules + i;
+        t->index = i;
+        if (t->path != NULL) {
+            n++;
+        } else if (!rules[i].recursive) {
+            w.failed++;
+        }
+    }
+    w.numTargets = n;
+    qsort(w.targets, n, sizeof(PermTarget), comparePermTargets);
+
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.cond, NULL);
+    w.threads = permThreads();
+
+    /* Walk from the outermost targets first; a target nested in one of
+     * them is found (and marked visited) by the walk.  Sorting puts
+     * "/a" right before everything under "/a/", so one pass finds them.
+     */
+    int pass;
+    for (pass = 0; pass < 2; pass++) {
+        const char *outer = NULL;
+        size_t outerLen = 0;
+        for (i = 0; i < n; i++) {
+            PermTarget *t = w.targets + i;
+            if (pass == 0 && outer != NULL &&
+                    !strncmp(t->path, outer, outerLen) &&
+                    (t->path[outerLen] == '/' || outerLen == 1)) {
+                continue;
+            }
+            if (pass == 0 && t->rule->recursive) {
+                outer = t->path;
+                outerLen = strlen(outer);
+            }
+            startPermTarget(&w, t);
+        }
+        runPermWalk(&w);
+    }
+
+    pthread_cond_destroy(&w.cond);
+    pthread_mutex_destroy(&w.lock);
+    for (i = 0; i < n; i++) {
+        free(w.targets[i].path);
+    }
+    free(w.targets);
+    return w.failed;
+}
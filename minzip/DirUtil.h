@@ -60,6 +60,30 @@ int dirUnlinkHierarchy(const char *path);
 int dirSetHierarchyPermissions(const char *path,
          int uid, int gid, int dirMode, int fileMode);
 
+/* One chown/chmod request for dirSetHierarchyPermissionsBatch().
+ * A recursive rule works like dirSetHierarchyPermissions(); otherwise
+ * only path itself is changed, following symlinks like chown/chmod.
+ */
+typedef struct {
+    const char *path;
+    int uid;
+    int gid;
+    int dirMode;
+    int fileMode;
+    bool recursive;
+} DirPermissionRule;
+
+/* Applies the rules with the same result as applying them one after
+ * the other, in a single walk of the trees they cover.  Inodes that
+ * already have the right owner and mode are left alone, and large
+ * trees are walked on several threads.
+ *
+ * Returns the number of non-recursive rules that could not be applied;
+ * recursive rules skip what they can't change.
+ */
+int dirSetHierarchyPermissionsBatch(const DirPermissionRule *rules,
+        int count);
+
 #ifdef __cplusplus
 }
 #endif
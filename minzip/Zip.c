@@ -3,12 +3,14 @@
  *
  * Simple Zip file support.
  */
+#define _GNU_SOURCE     // for fallocate()
 #include "safe_iop.h"
 #include "zlib.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdint.h>     // for uintptr_t
 #include <stdlib.h>
 #include <sys/stat.h>   // for S_ISLNK()
@@ -25,6 +27,9 @@
 
 #define SORT_ENTRIES 1
 
+#define UNZIP_DIRMODE 0755
+#define UNZIP_FILEMODE 0644
+
 /*
  * Offset and length constants (java.util.zip naming convention).
  */
@@ -511,6 +516,14 @@ const ZipEntry* mzFindZipEntry(const ZipArchive* pArchive,
                 itemHash, (char*) entryName, hashcmpZipName, false);
 }
 
+/*
+ * Return true if the entry is stored without compression.
+ */
+bool mzIsZipEntryStored(const ZipEntry* pEntry)
+{
+    return pEntry->compression == STORED;
+}
+
 /*
  * Return true if the entry is a symbolic link.
  */
@@ -847,6 +860,75 @@ bool mzExtractZipEntryToBuffer(const ZipArchive *pArchive,
 }
 
 
+/*
+ * Like mzExtractZipEntryToBuffer(), but the data is taken from the
+ * archive's memory mapping instead of being read through its file
+ * descriptor, so several threads can extract entries at the same time.
+ */
+bool mzExtractZipEntryToBufferMapped(const ZipArchive *pArchive,
+    const ZipEntry *pEntry, unsigned char *buffer)
+{
+    const unsigned char *data = mzGetZipEntryMappedData(pArchive, pEntry);
+    z_stream zstream;
+    int zerr;
+
+    if (data == NULL)
+        return false;
+
+    if (pEntry->compression == STORED) {
+        /* Only compLen is known to be inside the mapping */
+        if (pEntry->compLen != pEntry->uncompLen) {
+            LOGW("Stored entry '%.*s' has compLen %ld but uncompLen %ld\n",
+                pEntry->fileNameLen, pEntry->fileName,
+                pEntry->compLen, pEntry->uncompLen);
+            return false;
+        }
+        memcpy(buffer, data, pEntry->compLen);
+        return true;
+    }
+    if (pEntry->compression != DEFLATED) {
+        LOGE("Unsupported compression type %d for entry '%s'\n",
+                pEntry->compression, pEntry->fileName);
+        return false;
+    }
+
+    memset(&zstream, 0, sizeof(zstream));
+    zstream.next_in = (Bytef*) data;
+    zstream.avail_in = pEntry->compLen;
+    zstream.next_out = (Bytef*) buffer;
+    zstream.avail_out = pEntry->uncompLen;
+
+    /* Raw deflate data, see processDeflatedEntry() */
+    zerr = inflateInit2(&zstream, -MAX_WBITS);
+    if (zerr != Z_OK) {
+        LOGE("Call to inflateInit2 failed (zerr=%d)\n", zerr);
+        return false;
+    }
+    zerr = inflate(&zstream, Z_FINISH);
+    inflateEnd(&zstream);
+    if (zerr != Z_STREAM_END || (long) zstream.total_out != pEntry->uncompLen) {
+        LOGW("Can't inflate '%.*s' from the mapped archive (zerr=%d)\n",
+                pEntry->fileNameLen, pEntry->fileName, zerr);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Returns a pointer to the entry's compressed data inside the archive's
+ * memory mapping, or NULL if it does not fit in the mapping.
+ */
+const unsigned char *mzGetZipEntryMappedData(const ZipArchive *pArchive,
+    const ZipEntry *pEntry)
+{
+    if (pArchive->map.addr == NULL || pEntry->offset < 0 ||
+            (size_t) pEntry->offset > pArchive->map.length ||
+            (size_t) pEntry->compLen > pArchive->map.length - pEntry->offset)
+        return NULL;
+    return (const unsigned char *) pArchive->map.addr + pEntry->offset;
+}
+
+
 /* Helper state to make path translation easier and less malloc-happy.
  */
 typedef struct {
@@ -907,6 +989,336 @@ static const char *targetEntryPath(MzPathHelper *helper, ZipEntry *pEntry)
     return helper->buf;
 }
 
+#if SORT_ENTRIES
+/*
+ * Returns the index of the first entry whose name does not sort before
+ * prefix.  Since the entries are sorted, all the entries that start with
+ * prefix follow it contiguously.
+ */
+static unsigned int findFirstEntry(const ZipArchive *pArchive,
+        const char *prefix, unsigned int prefixLen)
+{
+    unsigned int low = 0;
+    unsigned int high = pArchive->numEntries;
+
+    while (low < high) {
+        unsigned int mid = low + ((high - low) / 2);
+        const ZipEntry *pEntry = pArchive->pEntries + mid;
+        unsigned int len = pEntry->fileNameLen < prefixLen ?
+                pEntry->fileNameLen : prefixLen;
+        int diff = memcmp(pEntry->fileName, prefix, len);
+
+        if (diff == 0 && pEntry->fileNameLen < prefixLen)
+            diff = -1;
+        if (diff < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+#endif
+
+/*
+ * Regular files under zipDir are inflated on up to this many worker
+ * threads.  The MINZIP_EXTRACT_THREADS environment variable overrides
+ * the default (one per online CPU), which is mostly useful for
+ * benchmarking.
+ */
+#define MZ_EXTRACT_MAX_THREADS 4
+#define MZ_EXTRACT_BUFSIZE (128 * 1024)
+
+enum { MZ_JOB_SKIP, MZ_JOB_FILE };
+
+typedef struct {
+    const ZipEntry *pEntry;
+    char *targetFile;
+    int kind;
+    bool ok;
+    const char *error;          // what failed, reported after extraction
+    int err;                    // errno for error, or 0
+} MzExtractJob;
+
+typedef struct {
+    const ZipArchive *pArchive;
+    const struct utimbuf *timestamp;
+    MzExtractJob *jobs;
+    unsigned int numJobs;
+    unsigned int nextJob;
+    bool failed;
+    pthread_mutex_t lock;
+} MzExtractState;
+
+static int extractThreads(unsigned int numFiles)
+{
+    int threads;
+    const char *env = getenv("MINZIP_EXTRACT_THREADS");
+
+    if (env != NULL) {
+        threads = atoi(env);
+    } else {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads > MZ_EXTRACT_MAX_THREADS) threads = MZ_EXTRACT_MAX_THREADS;
+    if (threads > (int) numFiles) threads = numFiles;
+    if (threads < 1) threads = 1;
+    return threads;
+}
+
+/*
+ * Reserve the file's final size up front so the filesystem can lay it
+ * out in one go.  Failure is harmless, the writes allocate as usual.
+ */
+static void preallocateFile(int fd, long len)
+{
+#if defined(__GLIBC__) || (defined(__ANDROID_API__) && __ANDROID_API__ >= 21)
+    if (len > 0)
+        fallocate(fd, 0, 0, len);
+#endif
+}
+
+/*
+ * Writes the entry's uncompressed data to fd, taking the input from the
+ * archive's memory mapping so that several threads can do this at once.
+ */
+static bool writeMappedEntry(const ZipArchive *pArchive,
+    const ZipEntry *pEntry, int fd, unsigned char *buf, size_t bufLen)
+{
+    const unsigned char *data = mzGetZipEntryMappedData(pArchive, pEntry);
+    z_stream zstream;
+    int zerr;
+
+    if (data == NULL)
+        return false;
+
+    if (pEntry->compression == STORED) {
+        return pEntry->compLen == 0 ||
+            writeProcessFunction(data, pEntry->compLen, (void*)fd);
+    }
+    if (pEntry->compression != DEFLATED)
+        return false;
+
+    memset(&zstream, 0, sizeof(zstream));
+    zstream.next_in = (Bytef*) data;
+    zstream.avail_in = pEntry->compLen;
+
+    /* Raw deflate data, see processDeflatedEntry() */
+    if (inflateInit2(&zstream, -MAX_WBITS) != Z_OK)
+        return false;
+    do {
+        zstream.next_out = buf;
+        zstream.avail_out = bufLen;
+        zerr = inflate(&zstream, Z_NO_FLUSH);
+        if (zerr != Z_OK && zerr != Z_STREAM_END)
+            break;
+        if (zstream.next_out != buf &&
+                !writeProcessFunction(buf, zstream.next_out - buf, (void*)fd)) {
+            zerr = Z_ERRNO;
+            break;
+        }
+        if (zerr == Z_OK && zstream.avail_in == 0 && zstream.avail_out != 0) {
+            zerr = Z_DATA_ERROR;    // truncated stream
+            break;
+        }
+    } while (zerr == Z_OK);
+    inflateEnd(&zstream);
+
+    return zerr == Z_STREAM_END &&
+        (long) zstream.total_out == pEntry->uncompLen;
+}
+
+/*
+ * Fills in a regular file that extraction has already created.
+ */
+static void extractFileJob(MzExtractState *state, MzExtractJob *job,
+    unsigned char *buf)
+{
+    const ZipEntry *pEntry = job->pEntry;
+    int fd;
+
+    if (buf == NULL) {
+        job->error = "Can't allocate buffer for";
+        return;
+    }
+    fd = open(job->targetFile, O_WRONLY);
+    if (fd < 0) {
+        job->error = "Can't open target file";
+        job->err = errno;
+        return;
+    }
+    preallocateFile(fd, pEntry->uncompLen);
+    if (!writeMappedEntry(state->pArchive, pEntry, fd, buf,
+            MZ_EXTRACT_BUFSIZE)) {
+        job->error = "Error extracting";
+        close(fd);
+        return;
+    }
+    if (close(fd) != 0) {
+        job->error = "Error extracting";
+        job->err = errno;
+        return;
+    }
+    if (state->timestamp != NULL &&
+            utime(job->targetFile, state->timestamp) != 0) {
+        job->error = "Error touching";
+        job->err = errno;
+        return;
+    }
+    job->ok = true;
+}
+
+static void *extractWorker(void *cookie)
+{
+    MzExtractState *state = (MzExtractState *)cookie;
+    unsigned char *buf = (unsigned char *)malloc(MZ_EXTRACT_BUFSIZE);
+
+    while (true) {
+        MzExtractJob *job = NULL;
+
+        pthread_mutex_lock(&state->lock);
+        while (state->nextJob < state->numJobs &&
+                state->jobs[state->nextJob].kind != MZ_JOB_FILE) {
+            state->nextJob++;
+        }
+        if (!state->failed && state->nextJob < state->numJobs)
+            job = state->jobs + state->nextJob++;
+        pthread_mutex_unlock(&state->lock);
+        if (job == NULL)
+            break;
+
+        extractFileJob(state, job, buf);
+        if (!job->ok) {
+            pthread_mutex_lock(&state->lock);
+            state->failed = true;
+            pthread_mutex_unlock(&state->lock);
+        }
+    }
+
+    free(buf);
+    return NULL;
+}
+
+/*
+ * Runs the file jobs on a pool of worker threads, or on this thread if
+ * there is only one file or no thread can be started.
+ */
+static void runExtractJobs(MzExtractState *state)
+{
+    pthread_t workers[MZ_EXTRACT_MAX_THREADS];
+    unsigned int i, numFiles = 0;
+    int threads, started = 0;
+
+    for (i = 0; i < state->numJobs; i++) {
+        if (state->jobs[i].kind == MZ_JOB_FILE)
+            numFiles++;
+    }
+    if (numFiles == 0)
+        return;
+
+    threads = extractThreads(numFiles);
+    pthread_mutex_init(&state->lock, NULL);
+    if (threads > 1) {
+        for (i = 0; i < (unsigned int) threads; i++) {
+            if (pthread_create(&workers[started], NULL, extractWorker,
+                    state) == 0) {
+                started++;
+            }
+        }
+    }
+    if (started == 0)
+        extractWorker(state);
+    for (i = 0; i < (unsigned int) started; i++)
+        pthread_join(workers[i], NULL);
+    pthread_mutex_destroy(&state->lock);
+}
+
+static unsigned int hashDirName(const char *dir)
+{
+    return computeHash(dir, strlen(dir));
+}
+
+static int hashcmpDirName(const void *tableItem, const void *looseItem)
+{
+    return strcmp((const char *)tableItem, (const char *)looseItem);
+}
+
+/*
+ * Creates the directory containing path, or path itself if it ends in
+ * a slash, unless an earlier entry already did.
+ */
+static int createEntryDirectory(HashTable *pDirs, const char *path,
+    const struct utimbuf *timestamp, struct selabel_handle *sehnd)
+{
+    const char *slash = strrchr(path, '/');
+    char *dir;
+    unsigned int hash;
+
+    if (slash == NULL || slash == path)
+        return 0;
+    dir = strndup(path, slash - path);
+    if (dir == NULL)
+        return -1;
+    hash = hashDirName(dir);
+    if (pDirs != NULL &&
+            mzHashTableLookup(pDirs, hash, dir, hashcmpDirName, false) != NULL) {
+        free(dir);
+        return 0;
+    }
+    if (dirCreateHierarchy(path, UNZIP_DIRMODE, timestamp, true, sehnd) != 0) {
+        free(dir);
+        return -1;
+    }
+    if (pDirs == NULL ||
+            mzHashTableLookup(pDirs, hash, dir, hashcmpDirName, true) != dir)
+        free(dir);
+    return 0;
+}
+
+static int hashcmpJobTarget(const void *tableItem, const void *looseItem)
+{
+    return strcmp(((const MzExtractJob *)tableItem)->targetFile,
+            ((const MzExtractJob *)looseItem)->targetFile);
+}
+
+/*
+ * An archive may hold several entries with the same name, in no
+ * particular order once sorted.  Keep only the file job for the one
+ * stored last in the archive, as unzip would; otherwise two workers
+ * would write the same file.
+ */
+static bool dropDuplicateFileJobs(MzExtractJob *jobs, unsigned int count)
+{
+    HashTable *pNames = mzHashTableCreate(mzHashSize(count), NULL);
+    unsigned int i;
+
+    if (pNames == NULL)
+        return false;
+    for (i = 0; i < count; i++) {
+        MzExtractJob *job = jobs + i;
+        MzExtractJob *prev;
+        unsigned int hash;
+
+        if (job->kind != MZ_JOB_FILE)
+            continue;
+        hash = hashDirName(job->targetFile);
+        prev = (MzExtractJob *)mzHashTableLookup(pNames, hash, job,
+                hashcmpJobTarget, true);
+        if (prev == job)
+            continue;
+        if (prev->pEntry->offset > job->pEntry->offset) {
+            job->kind = MZ_JOB_SKIP;
+            job->ok = true;
+            continue;
+        }
+        prev->kind = MZ_JOB_SKIP;
+        prev->ok = true;
+        mzHashTableRemove(pNames, hash, prev);
+        mzHashTableLookup(pNames, hash, job, hashcmpJobTarget, true);
+    }
+    mzHashTableFree(pNames);
+    return true;
+}
+
 /*
  * Inflate all entries under zipDir to the directory specified by
  * targetDir, which must exist and be a writable directory.
@@ -925,6 +1337,11 @@ static const char *targetEntryPath(MzPathHelper *helper, ZipEntry *pEntry)
  *     /tmp/two
  *     /tmp/d/three
  *
+ * Directories, symlinks and empty target files are created in archive
+ * order on this thread; the regular files are then filled in by the
+ * worker pool.  Errors and callbacks are reported afterwards, again in
+ * archive order, stopping at the first failed entry.
+ *
  * Returns true on success, false on failure.
  */
 bool mzExtractRecursive(const ZipArchive *pArchive,
@@ -977,190 +1394,204 @@ bool mzExtractRecursive(const ZipArchive *pArchive,
     helper.buf = NULL;
     helper.bufLen = 0;
 
-    /* Walk through the entries and extract anything whose path begins
-     * with zpath.
-//TODO: since the entries are sorted, binary search for the first match
-//      and stop after the first non-match.
-     */
-    unsigned int i;
-    bool seenMatch = false;
-    int ok = true;
-    for (i = 0; i < pArchive->numEntries; i++) {
-        ZipEntry *pEntry = pArchive->pEntries + i;
-        if (pEntry->fileNameLen < zipDirLen) {
+    /* Find the entries whose path begins with zpath.  Since the
+     * entries are sorted, they are the ones from the first entry not
+     * sorting before zpath up to the first one that doesn't match.
 //TODO: look out for a single empty directory entry that matches zpath, but
 //      missing the trailing slash.  Most zip files seem to include
 //      the trailing slash, but I think it's legal to leave it off.
 //      e.g., zpath "a/b/", entry "a/b", with no children of the entry.
-            /* No chance of matching.
-             */
+     */
+    unsigned int i, first, count;
 #if SORT_ENTRIES
-            if (seenMatch) {
-                /* Since the entries are sorted, we can give up
-                 * on the first mismatch after the first match.
-                 */
-                break;
-            }
+    first = findFirstEntry(pArchive, zpath, zipDirLen);
+#else
+    first = 0;
 #endif
-            continue;
-        }
-        /* If zpath is empty, this strncmp() will match everything,
-         * which is what we want.
+    count = 0;
+    MzExtractJob *jobs = (MzExtractJob *)calloc(
+            pArchive->numEntries - first + 1, sizeof(MzExtractJob));
+    HashTable *pDirs = mzHashTableCreate(64, free);
+    int ok = true;
+
+    if (jobs == NULL) {
+        LOGE("Can't allocate extraction jobs\n");
+        ok = false;
+    }
+    for (i = first; ok && i < pArchive->numEntries; i++) {
+        ZipEntry *pEntry = pArchive->pEntries + i;
+
+        /* If zpath is empty, this matches everything, which is what
+         * we want.
          */
-        if (strncmp(pEntry->fileName, zpath, zipDirLen) != 0) {
+        if (pEntry->fileNameLen < zipDirLen ||
+                memcmp(pEntry->fileName, zpath, zipDirLen) != 0) {
 #if SORT_ENTRIES
-            if (seenMatch) {
-                /* Since the entries are sorted, we can give up
-                 * on the first mismatch after the first match.
-                 */
-                break;
-            }
-#endif
+            break;
+#else
             continue;
+#endif
         }
-        /* This entry begins with zipDir, so we'll extract it.
-         */
-        seenMatch = true;
 
-        /* Find the target location of the entry.
+        /* This entry begins with zipDir, so we'll extract it.
+         * Find the target location of the entry.
          */
+        MzExtractJob *job = jobs + count++;
         const char *targetFile = targetEntryPath(&helper, pEntry);
+        job->pEntry = pEntry;
+        job->kind = MZ_JOB_SKIP;
         if (targetFile == NULL) {
-            LOGE("Can't assemble target path for \"%.*s\"\n",
-                    pEntry->fileNameLen, pEntry->fileName);
-            ok = false;
+            job->targetFile = strndup(pEntry->fileName, pEntry->fileNameLen);
+            job->error = "Can't assemble target path for";
+            break;
+        }
+        job->targetFile = strdup(targetFile);
+        if (job->targetFile == NULL) {
+            job->error = "Can't allocate target path";
             break;
         }
 
         /* With DRY_RUN set, invoke the callback but don't do anything else.
          */
         if (flags & MZ_EXTRACT_DRY_RUN) {
-            if (callback != NULL) callback(targetFile, cookie);
+            job->ok = true;
             continue;
         }
 
         /* Create the file or directory.
          */
-#define UNZIP_DIRMODE 0755
-#define UNZIP_FILEMODE 0644
         if (pEntry->fileName[pEntry->fileNameLen-1] == '/') {
             if (!(flags & MZ_EXTRACT_FILES_ONLY)) {
                 int ret = dirCreateHierarchy(
                         targetFile, UNZIP_DIRMODE, timestamp, false, sehnd);
                 if (ret != 0) {
-                    LOGE("Can't create containing directory for \"%s\": %s\n",
-                            targetFile, strerror(errno));
-                    ok = false;
+                    job->error = "Can't create containing directory for";
+                    job->err = errno;
                     break;
                 }
                 LOGD("Extracted dir \"%s\"\n", targetFile);
             }
-        } else {
-            /* This is not a directory.  First, make sure that
-             * the containing directory exists.
+            job->ok = true;
+            continue;
+        }
+
+        /* This is not a directory.  First, make sure that
+         * the containing directory exists.
+         */
+        if (createEntryDirectory(pDirs, targetFile, timestamp, sehnd) != 0) {
+            job->error = "Can't create containing directory for";
+            job->err = errno;
+            break;
+        }
+
+        /* With FILES_ONLY set, we need to ignore metadata entirely,
+         * so treat symlinks as regular files.
+         */
+        if (!(flags & MZ_EXTRACT_FILES_ONLY) && mzIsZipEntrySymlink(pEntry)) {
+            /* The entry is a symbolic link.
+             * The relative target of the symlink is in the
+             * data section of this entry.
              */
-            int ret = dirCreateHierarchy(
-                    targetFile, UNZIP_DIRMODE, timestamp, true, sehnd);
-            if (ret != 0) {
-                LOGE("Can't create containing directory for \"%s\": %s\n",
-                        targetFile, strerror(errno));
-                ok = false;
+            if (pEntry->uncompLen == 0) {
+                job->error = "Symlink entry has no target:";
+                break;
+            }
+            char *linkTarget = malloc(pEntry->uncompLen + 1);
+            if (linkTarget == NULL) {
+                job->error = "Can't allocate symlink target for";
+                break;
+            }
+            if (!mzReadZipEntry(pArchive, pEntry, linkTarget,
+                    pEntry->uncompLen)) {
+                job->error = "Can't read symlink target for";
+                free(linkTarget);
                 break;
             }
+            linkTarget[pEntry->uncompLen] = '\0';
 
-            /* With FILES_ONLY set, we need to ignore metadata entirely,
-             * so treat symlinks as regular files.
+            /* Make the link.
              */
-            if (!(flags & MZ_EXTRACT_FILES_ONLY) && mzIsZipEntrySymlink(pEntry)) {
-                /* The entry is a symbolic link.
-                 * The relative target of the symlink is in the
-                 * data section of this entry.
-                 */
-                if (pEntry->uncompLen == 0) {
-                    LOGE("Symlink entry \"%s\" has no target\n",
-                            targetFile);
-                    ok = false;
-                    break;
-                }
-                char *linkTarget = malloc(pEntry->uncompLen + 1);
-                if (linkTarget == NULL) {
-                    ok = false;
-                    break;
-                }
-                ok = mzReadZipEntry(pArchive, pEntry, linkTarget,
-                        pEntry->uncompLen);
-                if (!ok) {
-                    LOGE("Can't read symlink target for \"%s\"\n",
-                            targetFile);
-                    free(linkTarget);
-                    break;
-                }
-                linkTarget[pEntry->uncompLen] = '\0';
-
-                /* Make the link.
-                 */
-                ret = symlink(linkTarget, targetFile);
-                if (ret != 0) {
-                    LOGE("Can't symlink \"%s\" to \"%s\": %s\n",
-                            targetFile, linkTarget, strerror(errno));
-                    free(linkTarget);
-                    ok = false;
-                    break;
-                }
-                LOGD("Extracted symlink \"%s\" -> \"%s\"\n",
-                        targetFile, linkTarget);
+            if (symlink(linkTarget, targetFile) != 0) {
+                job->error = "Can't create symlink";
+                job->err = errno;
                 free(linkTarget);
-            } else {
-                /* The entry is a regular file.
-                 * Open the target for writing.
-                 */
+                break;
+            }
+            LOGD("Extracted symlink \"%s\" -> \"%s\"\n",
+                    targetFile, linkTarget);
+            free(linkTarget);
+            job->ok = true;
+            continue;
+        }
 
+        /* The entry is a regular file.  Create it here so that it gets
+         * its SELinux label from this thread; a worker fills it in.
+         */
 #ifdef HAVE_SELINUX
-                char *secontext = NULL;
+        char *secontext = NULL;
 
-                if (sehnd) {
-                    selabel_lookup(sehnd, &secontext, targetFile, UNZIP_FILEMODE);
-                    setfscreatecon(secontext);
-                }
+        if (sehnd) {
+            selabel_lookup(sehnd, &secontext, targetFile, UNZIP_FILEMODE);
+            setfscreatecon(secontext);
+        }
 #endif
 
-                int fd = creat(targetFile, UNZIP_FILEMODE);
+        int fd = creat(targetFile, UNZIP_FILEMODE);
 
 #ifdef HAVE_SELINUX
-                if (secontext) {
-                    freecon(secontext);
-                    setfscreatecon(NULL);
-                }
+        if (secontext) {
+            freecon(secontext);
+            setfscreatecon(NULL);
+        }
 #endif
 
-                if (fd < 0) {
-                    LOGE("Can't create target file \"%s\": %s\n",
-                            targetFile, strerror(errno));
-                    ok = false;
-                    break;
-                }
+        if (fd < 0) {
+            job->error = "Can't create target file";
+            job->err = errno;
+            break;
+        }
+        close(fd);
+        job->kind = MZ_JOB_FILE;
+    }
 
-                bool ok = mzExtractZipEntryToFile(pArchive, pEntry, fd);
-                close(fd);
-                if (!ok) {
-                    LOGE("Error extracting \"%s\"\n", targetFile);
-                    ok = false;
-                    break;
-                }
+    if (jobs != NULL) {
+        MzExtractState state;
+        memset(&state, 0, sizeof(state));
+        state.pArchive = pArchive;
+        state.timestamp = timestamp;
+        state.jobs = jobs;
+        state.numJobs = count;
+        if (dropDuplicateFileJobs(jobs, count)) {
+            runExtractJobs(&state);
+        } else {
+            LOGE("Can't allocate extraction name table\n");
+            ok = false;
+        }
 
-                if (timestamp != NULL && utime(targetFile, timestamp)) {
-                    LOGE("Error touching \"%s\"\n", targetFile);
-                    ok = false;
-                    break;
+        /* Report the results in archive order.
+         */
+        for (i = 0; i < count; i++) {
+            MzExtractJob *job = jobs + i;
+            if (ok && !job->ok) {
+                if (job->error != NULL) {
+                    LOGE("%s \"%s\"%s%s\n", job->error,
+                            job->targetFile ? job->targetFile : "",
+                            job->err ? ": " : "",
+                            job->err ? strerror(job->err) : "");
                 }
-
-                LOGD("Extracted file \"%s\"\n", targetFile);
+                ok = false;
+            }
+            if (ok) {
+                if (job->kind == MZ_JOB_FILE)
+                    LOGD("Extracted file \"%s\"\n", job->targetFile);
+                if (callback != NULL) callback(job->targetFile, cookie);
             }
+            free(job->targetFile);
         }
-
-        if (callback != NULL) callback(targetFile, cookie);
+        free(jobs);
     }
 
+    mzHashTableFree(pDirs);
     free(helper.buf);
     free(zpath);
 
@@ -128,6 +128,9 @@ INLINE UnterminatedString mzGetZipEntryFileName(const ZipEntry* pEntry) {
 INLINE long mzGetZipEntryOffset(const ZipEntry* pEntry) {
     return pEntry->offset;
 }
+INLINE long mzGetZipEntryCompLen(const ZipEntry* pEntry) {
+    return pEntry->compLen;
+}
 INLINE long mzGetZipEntryUncompLen(const ZipEntry* pEntry) {
     return pEntry->uncompLen;
 }
@@ -138,6 +141,7 @@ INLINE long mzGetZipEntryCrc32(const ZipEntry* pEntry) {
     return pEntry->crc32;
 }
 bool mzIsZipEntrySymlink(const ZipEntry* pEntry);
+bool mzIsZipEntryStored(const ZipEntry* pEntry);
 
 
 /*
@@ -186,6 +190,20 @@ bool mzExtractZipEntryToFile(const ZipArchive *pArchive,
 bool mzExtractZipEntryToBuffer(const ZipArchive *pArchive,
     const ZipEntry *pEntry, unsigned char* buffer);
 
+/*
+ * Same as mzExtractZipEntryToBuffer(), but safe to call from several
+ * threads at once because it only reads the archive's memory mapping.
+ */
+bool mzExtractZipEntryToBufferMapped(const ZipArchive *pArchive,
+    const ZipEntry *pEntry, unsigned char* buffer);
+
+/*
+ * Returns the entry's data as stored in the archive's memory mapping
+ * (compressed unless the entry is STORED), or NULL if it is out of range.
+ */
+const unsigned char* mzGetZipEntryMappedData(const ZipArchive *pArchive,
+    const ZipEntry *pEntry);
+
 /*
  * Inflate all entries under zipDir to the directory specified by
  * targetDir, which must exist and be a writable directory.
@@ -211,7 +229,11 @@ bool mzExtractZipEntryToBuffer(const ZipArchive *pArchive,
  *
  * If timestamp is non-NULL, file timestamps will be set accordingly.
  *
- * If callback is non-NULL, it will be invoked with each unpacked file.
+ * If callback is non-NULL, it will be invoked with each unpacked file,
+ * in archive order, after all the files have been written.
+ *
+ * Regular files are inflated on several threads; MINZIP_EXTRACT_THREADS
+ * in the environment overrides the number of threads.
  *
  * Returns true on success, false on failure.
  */
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2013 TeamWin
+ *
+ * Measures mzExtractRecursive() on a synthetic ROM zip.
+ *
+ * A zip laid out like a ROM's system directory (many small files in
+ * etc/ and lib/, fewer large ones in app/ and framework/) is written to
+ * the work directory, then extracted with 1, 2 and 4 worker threads
+ * (MINZIP_EXTRACT_THREADS) and every extracted file is checked against
+ * the entry's CRC.
+ *
+ * Build against libminzip and zlib, e.g. on the host:
+ *   cc -O2 -I../.. -I<safe-iop>/include main.c ../Zip.c ../Hash.c \
+ *      ../SysUtil.c ../DirUtil.c ../Inlines.c -lz -lpthread
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "zlib.h"
+#include "minzip/DirUtil.h"
+#include "minzip/Zip.h"
+
+#define DEFAULT_FILES 2000
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void put2(FILE *f, unsigned int v)
+{
+    fputc(v & 0xff, f);
+    fputc((v >> 8) & 0xff, f);
+}
+
+static void put4(FILE *f, unsigned long v)
+{
+    put2(f, v & 0xffff);
+    put2(f, (v >> 16) & 0xffff);
+}
+
+typedef struct {
+    char name[64];
+    unsigned long crc;
+    unsigned long compLen;
+    unsigned long uncompLen;
+    unsigned long offset;
+} BenchEntry;
+
+/*
+ * Sizes and contents roughly follow a ROM: mostly small config files and
+ * libraries, a few multi-megabyte apps, about half of it compressible.
+ */
+static void makeEntry(BenchEntry *e, int i, unsigned char **data)
+{
+    static const char *dirs[] = { "etc", "lib", "app", "framework",
+            "usr/share/zoneinfo", "fonts", "bin", "media/audio/ui" };
+    unsigned long len, j;
+    int kind = rand() % 100;
+    unsigned char *p;
+
+    if (kind < 70)
+        len = 1024 + rand() % (16 * 1024);
+    else if (kind < 95)
+        len = 16 * 1024 + rand() % (240 * 1024);
+    else
+        len = 1024 * 1024 + rand() % (3 * 1024 * 1024);
+
+    snprintf(e->name, sizeof(e->name), "system/%s/file%05d%s",
+            dirs[(kind < 95 ? i : i / 2) % 8], i, kind < 95 ? "" : ".apk");
+    p = (unsigned char *)malloc(len);
+    for (j = 0; j < len; j++) {
+        if ((j / 4096) & 1)
+            p[j] = rand();
+        else
+            p[j] = "system library data "[j % 20];
+    }
+    e->uncompLen = len;
+    e->crc = crc32(0L, p, len);
+    *data = p;
+}
+
+static int writeZip(const char *fn, BenchEntry *entries, int count)
+{
+    FILE *f = fopen(fn, "wb");
+    unsigned long cdOffset, cdLen;
+    int i;
+
+    if (f == NULL)
+        return -1;
+    for (i = 0; i < count; i++) {
+        BenchEntry *e = entries + i;
+        unsigned char *data;
+        z_stream zs;
+        uLongf bound;
+        unsigned char *out;
+
+        makeEntry(e, i, &data);
+        memset(&zs, 0, sizeof(zs));
+        deflateInit2(&zs, 6, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+        bound = deflateBound(&zs, e->uncompLen);
+        out = (unsigned char *)malloc(bound);
+        zs.next_in = data;
+        zs.avail_in = e->uncompLen;
+        zs.next_out = out;
+        zs.avail_out = bound;
+        deflate(&zs, Z_FINISH);
+        e->compLen = zs.total_out;
+        deflateEnd(&zs);
+
+        e->offset = ftell(f);
+        put4(f, 0x04034b50);
+        put2(f, 20); put2(f, 0); put2(f, 8);
+        put2(f, 0); put2(f, 0x3921);
+        put4(f, e->crc); put4(f, e->compLen); put4(f, e->uncompLen);
+        put2(f, strlen(e->name)); put2(f, 0);
+        fwrite(e->name, 1, strlen(e->name), f);
+        fwrite(out, 1, e->compLen, f);
+        free(out);
+        free(data);
+    }
+
+    cdOffset = ftell(f);
+    for (i = 0; i < count; i++) {
+        BenchEntry *e = entries + i;
+        put4(f, 0x02014b50);
+        put2(f, (3 << 8) | 20); put2(f, 20); put2(f, 0); put2(f, 8);
+        put2(f, 0); put2(f, 0x3921);
+        put4(f, e->crc); put4(f, e->compLen); put4(f, e->uncompLen);
+        put2(f, strlen(e->name)); put2(f, 0); put2(f, 0);
+        put2(f, 0); put2(f, 0); put4(f, 0100644UL << 16);
+        put4(f, e->offset);
+        fwrite(e->name, 1, strlen(e->name), f);
+    }
+    cdLen = ftell(f) - cdOffset;
+
+    put4(f, 0x06054b50);
+    put2(f, 0); put2(f, 0); put2(f, count); put2(f, count);
+    put4(f, cdLen); put4(f, cdOffset); put2(f, 0);
+    return fclose(f);
+}
+
+static int verify(const char *target, BenchEntry *entries, int count)
+{
+    unsigned char *buf = (unsigned char *)malloc(64 * 1024);
+    char path[PATH_MAX];
+    int i, bad = 0;
+
+    for (i = 0; i < count; i++) {
+        unsigned long crc = crc32(0L, Z_NULL, 0);
+        unsigned long len = 0;
+        ssize_t n;
+        int fd;
+
+        snprintf(path, sizeof(path), "%s/%s", target,
+                entries[i].name + strlen("system/"));
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            bad++;
+            continue;
+        }
+        while ((n = read(fd, buf, 64 * 1024)) > 0) {
+            crc = crc32(crc, buf, n);
+            len += n;
+        }
+        close(fd);
+        if (crc != entries[i].crc || len != entries[i].uncompLen)
+            bad++;
+    }
+    free(buf);
+    return bad;
+}
+
+int main(int argc, char *argv[])
+{
+    struct utimbuf timestamp = { 1217592000, 1217592000 };
+    static const char *threads[] = { "1", "2", "4" };
+    char zipFn[PATH_MAX], target[PATH_MAX];
+    BenchEntry *entries;
+    ZipArchive zip;
+    int count = DEFAULT_FILES;
+    unsigned int t;
+    double start;
+
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: %s <work-dir> [file-count]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 3)
+        count = atoi(argv[2]);
+    if (count < 1 || count > 65535) {
+        fprintf(stderr, "file-count must be between 1 and 65535\n");
+        return 1;
+    }
+
+    snprintf(zipFn, sizeof(zipFn), "%s/rom.zip", argv[1]);
+    snprintf(target, sizeof(target), "%s/system", argv[1]);
+    entries = (BenchEntry *)calloc(count, sizeof(BenchEntry));
+    srand(1);
+    start = now();
+    if (entries == NULL || writeZip(zipFn, entries, count) != 0) {
+        fprintf(stderr, "Can't write %s: %s\n", zipFn, strerror(errno));
+        return 1;
+    }
+    printf("wrote %d entries to %s in %.3f s\n", count, zipFn, now() - start);
+
+    if (mzOpenZipArchive(zipFn, &zip) != 0) {
+        fprintf(stderr, "Can't open %s\n", zipFn);
+        return 1;
+    }
+
+    for (t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+        bool ok;
+        int bad;
+
+        dirUnlinkHierarchy(target);
+        mkdir(target, 0755);
+        sync();
+        setenv("MINZIP_EXTRACT_THREADS", threads[t], 1);
+        start = now();
+        ok = mzExtractRecursive(&zip, "system", target, MZ_EXTRACT_FILES_ONLY,
+                &timestamp, NULL, NULL, NULL);
+        printf("%s thread(s): %.3f s%s", threads[t], now() - start,
+                ok ? "" : ", extraction failed");
+        bad = verify(target, entries, count);
+        printf(bad ? ", %d bad files\n" : "\n", bad);
+        if (!ok || bad)
+            return 1;
+    }
+
+    dirUnlinkHierarchy(target);
+    mzCloseZipArchive(&zip);
+    unlink(zipFn);
+    free(entries);
+    return 0;
+}
@@ -1,6 +1,16 @@
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/vfs.h>
+#include <sys/wait.h>
 
 #include "multirom.h"
+#include "twrp-functions.hpp"
+#include "twrpTar.hpp"
+#include "variables.h"
+
+#ifdef USE_EXT4
+#include "make_ext4fs.h"
+#endif
 
 extern "C" {
 #include "twcommon.h"
@@ -888,40 +898,176 @@ std::string MultiROM::getNewRomName(std::string zip, std::string def)
 	return res;
 }
 
-bool MultiROM::createImage(const std::string& base, const char *img, int size)
+bool MultiROM::allocateImage(const std::string& path, int size)
 {
-	gui_print("Creating %s.img...\n", img);
+	uint64_t img_bytes = uint64_t(size) * 1024 * 1024;
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+	{
+		gui_print("Failed to create %s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+
+	int res = ftruncate64(fd, img_bytes);
+	if(res < 0)
+		gui_print("Failed to resize %s: %s\n", path.c_str(), strerror(errno));
+	close(fd);
 
-	if(size <= 0)
+	if(res < 0)
 	{
-		gui_print("Failed to create %s image: invalid size (%d)\n", img, size);
+		unlink(path.c_str());
 		return false;
 	}
+	return true;
+}
 
-	char cmd[256];
-	sprintf(cmd, "dd if=/dev/zero of=\"%s/%s.img\" bs=1M count=%d", base.c_str(), img, size);
-	system(cmd);
+pid_t MultiROM::formatImageFork(const std::string& path, int size)
+{
+	pid_t pid = fork();
+	if(pid != 0)
+		return pid;
+
+	// make_ext4fs keeps its state in globals, so each image is formatted
+	// in its own process to allow several of them to run at once.
+#ifdef USE_EXT4
+	int res = make_ext4fs(path.c_str(), int64_t(size) * 1024 * 1024, NULL, NULL);
+	_exit(res == 0 ? 0 : 1);
+#else
+	char len[32];
+	sprintf(len, "%dM", size);
+	execl("/sbin/make_ext4fs", "make_ext4fs", "-l", len, path.c_str(), (char*)NULL);
+	_exit(127);
+#endif
+}
 
-	struct stat info;
-	sprintf(cmd, "%s/%s.img", base.c_str(), img);
-	if(stat(cmd, &info) < 0)
+// Only the given children are reaped: other threads may be waiting for
+// children of their own, so waitpid(-1) would steal their exit status.
+// If a child cannot be waited for, its status is set to -1 (a failure).
+pid_t MultiROM::waitForChild(const std::vector<pid_t>& pids, int *status)
+{
+	for(;;)
+	{
+		for(size_t i = 0; i < pids.size(); ++i)
+		{
+			pid_t res = waitpid(pids[i], status, WNOHANG);
+			if(res == pids[i])
+				return res;
+			if(res < 0 && errno != EINTR)
+			{
+				gui_print("Failed to wait for process %d: %s\n", (int)pids[i], strerror(errno));
+				*status = -1;
+				return pids[i];
+			}
+		}
+		usleep(50*1000);
+	}
+}
+
+bool MultiROM::createImage(const std::string& base, const char *img, int size)
+{
+	std::vector<image_job> jobs;
+	jobs.push_back(image_job(img, size));
+	return createImages(base, jobs);
+}
+
+bool MultiROM::createImages(const std::string& base, std::vector<image_job>& jobs)
+{
+	for(size_t i = 0; i < jobs.size(); ++i)
+	{
+		if(jobs[i].size <= 0)
+		{
+			gui_print("Failed to create %s image: invalid size (%d)\n", jobs[i].name.c_str(), jobs[i].size);
+			return false;
+		}
+	}
+
+	// ftruncate() does not reserve any blocks, so make sure all the images
+	// together can actually be filled up later on.
+	uint64_t img_bytes = 0;
+	for(size_t i = 0; i < jobs.size(); ++i)
+		img_bytes += uint64_t(jobs[i].size) * 1024 * 1024;
+
+	struct statfs s;
+	if(statfs(base.c_str(), &s) < 0)
 	{
-		gui_print("Failed to create %s image, probably not enough space.\n", img);
+		gui_print("Failed to check free space in %s: %s\n", base.c_str(), strerror(errno));
 		return false;
 	}
 
-	sprintf(cmd, "make_ext4fs -l %dM \"%s/%s.img\"", size, base.c_str(), img);
-	system(cmd);
-	return true;
+	uint64_t free_bytes = uint64_t(s.f_bavail) * s.f_bsize;
+	if(free_bytes < img_bytes)
+	{
+		gui_print("Failed to create images, not enough space (%llu MB needed, %llu MB free)\n",
+				(unsigned long long)(img_bytes/1024/1024), (unsigned long long)(free_bytes/1024/1024));
+		return false;
+	}
+
+	bool res = true;
+	for(size_t i = 0; i < jobs.size(); ++i)
+	{
+		std::string path = base + "/" + jobs[i].name + ".img";
+		gui_print("Creating %s.img (%d MB)...\n", jobs[i].name.c_str(), jobs[i].size);
+
+		if(!allocateImage(path, jobs[i].size))
+		{
+			res = false;
+			break;
+		}
+
+		jobs[i].pid = formatImageFork(path, jobs[i].size);
+		if(jobs[i].pid < 0)
+		{
+			gui_print("Failed to fork for formatting %s.img!\n", jobs[i].name.c_str());
+			res = false;
+			break;
+		}
+	}
+
+	size_t running = 0;
+	for(size_t i = 0; i < jobs.size(); ++i)
+		if(jobs[i].pid > 0)
+			++running;
+
+	const size_t total = running;
+	DataManager::SetProgress(0.0);
+	while(running > 0)
+	{
+		std::vector<pid_t> pids;
+		for(size_t i = 0; i < jobs.size(); ++i)
+			if(jobs[i].pid > 0)
+				pids.push_back(jobs[i].pid);
+
+		int status;
+		pid_t pid = waitForChild(pids, &status);
+
+		for(size_t i = 0; i < jobs.size(); ++i)
+		{
+			if(jobs[i].pid != pid)
+				continue;
+
+			jobs[i].pid = 0;
+			--running;
+			if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			{
+				gui_print("Failed to format %s.img!\n", jobs[i].name.c_str());
+				res = false;
+			}
+			else
+				gui_print("Formatted %s.img\n", jobs[i].name.c_str());
+			DataManager::SetProgress(float(total - running) / total);
+			break;
+		}
+	}
+	return res;
 }
 
 bool MultiROM::createImagesFromBase(const std::string& base)
 {
+	std::vector<image_job> jobs;
 	for(baseFolders::const_iterator itr = m_base_folders.begin(); itr != m_base_folders.end(); ++itr)
-		if(!createImage(base, itr->first.c_str(), itr->second.size))
-			return false;
+		jobs.push_back(image_job(itr->first, itr->second.size));
 
-	return true;
+	return createImages(base, jobs);
 }
 
 bool MultiROM::createDirsFromBase(const string& base)
@@ -1520,7 +1666,6 @@ bool MultiROM::patchInit(std::string name)
 bool MultiROM::installFromBackup(std::string name, std::string path, int type)
 {
 	struct stat info;
-	char cmd[256];
 	std::string base = getRomsPath() + "/" + name;
 	int has_system = 0, has_data = 0;
 
@@ -1553,8 +1698,11 @@ bool MultiROM::installFromBackup(std::string name, std::string path, int type)
 		return false;
 	}
 
-	sprintf(cmd, "cp \"%s/boot.emmc.win\" \"%s/boot.img\"", path.c_str(), base.c_str());
-	system(cmd);
+	if(TWFunc::copy_file(path + "/boot.emmc.win", base + "/boot.img", 0644) != 0)
+	{
+		gui_print("Failed to copy boot image!\n");
+		return false;
+	}
 
 	if(!extractBootForROM(base))
 		return false;
@@ -1579,40 +1727,89 @@ bool MultiROM::extractBackupFile(std::string path, std::string part)
 {
 	gui_print("Extracting backup of %s partition...\n", part.c_str());
 
-	struct stat info;
-	std::string filename = part + ".ext4.win";
-	std::string full_path =  path + "/" + filename;
-	int index = 0;
+	std::vector<std::string> archives;
+	std::string full_path = path + "/" + part + ".ext4.win";
 	char split_index[5];
-	char cmd[256];
+	bool split = false;
 
-	if (stat(full_path.c_str(), &info) < 0) // multiple archives
+	if(TWFunc::Path_Exists(full_path))
+		archives.push_back(full_path);
+	else // multiple archives
 	{
-		sprintf(split_index, "%03i", index);
-		full_path = path + "/" + filename + split_index;
-		while (stat(full_path.c_str(), &info) >= 0)
+		split = true;
+		for(int index = 0; index < 1000; ++index)
 		{
-			gui_print("Restoring archive %i...\n", ++index);
-
-			sprintf(cmd, "cd /%s && gnutar -xf \"%s\"", part.c_str(), full_path.c_str());
-			system(cmd);
-
 			sprintf(split_index, "%03i", index);
-			full_path = path + "/" + filename + split_index;
+			if(!TWFunc::Path_Exists(full_path + split_index))
+				break;
+			archives.push_back(full_path + split_index);
 		}
 
-		if (index == 0)
+		if(archives.empty())
 		{
 			gui_print("Failed to locate backup file %s\n", full_path.c_str());
 			return false;
 		}
 	}
-	else
+
+	int check_md5 = 0;
+	DataManager::GetValue(TW_SKIP_MD5_CHECK_VAR, check_md5);
+
+	// Split archives hold disjoint sets of files, so the next part can be read
+	// while the previous one is still being written out.
+	static const size_t max_running = 2;
+	std::vector<pid_t> running;
+	size_t next = 0;
+	bool res = true;
+
+	while(next < archives.size() || !running.empty())
 	{
-		sprintf(cmd, "cd /%s && gnutar -xf \"%s\"", part.c_str(), full_path.c_str());
-		system(cmd);
+		if(res && next < archives.size() && running.size() < max_running)
+		{
+			if(archives.size() > 1)
+				gui_print("Restoring archive %u...\n", (unsigned)next+1);
+
+			pid_t pid = fork();
+			if(pid == 0)
+			{
+				twrpTar tar;
+				tar.setdir("/" + part);
+				// Only split parts store the full path; a single archive holds
+				// names relative to the partition root, which may start with
+				// another directory of the same name (/data/data).
+				if(split)
+					tar.setremap("/" + part);
+				tar.setfn(archives[next]);
+				tar.setverify(check_md5 > 0 && TWFunc::Path_Exists(archives[next] + ".md5"));
+				_exit(tar.extract() == 0 ? 0 : 1);
+			}
+			else if(pid < 0)
+			{
+				gui_print("Failed to fork for extracting %s!\n", archives[next].c_str());
+				res = false;
+			}
+			else
+				running.push_back(pid);
+			++next;
+			continue;
+		}
+
+		if(running.empty())
+			break;
+
+		int status;
+		pid_t pid = waitForChild(running, &status);
+		running.erase(std::find(running.begin(), running.end(), pid));
+
+		if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		{
+			gui_print("Failed to extract backup of %s partition!\n", part.c_str());
+			res = false;
+		}
 	}
-	return true;
+
+	sync();
+	return res;
 }
 
 void MultiROM::setInstaller(MROMInstaller *i)
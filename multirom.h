@@ -84,6 +84,14 @@ public:
 		int enable_adb;
 	};
 
+	struct image_job {
+		image_job(const std::string& name, int size) : name(name), size(size), pid(0) { }
+
+		std::string name;
+		int size;
+		pid_t pid;
+	};
+
 	struct file_backup {
 		std::string name;
 		char *content;
@@ -146,7 +154,11 @@ private:
 	static void ubuntuDisableFlashKernel(bool initChroot, std::string rootDir);
 	static bool mountUbuntuImage(std::string name, std::string& dest);
 
+	static bool allocateImage(const std::string& path, int size);
+	static pid_t formatImageFork(const std::string& path, int size);
+	static pid_t waitForChild(const std::vector<pid_t>& pids, int *status);
 	static bool createImage(const std::string& base, const char *img, int size);
+	static bool createImages(const std::string& base, std::vector<image_job>& jobs);
 	static bool createImagesFromBase(const std::string& base);
 	static bool createDirsFromBase(const std::string& base);
 	static bool mountBaseImages(std::string base, std::string& dest);
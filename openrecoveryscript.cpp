@@ -23,6 +23,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/vfs.h>
 #include <unistd.h>
@@ -40,13 +43,90 @@
 #include "variables.h"
 #include "adb_install.h"
 #include "data.hpp"
+#include "mincrypt/sha.h"
+#include "gui/jobscheduler.hpp"
 extern "C" {
 	#include "twinstall.h"
 	#include "gui/gui.h"
+	#include "minadbd/adb.h"
 	int TWinstall_zip(const char* path, int* wipe_cache);
 }
 
 #define SCRIPT_COMMAND_SIZE 512
+#define PREFETCH_BUFFER_SIZE (256 * 1024)
+
+// The next install zip of the plan, read ahead on its own thread while the
+// steps before it run. When signed zips are enforced it is hashed on the
+// way, so that the signature check does not have to read it again.
+static struct {
+	pthread_t thread;
+	bool running;
+	bool started;
+	size_t index;
+	bool hash;
+	string path;
+	bool digest_valid;
+	sideload_digest digest;
+} prefetch;
+
+static void* Prefetch_Thread(void* cookie) {
+	unsigned long long total = 0, signed_len = 0, comment_size, len;
+	unsigned char footer[6];
+	unsigned char* buffer;
+	struct stat st, st_after;
+	time_t start = time(NULL);
+	ssize_t bytes;
+	SHA_CTX ctx;
+	int fd;
+
+	fd = open(prefetch.path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	buffer = (unsigned char*)malloc(PREFETCH_BUFFER_SIZE);
+	if (buffer == NULL || fstat(fd, &st) != 0) {
+		free(buffer);
+		close(fd);
+		return NULL;
+	}
+	if (prefetch.hash && st.st_size > (off_t)sizeof(footer) &&
+			pread(fd, footer, sizeof(footer), st.st_size - sizeof(footer)) == sizeof(footer) &&
+			footer[2] == 0xff && footer[3] == 0xff) {
+		// Same footer as verify_file(): the whole-file signature covers
+		// everything but the zip comment and its length field
+		comment_size = footer[4] + (footer[5] << 8);
+		if (comment_size + 2 < (unsigned long long)st.st_size)
+			signed_len = st.st_size - comment_size - 2;
+	}
+	SHA_init(&ctx);
+	while ((bytes = read(fd, buffer, PREFETCH_BUFFER_SIZE)) > 0) {
+		if (total < signed_len) {
+			len = signed_len - total;
+			if (len > (unsigned long long)bytes)
+				len = bytes;
+			SHA_update(&ctx, buffer, len);
+		}
+		total += bytes;
+	}
+	// A change made after hashing started moves ctime to start or later, so
+	// a file changed within the same second as its last ctime is not trusted
+	if (bytes == 0 && signed_len != 0 && total == (unsigned long long)st.st_size &&
+			st.st_ctime < start && fstat(fd, &st_after) == 0 &&
+			st_after.st_ctime == st.st_ctime && st_after.st_size == st.st_size) {
+		memset(&prefetch.digest, 0, sizeof(prefetch.digest));
+		strncpy(prefetch.digest.path, prefetch.path.c_str(), sizeof(prefetch.digest.path) - 1);
+		prefetch.digest.size = total;
+		prefetch.digest.mtime = st.st_mtime;
+		prefetch.digest.ctime = st.st_ctime;
+		prefetch.digest.dev = st.st_dev;
+		prefetch.digest.ino = st.st_ino;
+		prefetch.digest.signed_len = signed_len;
+		memcpy(prefetch.digest.sha1, SHA_final(&ctx), SHA_DIGEST_SIZE);
+		prefetch.digest_valid = true;
+	}
+	free(buffer);
+	close(fd);
+	return NULL;
+}
 
 int OpenRecoveryScript::check_for_script_file(void) {
 	if (!PartitionManager.Mount_By_Path(SCRIPT_FILE_CACHE, false)) {
@@ -65,295 +145,47 @@ int OpenRecoveryScript::check_for_script_file(void) {
 }
 
 int OpenRecoveryScript::run_script_file(void) {
-	FILE *fp = fopen(SCRIPT_FILE_TMP, "r");
-	int ret_val = 0, cindex, line_len, i, remove_nl, install_cmd = 0, sideload = 0;
-	char script_line[SCRIPT_COMMAND_SIZE], command[SCRIPT_COMMAND_SIZE],
-		 value[SCRIPT_COMMAND_SIZE], mount[SCRIPT_COMMAND_SIZE],
-		 value1[SCRIPT_COMMAND_SIZE], value2[SCRIPT_COMMAND_SIZE];
-	char *val_start, *tok;
-
-	if (fp != NULL) {
-		DataManager::SetValue(TW_SIMULATE_ACTIONS, 0);
-		DataManager::SetValue("ui_progress", 0); // Reset the progress bar
-		while (fgets(script_line, SCRIPT_COMMAND_SIZE, fp) != NULL && ret_val == 0) {
-			cindex = 0;
-			line_len = strlen(script_line);
-			if (line_len < 2)
-				continue; // there's a blank line or line is too short to contain a command
-			//gui_print("script line: '%s'\n", script_line);
-			for (i=0; i<line_len; i++) {
-				if ((int)script_line[i] == 32) {
-					cindex = i;
-					i = line_len;
-				}
-			}
-			memset(command, 0, sizeof(command));
-			memset(value, 0, sizeof(value));
-			if ((int)script_line[line_len - 1] == 10)
-					remove_nl = 2;
-				else
-					remove_nl = 1;
-			if (cindex != 0) {
-				strncpy(command, script_line, cindex);
-				LOGINFO("command is: '%s' and ", command);
-				val_start = script_line;
-				val_start += cindex + 1;
-				strncpy(value, val_start, line_len - cindex - remove_nl);
-				LOGINFO("value is: '%s'\n", value);
-			} else {
-				strncpy(command, script_line, line_len - remove_nl + 1);
-				gui_print("command is: '%s' and there is no value\n", command);
-			}
-			if (strcmp(command, "install") == 0) {
-				// Install Zip
-				DataManager::SetValue("tw_action_text2", "Installing Zip");
-				PartitionManager.Mount_All_Storage();
-				ret_val = Install_Command(value);
-				install_cmd = -1;
-			} else if (strcmp(command, "wipe") == 0) {
-				// Wipe
-				if (strcmp(value, "cache") == 0 || strcmp(value, "/cache") == 0) {
-					gui_print("-- Wiping Cache Partition...\n");
-					PartitionManager.Wipe_By_Path("/cache");
-					gui_print("-- Cache Partition Wipe Complete!\n");
-				} else if (strcmp(value, "dalvik") == 0 || strcmp(value, "dalvick") == 0 || strcmp(value, "dalvikcache") == 0 || strcmp(value, "dalvickcache") == 0) {
-					gui_print("-- Wiping Dalvik Cache...\n");
-					PartitionManager.Wipe_Dalvik_Cache();
-					gui_print("-- Dalvik Cache Wipe Complete!\n");
-				} else if (strcmp(value, "data") == 0 || strcmp(value, "/data") == 0 || strcmp(value, "factory") == 0 || strcmp(value, "factoryreset") == 0) {
-					gui_print("-- Wiping Data Partition...\n");
-					PartitionManager.Factory_Reset();
-					gui_print("-- Data Partition Wipe Complete!\n");
-				} else {
-					LOGERR("Error with wipe command value: '%s'\n", value);
-					ret_val = 1;
-				}
-			} else if (strcmp(command, "backup") == 0) {
-				// Backup
-				DataManager::SetValue("tw_action_text2", "Backing Up");
-				tok = strtok(value, " ");
-				strcpy(value1, tok);
-				tok = strtok(NULL, " ");
-				if (tok != NULL) {
-					memset(value2, 0, sizeof(value2));
-					strcpy(value2, tok);
-					line_len = strlen(tok);
-					if ((int)value2[line_len - 1] == 10 || (int)value2[line_len - 1] == 13) {
-						if ((int)value2[line_len - 1] == 10 || (int)value2[line_len - 1] == 13)
-							remove_nl = 2;
-						else
-							remove_nl = 1;
-					} else
-						remove_nl = 0;
-					strncpy(value2, tok, line_len - remove_nl);
-					DataManager::SetValue(TW_BACKUP_NAME, value2);
-					gui_print("Backup folder set to '%s'\n", value2);
-					if (PartitionManager.Check_Backup_Name(true) != 0) {
-						ret_val = 1;
-						continue;
-					}
-				} else {
-					char empt[50];
-					strcpy(empt, "(Current Date)");
-					DataManager::SetValue(TW_BACKUP_NAME, empt);
-				}
-				ret_val = Backup_Command(value1);
-			} else if (strcmp(command, "restore") == 0) {
-				// Restore
-				DataManager::SetValue("tw_action_text2", "Restoring");
-				PartitionManager.Mount_All_Storage();
-				DataManager::SetValue(TW_SKIP_MD5_CHECK_VAR, 0);
-				char folder_path[512], partitions[512];
-
-				string val = value, restore_folder, restore_partitions;
-				size_t pos = val.find_last_of(" ");
-				if (pos == string::npos) {
-					restore_folder = value;
-					partitions[0] = '\0';
-				} else {
-					restore_folder = val.substr(0, pos);
-					restore_partitions = val.substr(pos + 1, val.size() - pos - 1);
-					strcpy(partitions, restore_partitions.c_str());
-				}
-				strcpy(folder_path, restore_folder.c_str());
-				LOGINFO("Restore folder is: '%s' and partitions: '%s'\n", folder_path, partitions);
-				gui_print("Restoring '%s'\n", folder_path);
-
-				if (folder_path[0] != '/') {
-					char backup_folder[512];
-					string folder_var;
-					DataManager::GetValue(TW_BACKUPS_FOLDER_VAR, folder_var);
-					sprintf(backup_folder, "%s/%s", folder_var.c_str(), folder_path);
-					LOGINFO("Restoring relative path: '%s'\n", backup_folder);
-					if (!TWFunc::Path_Exists(backup_folder)) {
-						if (DataManager::GetIntValue(TW_HAS_DUAL_STORAGE)) {
-							if (DataManager::GetIntValue(TW_USE_EXTERNAL_STORAGE)) {
-								LOGINFO("Backup folder '%s' not found on external storage, trying internal...\n", folder_path);
-								DataManager::SetValue(TW_USE_EXTERNAL_STORAGE, 0);
-							} else {
-								LOGINFO("Backup folder '%s' not found on internal storage, trying external...\n", folder_path);
-								DataManager::SetValue(TW_USE_EXTERNAL_STORAGE, 1);
-							}
-							DataManager::GetValue(TW_BACKUPS_FOLDER_VAR, folder_var);
-							sprintf(backup_folder, "%s/%s", folder_var.c_str(), folder_path);
-							LOGINFO("2Restoring relative path: '%s'\n", backup_folder);
-						}
-					}
-					strcpy(folder_path, backup_folder);
-				} else {
-					if (folder_path[strlen(folder_path) - 1] == '/')
-						strcat(folder_path, ".");
-					else
-						strcat(folder_path, "/.");
-				}
-				if (!TWFunc::Path_Exists(folder_path)) {
-					gui_print("Unable to locate backup '%s'\n", folder_path);
-					ret_val = 1;
-					continue;
-				}
-				DataManager::SetValue("tw_restore", folder_path);
-
-				PartitionManager.Set_Restore_Files(folder_path);
-				string Partition_List;
-				DataManager::GetValue("tw_restore_list", Partition_List);
-				if (strlen(partitions) != 0) {
-					string Restore_List;
-
-					memset(value2, 0, sizeof(value2));
-					strcpy(value2, partitions);
-					gui_print("Setting restore options: '%s':\n", value2);
-					line_len = strlen(value2);
-					for (i=0; i<line_len; i++) {
-						if ((value2[i] == 'S' || value2[i] == 's') && Partition_List.find("/system;") != string::npos) {
-							Restore_List += "/system;";
-							gui_print("System\n");
-						} else if ((value2[i] == 'D' || value2[i] == 'd') && Partition_List.find("/data;") != string::npos) {
-							Restore_List += "/data;";
-							gui_print("Data\n");
-						} else if ((value2[i] == 'C' || value2[i] == 'c') && Partition_List.find("/cache;") != string::npos) {
-							Restore_List += "/cache;";
-							gui_print("Cache\n");
-						} else if ((value2[i] == 'R' || value2[i] == 'r') && Partition_List.find("/recovery;") != string::npos) {
-							gui_print("Recovery -- Not allowed to restore recovery\n");
-						} else if (value2[i] == '1' && DataManager::GetIntValue(TW_RESTORE_SP1_VAR) > 0) {
-							gui_print("%s\n", "Special1 -- No Longer Supported...");
-						} else if (value2[i] == '2' && DataManager::GetIntValue(TW_RESTORE_SP2_VAR) > 0) {
-							gui_print("%s\n", "Special2 -- No Longer Supported...");
-						} else if (value2[i] == '3' && DataManager::GetIntValue(TW_RESTORE_SP3_VAR) > 0) {
-							gui_print("%s\n", "Special3 -- No Longer Supported...");
-						} else if ((value2[i] == 'B' || value2[i] == 'b') && Partition_List.find("/boot;") != string::npos) {
-							Restore_List += "/boot;";
-							gui_print("Boot\n");
-						} else if ((value2[i] == 'A' || value2[i] == 'a')  && Partition_List.find("/and-sec;") != string::npos) {
-							Restore_List += "/and-sec;";
-							gui_print("Android Secure\n");
-						} else if ((value2[i] == 'E' || value2[i] == 'e')  && Partition_List.find("/sd-ext;") != string::npos) {
-							Restore_List += "/sd-ext;";
-							gui_print("SD-Ext\n");
-						} else if (value2[i] == 'M' || value2[i] == 'm') {
-							DataManager::SetValue(TW_SKIP_MD5_CHECK_VAR, 1);
-							gui_print("MD5 check skip is on\n");
-						}
-					}
-
-					DataManager::SetValue("tw_restore_selected", Restore_List);
-				} else {
-					DataManager::SetValue("tw_restore_selected", Partition_List);
-				}
-				if (!PartitionManager.Run_Restore(folder_path))
-					ret_val = 1;
-				else
-					gui_print("Restore complete!\n");
-			} else if (strcmp(command, "mount") == 0) {
-				// Mount
-				DataManager::SetValue("tw_action_text2", "Mounting");
-				if (value[0] != '/') {
-					strcpy(mount, "/");
-					strcat(mount, value);
-				} else
-					strcpy(mount, value);
-				if (PartitionManager.Mount_By_Path(mount, true))
-					gui_print("Mounted '%s'\n", mount);
-			} else if (strcmp(command, "unmount") == 0 || strcmp(command, "umount") == 0) {
-				// Unmount
-				DataManager::SetValue("tw_action_text2", "Unmounting");
-				if (value[0] != '/') {
-					strcpy(mount, "/");
-					strcat(mount, value);
-				} else
-					strcpy(mount, value);
-				if (PartitionManager.UnMount_By_Path(mount, true))
-					gui_print("Unmounted '%s'\n", mount);
-			} else if (strcmp(command, "set") == 0) {
-				// Set value
-				tok = strtok(value, " ");
-				strcpy(value1, tok);
-				tok = strtok(NULL, " ");
-				strcpy(value2, tok);
-				gui_print("Setting '%s' to '%s'\n", value1, value2);
-				DataManager::SetValue(value1, value2);
-			} else if (strcmp(command, "mkdir") == 0) {
-				// Make directory (recursive)
-				DataManager::SetValue("tw_action_text2", "Making Directory");
-				gui_print("Making directory (recursive): '%s'\n", value);
-				if (TWFunc::Recursive_Mkdir(value)) {
-					LOGERR("Unable to create folder: '%s'\n", value);
-					ret_val = 1;
-				}
-			} else if (strcmp(command, "reboot") == 0) {
-				// Reboot
-			} else if (strcmp(command, "cmd") == 0) {
-				DataManager::SetValue("tw_action_text2", "Running Command");
-				if (cindex != 0) {
-					string status;
-					TWFunc::Exec_Cmd(value, status);
-				} else {
-					LOGERR("No value given for cmd\n");
-				}
-			} else if (strcmp(command, "print") == 0) {
-				gui_print("%s\n", value);
-			} else if (strcmp(command, "sideload") == 0) {
-				// ADB Sideload
-				DataManager::SetValue("tw_action_text2", "ADB Sideload");
-				install_cmd = -1;
-
-				int wipe_cache = 0;
-				string result, Sideload_File;
-
-				if (!PartitionManager.Mount_Current_Storage(true)) {
-					ret_val = 1; // failure
-				} else {
-					Sideload_File = DataManager::GetCurrentStoragePath() + "/sideload.zip";
-					if (TWFunc::Path_Exists(Sideload_File)) {
-						unlink(Sideload_File.c_str());
-					}
-					gui_print("Starting ADB sideload feature...\n");
-					DataManager::SetValue("tw_has_cancel", 1);
-					DataManager::SetValue("tw_cancel_action", "adbsideloadcancel");
-					ret_val = apply_from_adb(Sideload_File.c_str());
-					DataManager::SetValue("tw_has_cancel", 0);
-					if (ret_val != 0)
-						ret_val = 1; // failure
-					else if (TWinstall_zip(Sideload_File.c_str(), &wipe_cache) == 0) {
-						if (wipe_cache)
-							PartitionManager.Wipe_By_Path("/cache");
-					} else {
-						ret_val = 1; // failure
-					}
-					sideload = 1; // Causes device to go to the home screen afterwards
-					gui_print("Sideload finished.\n");
-				}
-			} else {
-				LOGERR("Unrecognized script command: '%s'\n", command);
-				ret_val = 1;
-			}
-		}
-		fclose(fp);
-		gui_print("Done processing script file\n");
-	} else {
-		LOGERR("Error opening script file '%s'\n", SCRIPT_FILE_TMP);
+	vector<Script_Command> Plan;
+	int ret_val = 0, install_cmd = 0, sideload = 0;
+	bool dry_run = false, storage_mounted = false, barrier;
+	size_t i;
+
+	if (Parse_Script_File(Plan, dry_run) != 0)
 		return 1;
+	Optimize_Plan(Plan);
+	if (dry_run) {
+		Dry_Run(Plan);
+		return 0;
+	}
+
+	DataManager::SetValue(TW_SIMULATE_ACTIONS, 0);
+	DataManager::SetValue("ui_progress", 0); // Reset the progress bar
+	prefetch.started = false;
+	for (i = 0; i < Plan.size() && ret_val == 0; i++) {
+		if (jobScheduler.isCancelled()) {
+			gui_print("Script cancelled before line %d\n", Plan[i].Line);
+			ret_val = 1;
+			break;
+		}
+		barrier = Is_Barrier(Plan[i]);
+		if (Plan[i].Command == "install")
+			Finish_Prefetch(prefetch.index == i);
+		else if (barrier)
+			Finish_Prefetch(false);
+		if (!storage_mounted && Needs_Storage(Plan[i])) {
+			PartitionManager.Mount_All_Storage();
+			storage_mounted = true;
+		}
+		Start_Prefetch(Plan, i, storage_mounted);
+		ret_val = Run_Command(Plan[i], install_cmd, sideload);
+		// These can unmount or wipe the storage the next steps expect, an
+		// updater-script may unmount or format it too
+		if (barrier)
+			storage_mounted = false;
 	}
+	Finish_Prefetch(false);
+	gui_print("Done processing script file\n");
+
 	if (install_cmd && DataManager::GetIntValue(TW_HAS_INJECTTWRP) == 1 && DataManager::GetIntValue(TW_INJECT_AFTER_ZIP) == 1) {
 		string status;
 		gui_print("Injecting TWRP into boot image...\n");
@@ -371,6 +203,431 @@ int OpenRecoveryScript::run_script_file(void) {
 	return ret_val;
 }
 
+int OpenRecoveryScript::Parse_Script_File(vector<Script_Command>& Plan, bool& Dry_Run) {
+	ifstream script(SCRIPT_FILE_TMP);
+	Script_Command cmd;
+	string line;
+	size_t pos;
+	int line_num = 0;
+
+	if (!script.is_open()) {
+		LOGERR("Error opening script file '%s'\n", SCRIPT_FILE_TMP);
+		return 1;
+	}
+	while (getline(script, line)) {
+		line_num++;
+		while (!line.empty() && (line[line.size() - 1] == '\r' || line[line.size() - 1] == '\n'))
+			line.resize(line.size() - 1);
+		if (line.empty())
+			continue;
+		cmd.Line = line_num;
+		pos = line.find(' ');
+		if (pos == string::npos || pos == 0) {
+			cmd.Command = line;
+			cmd.Value.clear();
+		} else {
+			cmd.Command = line.substr(0, pos);
+			cmd.Value = line.substr(pos + 1);
+		}
+		if (cmd.Command == "dryrun") {
+			Dry_Run = true;
+			continue;
+		}
+		if (cmd.Command != "install" && cmd.Command != "wipe" && cmd.Command != "backup" &&
+				cmd.Command != "restore" && cmd.Command != "restorepath" && cmd.Command != "mount" &&
+				cmd.Command != "unmount" && cmd.Command != "umount" && cmd.Command != "set" &&
+				cmd.Command != "mkdir" && cmd.Command != "reboot" && cmd.Command != "cmd" &&
+				cmd.Command != "print" && cmd.Command != "sideload") {
+			// Refuse the whole script rather than stopping half way through it
+			LOGERR("Unrecognized script command on line %d: '%s'\n", line_num, cmd.Command.c_str());
+			return 1;
+		}
+		LOGINFO("line %d: command is: '%s' and value is: '%s'\n", line_num, cmd.Command.c_str(), cmd.Value.c_str());
+		Plan.push_back(cmd);
+	}
+	return 0;
+}
+
+string OpenRecoveryScript::Wipe_Target(string Value) {
+	if (Value == "cache" || Value == "/cache")
+		return "cache";
+	if (Value == "dalvik" || Value == "dalvick" || Value == "dalvikcache" || Value == "dalvickcache")
+		return "dalvik";
+	if (Value == "data" || Value == "/data" || Value == "factory" || Value == "factoryreset")
+		return "data";
+	return "";
+}
+
+bool OpenRecoveryScript::Merge_Backups(Script_Command& First, const Script_Command& Second) {
+	string first_options = First.Value, second_options = Second.Value;
+	bool first_flag, second_flag;
+	const char* flag;
+	size_t i;
+
+	// Backups with a name go to a folder each, the second one would fail if
+	// it shared it. Unnamed ones are only separated by their timestamps.
+	if (first_options.find(' ') != string::npos || second_options.find(' ') != string::npos)
+		return false;
+	for (flag = "OoMm"; *flag; flag += 2) {
+		first_flag = first_options.find_first_of(string(flag, 2)) != string::npos;
+		second_flag = second_options.find_first_of(string(flag, 2)) != string::npos;
+		if (first_flag != second_flag)
+			return false;
+	}
+	for (i = 0; i < second_options.size(); i++) {
+		if (first_options.find(toupper(second_options[i])) == string::npos &&
+				first_options.find(tolower(second_options[i])) == string::npos)
+			first_options += second_options[i];
+	}
+	LOGINFO("Merging backup on line %d into the one on line %d\n", Second.Line, First.Line);
+	First.Value = first_options;
+	return true;
+}
+
+void OpenRecoveryScript::Optimize_Plan(vector<Script_Command>& Plan) {
+	size_t i, start, end;
+	bool has_data, has_cache;
+
+	for (i = 1; i < Plan.size();) {
+		Script_Command& prev = Plan[i - 1];
+		const Script_Command& cur = Plan[i];
+
+		if (prev.Command == "backup" && cur.Command == "backup" && Merge_Backups(prev, cur)) {
+			Plan.erase(Plan.begin() + i);
+		} else if (prev.Command == "wipe" && cur.Command == "wipe" &&
+				!Wipe_Target(cur.Value).empty() && Wipe_Target(prev.Value) == Wipe_Target(cur.Value)) {
+			LOGINFO("Dropping repeated wipe on line %d\n", cur.Line);
+			Plan.erase(Plan.begin() + i);
+		} else
+			i++;
+	}
+
+	// Wiping data and cache already takes care of both dalvik-cache folders
+	for (start = 0; start < Plan.size(); start = end) {
+		has_data = has_cache = false;
+		for (end = start; end < Plan.size() && Plan[end].Command == "wipe"; end++) {
+			has_data |= Wipe_Target(Plan[end].Value) == "data";
+			has_cache |= Wipe_Target(Plan[end].Value) == "cache";
+		}
+		if (end == start) {
+			end++;
+			continue;
+		}
+		if (!has_data || !has_cache)
+			continue;
+		for (i = start; i < end;) {
+			if (Wipe_Target(Plan[i].Value) == "dalvik") {
+				LOGINFO("Dropping dalvik wipe on line %d, data and cache are wiped next to it\n", Plan[i].Line);
+				Plan.erase(Plan.begin() + i);
+				end--;
+			} else
+				i++;
+		}
+	}
+}
+
+bool OpenRecoveryScript::Is_Barrier(const Script_Command& Cmd) {
+	return Cmd.Command == "install" || Cmd.Command == "wipe" || Cmd.Command == "restore" || Cmd.Command == "restorepath" ||
+		Cmd.Command == "unmount" || Cmd.Command == "umount" || Cmd.Command == "cmd" ||
+		Cmd.Command == "sideload";
+}
+
+bool OpenRecoveryScript::Needs_Storage(const Script_Command& Cmd) {
+	return Cmd.Command == "install" || Cmd.Command == "restore" || Cmd.Command == "restorepath";
+}
+
+bool OpenRecoveryScript::Wipe_Keeps_File(const Script_Command& Wipe, const string& Path) {
+	string target = Wipe_Target(Wipe.Value);
+	struct stat file_st, mount_st;
+
+	if (target == "dalvik")
+		return true;
+	// An open file would keep the partition from being unmounted for formatting
+	if (stat(Path.c_str(), &file_st) != 0)
+		return false;
+	if (target == "cache")
+		return stat("/cache", &mount_st) == 0 && mount_st.st_dev != file_st.st_dev;
+	if (target == "data")
+		return stat("/data", &mount_st) == 0 && mount_st.st_dev != file_st.st_dev &&
+			(stat("/sd-ext", &mount_st) != 0 || mount_st.st_dev != file_st.st_dev);
+	return false;
+}
+
+void OpenRecoveryScript::Start_Prefetch(const vector<Script_Command>& Plan, size_t Index, bool& Storage_Mounted) {
+	const string& Current = Plan[Index].Command;
+	string Zip;
+	size_t i;
+
+	// The next zip can be read while an install or wipe runs, any other
+	// barrier may change the storage it is on
+	if (prefetch.running || Current == "set" || (Is_Barrier(Plan[Index]) && Current != "install" && Current != "wipe"))
+		return;
+	// A set in between could change the storage or the verification setting
+	for (i = Index + 1; i < Plan.size() && Plan[i].Command != "install"; i++) {
+		if (Is_Barrier(Plan[i]) || Plan[i].Command == "set")
+			return;
+	}
+	if (i >= Plan.size() || (prefetch.started && prefetch.index >= i))
+		return;
+	if (!Storage_Mounted) {
+		PartitionManager.Mount_All_Storage();
+		Storage_Mounted = true;
+	}
+	Zip = Find_Zip_File(Plan[i].Value);
+	if (Zip.empty() || (Current == "wipe" && !Wipe_Keeps_File(Plan[Index], Zip)))
+		return;
+
+	prefetch.started = true;
+	prefetch.index = i;
+	prefetch.path = Zip;
+	prefetch.hash = DataManager::GetIntValue(TW_SIGNED_ZIP_VERIFY_VAR) != 0;
+	prefetch.digest_valid = false;
+	if (pthread_create(&prefetch.thread, NULL, Prefetch_Thread, NULL) != 0) {
+		LOGINFO("Unable to start reading ahead '%s'\n", Zip.c_str());
+		return;
+	}
+	prefetch.running = true;
+	LOGINFO("Reading ahead '%s' for line %d\n", Zip.c_str(), Plan[i].Line);
+}
+
+void OpenRecoveryScript::Finish_Prefetch(bool Use_Digest) {
+	int fd;
+
+	if (!prefetch.running)
+		return;
+	pthread_join(prefetch.thread, NULL);
+	prefetch.running = false;
+	if (!Use_Digest || !prefetch.digest_valid)
+		return;
+	// Handed over the same way as a sideload, TWinstall_zip checks that
+	// the path, size, device, inode and ctime still match before trusting
+	// it, which catches a zip replaced by the step that ran meanwhile
+	fd = open(ADB_SIDELOAD_DIGEST, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return;
+	if (write(fd, &prefetch.digest, sizeof(prefetch.digest)) != sizeof(prefetch.digest))
+		unlink(ADB_SIDELOAD_DIGEST);
+	close(fd);
+}
+
+int OpenRecoveryScript::Run_Command(const Script_Command& Cmd, int& install_cmd, int& sideload) {
+	string command = Cmd.Command, value = Cmd.Value, mount;
+	int ret_val = 0, i;
+	size_t pos;
+
+	if (command == "install") {
+		// Install Zip
+		DataManager::SetValue("tw_action_text2", "Installing Zip");
+		ret_val = Install_Command(value);
+		install_cmd = -1;
+	} else if (command == "wipe") {
+		// Wipe
+		string target = Wipe_Target(value);
+		if (target == "cache") {
+			gui_print("-- Wiping Cache Partition...\n");
+			PartitionManager.Wipe_By_Path("/cache");
+			gui_print("-- Cache Partition Wipe Complete!\n");
+		} else if (target == "dalvik") {
+			gui_print("-- Wiping Dalvik Cache...\n");
+			PartitionManager.Wipe_Dalvik_Cache();
+			gui_print("-- Dalvik Cache Wipe Complete!\n");
+		} else if (target == "data") {
+			gui_print("-- Wiping Data Partition...\n");
+			PartitionManager.Factory_Reset();
+			gui_print("-- Data Partition Wipe Complete!\n");
+		} else {
+			LOGERR("Error with wipe command value: '%s'\n", value.c_str());
+			ret_val = 1;
+		}
+	} else if (command == "backup") {
+		// Backup
+		DataManager::SetValue("tw_action_text2", "Backing Up");
+		string options = value, name;
+		pos = value.find(' ');
+		if (pos != string::npos) {
+			options = value.substr(0, pos);
+			name = value.substr(pos + 1);
+			name = name.substr(0, name.find(' '));
+		}
+		if (!name.empty()) {
+			DataManager::SetValue(TW_BACKUP_NAME, name);
+			gui_print("Backup folder set to '%s'\n", name.c_str());
+			if (PartitionManager.Check_Backup_Name(true) != 0)
+				return 1;
+		} else {
+			DataManager::SetValue(TW_BACKUP_NAME, "(Current Date)");
+		}
+		ret_val = Backup_Command(options);
+	} else if (command == "restore") {
+		// Restore
+		DataManager::SetValue("tw_action_text2", "Restoring");
+		DataManager::SetValue(TW_SKIP_MD5_CHECK_VAR, 0);
+
+		string restore_folder, partitions;
+		pos = value.find_last_of(" ");
+		if (pos == string::npos) {
+			restore_folder = value;
+		} else {
+			restore_folder = value.substr(0, pos);
+			partitions = value.substr(pos + 1);
+		}
+		LOGINFO("Restore folder is: '%s' and partitions: '%s'\n", restore_folder.c_str(), partitions.c_str());
+		gui_print("Restoring '%s'\n", restore_folder.c_str());
+
+		restore_folder = Locate_Backup_Folder(restore_folder);
+		if (restore_folder.empty())
+			return 1;
+		DataManager::SetValue("tw_restore", restore_folder);
+
+		PartitionManager.Set_Restore_Files(restore_folder);
+		string Partition_List;
+		DataManager::GetValue("tw_restore_list", Partition_List);
+		if (!partitions.empty()) {
+			string Restore_List;
+
+			gui_print("Setting restore options: '%s':\n", partitions.c_str());
+			for (i = 0; i < (int)partitions.size(); i++) {
+				char option = partitions[i];
+				if ((option == 'S' || option == 's') && Partition_List.find("/system;") != string::npos) {
+					Restore_List += "/system;";
+					gui_print("System\n");
+				} else if ((option == 'D' || option == 'd') && Partition_List.find("/data;") != string::npos) {
+					Restore_List += "/data;";
+					gui_print("Data\n");
+				} else if ((option == 'C' || option == 'c') && Partition_List.find("/cache;") != string::npos) {
+					Restore_List += "/cache;";
+					gui_print("Cache\n");
+				} else if ((option == 'R' || option == 'r') && Partition_List.find("/recovery;") != string::npos) {
+					gui_print("Recovery -- Not allowed to restore recovery\n");
+				} else if (option == '1' && DataManager::GetIntValue(TW_RESTORE_SP1_VAR) > 0) {
+					gui_print("%s\n", "Special1 -- No Longer Supported...");
+				} else if (option == '2' && DataManager::GetIntValue(TW_RESTORE_SP2_VAR) > 0) {
+					gui_print("%s\n", "Special2 -- No Longer Supported...");
+				} else if (option == '3' && DataManager::GetIntValue(TW_RESTORE_SP3_VAR) > 0) {
+					gui_print("%s\n", "Special3 -- No Longer Supported...");
+				} else if ((option == 'B' || option == 'b') && Partition_List.find("/boot;") != string::npos) {
+					Restore_List += "/boot;";
+					gui_print("Boot\n");
+				} else if ((option == 'A' || option == 'a')  && Partition_List.find("/and-sec;") != string::npos) {
+					Restore_List += "/and-sec;";
+					gui_print("Android Secure\n");
+				} else if ((option == 'E' || option == 'e')  && Partition_List.find("/sd-ext;") != string::npos) {
+					Restore_List += "/sd-ext;";
+					gui_print("SD-Ext\n");
+				} else if (option == 'M' || option == 'm') {
+					DataManager::SetValue(TW_SKIP_MD5_CHECK_VAR, 1);
+					gui_print("MD5 check skip is on\n");
+				}
+			}
+
+			DataManager::SetValue("tw_restore_selected", Restore_List);
+		} else {
+			DataManager::SetValue("tw_restore_selected", Partition_List);
+		}
+		if (!PartitionManager.Run_Restore(restore_folder))
+			ret_val = 1;
+		else
+			gui_print("Restore complete!\n");
+	} else if (command == "restorepath") {
+		// Restore single files or folders from a backup: restorepath <backup folder> <path>
+		DataManager::SetValue("tw_action_text2", "Restoring");
+		string restore_folder;
+		pos = value.find(" ");
+		if (pos == string::npos) {
+			LOGERR("restorepath needs a backup folder and a path\n");
+			return 1;
+		}
+		restore_folder = Locate_Backup_Folder(value.substr(0, pos));
+		if (restore_folder.empty())
+			return 1;
+		vector<string> paths;
+		paths.push_back(value.substr(pos + 1));
+		if (!PartitionManager.Run_Restore_Paths(restore_folder, paths))
+			ret_val = 1;
+		else
+			gui_print("Restore complete!\n");
+	} else if (command == "mount") {
+		// Mount
+		DataManager::SetValue("tw_action_text2", "Mounting");
+		mount = value;
+		if (mount.substr(0, 1) != "/")
+			mount = "/" + mount;
+		if (PartitionManager.Mount_By_Path(mount, true))
+			gui_print("Mounted '%s'\n", mount.c_str());
+	} else if (command == "unmount" || command == "umount") {
+		// Unmount
+		DataManager::SetValue("tw_action_text2", "Unmounting");
+		mount = value;
+		if (mount.substr(0, 1) != "/")
+			mount = "/" + mount;
+		if (PartitionManager.UnMount_By_Path(mount, true))
+			gui_print("Unmounted '%s'\n", mount.c_str());
+	} else if (command == "set") {
+		// Set value
+		pos = value.find(' ');
+		if (pos == string::npos) {
+			LOGERR("set needs a variable and a value\n");
+			return 1;
+		}
+		string var = value.substr(0, pos), val = value.substr(pos + 1);
+		val = val.substr(0, val.find(' '));
+		gui_print("Setting '%s' to '%s'\n", var.c_str(), val.c_str());
+		DataManager::SetValue(var, val);
+	} else if (command == "mkdir") {
+		// Make directory (recursive)
+		DataManager::SetValue("tw_action_text2", "Making Directory");
+		gui_print("Making directory (recursive): '%s'\n", value.c_str());
+		if (TWFunc::Recursive_Mkdir(value)) {
+			LOGERR("Unable to create folder: '%s'\n", value.c_str());
+			ret_val = 1;
+		}
+	} else if (command == "reboot") {
+		// Reboot
+	} else if (command == "cmd") {
+		DataManager::SetValue("tw_action_text2", "Running Command");
+		if (!value.empty()) {
+			string status;
+			TWFunc::Exec_Cmd(value, status);
+		} else {
+			LOGERR("No value given for cmd\n");
+		}
+	} else if (command == "print") {
+		gui_print("%s\n", value.c_str());
+	} else if (command == "sideload") {
+		// ADB Sideload
+		DataManager::SetValue("tw_action_text2", "ADB Sideload");
+		install_cmd = -1;
+
+		int wipe_cache = 0;
+		string result, Sideload_File;
+
+		if (!PartitionManager.Mount_Current_Storage(true)) {
+			ret_val = 1; // failure
+		} else {
+			Sideload_File = DataManager::GetCurrentStoragePath() + "/sideload.zip";
+			if (TWFunc::Path_Exists(Sideload_File)) {
+				unlink(Sideload_File.c_str());
+			}
+			gui_print("Starting ADB sideload feature...\n");
+			DataManager::SetValue("tw_has_cancel", 1);
+			DataManager::SetValue("tw_cancel_action", "adbsideloadcancel");
+			ret_val = apply_from_adb(Sideload_File.c_str());
+			DataManager::SetValue("tw_has_cancel", 0);
+			if (ret_val != 0)
+				ret_val = 1; // failure
+			else if (TWinstall_zip(Sideload_File.c_str(), &wipe_cache) == 0) {
+				if (wipe_cache)
+					PartitionManager.Wipe_By_Path("/cache");
+			} else {
+				ret_val = 1; // failure
+			}
+			sideload = 1; // Causes device to go to the home screen afterwards
+			gui_print("Sideload finished.\n");
+		}
+	}
+	return ret_val;
+}
+
 int OpenRecoveryScript::Insert_ORS_Command(string Command) {
 	ofstream ORSfile(SCRIPT_FILE_TMP);
 	if (ORSfile.is_open()) {
@@ -390,7 +647,6 @@ int OpenRecoveryScript::Install_Command(string Zip) {
 	string ret_string;
 	int ret_val = 0, wipe_cache = 0;
 
-	PartitionManager.Mount_All_Storage();
 	if (Zip.substr(0, 1) != "/") {
 		// Relative path given
 		string Full_Path;
@@ -467,13 +723,46 @@ string OpenRecoveryScript::Locate_Zip_File(string Zip, string Storage_Root) {
 	return "";
 }
 
+string OpenRecoveryScript::Locate_Backup_Folder(string Folder) {
+	string folder_path;
+
+	if (Folder[0] != '/') {
+		string folder_var;
+		DataManager::GetValue(TW_BACKUPS_FOLDER_VAR, folder_var);
+		folder_path = folder_var + "/" + Folder;
+		LOGINFO("Restoring relative path: '%s'\n", folder_path.c_str());
+		if (!TWFunc::Path_Exists(folder_path)) {
+			if (DataManager::GetIntValue(TW_HAS_DUAL_STORAGE)) {
+				if (DataManager::GetIntValue(TW_USE_EXTERNAL_STORAGE)) {
+					LOGINFO("Backup folder '%s' not found on external storage, trying internal...\n", Folder.c_str());
+					DataManager::SetValue(TW_USE_EXTERNAL_STORAGE, 0);
+				} else {
+					LOGINFO("Backup folder '%s' not found on internal storage, trying external...\n", Folder.c_str());
+					DataManager::SetValue(TW_USE_EXTERNAL_STORAGE, 1);
+				}
+				DataManager::GetValue(TW_BACKUPS_FOLDER_VAR, folder_var);
+				folder_path = folder_var + "/" + Folder;
+				LOGINFO("2Restoring relative path: '%s'\n", folder_path.c_str());
+			}
+		}
+	} else {
+		folder_path = Folder;
+		if (folder_path[folder_path.size() - 1] == '/')
+			folder_path += ".";
+		else
+			folder_path += "/.";
+	}
+	if (!TWFunc::Path_Exists(folder_path)) {
+		gui_print("Unable to locate backup '%s'\n", folder_path.c_str());
+		return "";
+	}
+	return folder_path;
+}
+
 int OpenRecoveryScript::Backup_Command(string Options) {
-	char value1[SCRIPT_COMMAND_SIZE];
 	int line_len, i;
 	string Backup_List;
 
-	strcpy(value1, Options.c_str());
-
 	DataManager::SetValue(TW_USE_COMPRESSION_VAR, 0);
 	DataManager::SetValue(TW_SKIP_MD5_GENERATE_VAR, 0);
 
@@ -539,3 +828,109 @@ void OpenRecoveryScript::Run_OpenRecoveryScript(void) {
 		LOGERR("Failed to load OpenRecoveryScript GUI page.\n");
 	}
 }
+
+string OpenRecoveryScript::Find_Zip_File(string Zip) {
+	string Full_Path = Zip;
+
+	// Same lookup as Install_Command, without switching storage
+	if (Zip.substr(0, 1) != "/")
+		Full_Path = DataManager::GetCurrentStoragePath() + "/" + Zip;
+	if (!TWFunc::Path_Exists(Full_Path))
+		Full_Path = Locate_Zip_File(Full_Path, DataManager::GetCurrentStoragePath());
+	return Full_Path;
+}
+
+string OpenRecoveryScript::Option_To_Path(char Option) {
+	switch (toupper(Option)) {
+		case 'S': return "/system";
+		case 'D': return "/data";
+		case 'C': return "/cache";
+		case 'R': return "/recovery";
+		case 'B': return "/boot";
+		case 'A': return "/and-sec";
+		case 'E': return "/sd-ext";
+	}
+	return "";
+}
+
+unsigned long long OpenRecoveryScript::Backup_Files_Size(string Folder, string Name) {
+	unsigned long long size = 0;
+	string prefix = Name + ".";
+	struct dirent* de;
+	struct stat st;
+	DIR* d;
+
+	d = opendir(Folder.c_str());
+	if (d == NULL)
+		return 0;
+	while ((de = readdir(d)) != NULL) {
+		if (strncmp(de->d_name, prefix.c_str(), prefix.size()) == 0 &&
+				stat((Folder + "/" + de->d_name).c_str(), &st) == 0)
+			size += st.st_size;
+	}
+	closedir(d);
+	return size;
+}
+
+void OpenRecoveryScript::Dry_Run(const vector<Script_Command>& Plan) {
+	unsigned long long img_bps, file_bps, comp_bps, rate, size, bytes, secs, total_bytes = 0, total_secs = 0;
+	int use_external = DataManager::GetIntValue(TW_USE_EXTERNAL_STORAGE);
+	string options, folder, Zip;
+	TWPartition* Part;
+	struct stat st;
+	size_t i, j, pos;
+
+	DataManager::GetValue(TW_BACKUP_AVG_IMG_RATE, img_bps);
+	DataManager::GetValue(TW_BACKUP_AVG_FILE_RATE, file_bps);
+	DataManager::GetValue(TW_BACKUP_AVG_FILE_COMP_RATE, comp_bps);
+	if (img_bps == 0 || file_bps == 0 || comp_bps == 0) {
+		LOGERR("No backup rate history to estimate with\n");
+		return;
+	}
+	PartitionManager.Update_System_Details();
+	PartitionManager.Mount_All_Storage();
+
+	// Estimates use the rates of the previous backups: restores run at the
+	// backup rate of each partition, zips are read at the image rate.
+	gui_print("Dry run, %d steps after planning:\n", (int)Plan.size());
+	for (i = 0; i < Plan.size(); i++) {
+		const Script_Command& cmd = Plan[i];
+		bytes = secs = 0;
+		if (cmd.Command == "backup") {
+			options = cmd.Value.substr(0, cmd.Value.find(' '));
+			rate = options.find_first_of("Oo") != string::npos ? comp_bps : file_bps;
+			for (j = 0; j < options.size(); j++) {
+				Part = PartitionManager.Find_Partition_By_Path(Option_To_Path(options[j]));
+				if (Part == NULL || !Part->Can_Be_Backed_Up)
+					continue;
+				bytes += Part->Backup_Size;
+				secs += Part->Backup_Size / (Part->Backup_Method == TWPartition::FILES ? rate : img_bps);
+			}
+		} else if (cmd.Command == "restore") {
+			pos = cmd.Value.find_last_of(" ");
+			options = pos == string::npos ? "SDCBAE" : cmd.Value.substr(pos + 1);
+			folder = Locate_Backup_Folder(cmd.Value.substr(0, pos));
+			for (j = 0; j < options.size() && !folder.empty(); j++) {
+				Part = PartitionManager.Find_Partition_By_Path(Option_To_Path(options[j]));
+				if (Part == NULL || Part->Mount_Point == "/recovery")
+					continue;
+				size = Backup_Files_Size(folder, Part->Backup_Name);
+				bytes += size;
+				secs += size / (Part->Backup_Method == TWPartition::FILES ? file_bps : img_bps);
+			}
+		} else if (cmd.Command == "install") {
+			Zip = Find_Zip_File(cmd.Value);
+			if (!Zip.empty() && stat(Zip.c_str(), &st) == 0) {
+				bytes = st.st_size;
+				secs = bytes / img_bps;
+			} else
+				gui_print("Unable to locate zip file '%s'.\n", cmd.Value.c_str());
+		}
+		total_bytes += bytes;
+		total_secs += secs;
+		gui_print("%4d: %-10s %-32s %6llu MB %5llu s\n", cmd.Line, cmd.Command.c_str(),
+			cmd.Value.c_str(), bytes / (1024 * 1024), secs);
+	}
+	gui_print("Total: %llu MB in about %llu s\n", total_bytes / (1024 * 1024), total_secs);
+	DataManager::SetValue(TW_USE_EXTERNAL_STORAGE, use_external);
+}
@@ -24,6 +24,7 @@
 #define _OPENRECOVERYSCRIPT_HPP
 
 #include <string>
+#include <vector>
 
 using namespace std;
 
@@ -31,13 +32,37 @@ using namespace std;
 class OpenRecoveryScript
 {
 public:
+	// One line of the script, as planned before anything runs
+	struct Script_Command {
+		string Command;
+		string Value;
+		int Line;
+	};
+
 	static int check_for_script_file();                                            // Checks to see if the ORS file is present in /cache
 	static int run_script_file();                                                  // Executes the commands in the ORS file
 	static int Insert_ORS_Command(string Command);                                 // Inserts the Command into the SCRIPT_FILE_TMP file
 	static int Install_Command(string Zip);                                        // Installs a zip
 	static string Locate_Zip_File(string Path, string File);                       // Attempts to locate the zip file in storage
+	static string Locate_Backup_Folder(string Folder);                             // Resolves a backup folder relative to the backups folder, empty if not found
 	static int Backup_Command(string Options);                                     // Runs a backup
 	static void Run_OpenRecoveryScript();                                          // Starts the GUI Page for running OpenRecoveryScript
+
+private:
+	static int Parse_Script_File(vector<Script_Command>& Plan, bool& Dry_Run);     // Reads the whole ORS file into a plan, fails on unknown commands
+	static void Optimize_Plan(vector<Script_Command>& Plan);                       // Merges adjacent unnamed backups and drops redundant wipes
+	static bool Merge_Backups(Script_Command& First, const Script_Command& Second); // Folds Second into First if both go to a dated folder with the same flags
+	static string Wipe_Target(string Value);                                       // Normalizes a wipe value to cache, dalvik or data, empty if invalid
+	static bool Is_Barrier(const Script_Command& Cmd);                             // True for steps that can unmount or change storage, no read ahead spans them
+	static bool Needs_Storage(const Script_Command& Cmd);                          // True for steps that read from storage
+	static bool Wipe_Keeps_File(const Script_Command& Wipe, const string& Path);   // True if the wipe leaves the partition holding Path mounted
+	static void Start_Prefetch(const vector<Script_Command>& Plan, size_t Index, bool& Storage_Mounted); // Reads ahead the next install zip while step Index runs, Index may be an install or wipe
+	static void Finish_Prefetch(bool Use_Digest);                                  // Waits for the read ahead, optionally hands its digest to the signature check
+	static int Run_Command(const Script_Command& Cmd, int& install_cmd, int& sideload); // Executes one planned step
+	static string Find_Zip_File(string Zip);                                       // Resolves a zip path on the current storage without switching storage
+	static string Option_To_Path(char Option);                                     // Maps a backup/restore option letter to its partition
+	static unsigned long long Backup_Files_Size(string Folder, string Name);       // Size of the backup files of one partition in a backup folder
+	static void Dry_Run(const vector<Script_Command>& Plan);                       // Prints the plan with estimated bytes and time instead of running it
 };
 
 #endif // _OPENRECOVERYSCRIPT_HPP
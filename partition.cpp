@@ -28,8 +28,14 @@
 #include <sys/mount.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
+#include <map>
+#include <set>
 
 #ifdef TW_INCLUDE_CRYPTO
 	#include "cutils/properties.h"
@@ -43,6 +49,7 @@
 #include "twrp-functions.hpp"
 #include "twrpDigest.hpp"
 #include "twrpTar.hpp"
+#include "twrpDD.hpp"
 extern "C" {
 	#include "mtdutils/mtdutils.h"
 	#include "mtdutils/mounts.h"
@@ -106,11 +113,10 @@ TWPartition::~TWPartition(void) {
 	// Do nothing
 }
 
-bool TWPartition::Process_Fstab_Line(string Line, bool Display_Error) {
+bool TWPartition::Parse_Fstab_Line(string Line, bool Display_Error) {
 	char full_line[MAX_FSTAB_LINE_LENGTH], item[MAX_FSTAB_LINE_LENGTH];
 	int line_len = Line.size(), index = 0, item_index = 0;
 	char* ptr;
-	string Flags;
 	strncpy(full_line, Line.c_str(), line_len);
 	bool skip = false;
 
@@ -172,8 +178,8 @@ bool TWPartition::Process_Fstab_Line(string Line, bool Display_Error) {
 			} else if (strlen(ptr) > 6 && strncmp(ptr, "flags=", 6) == 0) {
 				// Custom flags, save for later so that new values aren't overwritten by defaults
 				ptr += 6;
-				Flags = ptr;
-				Process_Flags(Flags, Display_Error);
+				Fstab_Flags = ptr;
+				Process_Flags(Fstab_Flags, Display_Error);
 			} else if (strlen(ptr) == 4 && (strncmp(ptr, "NULL", 4) == 0 || strncmp(ptr, "null", 4) == 0 || strncmp(ptr, "null", 4) == 0)) {
 				// Do nothing
 			} else {
@@ -191,8 +197,15 @@ bool TWPartition::Process_Fstab_Line(string Line, bool Display_Error) {
 		else
 			LOGINFO("Unknown File System: '%s'\n", Fstab_File_System.c_str());
 		return 0;
-	} else if (Is_File_System(Fstab_File_System)) {
-		Find_Actual_Block_Device();
+	}
+	Find_Actual_Block_Device();
+	if (Is_Image(Fstab_File_System))
+		Setup_Image(Display_Error);
+	return true;
+}
+
+bool TWPartition::Setup_Fstab_Line(bool Display_Error) {
+	if (Is_File_System(Fstab_File_System)) {
 		Setup_File_System(Display_Error);
 		if (Mount_Point == "/system") {
 			Display_Name = "System";
@@ -340,8 +353,6 @@ bool TWPartition::Process_Fstab_Line(string Line, bool Display_Error) {
 		}
 #endif
 	} else if (Is_Image(Fstab_File_System)) {
-		Find_Actual_Block_Device();
-		Setup_Image(Display_Error);
 		if (Mount_Point == "/boot") {
 			Display_Name = "Boot";
 			Backup_Display_Name = Display_Name;
@@ -354,8 +365,8 @@ bool TWPartition::Process_Fstab_Line(string Line, bool Display_Error) {
 	}
 
 	// Process any custom flags
-	if (Flags.size() > 0)
-		Process_Flags(Flags, Display_Error);
+	if (Fstab_Flags.size() > 0)
+		Process_Flags(Fstab_Flags, Display_Error);
 	return true;
 }
 
@@ -647,7 +658,7 @@ bool TWPartition::Get_Size_Via_statfs(bool Display_Error) {
 
 bool TWPartition::Get_Size_Via_df(bool Display_Error) {
 	FILE* fp;
-	char command[255], line[512];
+	char command[255], line[512], dfoutput[64];
 	int include_block = 1;
 	unsigned int min_len;
 	string result;
@@ -655,12 +666,14 @@ bool TWPartition::Get_Size_Via_df(bool Display_Error) {
 	if (!Mount(Display_Error))
 		return false;
 
+	// Partitions may be sized concurrently, so each one gets its own output file
 	min_len = Actual_Block_Device.size() + 2;
-	sprintf(command, "df %s > /tmp/dfoutput.txt", Mount_Point.c_str());
+	snprintf(dfoutput, sizeof(dfoutput), "/tmp/dfoutput-%s.txt", Backup_Name.c_str());
+	sprintf(command, "df %s > %s", Mount_Point.c_str(), dfoutput);
 	TWFunc::Exec_Cmd(command, result);
-	fp = fopen("/tmp/dfoutput.txt", "rt");
+	fp = fopen(dfoutput, "rt");
 	if (fp == NULL) {
-		LOGINFO("Unable to open /tmp/dfoutput.txt.\n");
+		LOGINFO("Unable to open %s.\n", dfoutput);
 		return false;
 	}
 
@@ -752,10 +765,131 @@ bool TWPartition::Find_Partition_Size(void) {
 	return false;
 }
 
+// blkid results per block device. An entry is only used while the device
+// node is the same one that was probed (swapped removable media gets a new
+// node) and nothing invalidated it since the probe was started.
+struct fs_probe_entry {
+	fs_probe_entry() : Generation(0), Rdev(0), Ctime(0), Valid(false) {}
+
+	unsigned int Generation;
+	dev_t Rdev;
+	time_t Ctime;
+	string Type;
+	bool Valid;
+};
+
+static map<string, fs_probe_entry> fs_probe_cache;
+static pthread_mutex_t fs_probe_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long fs_probe_hits, fs_probe_misses;
+
+// Mount points from /proc/self/mountinfo. The kernel flags the file with
+// POLLPRI whenever the mount namespace changes, so it is only read again
+// after something was mounted or unmounted.
+static set<string> mount_table;
+static int mount_table_fd = -2; // -1 when mountinfo is not available
+static pthread_mutex_t mount_table_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long mount_table_queries, mount_table_reloads;
+
+static string Mountinfo_Unescape(const string& Path) {
+	string ret;
+
+	for (size_t i = 0; i < Path.size(); i++) {
+		if (Path[i] == '\\' && i + 3 < Path.size() && isdigit(Path[i + 1])) {
+			ret += (char) strtol(Path.substr(i + 1, 3).c_str(), NULL, 8);
+			i += 3;
+		} else
+			ret += Path[i];
+	}
+	return ret;
+}
+
+static bool Mount_Table_Reload(void) {
+	string data;
+	char buf[4096];
+	ssize_t len;
+
+	if (lseek(mount_table_fd, 0, SEEK_SET) != 0)
+		return false;
+	while ((len = read(mount_table_fd, buf, sizeof(buf))) > 0)
+		data.append(buf, len);
+	if (len < 0)
+		return false;
+
+	// Each line is "id parent major:minor root mount_point ...", see proc(5)
+	mount_table.clear();
+	istringstream lines(data);
+	string line;
+	while (getline(lines, line)) {
+		istringstream fields(line);
+		string id, parent, dev, root, mount_point;
+		if (fields >> id >> parent >> dev >> root >> mount_point)
+			mount_table.insert(Mountinfo_Unescape(mount_point));
+	}
+	mount_table_reloads++;
+	return true;
+}
+
+// Returns 1 if something is mounted at Mount_Point, 0 if not, or -1 if
+// the mount table can't be used and the caller has to check by itself
+static int Mount_Table_Lookup(const string& Mount_Point) {
+	int ret = -1;
+
+	pthread_mutex_lock(&mount_table_lock);
+	if (mount_table_fd == -2) {
+		mount_table_fd = open("/proc/self/mountinfo", O_RDONLY);
+		if (mount_table_fd >= 0 && !Mount_Table_Reload()) {
+			close(mount_table_fd);
+			mount_table_fd = -1;
+		}
+	}
+	if (mount_table_fd >= 0) {
+		struct pollfd pfd;
+		pfd.fd = mount_table_fd;
+		pfd.events = POLLPRI;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLPRI | POLLERR)) && !Mount_Table_Reload()) {
+			close(mount_table_fd);
+			mount_table_fd = -1;
+		} else {
+			mount_table_queries++;
+			ret = mount_table.count(Mount_Point) ? 1 : 0;
+		}
+	}
+	pthread_mutex_unlock(&mount_table_lock);
+	return ret;
+}
+
+void TWPartition::Log_State_Cache_Stats(void) {
+	pthread_mutex_lock(&fs_probe_lock);
+	LOGINFO("blkid probe cache: %lu hits, %lu probes\n", fs_probe_hits, fs_probe_misses);
+	pthread_mutex_unlock(&fs_probe_lock);
+	pthread_mutex_lock(&mount_table_lock);
+	LOGINFO("Mount table: %lu mount checks, %lu mountinfo reads\n", mount_table_queries, mount_table_reloads);
+	pthread_mutex_unlock(&mount_table_lock);
+}
+
+void TWPartition::Invalidate_FS_Type(void) {
+	string Devices[3] = {Primary_Block_Device, Alternate_Block_Device, Actual_Block_Device};
+
+	pthread_mutex_lock(&fs_probe_lock);
+	for (int i = 0; i < 3; i++) {
+		if (Devices[i].empty())
+			continue;
+		fs_probe_entry& entry = fs_probe_cache[Devices[i]];
+		entry.Generation++;
+		entry.Valid = false;
+	}
+	pthread_mutex_unlock(&fs_probe_lock);
+}
+
 bool TWPartition::Is_Mounted(void) {
 	if (!Can_Be_Mounted)
 		return false;
 
+	int mounted = Mount_Table_Lookup(Mount_Point);
+	if (mounted >= 0)
+		return mounted == 1;
+
 	struct stat st1, st2;
 	string test_path;
 
@@ -840,6 +974,8 @@ bool TWPartition::Mount(bool Display_Error) {
 			else
 				LOGINFO("Unable to mount '%s'\n", Mount_Point.c_str());
 			LOGINFO("Actual block device: '%s', current file system: '%s'\n", Actual_Block_Device.c_str(), Current_File_System.c_str());
+			// Probe again next time in case the file system changed behind our back
+			Invalidate_FS_Type();
 			return false;
 #ifdef TW_NO_EXFAT_FUSE
 		}
@@ -961,6 +1097,7 @@ bool TWPartition::Wipe(string New_File_System) {
 		}
 		update_crypt = wiped;
 	}
+	Invalidate_FS_Type();
 
 	if (wiped) {
 #ifdef TW_INCLUDE_CRYPTO_SAMSUNG
@@ -1015,8 +1152,11 @@ bool TWPartition::Wipe_AndSec(void) {
 }
 
 bool TWPartition::Backup(string backup_folder) {
-	if (Backup_Method == FILES)
+	if (Backup_Method == FILES) {
+		if (Current_File_System == "vfat")
+			Check_FAT(backup_folder);
 		return Backup_Tar(backup_folder);
+	}
 	else if (Backup_Method == DD)
 		return Backup_DD(backup_folder);
 	else if (Backup_Method == FLASH_UTILS)
@@ -1025,6 +1165,31 @@ bool TWPartition::Backup(string backup_folder) {
 	return false;
 }
 
+bool TWPartition::Check_FAT(string backup_folder) {
+	string Command, result;
+
+	if (!TWFunc::Path_Exists("/sbin/dosfsck"))
+		return true;
+	// The backup is being written to this partition, so it has to stay mounted
+	if (backup_folder.find(Mount_Point + "/") == 0 || (!Symlink_Mount_Point.empty() && backup_folder.find(Symlink_Mount_Point + "/") == 0)) {
+		LOGINFO("Not checking '%s', backup storage is on it.\n", Mount_Point.c_str());
+		return true;
+	}
+	if (!UnMount(false)) {
+		LOGINFO("Not checking '%s', unable to unmount.\n", Mount_Point.c_str());
+		return true;
+	}
+
+	Find_Actual_Block_Device();
+	Command = "dosfsck -q " + Actual_Block_Device;
+	LOGINFO("dosfsck command: %s\n", Command.c_str());
+	if (TWFunc::Exec_Cmd(Command, result) == 0)
+		return true;
+	LOGINFO("dosfsck output:\n%s", result.c_str());
+	gui_print("WARNING: %s has file system errors, backing up anyway.\n", Backup_Display_Name.c_str());
+	return false;
+}
+
 bool TWPartition::Check_MD5(string restore_folder) {
 	string Full_Filename, md5file;
 	char split_filename[512];
@@ -1095,17 +1260,20 @@ bool TWPartition::Restore(string restore_folder) {
 	Restore_File_System.resize(second_period);
 	LOGINFO("Restore file system is: '%s'.\n", Restore_File_System.c_str());
 
+	bool ret = false;
 	if (Is_File_System(Restore_File_System))
-		return Restore_Tar(restore_folder, Restore_File_System);
-	else if (Is_Image(Restore_File_System)) {
-		if (Restore_File_System == "emmc")
-			return Restore_DD(restore_folder);
-		else if (Restore_File_System == "mtd" || Restore_File_System == "bml")
-			return Restore_Flash_Image(restore_folder);
+		ret = Restore_Tar(restore_folder, Restore_File_System);
+	else if (Is_Image(Restore_File_System) && Restore_File_System == "emmc")
+		ret = Restore_DD(restore_folder);
+	else if (Is_Image(Restore_File_System) && (Restore_File_System == "mtd" || Restore_File_System == "bml"))
+		ret = Restore_Flash_Image(restore_folder);
+	else {
+		LOGERR("Unknown restore method for '%s'\n", Mount_Point.c_str());
+		return false;
 	}
-
-	LOGERR("Unknown restore method for '%s'\n", Mount_Point.c_str());
-	return false;
+	// A restored image may carry a different file system than before
+	Invalidate_FS_Type();
+	return ret;
 }
 
 string TWPartition::Backup_Method_By_Name() {
@@ -1150,6 +1318,65 @@ bool TWPartition::Wipe_Encryption() {
 	return false;
 }
 
+// Probes the devices of all given partitions at once with libblkid's
+// concurrent prober, so the Check_FS_Type calls of the first mounts are
+// served from the cache instead of probing one device after another
+void TWPartition::Probe_FS_Types(std::vector<TWPartition*>& Partitions) {
+	std::vector<TWPartition*>::iterator iter;
+	std::vector<string> Devices;
+	std::vector<unsigned int> Generations;
+	std::vector<struct stat> Stats;
+
+	pthread_mutex_lock(&fs_probe_lock);
+	for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
+		TWPartition* Part = *iter;
+		struct stat st;
+
+		if (Part->Fstab_File_System == "yaffs2" || Part->Fstab_File_System == "mtd" || Part->Fstab_File_System == "bml" || Part->Ignore_Blkid)
+			continue;
+		// Raw partitions keep the type they were set up with and mounted ones
+		// were already probed by Mount, so their Current_File_System is settled
+		if (!Part->Can_Be_Mounted || Part->Is_Mounted())
+			continue;
+		Part->Find_Actual_Block_Device();
+		if (!Part->Is_Present || stat(Part->Actual_Block_Device.c_str(), &st) != 0)
+			continue;
+		if (find(Devices.begin(), Devices.end(), Part->Actual_Block_Device) != Devices.end())
+			continue;
+
+		fs_probe_entry& entry = fs_probe_cache[Part->Actual_Block_Device];
+		if (entry.Valid && entry.Rdev == st.st_rdev && entry.Ctime == st.st_ctime)
+			continue;
+		Devices.push_back(Part->Actual_Block_Device);
+		Generations.push_back(entry.Generation);
+		Stats.push_back(st);
+	}
+	pthread_mutex_unlock(&fs_probe_lock);
+
+	if (Devices.empty())
+		return;
+
+	std::vector<const char*> Names(Devices.size());
+	std::vector<char*> Types(Devices.size());
+	for (size_t i = 0; i < Devices.size(); i++)
+		Names[i] = Devices[i].c_str();
+	int found = blkid_probe_devices_types(&Names[0], &Types[0], Devices.size(), 0);
+	LOGINFO("Probed %lu block devices, %i file systems found\n", (unsigned long) Devices.size(), found);
+
+	pthread_mutex_lock(&fs_probe_lock);
+	for (size_t i = 0; i < Devices.size(); i++) {
+		fs_probe_entry& entry = fs_probe_cache[Devices[i]];
+		if (Types[i] && entry.Generation == Generations[i]) {
+			entry.Rdev = Stats[i].st_rdev;
+			entry.Ctime = Stats[i].st_ctime;
+			entry.Type = Types[i];
+			entry.Valid = true;
+		}
+		free(Types[i]);
+	}
+	pthread_mutex_unlock(&fs_probe_lock);
+}
+
 void TWPartition::Check_FS_Type() {
 	const char* type;
 	blkid_probe pr;
@@ -1161,6 +1388,22 @@ void TWPartition::Check_FS_Type() {
 	if (!Is_Present)
 		return;
 
+	struct stat st;
+	if (stat(Actual_Block_Device.c_str(), &st) != 0)
+		memset(&st, 0, sizeof(st));
+
+	pthread_mutex_lock(&fs_probe_lock);
+	fs_probe_entry& entry = fs_probe_cache[Actual_Block_Device];
+	if (entry.Valid && entry.Rdev == st.st_rdev && entry.Ctime == st.st_ctime) {
+		fs_probe_hits++;
+		Current_File_System = entry.Type;
+		pthread_mutex_unlock(&fs_probe_lock);
+		return;
+	}
+	fs_probe_misses++;
+	unsigned int generation = entry.Generation;
+	pthread_mutex_unlock(&fs_probe_lock);
+
 	pr = blkid_new_probe_from_filename(Actual_Block_Device.c_str());
 	if (blkid_do_fullprobe(pr)) {
 		blkid_free_probe(pr);
@@ -1173,6 +1416,17 @@ void TWPartition::Check_FS_Type() {
 		return;
 	}
 	Current_File_System = type;
+	blkid_free_probe(pr);
+
+	// Don't keep the result if the device was wiped or restored meanwhile
+	pthread_mutex_lock(&fs_probe_lock);
+	if (entry.Generation == generation) {
+		entry.Rdev = st.st_rdev;
+		entry.Ctime = st.st_ctime;
+		entry.Type = Current_File_System;
+		entry.Valid = true;
+	}
+	pthread_mutex_unlock(&fs_probe_lock);
 	return;
 }
 
@@ -1423,12 +1677,9 @@ bool TWPartition::Backup_Tar(string backup_folder) {
 }
 
 bool TWPartition::Backup_DD(string backup_folder) {
-	char back_name[255], backup_size[32];
-	string Full_FileName, Command, result, DD_BS;
-	int use_compression;
-
-	sprintf(backup_size, "%llu", Backup_Size);
-	DD_BS = backup_size;
+	char back_name[255];
+	string Full_FileName;
+	twrpDD dd;
 
 	TWFunc::GUI_Operation_Text(TW_BACKUP_TEXT, Display_Name, "Backing Up");
 	gui_print("Backing up %s...\n", Display_Name.c_str());
@@ -1438,20 +1689,23 @@ bool TWPartition::Backup_DD(string backup_folder) {
 
 	Full_FileName = backup_folder + "/" + Backup_FileName;
 
-	Command = "dd if=" + Actual_Block_Device + " of='" + Full_FileName + "'" + " bs=" + DD_BS + "c count=1";
-	LOGINFO("Backup command: '%s'\n", Command.c_str());
-	TWFunc::Exec_Cmd(Command, result);
+	dd.setdev(Actual_Block_Device);
+	dd.setfn(Full_FileName);
+	dd.setsize(Backup_Size);
+	dd.setsparse(true);
+	if (dd.backup() != 0)
+		return false;
 	if (TWFunc::Get_File_Size(Full_FileName) == 0) {
 		LOGERR("Backup file size for '%s' is 0 bytes.\n", Full_FileName.c_str());
 		return false;
 	}
-	return true;
+	return Write_Image_MD5(Full_FileName, dd.digest());
 }
 
 bool TWPartition::Backup_Dump_Image(string backup_folder) {
 	char back_name[255];
-	string Full_FileName, Command, result;
-	int use_compression;
+	string Full_FileName;
+	twrpDD dd;
 
 	TWFunc::GUI_Operation_Text(TW_BACKUP_TEXT, Display_Name, "Backing Up");
 	gui_print("Backing up %s...\n", Display_Name.c_str());
@@ -1461,14 +1715,34 @@ bool TWPartition::Backup_Dump_Image(string backup_folder) {
 
 	Full_FileName = backup_folder + "/" + Backup_FileName;
 
-	Command = "dump_image " + MTD_Name + " '" + Full_FileName + "'";
-	LOGINFO("Backup command: '%s'\n", Command.c_str());
-	TWFunc::Exec_Cmd(Command, result);
+	dd.setmtd(true);
+	dd.setdev(MTD_Name);
+	dd.setfn(Full_FileName);
+	dd.setsparse(true);
+	if (dd.backup() != 0)
+		return false;
 	if (TWFunc::Get_File_Size(Full_FileName) == 0) {
 		// Actual size may not match backup size due to bad blocks on MTD devices so just check for 0 bytes
 		LOGERR("Backup file size for '%s' is 0 bytes.\n", Full_FileName.c_str());
 		return false;
 	}
+	return Write_Image_MD5(Full_FileName, dd.digest());
+}
+
+bool TWPartition::Write_Image_MD5(string Full_FileName, const unsigned char* digest) {
+	int skip_md5;
+	twrpDigest md5sum;
+
+	// The image was hashed while it was copied, so store the result now
+	// instead of reading the whole file again for the md5 step
+	DataManager::GetValue(TW_SKIP_MD5_GENERATE_VAR, skip_md5);
+	if (skip_md5 != 0)
+		return true;
+	md5sum.setfn(Full_FileName);
+	if (md5sum.write_md5digest(digest) != 0) {
+		LOGERR("Unable to write md5 for '%s'\n", Full_FileName.c_str());
+		return false;
+	}
 	return true;
 }
 
@@ -1525,8 +1799,49 @@ bool TWPartition::Restore_Tar(string restore_folder, string Restore_File_System)
 	return true;
 }
 
+bool TWPartition::Restore_Tar_Paths(string restore_folder, vector<string> Paths) {
+	string Full_FileName;
+	int index = 0;
+	char split_index[5];
+
+	if (!Mount(true))
+		return false;
+
+	Full_FileName = restore_folder + "/" + Backup_FileName;
+	if (!TWFunc::Path_Exists(Full_FileName)) {
+		// Backup is multiple archives, each with its own index
+		sprintf(split_index, "%03i", index);
+		Full_FileName = restore_folder + "/" + Backup_FileName + split_index;
+		while (TWFunc::Path_Exists(Full_FileName)) {
+			LOGINFO("Restoring selected paths from '%s'...\n", Full_FileName.c_str());
+			twrpTar tar;
+			tar.setdir("/");
+			tar.setfn(Full_FileName);
+			tar.setpaths(Paths);
+			if (tar.extractTarFork() != 0)
+				return false;
+			index++;
+			sprintf(split_index, "%03i", index);
+			Full_FileName = restore_folder + "/" + Backup_FileName + split_index;
+		}
+		if (index == 0) {
+			LOGERR("Error locating restore file: '%s'\n", Full_FileName.c_str());
+			return false;
+		}
+	} else {
+		twrpTar tar;
+		tar.setdir(Backup_Path);
+		tar.setfn(Full_FileName);
+		tar.setpaths(Paths);
+		if (tar.extractTarFork() != 0)
+			return false;
+	}
+	return true;
+}
+
 bool TWPartition::Restore_DD(string restore_folder) {
-	string Full_FileName, Command, result;
+	string Full_FileName;
+	twrpDD dd;
 
 	TWFunc::GUI_Operation_Text(TW_RESTORE_TEXT, Display_Name, "Restoring");
 	Full_FileName = restore_folder + "/" + Backup_FileName;
@@ -1544,25 +1859,23 @@ bool TWPartition::Restore_DD(string restore_folder) {
 	}
 
 	gui_print("Restoring %s...\n", Display_Name.c_str());
-	Command = "dd bs=4096 if='" + Full_FileName + "' of=" + Actual_Block_Device;
-	LOGINFO("Restore command: '%s'\n", Command.c_str());
-	TWFunc::Exec_Cmd(Command, result);
-	return true;
+	dd.setdev(Actual_Block_Device);
+	dd.setfn(Full_FileName);
+	return dd.restore() == 0;
 }
 
 bool TWPartition::Restore_Flash_Image(string restore_folder) {
-	string Full_FileName, Command, result;
+	string Full_FileName;
+	twrpDD dd;
 
 	gui_print("Restoring %s...\n", Display_Name.c_str());
 	Full_FileName = restore_folder + "/" + Backup_FileName;
-	// Sometimes flash image doesn't like to flash due to the first 2KB matching, so we erase first to ensure that it flashes
-	Command = "erase_image " + MTD_Name;
-	LOGINFO("Erase command: '%s'\n", Command.c_str());
-	TWFunc::Exec_Cmd(Command, result);
-	Command = "flash_image " + MTD_Name + " '" + Full_FileName + "'";
-	LOGINFO("Restore command: '%s'\n", Command.c_str());
-	TWFunc::Exec_Cmd(Command, result);
-	return true;
+	// The MTD write context erases each block before writing it and the
+	// rest of the partition afterwards, so no separate erase is needed
+	dd.setmtd(true);
+	dd.setdev(MTD_Name);
+	dd.setfn(Full_FileName);
+	return dd.restore() == 0;
 }
 
 bool TWPartition::Update_Size(bool Display_Error) {
@@ -31,6 +31,7 @@
 #include <time.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <iostream>
 #include <iomanip>
 #include "variables.h"
@@ -50,10 +51,56 @@
 	#include "cutils/properties.h"
 #endif
 
-int TWPartitionManager::Process_Fstab(string Fstab_Filename, bool Display_Error) {
+// Probing and sizing a partition can mean mounting it, retrying slow
+// storage and walking the whole tree, so these are done for every
+// partition at once on their own threads
+struct partition_job {
+	TWPartition* Part;
+	string Line;
+	bool Display_Error;
+	bool Result;
+	bool Started;
+	pthread_t Thread;
+};
+
+static void Run_Partition_Jobs(std::vector<partition_job>& jobs, void* (*start_routine)(void*)) {
+	std::vector<partition_job>::iterator job;
+
+	for (job = jobs.begin(); job != jobs.end(); job++) {
+#ifdef TW_NO_PARALLEL_PARTITIONS
+		job->Started = false;
+#else
+		job->Started = (pthread_create(&job->Thread, NULL, start_routine, &(*job)) == 0);
+#endif
+		if (!job->Started)
+			start_routine(&(*job));
+	}
+	for (job = jobs.begin(); job != jobs.end(); job++) {
+		if (job->Started)
+			pthread_join(job->Thread, NULL);
+	}
+}
+
+void* TWPartitionManager::Parse_Fstab_Line_Thread(void* cookie) {
+	partition_job* job = (partition_job*) cookie;
+
+	job->Result = job->Part->Parse_Fstab_Line(job->Line, job->Display_Error);
+	return NULL;
+}
+
+void* TWPartitionManager::Update_Size_Thread(void* cookie) {
+	partition_job* job = (partition_job*) cookie;
+
+	job->Result = job->Part->Update_Size(job->Display_Error);
+	return NULL;
+}
+
+int TWPartitionManager::Process_Fstab(string Fstab_Filename, bool Display_Error, bool Update_Details) {
 	FILE *fstabFile;
 	char fstab_line[MAX_FSTAB_LINE_LENGTH];
 	bool Found_Settings_Storage = false;
+	std::vector<partition_job> jobs;
+	std::vector<partition_job>::iterator job;
 
 	fstabFile = fopen(Fstab_Filename.c_str(), "rt");
 	if (fstabFile == NULL) {
@@ -68,11 +115,27 @@ int TWPartitionManager::Process_Fstab(string Fstab_Filename, bool Display_Error)
 		if (fstab_line[strlen(fstab_line) - 1] != '\n')
 			fstab_line[strlen(fstab_line)] = '\n';
 
-		TWPartition* partition = new TWPartition();
-		string line = fstab_line;
+		partition_job line_job;
+		line_job.Part = new TWPartition();
+		line_job.Line = fstab_line;
+		line_job.Display_Error = Display_Error;
+		line_job.Result = false;
+		jobs.push_back(line_job);
 		memset(fstab_line, 0, sizeof(fstab_line));
+	}
+	fclose(fstabFile);
 
-		if (partition->Process_Fstab_Line(line, Display_Error)) {
+	// Only parsing and block device lookups run in parallel. Mounting,
+	// the storage retries and folder creation touch shared mount points
+	// and settings, so they run here in fstab order, which also keeps the
+	// settings storage selection below independent of probe timing
+	Run_Partition_Jobs(jobs, Parse_Fstab_Line_Thread);
+	for (job = jobs.begin(); job != jobs.end(); job++) {
+		TWPartition* partition = job->Part;
+
+		if (job->Result)
+			job->Result = partition->Setup_Fstab_Line(job->Display_Error);
+		if (job->Result) {
 			if (!Found_Settings_Storage && partition->Is_Settings_Storage) {
 				Found_Settings_Storage = true;
 				Partitions.push_back(partition);
@@ -87,7 +150,6 @@ int TWPartitionManager::Process_Fstab(string Fstab_Filename, bool Display_Error)
 			delete partition;
 		}
 	}
-	fclose(fstabFile);
 	if (!Found_Settings_Storage) {
 		std::vector<TWPartition*>::iterator iter;
 		for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
@@ -103,14 +165,17 @@ int TWPartitionManager::Process_Fstab(string Fstab_Filename, bool Display_Error)
 		if (!Found_Settings_Storage)
 			LOGERR("Unable to locate storage partition for storing settings file.\n");
 	}
+	TWPartition::Probe_FS_Types(Partitions);
 	if (!Write_Fstab()) {
 		if (Display_Error)
 			LOGERR("Error creating fstab\n");
 		else
 			LOGINFO("Error creating fstab\n");
 	}
-	Update_System_Details();
-	UnMount_Main_Partitions();
+	if (Update_Details) {
+		Update_System_Details();
+		UnMount_Main_Partitions();
+	}
 	return true;
 }
 
@@ -148,6 +213,7 @@ void TWPartitionManager::Output_Partition_Logging(void) {
 	printf("\n\nPartition Logs:\n");
 	for (iter = Partitions.begin(); iter != Partitions.end(); iter++)
 		Output_Partition((*iter));
+	TWPartition::Log_State_Cache_Stats();
 }
 
 void TWPartitionManager::Output_Partition(TWPartition* Part) {
@@ -514,6 +580,10 @@ bool TWPartitionManager::Make_MD5(bool generate_md5, string Backup_Folder, strin
 	if (!generate_md5) 
 		return true;
 
+	// Images are hashed while they are copied and already have their md5
+	if (TWFunc::Path_Exists(Full_File + ".md5"))
+		return true;
+
 	TWFunc::GUI_Operation_Text(TW_GENERATE_MD5_TEXT, "Generating MD5");
 	gui_print(" * Generating md5...\n");
 
@@ -899,6 +969,50 @@ int TWPartitionManager::Run_Restore(string Restore_Name) {
 	return true;
 }
 
+int TWPartitionManager::Run_Restore_Paths(string Restore_Name, vector<string> Paths) {
+	vector<TWPartition*> parts;
+	vector<vector<string> > part_paths;
+	time_t rStart, rStop;
+	time(&rStart);
+
+	gui_print("\n[RESTORE PATHS STARTED]\n\n");
+	gui_print("Restore folder: '%s'\n", Restore_Name.c_str());
+
+	if (!Mount_Current_Storage(true))
+		return false;
+
+	// Only the parts of the archives holding the paths are read, so there is
+	// no MD5 check and nothing is wiped
+	Set_Restore_Files(Restore_Name);
+	for (size_t i = 0; i < Paths.size(); i++) {
+		TWPartition* Part = Find_Partition_By_Path(Paths[i]);
+		if (Part == NULL || Part->Backup_Method != TWPartition::FILES || Part->Backup_FileName.empty()) {
+			LOGERR("Unable to find a file backup of '%s' in '%s'\n", Paths[i].c_str(), Restore_Name.c_str());
+			return false;
+		}
+		size_t j;
+		for (j = 0; j < parts.size() && parts[j] != Part; j++)
+			;
+		if (j == parts.size()) {
+			parts.push_back(Part);
+			part_paths.push_back(vector<string>());
+		}
+		part_paths[j].push_back(Paths[i]);
+	}
+
+	for (size_t j = 0; j < parts.size(); j++) {
+		TWFunc::GUI_Operation_Text(TW_RESTORE_TEXT, parts[j]->Backup_Display_Name, "Restoring");
+		for (size_t i = 0; i < part_paths[j].size(); i++)
+			gui_print("Restoring '%s'...\n", part_paths[j][i].c_str());
+		if (!parts[j]->Restore_Tar_Paths(Restore_Name, part_paths[j]))
+			return false;
+	}
+
+	time(&rStop);
+	gui_print("[RESTORE PATHS COMPLETED IN %d SECONDS]\n\n",(int)difftime(rStop,rStart));
+	return true;
+}
+
 void TWPartitionManager::Set_Restore_Files(string Restore_Name) {
 	// Start with the default values
 	string Restore_List;
@@ -1187,14 +1301,43 @@ void TWPartitionManager::Refresh_Sizes(void) {
 	return;
 }
 
+void TWPartitionManager::Update_Sizes(bool Display_Error) {
+	std::vector<TWPartition*>::iterator iter, parent;
+	std::vector<partition_job> jobs, nested_jobs;
+
+	for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
+		if (!(*iter)->Can_Be_Mounted)
+			continue;
+
+		partition_job job;
+		job.Part = *iter;
+		job.Display_Error = Display_Error;
+		job.Result = false;
+
+		// A partition mounted inside another one has to wait until the
+		// outer one is done mounting and unmounting
+		bool nested = false;
+		for (parent = Partitions.begin(); parent != Partitions.end(); parent++) {
+			if (*parent != *iter && (*parent)->Can_Be_Mounted && (*iter)->Mount_Point.find((*parent)->Mount_Point + "/") == 0)
+				nested = true;
+		}
+		if (nested)
+			nested_jobs.push_back(job);
+		else
+			jobs.push_back(job);
+	}
+	Run_Partition_Jobs(jobs, Update_Size_Thread);
+	Run_Partition_Jobs(nested_jobs, Update_Size_Thread);
+}
+
 void TWPartitionManager::Update_System_Details(void) {
 	std::vector<TWPartition*>::iterator iter;
 	int data_size = 0;
 
 	gui_print("Updating partition details...\n");
+	Update_Sizes(true);
 	for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
 		if ((*iter)->Can_Be_Mounted) {
-			(*iter)->Update_Size(true);
 			if ((*iter)->Mount_Point == "/system") {
 				int backup_display_size = (int)((*iter)->Backup_Size / 1048576LLU);
 				DataManager::SetValue(TW_BACKUP_SYSTEM_SIZE, backup_display_size);
@@ -1329,6 +1472,7 @@ void TWPartitionManager::Update_System_Details(void) {
 	}
 	if (!Write_Fstab())
 		LOGERR("Error creating fstab\n");
+	TWPartition::Log_State_Cache_Stats();
 	return;
 }
 
@@ -1378,7 +1522,11 @@ int TWPartitionManager::Decrypt_Device(string Password) {
 #endif
 
 	strcpy(cPassword, Password.c_str());
+	struct timespec start, stop;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	int pwret = cryptfs_check_passwd(cPassword);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	LOGINFO("cryptfs_check_passwd returned %i after %lli ms\n", pwret, (long long) (stop.tv_sec - start.tv_sec) * 1000 + (stop.tv_nsec - start.tv_nsec) / 1000000);
 
 	if (pwret != 0) {
 		LOGERR("Failed to decrypt data.\n");
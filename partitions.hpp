@@ -65,6 +65,9 @@ public:
 	virtual bool Decrypt(string Password);                                    // Decrypts the partition, return 0 for failure and -1 for success
 	virtual bool Wipe_Encryption();                                           // Ignores wipe commands for /data/media devices and formats the original block device
 	virtual void Check_FS_Type();                                             // Checks the fs type using blkid, does not do anything on MTD / yaffs2 because this crashes on some devices
+	void Invalidate_FS_Type();                                                // Forgets the cached blkid result, needed after the file system may have changed
+	static void Log_State_Cache_Stats();                                      // Logs how many blkid probes and mount checks the caches saved
+	static void Probe_FS_Types(vector<TWPartition*>& Partitions);             // Probes the file systems of all partitions concurrently to fill the blkid cache
 	virtual bool Update_Size(bool Display_Error);                             // Updates size information
 	virtual void Recreate_Media_Folder();                                     // Recreates the /data/media folder
 
@@ -75,7 +78,8 @@ public:
 
 
 protected:
-	bool Process_Fstab_Line(string Line, bool Display_Error);                 // Processes a fstab line
+	bool Parse_Fstab_Line(string Line, bool Display_Error);                   // Parses a fstab line and probes its block devices without mounting anything
+	bool Setup_Fstab_Line(bool Display_Error);                                // Finishes a parsed fstab line, may mount the partition and create folders
 	void Find_Actual_Block_Device();                                          // Determines the correct block device and stores it in Actual_Block_Device
 
 protected:
@@ -116,6 +120,7 @@ protected:
 	bool Is_Settings_Storage;                                                 // Indicates that this storage partition is the location of the .twrps settings file and the location that is used for custom themes
 	string Storage_Path;                                                      // Indicates the path to the storage -- root indicates mount point, media/ indicates e.g. /data/media
 	string Fstab_File_System;                                                 // File system from the recovery.fstab
+	string Fstab_Flags;                                                       // Custom flags from the recovery.fstab, applied again after the defaults
 	int Format_Block_Size;                                                    // Block size for formatting
 	bool Ignore_Blkid;                                                        // Ignore blkid results due to superblocks lying to us on certain devices / partitions
 	bool Retain_Layout_Version;                                               // Retains the .layout_version file during a wipe (needed on devices like Sony Xperia T where /data and /data/media are separate partitions)
@@ -140,12 +145,15 @@ private:
 	bool Wipe_MTD();                                                          // Formats as yaffs2 for MTD memory types
 	bool Wipe_RMRF();                                                         // Uses rm -rf to wipe
 	bool Wipe_Data_Without_Wiping_Media();                                    // Uses rm -rf to wipe but does not wipe /data/media
+	bool Check_FAT(string backup_folder);                                     // Runs a quick read-only dosfsck of a vfat partition before it is backed up
 	bool Backup_Tar(string backup_folder);                                    // Backs up using tar for file systems
-	bool Backup_DD(string backup_folder);                                     // Backs up using dd for emmc memory types
-	bool Backup_Dump_Image(string backup_folder);                             // Backs up using dump_image for MTD memory types
+	bool Backup_DD(string backup_folder);                                     // Backs up a raw image of emmc memory types
+	bool Backup_Dump_Image(string backup_folder);                             // Backs up a raw image of MTD memory types
+	bool Write_Image_MD5(string Full_FileName, const unsigned char* digest);  // Writes the md5 computed while backing up an image
 	bool Restore_Tar(string restore_folder, string Restore_File_System);      // Restore using tar for file systems
-	bool Restore_DD(string restore_folder);                                   // Restore using dd for emmc memory types
-	bool Restore_Flash_Image(string restore_folder);                          // Restore using flash_image for MTD memory types
+	bool Restore_Tar_Paths(string restore_folder, vector<string> Paths);      // Restores only the given paths from a tar backup without wiping
+	bool Restore_DD(string restore_folder);                                   // Restores a raw image to emmc memory types
+	bool Restore_Flash_Image(string restore_folder);                          // Restores a raw image to MTD memory types
 	bool Get_Size_Via_statfs(bool Display_Error);                             // Get Partition size, used, and free space using statfs
 	bool Get_Size_Via_df(bool Display_Error);                                 // Get Partition size, used, and free space using df command
 	bool Make_Dir(string Path, bool Display_Error);                           // Creates a directory if it doesn't already exist
@@ -156,6 +164,7 @@ private:
 friend class TWPartitionManager;
 friend class DataManager;
 friend class GUIPartitionList;
+friend class OpenRecoveryScript;
 };
 
 class TWPartitionManager
@@ -165,7 +174,7 @@ public:
 	virtual ~TWPartitionManager() {}
 
 public:
-	virtual int Process_Fstab(string Fstab_Filename, bool Display_Error);     // Parses the fstab and populates the partitions
+	virtual int Process_Fstab(string Fstab_Filename, bool Display_Error, bool Update_Details = true); // Parses the fstab and populates the partitions, sizing them unless Update_Details is false
 	virtual int Write_Fstab();                                                // Creates /etc/fstab file that's used by the command line for mount commands
 	virtual void Output_Partition_Logging();                                  // Outputs partition information to the log
 	virtual int Mount_By_Path(string Path, bool Display_Error);               // Mounts partition based on path (e.g. /system)
@@ -185,6 +194,7 @@ public:
 	virtual int Check_Backup_Name(bool Display_Error);                        // Checks the current backup name to ensure that it is valid
 	virtual int Run_Backup();                                                 // Initiates a backup in the current storage
 	virtual int Run_Restore(string Restore_Name);                             // Restores a backup
+	virtual int Run_Restore_Paths(string Restore_Name, vector<string> Paths); // Restores single files or folders from a backup using the archive indexes
 	virtual void Set_Restore_Files(string Restore_Name);                      // Used to gather a list of available backup partitions for the user to select for a restore
 	virtual int Wipe_By_Path(string Path);                                    // Wipes a partition based on path
 	virtual int Wipe_By_Block(string Block);                                  // Wipes a partition based on block device
@@ -198,6 +208,7 @@ public:
 	virtual int Wipe_Media_From_Data();                                       // Removes and recreates the media folder on /data/media devices
 	virtual void Refresh_Sizes();                                             // Refreshes size data of partitions
 	virtual void Update_System_Details();                                     // Updates fstab, file systems, sizes, etc.
+	virtual void Update_Sizes(bool Display_Error);                            // Updates the size of all mountable partitions in parallel
 	virtual int Decrypt_Device(string Password);                              // Attempt to decrypt any encrypted partitions
 	virtual int usb_storage_enable(void);                                     // Enable USB storage mode
 	virtual int usb_storage_disable(void);                                    // Disable USB storage mode
@@ -215,6 +226,8 @@ private:
 	bool Restore_Partition(TWPartition* Part, string Restore_Name, int partition_count);
 	void Output_Partition(TWPartition* Part);
 	int Open_Lun_File(string Partition_Path, string Lun_File);
+	static void* Parse_Fstab_Line_Thread(void* cookie);
+	static void* Update_Size_Thread(void* cookie);
 
 private:
 	std::vector<TWPartition*> Partitions;                                     // Vector list of all partitions
@@ -199,6 +199,16 @@
    under some circumstances.  Parallel decompression can be turned off by
    specifying one process (-dp 1 or -tp 1).
 
+   The --index or -X option prepares such streams.  The blocks are compressed
+   independently as with -i, and after the gzip trailer the compressed and
+   uncompressed length of each block is appended in empty gzip members that
+   carry the lengths in "PI" extra subfields, followed by a final empty member
+   of fixed size with a "PL" subfield that locates the first of those.  gzip
+   (or pigz without an index) decompresses the empty members to nothing, so the
+   result is still an ordinary gzip file.  When pigz decompresses or tests a
+   regular file that ends with such an index, the blocks are inflated on up to
+   -p threads and written out in order.
+
    pigz requires zlib 1.2.1 or later to allow setting the dictionary when doing
    raw deflate.  Since zlib 1.2.3 corrects security vulnerabilities in zlib
    version 1.2.1 and 1.2.2, conditionals check for zlib 1.2.3 or later during
@@ -338,6 +348,20 @@
 /* for local functions and globals */
 #define local static
 
+/* block index members -- "PI" subfields hold up to IDXMAX pairs of compressed
+   and uncompressed block lengths, and the last member of the file, IDXTAIL
+   bytes long, has a "PL" subfield with the offset of the first index member
+   and the number of blocks */
+#define IDXMAX 8000
+#define IDXTAIL 38
+
+/* bionic ignores _FILE_OFFSET_BITS, so ask for 64-bit offsets explicitly */
+#ifdef __ANDROID__
+#  define PREAD pread64
+#else
+#  define PREAD pread
+#endif
+
 /* prevent end-of-line conversions on MSDOSish operating systems */
 #if defined(MSDOS) || defined(OS2) || defined(WIN32) || defined(__CYGWIN__)
 #  include <io.h>       /* setmode(), O_BINARY */
@@ -441,6 +465,7 @@ local int rsync;            /* true for rsync blocking */
 local int procs;            /* maximum number of compression threads (>= 1) */
 local int setdict;          /* true to initialize dictionary in each thread */
 local size_t size;          /* uncompressed input size per thread (>= 32K) */
+local int blkidx;           /* true to append a block index (gzip only) */
 local int warned = 0;       /* true if a warning has been given */
 
 /* saved gzip/zip header data for decompression, testing, and listing */
@@ -450,6 +475,15 @@ local unsigned long zip_crc;        /* local header crc */
 local unsigned long zip_clen;       /* local header compressed length */
 local unsigned long zip_ulen;       /* local header uncompressed length */
 
+/* block index of the input for parallel decompression (NULL if none) */
+local struct block {
+    unsigned long long pos;         /* offset of the deflate block in input */
+    unsigned long clen;             /* compressed length */
+    unsigned long ulen;             /* uncompressed length */
+} *blocks = NULL;
+local unsigned long nblocks;        /* number of blocks in index */
+local unsigned long long idx_trail; /* offset of the gzip trailer */
+
 /* display a complaint with the program name on stderr */
 local int complain(char *fmt, ...)
 {
@@ -1395,6 +1429,74 @@ local void compress_thread(void *dummy)
     (void)deflateEnd(&strm);
 }
 
+/* block lengths collected by write_thread() for the block index */
+local unsigned char *idx_list = NULL;
+local size_t idx_len, idx_size;
+local unsigned long long idx_clen;  /* total compressed length of blocks */
+
+/* empty deflate stream, crc and length that end each block index member */
+local unsigned char idx_end[10] = {3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+/* save the lengths of the next block for the block index */
+local void add_index(size_t clen, size_t ulen)
+{
+    if (clen > 0xffffffffUL || ulen > 0xffffffffUL)
+        bail("block too large for index: ", in);
+    if (idx_len + 8 > idx_size) {
+        idx_size = idx_size ? idx_size << 1 : 8 * 1024;
+        idx_list = realloc(idx_list, idx_size);
+        if (idx_list == NULL)
+            bail("not enough memory", "");
+    }
+    PUT4L(idx_list + idx_len, clen);
+    PUT4L(idx_list + idx_len + 4, ulen);
+    idx_len += 8;
+    idx_clen += clen;
+}
+
+/* write an empty gzip member with len bytes of data in a P<id> subfield */
+local void put_member(int id, unsigned char *data, unsigned len)
+{
+    unsigned char head[16];
+
+    head[0] = 31;
+    head[1] = 139;
+    head[2] = 8;                    /* deflate */
+    head[3] = 4;                    /* extra field present */
+    PUT4L(head + 4, 0);             /* no time stamp */
+    head[8] = 0;
+    head[9] = 3;                    /* unix */
+    PUT2L(head + 10, len + 4);      /* extra field length */
+    head[12] = 'P';
+    head[13] = id;
+    PUT2L(head + 14, len);          /* subfield length */
+    writen(outd, head, 16);
+    writen(outd, data, len);
+    writen(outd, idx_end, 10);
+}
+
+/* write the block index after a gzip stream of head bytes of header followed
+   by the blocks in idx_list and an eight-byte trailer */
+local void put_index(unsigned long head)
+{
+    unsigned char loc[12];
+    unsigned long long pos;
+    size_t n, len;
+
+    /* write the lengths, IDXMAX blocks per member, then the locator */
+    for (n = 0; n < idx_len; n += len) {
+        len = idx_len - n < IDXMAX * 8 ? idx_len - n : IDXMAX * 8;
+        put_member('I', idx_list + n, len);
+    }
+    pos = head + idx_clen + 8;          /* end of the gzip stream */
+    PUT4L(loc, pos & 0xffffffffUL);
+    PUT4L(loc + 4, pos >> 32);
+    PUT4L(loc + 8, idx_len >> 3);
+    put_member('L', loc, 12);
+    idx_len = 0;
+    idx_clen = 0;
+}
+
 /* collect the write jobs off of the list in sequence order and write out the
    compressed data until the last chunk is written -- also write the header and
    trailer and combine the individual check values of the input buffers */
@@ -1433,6 +1535,8 @@ local void write_thread(void *dummy)
         drop_space(job->in);
         ulen += (unsigned long)len;
         clen += (unsigned long)(job->out->len);
+        if (blkidx && form == 0)
+            add_index(job->out->len, len);
 
         /* write the compressed data and drop the output buffer */
         Trace(("-- writing #%ld", seq));
@@ -1457,6 +1561,8 @@ local void write_thread(void *dummy)
 
     /* write trailer */
     put_trailer(ulen, clen, check, head);
+    if (blkidx && form == 0)
+        put_index(head);
 
     /* verify no more jobs, prepare for next use */
     possess(compress_have);
@@ -1913,7 +2019,7 @@ local size_t load(void)
 #ifndef NOTHREAD
     /* if first time in or procs == 1, read a buffer to have something to
        return, otherwise wait for the previous read job to complete */
-    if (procs > 1) {
+    if (procs > 1 && blocks == NULL) {
         /* if first time, fire up the read thread, ask for a read */
         if (in_which == -1) {
             in_which = 1;
@@ -2613,6 +2719,247 @@ local int outb(void *desc, unsigned char *buf, unsigned len)
     return 0;
 }
 
+#ifndef NOTHREAD
+/* --- parallel decompression of input with a block index --- */
+
+/* output slots -- block n goes into slot n % idx_slots, and the state of a slot
+   is n << 1 while it waits to be filled with block n, then (n << 1) + 1 when
+   block n is ready to be written */
+local struct slot {
+    lock *state;                    /* which block and whether it is ready */
+    unsigned char *buf;             /* uncompressed block */
+    unsigned long check;            /* crc-32 of the block */
+    int bad;                        /* true if the block didn't inflate */
+} *idx_slot;
+local int idx_slots;                /* number of output slots */
+local lock *idx_next;               /* next block for an inflate thread */
+local size_t idx_cmax, idx_umax;    /* largest compressed, uncompressed block */
+
+/* release the block index */
+local void drop_index(void)
+{
+    RELEASE(blocks);
+    nblocks = 0;
+}
+
+/* check for a block index member with id and len bytes of data at p */
+local int idx_member(unsigned char *p, int id, unsigned len)
+{
+    return p[0] == 31 && p[1] == 139 && p[2] == 8 && p[3] == 4 &&
+           PULL2L(p + 10) == len + 4 && p[12] == 'P' && p[13] == id &&
+           PULL2L(p + 14) == len && memcmp(p + 16 + len, idx_end, 10) == 0;
+}
+
+/* load the block index from the end of ind into blocks, if it is a regular
+   file and has one -- leave blocks NULL otherwise */
+local void get_index(void)
+{
+    struct stat st;
+    unsigned char tail[IDXTAIL], *buf, *next;
+    unsigned long long pos, len, tot;
+    unsigned long n, count, k;
+
+    drop_index();
+    if (fstat(ind, &st) || !S_ISREG(st.st_mode) || st.st_size < IDXTAIL)
+        return;
+    if (PREAD(ind, tail, IDXTAIL, st.st_size - IDXTAIL) != IDXTAIL ||
+            !idx_member(tail, 'L', 12))
+        return;
+
+    /* the index members must exactly fill the space before the locator */
+    pos = PULL4L(tail + 16) + ((unsigned long long)PULL4L(tail + 20) << 32);
+    count = PULL4L(tail + 24);
+    if (count == 0 || pos < 18 || pos > (unsigned long long)st.st_size)
+        return;
+    len = st.st_size - IDXTAIL - pos;
+    if (len != (count + IDXMAX - 1) / IDXMAX * 26 + count * 8ULL)
+        return;
+
+    buf = malloc(len);
+    blocks = malloc(count * sizeof(struct block));
+    if (buf == NULL || blocks == NULL)
+        bail("not enough memory", "");
+    if (PREAD(ind, buf, len, pos) != (ssize_t)len) {
+        free(buf);
+        drop_index();
+        return;
+    }
+
+    /* get the block lengths */
+    tot = 0;
+    next = buf;
+    n = 0;
+    while (n < count) {
+        k = count - n < IDXMAX ? count - n : IDXMAX;
+        if (!idx_member(next, 'I', k << 3)) {
+            free(buf);
+            drop_index();
+            return;
+        }
+        next += 16;
+        do {
+            blocks[n].clen = PULL4L(next);
+            blocks[n].ulen = PULL4L(next + 4);
+            tot += blocks[n].clen;
+            next += 8;
+            n++;
+        } while (--k);
+        next += 10;
+    }
+    free(buf);
+
+    /* lay the blocks out back from the gzip trailer, leaving a header */
+    if (tot + 18 > pos) {
+        drop_index();
+        return;
+    }
+    idx_trail = pos - 8;
+    pos = idx_trail - tot;
+    idx_cmax = idx_umax = 0;
+    for (n = 0; n < count; n++) {
+        blocks[n].pos = pos;
+        pos += blocks[n].clen;
+        if (blocks[n].clen > idx_cmax)
+            idx_cmax = blocks[n].clen;
+        if (blocks[n].ulen > idx_umax)
+            idx_umax = blocks[n].ulen;
+    }
+    nblocks = count;
+}
+
+/* inflate blocks in turn into their output slots until there are none left */
+local void inflate_thread(void *dummy)
+{
+    long n;                         /* block number */
+    struct block *blk;              /* block being inflated */
+    struct slot *slot;              /* where to put the block */
+    unsigned char *buf;             /* compressed block */
+    z_stream strm;                  /* raw inflate stream */
+    int ret;
+
+    (void)dummy;
+
+    buf = malloc(idx_cmax);
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.avail_in = 0;
+    strm.next_in = Z_NULL;
+    if (buf == NULL || inflateInit2(&strm, -15) != Z_OK)
+        bail("not enough memory", "");
+
+    for (;;) {
+        /* take the next block */
+        possess(idx_next);
+        n = peek_lock(idx_next);
+        twist(idx_next, BY, +1);
+        if ((unsigned long)n >= nblocks)
+            break;
+        blk = blocks + n;
+        slot = idx_slot + n % idx_slots;
+
+        /* wait for its slot to be written out and free */
+        possess(slot->state);
+        wait_for(slot->state, TO_BE, n << 1);
+        release(slot->state);
+
+        /* inflate it -- all but the last block end on a byte boundary without
+           ending the deflate stream, and each must fill exactly its length */
+        Trace(("-- inflating #%ld", n));
+        slot->bad = 1;
+        if (PREAD(ind, buf, blk->clen, blk->pos) == (ssize_t)blk->clen) {
+            (void)inflateReset(&strm);
+            strm.next_in = buf;
+            strm.avail_in = (unsigned)blk->clen;
+            strm.next_out = slot->buf;
+            strm.avail_out = (unsigned)blk->ulen + 1;
+            ret = inflate(&strm, Z_NO_FLUSH);
+            if (strm.avail_in == 0 && strm.total_out == blk->ulen &&
+                    ret == ((unsigned long)n + 1 == nblocks ? Z_STREAM_END :
+                            Z_OK)) {
+                slot->check = crc32(crc32(0L, Z_NULL, 0), slot->buf,
+                                    (unsigned)blk->ulen);
+                slot->bad = 0;
+            }
+        }
+
+        /* let the main thread write it */
+        possess(slot->state);
+        twist(slot->state, TO, (n << 1) + 1);
+    }
+    (void)inflateEnd(&strm);
+    free(buf);
+}
+
+/* decompress from ind to outd (or just test) using the block index -- the
+   header has already been read, and the blocks are inflated in parallel and
+   written in order, followed by a check of the gzip trailer */
+local void parallel_infchk(void)
+{
+    unsigned long n, check;
+    int k, threads;
+    thread **inflaters;
+    struct slot *slot;
+    unsigned char tail[8];
+
+    /* set up output slots, two for each thread */
+    threads = nblocks < (unsigned long)procs ? (int)nblocks : procs;
+    idx_slots = threads << 1;
+    idx_slot = malloc(idx_slots * sizeof(struct slot));
+    inflaters = malloc(threads * sizeof(thread *));
+    if (idx_slot == NULL || inflaters == NULL)
+        bail("not enough memory", "");
+    for (k = 0; k < idx_slots; k++) {
+        idx_slot[k].state = new_lock((long)k << 1);
+        idx_slot[k].buf = malloc(idx_umax + 1);
+        if (idx_slot[k].buf == NULL)
+            bail("not enough memory", "");
+    }
+    idx_next = new_lock(0);
+    for (k = 0; k < threads; k++)
+        inflaters[k] = launch(inflate_thread, NULL);
+
+    /* write out the blocks in order as they become ready */
+    out_tot = 0;
+    check = crc32(0L, Z_NULL, 0);
+    for (n = 0; n < nblocks; n++) {
+        slot = idx_slot + n % idx_slots;
+        possess(slot->state);
+        wait_for(slot->state, TO_BE, ((long)n << 1) + 1);
+        release(slot->state);
+        if (slot->bad)
+            bail("corrupted input -- invalid deflate data: ", in);
+        if (decode == 1)
+            writen(outd, slot->buf, blocks[n].ulen);
+        check = crc32_comb(check, slot->check, blocks[n].ulen);
+        out_tot += blocks[n].ulen;
+        possess(slot->state);
+        twist(slot->state, TO, (long)(n + idx_slots) << 1);
+    }
+
+    /* clean up */
+    for (k = 0; k < threads; k++)
+        join(inflaters[k]);
+    free(inflaters);
+    for (k = 0; k < idx_slots; k++) {
+        free(idx_slot[k].buf);
+        free_lock(idx_slot[k].state);
+    }
+    free(idx_slot);
+    free_lock(idx_next);
+
+    /* check the gzip trailer (what follows it is the index) */
+    if (PREAD(ind, tail, 8, idx_trail) != 8)
+        bail("corrupted gzip stream -- missing trailer: ", in);
+    if (PULL4L(tail) != check)
+        bail("corrupted gzip stream -- crc32 mismatch: ", in);
+    if (PULL4L(tail + 4) != (out_tot & LOW32))
+        bail("corrupted gzip stream -- length mismatch: ", in);
+    drop_index();
+}
+
+#endif
+
 /* inflate for decompression or testing -- decompress from ind to outd unless
    decode != 1, in which case just test ind, and then also list if list != 0;
    look for and decode multiple, concatenated gzip and/or zlib streams;
@@ -2626,6 +2973,14 @@ local void infchk(void)
     unsigned long tmp4;
     off_t clen;
 
+#ifndef NOTHREAD
+    /* use the block index if there is one */
+    if (blocks != NULL) {
+        parallel_infchk();
+        return;
+    }
+#endif
+
     cont = 0;
     do {
         /* header already read -- set up for decompression */
@@ -3142,8 +3497,20 @@ local void process(char *path)
     /* if decoding or testing, try to read gzip header */
     hname = NULL;
     if (decode) {
+#ifndef NOTHREAD
+        /* look for a block index to decompress in parallel (which also keeps
+           load() from reading ahead, since the blocks are read directly) */
+        if (procs > 1 && !list)
+            get_index();
+#endif
         in_init();
         method = get_header(1);
+#ifndef NOTHREAD
+        /* the index must describe the gzip stream that starts the file */
+        if (blocks != NULL &&
+                (method != 8 || form != 0 || in_tot - in_left != blocks->pos))
+            drop_index();
+#endif
         if (method != 8 && method != 256 &&
                 /* gzip -cdf acts like cat on uncompressed input */
                 !(method == -2 && force && pipeout && decode != 2 && !list)) {
@@ -3263,7 +3630,7 @@ local void process(char *path)
             cat();
     }
 #ifndef NOTHREAD
-    else if (procs > 1)
+    else if (procs > 1 || (blkidx && form == 0))
         parallel_compress();
 #endif
     else
@@ -3331,6 +3698,9 @@ local char *helptext[] = {
 "  -v, --verbose        Provide more verbose output",
 #endif
 "  -V  --version        Show the version of pigz",
+#ifndef NOTHREAD
+"  -X, --index          Add a block index for parallel decompression (gzip)",
+#endif
 "  -z, --zlib           Compress to zlib (.zz) instead of gzip format",
 "  --                   All arguments after \"--\" are treated as files"
 };
@@ -3384,6 +3754,7 @@ local void defaults(void)
     size = 131072UL;
     rsync = 0;                      /* don't do rsync blocking */
     setdict = 1;                    /* initialize dictionary each thread */
+    blkidx = 0;                     /* don't append a block index */
     verbosity = 1;                  /* normal message level */
     headis = 3;                     /* store/restore name and timestamp */
     pipeout = 0;                    /* don't force output to stdout */
@@ -3400,11 +3771,11 @@ local void defaults(void)
 local char *longopts[][2] = {
     {"LZW", "Z"}, {"ascii", "a"}, {"best", "9"}, {"bits", "Z"},
     {"blocksize", "b"}, {"decompress", "d"}, {"fast", "1"}, {"force", "f"},
-    {"help", "h"}, {"independent", "i"}, {"keep", "k"}, {"license", "L"},
-    {"list", "l"}, {"name", "N"}, {"no-name", "n"}, {"no-time", "T"},
-    {"processes", "p"}, {"quiet", "q"}, {"recursive", "r"}, {"rsyncable", "R"},
-    {"silent", "q"}, {"stdout", "c"}, {"suffix", "S"}, {"test", "t"},
-    {"to-stdout", "c"}, {"uncompress", "d"}, {"verbose", "v"},
+    {"help", "h"}, {"independent", "i"}, {"index", "X"}, {"keep", "k"},
+    {"license", "L"}, {"list", "l"}, {"name", "N"}, {"no-name", "n"},
+    {"no-time", "T"}, {"processes", "p"}, {"quiet", "q"}, {"recursive", "r"},
+    {"rsyncable", "R"}, {"silent", "q"}, {"stdout", "c"}, {"suffix", "S"},
+    {"test", "t"}, {"to-stdout", "c"}, {"uncompress", "d"}, {"verbose", "v"},
     {"version", "V"}, {"zip", "K"}, {"zlib", "z"}};
 #define NLOPTS (sizeof(longopts) / (sizeof(char *) << 1))
 
@@ -3503,6 +3874,7 @@ local int option(char *arg)
             case 'R':  rsync = 1;  break;
             case 'S':  get = 3;  break;
             case 'V':  fputs(VERSION, stderr);  exit(0);
+            case 'X':  blkidx = 1;  setdict = 0;  break;
             case 'Z':
                 bail("invalid option: LZW output not supported: ", bad);
             case 'a':
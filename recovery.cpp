@@ -53,6 +53,7 @@ extern "C" {
 #include "data.h"
 #include "gui/gui.h"
 }
+#include "data.hpp"
 #include "partitions.hpp"
 #include "variables.h"
 #include "openrecoveryscript.hpp"
@@ -1001,9 +1002,7 @@ main(int argc, char **argv) {
     // Otherwise, get ready to boot the main system...
     finish_recovery(send_intent);
     ui->Print("Rebooting...\n");
-	char backup_arg_char[50];
-	strcpy(backup_arg_char, DataManager_GetStrValue("tw_reboot_arg"));
-	string backup_arg = backup_arg_char;
+	string backup_arg = DataManager::GetStrValue("tw_reboot_arg");
 	if (backup_arg == "recovery")
 		TWFunc::tw_reboot(rb_recovery);
 	else if (backup_arg == "poweroff")
@@ -26,6 +26,7 @@
 #include "twrp-functions.hpp"
 extern "C" {
 	#include "gui/gui.h"
+	#include "minadbd/adb.h"
 }
 
 static int Run_Update_Binary(const char *path, ZipArchive *Zip, int* wipe_cache) {
@@ -130,6 +131,32 @@ static int Run_Update_Binary(const char *path, ZipArchive *Zip, int* wipe_cache)
 	return INSTALL_SUCCESS;
 }
 
+// Uses the digest the ADB sideload service computed while receiving this
+// very package, so that it does not have to be read back just to hash it.
+// It is only trusted while the path still names the same inode, unchanged.
+static int Verify_Zip_Signature(const char* path) {
+	sideload_digest digest;
+	struct stat st;
+	ssize_t len;
+	int fd;
+
+	fd = open(ADB_SIDELOAD_DIGEST, O_RDONLY);
+	if (fd >= 0) {
+		len = read(fd, &digest, sizeof(digest));
+		close(fd);
+		unlink(ADB_SIDELOAD_DIGEST);
+		digest.path[sizeof(digest.path) - 1] = '\0';
+		if (len == sizeof(digest) && strcmp(digest.path, path) == 0 &&
+				stat(path, &st) == 0 && (uint64_t)st.st_size == digest.size &&
+				st.st_mtime == digest.mtime && st.st_ctime == digest.ctime &&
+				(uint64_t)st.st_dev == digest.dev && (uint64_t)st.st_ino == digest.ino) {
+			LOGINFO("Using signature digest computed during sideload\n");
+			return verify_file_digest(path, digest.sha1, digest.signed_len);
+		}
+	}
+	return verify_file(path);
+}
+
 extern "C" int TWinstall_zip(const char* path, int* wipe_cache) {
 	int ret_val, zip_verify, md5_return, key_count;
 	twrpDigest md5sum;
@@ -158,7 +185,7 @@ extern "C" int TWinstall_zip(const char* path, int* wipe_cache) {
 	DataManager::SetProgress(0);
 	if (zip_verify) {
 		gui_print("Verifying zip signature...\n");
-		ret_val = verify_file(path);
+		ret_val = Verify_Zip_Signature(path);
 		if (ret_val != VERIFY_SUCCESS) {
 			LOGERR("Zip signature verification failed: %i\n", ret_val);
 			return -1;
@@ -16,6 +16,7 @@
         along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -52,6 +53,77 @@ static void Print_Prop(const char *key, const char *name, void *cookie) {
 	printf("%s=%s\n", key, name);
 }
 
+// Startup is split into stages, some of which run concurrently. Each stage
+// logs its wall time and publishes it as tw_startup_<stage>_ms so that
+// boot-to-UI regressions show up in the log and can be displayed by a theme.
+static timespec Startup_Time;
+
+static unsigned long Startup_Elapsed_Ms(timespec& start) {
+	timespec now, diff;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	diff = TWFunc::timespec_diff(start, now);
+	return diff.tv_sec * 1000 + diff.tv_nsec / 1000000;
+}
+
+static void Startup_Trace(const char* stage, timespec& start) {
+	unsigned long ms = Startup_Elapsed_Ms(start);
+	string var = "tw_startup_";
+
+	var += stage;
+	var += "_ms";
+	LOGINFO("Startup: %s took %lums, %lums since start\n", stage, ms, Startup_Elapsed_Ms(Startup_Time));
+	DataManager::SetValue(var, (int) ms);
+}
+
+struct startup_stage {
+	const char* Name;
+	int (*Function)(void);
+	int Result;
+	bool Started;
+	pthread_t Thread;
+};
+
+static void* Startup_Stage_Thread(void* cookie) {
+	startup_stage* stage = (startup_stage*) cookie;
+	timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	stage->Result = stage->Function();
+	Startup_Trace(stage->Name, start);
+	return NULL;
+}
+
+static void Start_Stage(startup_stage* stage) {
+	stage->Started = (pthread_create(&stage->Thread, NULL, Startup_Stage_Thread, stage) == 0);
+	if (!stage->Started)
+		Startup_Stage_Thread(stage);
+}
+
+static int Finish_Stage(startup_stage* stage) {
+	if (stage->Started)
+		pthread_join(stage->Thread, NULL);
+	stage->Started = false;
+	return stage->Result;
+}
+
+#ifdef TW_INCLUDE_INJECTTWRP
+static int Backup_TWRP_Ramdisk(void) {
+	// Back up TWRP Ramdisk if needed:
+	TWPartition* Boot = PartitionManager.Find_Partition_By_Path("/boot");
+	string result;
+	LOGINFO("Backing up TWRP ramdisk...\n");
+	if (Boot == NULL || Boot->Current_File_System != "emmc")
+		TWFunc::Exec_Cmd("injecttwrp --backup /tmp/backup_recovery_ramdisk.img", result);
+	else {
+		string injectcmd = "injecttwrp --backup /tmp/backup_recovery_ramdisk.img bd=" + Boot->Actual_Block_Device;
+		TWFunc::Exec_Cmd(injectcmd, result);
+	}
+	LOGINFO("Backup of TWRP ramdisk done.\n");
+	return 0;
+}
+#endif
+
 int main(int argc, char **argv) {
 	// Recovery needs to install world-readable files, so clear umask
 	// set by init
@@ -73,23 +145,53 @@ int main(int argc, char **argv) {
 
 	time_t StartupTime = time(NULL);
 	printf("Starting TWRP %s on %s", TW_VERSION_STR, ctime(&StartupTime));
+	clock_gettime(CLOCK_MONOTONIC, &Startup_Time);
+
+	timespec stage_start;
+	startup_stage ui_stage = { "gui_init", gui_init, 0, false, 0 };
+	startup_stage theme_stage = { "theme", gui_loadResources, 0, false, 0 };
+#ifdef TW_INCLUDE_INJECTTWRP
+	startup_stage ramdisk_stage = { "injecttwrp", Backup_TWRP_Ramdisk, 0, false, 0 };
+#endif
 
 	// Load default values to set DataManager constants and handle ifdefs
 	DataManager::SetDefaultValues();
-	printf("Starting the UI...");
-	gui_init();
+	printf("Starting the UI...\n");
+	// Graphics setup doesn't depend on the partitions, so it runs while the fstab is processed
+	Start_Stage(&ui_stage);
 	printf("=> Linking mtab\n");
 	symlink("/proc/mounts", "/etc/mtab");
 	printf("=> Processing recovery.fstab\n");
-	if (!PartitionManager.Process_Fstab("/etc/recovery.fstab", 1)) {
+	clock_gettime(CLOCK_MONOTONIC, &stage_start);
+	if (!PartitionManager.Process_Fstab("/etc/recovery.fstab", 1, false)) {
 		LOGERR("Failing out of recovery due to problem with recovery.fstab.\n");
 		return -1;
 	}
+	Startup_Trace("fstab", stage_start);
+	Finish_Stage(&ui_stage);
+
+#ifdef TW_INCLUDE_INJECTTWRP
+	// Only needs to know where the boot partition is
+	Start_Stage(&ramdisk_stage);
+#endif
+
+	// The theme is loaded from the settings storage, so mount it up front.
+	// Sizing leaves partitions that were already mounted alone, so the two
+	// stages below can't unmount the storage from under each other.
+	if (DataManager::GetIntValue(TW_IS_ENCRYPTED) == 0)
+		PartitionManager.Mount_Settings_Storage(false);
+	// Load up all the resources while the partitions are being sized
+	Start_Stage(&theme_stage);
+	clock_gettime(CLOCK_MONOTONIC, &stage_start);
+	PartitionManager.Update_System_Details();
+	PartitionManager.UnMount_Main_Partitions();
+	Startup_Trace("partition_details", stage_start);
 	PartitionManager.Output_Partition_Logging();
-	// Load up all the resources
-	gui_loadResources();
+	Finish_Stage(&theme_stage);
 
+	clock_gettime(CLOCK_MONOTONIC, &stage_start);
 	PartitionManager.Mount_By_Path("/cache", true);
+	Startup_Trace("cache", stage_start);
 
     string Zip_File, Reboot_Value;
 	bool Cache_Wipe = false, Factory_Reset = false, Perform_Backup = false;
@@ -134,22 +236,10 @@ int main(int argc, char **argv) {
 	}
 
 	// Check for and run startup script if script exists
+	clock_gettime(CLOCK_MONOTONIC, &stage_start);
 	TWFunc::check_and_run_script("/sbin/runatboot.sh", "boot");
 	TWFunc::check_and_run_script("/sbin/postrecoveryboot.sh", "boot");
-
-#ifdef TW_INCLUDE_INJECTTWRP
-	// Back up TWRP Ramdisk if needed:
-	TWPartition* Boot = PartitionManager.Find_Partition_By_Path("/boot");
-	string result;
-	LOGINFO("Backing up TWRP ramdisk...\n");
-	if (Boot == NULL || Boot->Current_File_System != "emmc")
-		TWFunc::Exec_Cmd("injecttwrp --backup /tmp/backup_recovery_ramdisk.img", result);
-	else {
-		string injectcmd = "injecttwrp --backup /tmp/backup_recovery_ramdisk.img bd=" + Boot->Actual_Block_Device;
-		TWFunc::Exec_Cmd(injectcmd, result);
-	}
-	LOGINFO("Backup of TWRP ramdisk done.\n");
-#endif
+	Startup_Trace("scripts", stage_start);
 
 	bool Keep_Going = true;
 	if (Perform_Backup) {
@@ -184,6 +274,12 @@ int main(int argc, char **argv) {
 
 	// Read the settings file
 	DataManager::ReadSettingsFile();
+#ifdef TW_INCLUDE_INJECTTWRP
+	// Scripts and zips may reflash boot, which needs the ramdisk backup
+	Finish_Stage(&ramdisk_stage);
+#endif
+	DataManager::SetValue("tw_startup_total_ms", (int) Startup_Elapsed_Ms(Startup_Time));
+	LOGINFO("Startup: UI ready after %lums\n", Startup_Elapsed_Ms(Startup_Time));
 	// Run any outstanding OpenRecoveryScript
 	if (DataManager::GetIntValue(TW_IS_ENCRYPTED) == 0 && (TWFunc::Path_Exists(SCRIPT_FILE_TMP) || TWFunc::Path_Exists(SCRIPT_FILE_CACHE))) {
 		OpenRecoveryScript::Run_OpenRecoveryScript();
@@ -0,0 +1,444 @@
+/*
+        Copyright 2013 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "twrpDD.hpp"
+#include "twcommon.h"
+
+#ifndef O_DIRECT
+#define O_DIRECT 040000
+#endif
+
+// Size of each of the two transfer buffers
+#define DD_CHUNK_SIZE (4 * 1024 * 1024)
+// Alignment of the buffers and of O_DIRECT reads
+#define DD_ALIGN 4096
+// Granularity of zero block detection for sparse backups
+#define DD_SPARSE_BLOCK 4096
+
+static const unsigned char zero_block[DD_SPARSE_BLOCK] = { 0 };
+
+twrpDD::twrpDD() {
+	mtd = false;
+	sparse = false;
+	to_device = false;
+	size = 0;
+	done = 0;
+	hole = 0;
+	dev_fd = -1;
+	file_fd = -1;
+	mtd_read = NULL;
+	mtd_write = NULL;
+	bufs[0].data = bufs[1].data = NULL;
+	abort = false;
+	memset(md5sum, 0, sizeof(md5sum));
+}
+
+void twrpDD::setdev(string dev) {
+	this->dev = dev;
+}
+
+void twrpDD::setmtd(bool mtd) {
+	this->mtd = mtd;
+}
+
+void twrpDD::setfn(string fn) {
+	this->fn = fn;
+}
+
+void twrpDD::setsize(unsigned long long size) {
+	this->size = size;
+}
+
+void twrpDD::setsparse(bool sparse) {
+	this->sparse = sparse;
+}
+
+const unsigned char* twrpDD::digest() {
+	return md5sum;
+}
+
+unsigned long long twrpDD::bytes() {
+	return done;
+}
+
+int twrpDD::openDev(bool write) {
+	if (mtd) {
+		const MtdPartition* part;
+		size_t total_size;
+
+		if (mtd_scan_partitions() <= 0) {
+			LOGERR("Unable to scan MTD partitions.\n");
+			return -1;
+		}
+		part = mtd_find_partition_by_name(dev.c_str());
+		if (part == NULL) {
+			LOGERR("Unable to find MTD partition '%s'\n", dev.c_str());
+			return -1;
+		}
+		if (mtd_partition_info(part, &total_size, NULL, NULL) != 0) {
+			LOGERR("Unable to get size of MTD partition '%s'\n", dev.c_str());
+			return -1;
+		}
+		if (write) {
+			if (size > total_size) {
+				LOGERR("Image '%s' is larger than MTD partition '%s'\n", fn.c_str(), dev.c_str());
+				return -1;
+			}
+			mtd_write = mtd_write_partition(part);
+		} else {
+			if (size == 0 || size > total_size)
+				size = total_size;
+			mtd_read = mtd_read_partition(part);
+		}
+		if (mtd_read == NULL && mtd_write == NULL) {
+			LOGERR("Unable to open MTD partition '%s'\n", dev.c_str());
+			return -1;
+		}
+		return 0;
+	}
+
+	if (write) {
+		dev_fd = open(dev.c_str(), O_WRONLY | O_LARGEFILE);
+	} else {
+		// Bypass the page cache when reading, the data is only needed once
+		dev_fd = open(dev.c_str(), O_RDONLY | O_LARGEFILE | O_DIRECT);
+		if (dev_fd < 0 && errno == EINVAL)
+			dev_fd = open(dev.c_str(), O_RDONLY | O_LARGEFILE);
+	}
+	if (dev_fd < 0) {
+		LOGERR("Unable to open '%s': %s\n", dev.c_str(), strerror(errno));
+		return -1;
+	}
+
+	off64_t dev_size = lseek64(dev_fd, 0, SEEK_END);
+	lseek64(dev_fd, 0, SEEK_SET);
+	if (write) {
+		if (dev_size > 0 && size > (unsigned long long)dev_size) {
+			LOGERR("Image '%s' is larger than '%s'\n", fn.c_str(), dev.c_str());
+			return -1;
+		}
+	} else if (size == 0) {
+		if (dev_size <= 0) {
+			LOGERR("Unable to find size of '%s'\n", dev.c_str());
+			return -1;
+		}
+		size = dev_size;
+	}
+	return 0;
+}
+
+void twrpDD::closeDev() {
+	if (dev_fd >= 0)
+		close(dev_fd);
+	if (mtd_read != NULL)
+		mtd_read_close(mtd_read);
+	if (mtd_write != NULL)
+		mtd_write_close(mtd_write);
+	dev_fd = -1;
+	mtd_read = NULL;
+	mtd_write = NULL;
+}
+
+int twrpDD::allocBuffers() {
+	for (int i = 0; i < 2; i++) {
+		void* data;
+		if (posix_memalign(&data, DD_ALIGN, DD_CHUNK_SIZE) != 0) {
+			LOGERR("Unable to allocate %d byte buffer\n", DD_CHUNK_SIZE);
+			freeBuffers();
+			return -1;
+		}
+		bufs[i].data = (unsigned char*) data;
+		bufs[i].len = 0;
+		bufs[i].full = false;
+	}
+	return 0;
+}
+
+void twrpDD::freeBuffers() {
+	for (int i = 0; i < 2; i++) {
+		free(bufs[i].data);
+		bufs[i].data = NULL;
+	}
+}
+
+ssize_t twrpDD::readInput(unsigned char* data, size_t len) {
+	if (!to_device && mtd)
+		return mtd_read_data(mtd_read, (char*) data, len);
+
+	int fd = to_device ? file_fd : dev_fd;
+	// O_DIRECT needs whole sectors, the buffer always has room for that
+	size_t want = to_device ? len : (len + DD_ALIGN - 1) & ~(size_t)(DD_ALIGN - 1);
+	size_t got = 0;
+	while (got < len) {
+		ssize_t r = read(fd, data + got, want - got);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (r == 0)
+			break;
+		got += r;
+	}
+	return got < len ? got : len;
+}
+
+void* twrpDD::readThread(void* cookie) {
+	twrpDD* dd = (twrpDD*) cookie;
+	unsigned long long remaining = dd->size;
+	int idx = 0;
+
+	for (;;) {
+		buffer* b = &dd->bufs[idx];
+
+		pthread_mutex_lock(&dd->lock);
+		while (b->full && !dd->abort)
+			pthread_cond_wait(&dd->cond, &dd->lock);
+		bool stop = dd->abort;
+		pthread_mutex_unlock(&dd->lock);
+		if (stop)
+			break;
+
+		size_t want = remaining < DD_CHUNK_SIZE ? (size_t) remaining : DD_CHUNK_SIZE;
+		ssize_t len = 0;
+		if (want > 0) {
+			len = dd->readInput(b->data, want);
+			if (len > 0) {
+				MD5Update(&dd->md5c, b->data, len);
+				remaining -= len;
+			} else if (len < 0) {
+				LOGERR("Error reading '%s': %s\n", dd->to_device ? dd->fn.c_str() : dd->dev.c_str(), strerror(errno));
+			}
+		}
+
+		pthread_mutex_lock(&dd->lock);
+		b->len = len;
+		b->full = true;
+		pthread_cond_broadcast(&dd->cond);
+		pthread_mutex_unlock(&dd->lock);
+
+		if (len <= 0)
+			break;
+		idx ^= 1;
+	}
+	return NULL;
+}
+
+int twrpDD::writeOutput(const unsigned char* data, size_t len) {
+	if (to_device && mtd) {
+		ssize_t wrote = mtd_write_data(mtd_write, (const char*) data, len);
+		return (wrote >= 0 && (size_t) wrote == len) ? 0 : -1;
+	}
+
+	int fd = to_device ? dev_fd : file_fd;
+	size_t pos = 0;
+	while (pos < len) {
+		size_t end = len;
+		if (sparse && !to_device) {
+			// Turn leading zero blocks into a hole and write the
+			// following run of data blocks in one go
+			while (pos + DD_SPARSE_BLOCK <= len && memcmp(data + pos, zero_block, DD_SPARSE_BLOCK) == 0) {
+				hole += DD_SPARSE_BLOCK;
+				pos += DD_SPARSE_BLOCK;
+			}
+			if (pos == len)
+				break;
+			end = pos + DD_SPARSE_BLOCK;
+			while (end + DD_SPARSE_BLOCK <= len && memcmp(data + end, zero_block, DD_SPARSE_BLOCK) != 0)
+				end += DD_SPARSE_BLOCK;
+			if (end + DD_SPARSE_BLOCK > len)
+				end = len;
+			if (hole > 0) {
+				if (lseek64(fd, hole, SEEK_CUR) < 0)
+					return -1;
+				hole = 0;
+			}
+		}
+		while (pos < end) {
+			ssize_t wrote = write(fd, data + pos, end - pos);
+			if (wrote < 0 && errno == EINTR)
+				continue;
+			if (wrote <= 0)
+				return -1;
+			pos += wrote;
+		}
+	}
+	return 0;
+}
+
+int twrpDD::finishOutput() {
+	if (to_device) {
+		if (mtd) {
+			if (mtd_erase_blocks(mtd_write, -1) == (off_t) -1) {
+				LOGERR("Unable to erase the rest of MTD partition '%s'\n", dev.c_str());
+				return -1;
+			}
+			return 0;
+		}
+		if (fsync(dev_fd) != 0) {
+			LOGERR("Unable to sync '%s': %s\n", dev.c_str(), strerror(errno));
+			return -1;
+		}
+		return 0;
+	}
+
+	// A trailing hole still has to count towards the file size
+	if (hole > 0 && ftruncate64(file_fd, done) != 0) {
+		LOGERR("Unable to extend '%s': %s\n", fn.c_str(), strerror(errno));
+		return -1;
+	}
+	hole = 0;
+	if (fsync(file_fd) != 0) {
+		LOGERR("Unable to sync '%s': %s\n", fn.c_str(), strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int twrpDD::copy() {
+	pthread_t reader;
+	struct timespec start, end;
+	int ret = 0, idx = 0;
+
+	done = 0;
+	hole = 0;
+	abort = false;
+	MD5Init(&md5c);
+	if (allocBuffers() != 0)
+		return -1;
+
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&cond, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (pthread_create(&reader, NULL, readThread, this) != 0) {
+		LOGERR("Unable to start reader thread\n");
+		freeBuffers();
+		return -1;
+	}
+
+	for (;;) {
+		buffer* b = &bufs[idx];
+
+		pthread_mutex_lock(&lock);
+		while (!b->full)
+			pthread_cond_wait(&cond, &lock);
+		pthread_mutex_unlock(&lock);
+
+		if (b->len < 0) {
+			ret = -1;
+			break;
+		}
+		if (b->len == 0)
+			break;
+		if (writeOutput(b->data, b->len) != 0) {
+			LOGERR("Error writing '%s': %s\n", to_device ? dev.c_str() : fn.c_str(), strerror(errno));
+			ret = -1;
+			break;
+		}
+		done += b->len;
+
+		pthread_mutex_lock(&lock);
+		b->full = false;
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&lock);
+		idx ^= 1;
+	}
+
+	pthread_mutex_lock(&lock);
+	abort = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+	pthread_join(reader, NULL);
+
+	if (ret == 0 && done < size && !to_device) {
+		LOGERR("Only read %llu of %llu bytes from '%s'\n", done, size, dev.c_str());
+		ret = -1;
+	}
+	if (ret == 0)
+		ret = finishOutput();
+	MD5Final(md5sum, &md5c);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	unsigned long long msec = (end.tv_sec - start.tv_sec) * 1000ULL + (end.tv_nsec - start.tv_nsec) / 1000000;
+	LOGINFO("Copied %llu bytes in %llu ms (%llu KB/s)\n", done, msec, msec ? done * 1000 / 1024 / msec : 0);
+
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&lock);
+	freeBuffers();
+	return ret;
+}
+
+int twrpDD::backup() {
+	to_device = false;
+	if (openDev(false) != 0) {
+		closeDev();
+		return -1;
+	}
+	file_fd = open(fn.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0644);
+	if (file_fd < 0) {
+		LOGERR("Unable to create '%s': %s\n", fn.c_str(), strerror(errno));
+		closeDev();
+		return -1;
+	}
+	LOGINFO("Backing up %llu bytes of '%s' to '%s'\n", size, dev.c_str(), fn.c_str());
+	int ret = copy();
+	close(file_fd);
+	file_fd = -1;
+	closeDev();
+	if (ret != 0)
+		unlink(fn.c_str());
+	return ret;
+}
+
+int twrpDD::restore() {
+	struct stat st;
+
+	to_device = true;
+	file_fd = open(fn.c_str(), O_RDONLY | O_LARGEFILE);
+	if (file_fd < 0) {
+		LOGERR("Unable to open '%s': %s\n", fn.c_str(), strerror(errno));
+		return -1;
+	}
+	if (fstat(file_fd, &st) != 0) {
+		LOGERR("Unable to stat '%s': %s\n", fn.c_str(), strerror(errno));
+		close(file_fd);
+		file_fd = -1;
+		return -1;
+	}
+	size = st.st_size;
+	if (openDev(true) != 0) {
+		close(file_fd);
+		file_fd = -1;
+		closeDev();
+		return -1;
+	}
+	LOGINFO("Restoring %llu bytes of '%s' to '%s'\n", size, fn.c_str(), dev.c_str());
+	int ret = copy();
+	close(file_fd);
+	file_fd = -1;
+	closeDev();
+	return ret;
+}
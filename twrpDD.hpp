@@ -0,0 +1,88 @@
+/*
+        Copyright 2013 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _TWRPDD_HPP
+#define _TWRPDD_HPP
+
+extern "C" {
+	#include "digest/md5.h"
+	#include "mtdutils/mtdutils.h"
+}
+#include <pthread.h>
+#include <string>
+
+using namespace std;
+
+// Copies raw partition images between a block device (or MTD partition)
+// and a backup file without going through dd/dump_image/flash_image.
+// Reading runs on its own thread into one of two large aligned buffers
+// while the other one is written out, and the data is MD5'd on the way.
+class twrpDD {
+	public:
+		twrpDD();
+		void setdev(string dev);                // block device path, or MTD partition name when setmtd(true)
+		void setmtd(bool mtd);
+		void setfn(string fn);
+		void setsize(unsigned long long size);  // number of bytes to back up, 0 for the whole device
+		void setsparse(bool sparse);            // leave holes in the backup file for all-zero blocks
+		int backup();                           // device -> file
+		int restore();                          // file -> device
+		const unsigned char* digest();          // MD5 of the image data after backup() or restore()
+		unsigned long long bytes();             // bytes copied by the last operation
+
+	private:
+		struct buffer {
+			unsigned char* data;
+			ssize_t len;                    // bytes in data, 0 at end of input, -1 on read error
+			bool full;
+		};
+
+		int openDev(bool write);
+		void closeDev();
+		int allocBuffers();
+		void freeBuffers();
+		int copy();
+		ssize_t readInput(unsigned char* data, size_t len);
+		int writeOutput(const unsigned char* data, size_t len);
+		int finishOutput();
+		static void* readThread(void* cookie);
+
+		string dev;
+		string fn;
+		bool mtd;
+		bool sparse;
+		bool to_device;
+		unsigned long long size;
+		unsigned long long done;
+		unsigned long long hole;               // pending zero bytes not yet written to a sparse file
+
+		int dev_fd;
+		int file_fd;
+		MtdReadContext* mtd_read;
+		MtdWriteContext* mtd_write;
+
+		buffer bufs[2];
+		bool abort;
+		pthread_mutex_t lock;
+		pthread_cond_t cond;
+
+		struct MD5Context md5c;
+		unsigned char md5sum[MD5LENGTH];
+};
+
+#endif // _TWRPDD_HPP
@@ -83,6 +83,11 @@ int twrpDigest::write_md5digest(void) {
 	return 0;
 }
 
+int twrpDigest::write_md5digest(const unsigned char *digest) {
+	memcpy(md5sum, digest, MD5LENGTH);
+	return write_md5digest();
+}
+
 int twrpDigest::read_md5digest(void) {
 	string md5file = md5fn + ".md5";
 	if (TWFunc::read_file(md5file, line) != 0)
@@ -91,17 +96,30 @@ int twrpDigest::read_md5digest(void) {
 }
 
 int twrpDigest::verify_md5digest(void) {
+	if (read_md5digest() != 0)
+		return -1;
+	computeMD5();
+	return compare_md5digest();
+}
+
+int twrpDigest::verify_md5digest(const unsigned char *digest) {
+	if (read_md5digest() != 0)
+		return -1;
+	memcpy(md5sum, digest, MD5LENGTH);
+	return compare_md5digest();
+}
+
+int twrpDigest::compare_md5digest(void) {
 	string buf;
 	char hex[3];
 	int i;
 	string md5string;
-	if (read_md5digest() != 0)
-		return -1;
 	stringstream ss(line);
 	vector<string> tokens;
 	while (ss >> buf)
 		tokens.push_back(buf);
-	computeMD5();
+	if (tokens.empty())
+		return -1;
 	for (i = 0; i < 16; ++i) {
 		snprintf(hex, 3, "%02x", md5sum[i]);
 		md5string += hex;
@@ -26,9 +26,12 @@ class twrpDigest {
                 void setdir(string dir);
 		int computeMD5(void);
 		int verify_md5digest(void);
+		int verify_md5digest(const unsigned char *digest); // compares an already computed digest against the .md5 file
 		int write_md5digest(void);
+		int write_md5digest(const unsigned char *digest); // writes an already computed digest to the .md5 file
 	private:
 		int read_md5digest(void);
+		int compare_md5digest(void);
 		string md5fn;
 		string line;
 		unsigned char md5sum[MD5LENGTH];
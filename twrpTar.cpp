@@ -34,14 +34,243 @@ extern "C" {
 #include <sstream>
 #include <dirent.h>
 #include <sys/mman.h>
+#include <zlib.h>
 #include "twrpTar.hpp"
 #include "twcommon.h"
 #include "data.hpp"
 #include "variables.h"
 #include "twrp-functions.hpp"
+#include "twrpDigest.hpp"
 
 using namespace std;
 
+// Digest of the archive being extracted, fed by read_tar_digest. Extraction
+// normally runs in its own forked process, so one context is enough.
+static struct MD5Context tar_md5c;
+
+static ssize_t read_tar_digest(int fd, void *buf, size_t size) {
+	ssize_t len = read(fd, buf, size);
+	if (len > 0)
+		MD5Update(&tar_md5c, (unsigned char*) buf, len);
+	return len;
+}
+
+// Sidecar index written next to every archive while it is created, one line
+// per entry: the offset of its first header block in the tar stream (before
+// compression), its size and its name. libtar has no per-entry hook, so
+// write_tar spots header blocks by their source, which is always t->th_buf.
+static FILE* tar_index;
+static TAR* tar_index_tar;
+static unsigned long long tar_index_offset;
+static long long tar_index_entry;
+
+static void index_block(const void *buffer, size_t size) {
+	TAR* t = tar_index_tar;
+
+	if (buffer == &t->th_buf) {
+		// GNU long name and long link blocks come before the real header
+		if (tar_index_entry < 0)
+			tar_index_entry = tar_index_offset;
+		if (!TH_ISLONGNAME(t) && !TH_ISLONGLINK(t)) {
+			char* filename = th_get_pathname(t);
+			fprintf(tar_index, "%llu %llu %s\n", tar_index_entry, (unsigned long long) th_get_size(t), filename);
+			if (filename != t->th_buf.gnu_longname)
+				free(filename);
+			tar_index_entry = -1;
+		}
+	}
+	tar_index_offset += size;
+}
+
+// Serves the tar stream of an archive from any offset for selective restore.
+// Archives compressed with pigz -X end with a block index, so inflation can
+// start at the block holding the offset; other gzipped archives are inflated
+// from the start and skipped forward.
+#define SEEK_INDEX_TAIL 38 // size of the pigz index locator member
+#define SEEK_INDEX_MAX 8000 // blocks per pigz index member
+
+struct seek_block {
+	unsigned long long pos;  // file offset of the deflate block
+	unsigned long long upos; // offset of its data in the tar stream
+};
+
+static struct {
+	int fd;
+	bool gzip;
+	bool started;
+	bool eof;
+	z_stream strm;
+	unsigned long long upos; // tar stream offset of the next read
+	vector<seek_block> blocks;
+	unsigned char in[32768];
+} seek_tar;
+
+static bool seek_member(const unsigned char* p, char id, unsigned len) {
+	static const unsigned char end[10] = {3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+	return p[0] == 0x1f && p[1] == 0x8b && p[2] == 8 && p[3] == 4 &&
+		(p[10] | p[11] << 8) == len + 4 && p[12] == 'P' && p[13] == id &&
+		(p[14] | p[15] << 8) == len && memcmp(p + 16 + len, end, 10) == 0;
+}
+
+static unsigned long get_le32(const unsigned char* p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long) p[3] << 24;
+}
+
+// Loads the pigz block index, leaving seek_tar.blocks empty if there is none
+static void seek_load_index() {
+	struct stat st;
+	unsigned char tail[SEEK_INDEX_TAIL];
+	unsigned long long pos, len, tot = 0, upos = 0;
+	unsigned long count, n = 0;
+	vector<unsigned char> buf;
+	vector<seek_block> blocks;
+	vector<unsigned long> clens;
+
+	if (fstat(seek_tar.fd, &st) != 0 || st.st_size < SEEK_INDEX_TAIL)
+		return;
+	if (pread64(seek_tar.fd, tail, SEEK_INDEX_TAIL, st.st_size - SEEK_INDEX_TAIL) != SEEK_INDEX_TAIL || !seek_member(tail, 'L', 12))
+		return;
+	pos = get_le32(tail + 16) + ((unsigned long long) get_le32(tail + 20) << 32);
+	count = get_le32(tail + 24);
+	if (count == 0 || pos < 18 || pos > (unsigned long long) st.st_size)
+		return;
+	len = st.st_size - SEEK_INDEX_TAIL - pos;
+	if (len != (count + SEEK_INDEX_MAX - 1) / SEEK_INDEX_MAX * 26 + count * 8ULL)
+		return;
+	buf.resize(len);
+	if (pread64(seek_tar.fd, &buf[0], len, pos) != (ssize_t) len)
+		return;
+
+	blocks.resize(count);
+	clens.resize(count);
+	const unsigned char* next = &buf[0];
+	while (n < count) {
+		unsigned long k = count - n < SEEK_INDEX_MAX ? count - n : SEEK_INDEX_MAX;
+		if (!seek_member(next, 'I', k * 8))
+			return;
+		next += 16;
+		for (; k > 0; k--, n++, next += 8) {
+			clens[n] = get_le32(next);
+			blocks[n].upos = upos;
+			upos += get_le32(next + 4);
+			tot += clens[n];
+		}
+		next += 10;
+	}
+	// The blocks end where the eight byte gzip trailer starts
+	if (tot + 18 > pos)
+		return;
+	pos -= tot + 8;
+	for (n = 0; n < count; n++) {
+		blocks[n].pos = pos;
+		pos += clens[n];
+	}
+	seek_tar.blocks.swap(blocks);
+}
+
+static int seek_open(int fd, bool gzip) {
+	seek_tar.fd = fd;
+	seek_tar.gzip = gzip;
+	seek_tar.started = false;
+	seek_tar.upos = 0;
+	seek_tar.blocks.clear();
+	if (!gzip)
+		return 0;
+	memset(&seek_tar.strm, 0, sizeof(seek_tar.strm));
+	if (inflateInit2(&seek_tar.strm, -15) != Z_OK)
+		return -1;
+	seek_load_index();
+	LOGINFO("Archive has %u indexed compressed blocks\n", (unsigned) seek_tar.blocks.size());
+	return 0;
+}
+
+static void seek_close() {
+	if (seek_tar.gzip)
+		inflateEnd(&seek_tar.strm);
+	seek_tar.blocks.clear();
+}
+
+static ssize_t read_tar_seek(int fd, void *buf, size_t size) {
+	z_stream* strm = &seek_tar.strm;
+	ssize_t len;
+
+	if (!seek_tar.gzip) {
+		len = read(fd, buf, size);
+		if (len > 0)
+			seek_tar.upos += len;
+		return len;
+	}
+	strm->next_out = (unsigned char*) buf;
+	strm->avail_out = size;
+	while (strm->avail_out > 0 && !seek_tar.eof) {
+		if (strm->avail_in == 0) {
+			len = read(fd, seek_tar.in, sizeof(seek_tar.in));
+			if (len < 0)
+				return -1;
+			if (len == 0)
+				break;
+			strm->next_in = seek_tar.in;
+			strm->avail_in = len;
+		}
+		int ret = inflate(strm, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END)
+			seek_tar.eof = true;
+		else if (ret != Z_OK && ret != Z_BUF_ERROR)
+			return -1;
+	}
+	len = size - strm->avail_out;
+	seek_tar.upos += len;
+	return len;
+}
+
+// Positions the tar stream at offset, skipping forward if that is cheaper
+static int seek_to(unsigned long long offset) {
+	if (!seek_tar.gzip) {
+		if (lseek64(seek_tar.fd, offset, SEEK_SET) < 0)
+			return -1;
+		seek_tar.upos = offset;
+		return 0;
+	}
+
+	// Find the last block starting at or before offset
+	unsigned long long start = 0, pos = 0;
+	size_t lo = 0, hi = seek_tar.blocks.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (seek_tar.blocks[mid].upos <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo > 0) {
+		start = seek_tar.blocks[lo - 1].upos;
+		pos = seek_tar.blocks[lo - 1].pos;
+	}
+	if (!seek_tar.started || seek_tar.upos > offset || seek_tar.upos < start) {
+		if (lseek64(seek_tar.fd, seek_tar.blocks.empty() ? 0 : pos, SEEK_SET) < 0)
+			return -1;
+		// Without an index, inflate the gzip stream from its header
+		if (inflateReset2(&seek_tar.strm, seek_tar.blocks.empty() ? 31 : -15) != Z_OK)
+			return -1;
+		seek_tar.strm.avail_in = 0;
+		seek_tar.upos = start;
+		seek_tar.started = true;
+		seek_tar.eof = false;
+	}
+	char buf[T_BLOCKSIZE * 16];
+	while (seek_tar.upos < offset) {
+		size_t len = offset - seek_tar.upos < sizeof(buf) ? offset - seek_tar.upos : sizeof(buf);
+		if (read_tar_seek(seek_tar.fd, buf, len) != (ssize_t) len)
+			return -1;
+	}
+	return 0;
+}
+
+twrpTar::twrpTar() {
+	verify_md5 = false;
+}
+
 void twrpTar::setfn(string fn) {
 	tarfn = fn;
 }
@@ -50,6 +279,22 @@ void twrpTar::setdir(string dir) {
 	tardir = dir;
 }
 
+void twrpTar::setremap(string root) {
+	while (!root.empty() && root[0] == '/')
+		root.erase(0, 1);
+	remap_root = root;
+}
+
+void twrpTar::setverify(bool verify) {
+	verify_md5 = verify;
+}
+
+void twrpTar::setpaths(vector<string> restore_paths) {
+	paths.clear();
+	for (size_t i = 0; i < restore_paths.size(); i++)
+		paths.push_back(normalizePath(restore_paths[i]));
+}
+
 int twrpTar::createTarGZFork() {
 	int status;
 	pid_t pid;
@@ -292,19 +537,172 @@ int twrpTar::Split_Archive()
 	return (Archive_File_Count);
 }
 
-int twrpTar::extractTar() {
+string twrpTar::normalizePath(string path) {
+	string ret;
+
+	for (size_t i = 0; i < path.size(); i++) {
+		if (path[i] != '/' || ret.empty() || ret[ret.size() - 1] != '/')
+			ret += path[i];
+	}
+	if (ret.size() > 1 && ret[ret.size() - 1] == '/')
+		ret.resize(ret.size() - 1);
+	return ret;
+}
+
+string twrpTar::entryName(const char* filename) {
+	string name = filename;
+
+	// Split archives store the full path including the partition root,
+	// strip it so every entry lands relative to tardir.
+	if (!remap_root.empty()) {
+		size_t start = name.find_first_not_of('/');
+		if (start != string::npos && name.compare(start, remap_root.size(), remap_root) == 0
+			&& (name.size() == start + remap_root.size() || name[start + remap_root.size()] == '/'))
+			name = name.substr(start + remap_root.size());
+	}
+	return name;
+}
+
+bool twrpTar::isSelected(string name) {
+	if (paths.empty())
+		return true;
+	string dest = normalizePath(tardir + "/" + name);
+	for (size_t i = 0; i < paths.size(); i++) {
+		const string& path = paths[i];
+		if (dest.compare(0, path.size(), path) == 0 && (dest.size() == path.size() || dest[path.size()] == '/' || path == "/"))
+			return true;
+	}
+	return false;
+}
+
+int twrpTar::extractEntry() {
+	char buf[PATH_MAX];
 	char* charRootDir = (char*) tardir.c_str();
-	bool gzip = false;
-	if (openTar(gzip) == -1)
+	char* filename = th_get_pathname(t);
+	string name = entryName(filename);
+	if (filename != t->th_buf.gnu_longname)
+		free(filename);
+
+	if (!isSelected(name)) {
+		if (TH_ISREG(t) && tar_skip_regfile(t) != 0) {
+			LOGERR("Unable to skip '%s' in '%s'\n", name.c_str(), tarfn.c_str());
+			return -1;
+		}
+		return 0;
+	}
+	snprintf(buf, sizeof(buf), "%s/%s", charRootDir, name.c_str());
+	if (tar_extract_file(t, buf, charRootDir) != 0) {
+		LOGERR("Unable to extract '%s' from '%s'\n", name.c_str(), tarfn.c_str());
+		return -1;
+	}
+	return 0;
+}
+
+int twrpTar::extractEntries() {
+	int i;
+
+	while ((i = th_read(t)) == 0) {
+		if (extractEntry() != 0)
+			return -1;
+	}
+	return (i == 1 ? 0 : -1);
+}
+
+int twrpTar::readIndex(vector<unsigned long long>& offsets) {
+	string line;
+	ifstream index((tarfn + ".idx").c_str());
+
+	if (!index.is_open())
+		return -1;
+	while (getline(index, line)) {
+		unsigned long long offset, size;
+		int name_start = 0;
+
+		if (sscanf(line.c_str(), "%llu %llu %n", &offset, &size, &name_start) < 2 || name_start == 0) {
+			LOGERR("Invalid line in '%s.idx'\n", tarfn.c_str());
+			return -1;
+		}
+		if (isSelected(entryName(line.c_str() + name_start)))
+			offsets.push_back(offset);
+	}
+	return 0;
+}
+
+int twrpTar::extractSelected() {
+	vector<unsigned long long> offsets;
+	char* charRootDir = (char*) tardir.c_str();
+	bool gzip = getArchiveType() == 1;
+	static tartype_t seek_type = { open, close, read_tar_seek, write_tar };
+
+	if (readIndex(offsets) != 0) {
+		LOGINFO("No index for '%s', scanning the whole archive\n", tarfn.c_str());
+		return gzip ? extractTGZ() : extractTar();
+	}
+	LOGINFO("%u selected entries in '%s'\n", (unsigned) offsets.size(), tarfn.c_str());
+	if (offsets.empty())
+		return 0;
+
+	int tar_fd = open(tarfn.c_str(), O_RDONLY | O_LARGEFILE);
+	if (tar_fd < 0) {
+		LOGERR("Unable to open tar archive '%s'\n", tarfn.c_str());
 		return -1;
-	if (tar_extract_all(t, charRootDir) != 0) {
+	}
+	if (seek_open(tar_fd, gzip) != 0 || tar_fdopen(&t, tar_fd, charRootDir, &seek_type, O_RDONLY | O_LARGEFILE, 0644, TAR_GNU) != 0) {
+		LOGERR("Unable to open tar archive '%s'\n", tarfn.c_str());
+		close(tar_fd);
+		return -1;
+	}
+	int ret = 0;
+	for (size_t i = 0; i < offsets.size() && ret == 0; i++) {
+		if (seek_to(offsets[i]) != 0 || th_read(t) != 0) {
+			LOGERR("Unable to read entry at %llu in '%s'\n", offsets[i], tarfn.c_str());
+			ret = -1;
+		} else
+			ret = extractEntry();
+	}
+	seek_close();
+	if (tar_close(t) != 0) {
+		LOGERR("Unable to close tar file\n");
+		return -1;
+	}
+	return ret;
+}
+
+int twrpTar::extractTar() {
+	char* charTarFile = (char*) tarfn.c_str();
+	static tartype_t digest_type = { open, close, read_tar_digest, write_tar };
+
+	MD5Init(&tar_md5c);
+	if (tar_open(&t, charTarFile, verify_md5 ? &digest_type : NULL, O_RDONLY | O_LARGEFILE, 0644, TAR_GNU) != 0) {
+		LOGERR("Unable to open tar archive '%s'\n", charTarFile);
+		return -1;
+	}
+	if (extractEntries() != 0) {
 		LOGERR("Unable to extract tar archive '%s'\n", tarfn.c_str());
+		tar_close(t);
 		return -1;
 	}
+	if (verify_md5) {
+		// Hash the end-of-archive blocks libtar did not need to read
+		char buf[T_BLOCKSIZE * 16];
+		while (read_tar_digest(t->fd, buf, sizeof(buf)) > 0)
+			;
+	}
 	if (tar_close(t) != 0) {
 		LOGERR("Unable to close tar file\n");
 		return -1;
 	}
+	if (verify_md5) {
+		unsigned char digest[MD5LENGTH];
+		twrpDigest md5sum;
+
+		MD5Final(digest, &tar_md5c);
+		md5sum.setfn(tarfn);
+		if (md5sum.verify_md5digest(digest) != 0) {
+			LOGERR("MD5 failed to match on '%s'.\n", tarfn.c_str());
+			return -1;
+		}
+	}
 	return 0;
 }
 
@@ -330,6 +728,9 @@ int twrpTar::getArchiveType() {
 }
 
 int twrpTar::extract() {
+	if (!paths.empty())
+		return extractSelected();
+
 	int Archive_Current_Type = getArchiveType();
 
 	if (Archive_Current_Type == 1) {
@@ -424,6 +825,8 @@ int twrpTar::addFilesToExistingTar(vector <string> files, string fn) {
 	static tartype_t type = { open, close, read, write_tar };
 
 	init_libtar_buffer(0);
+	// The appended files would be missing from the index
+	unlink((fn + ".idx").c_str());
 	if (tar_open(&t, charTarFile, &type, O_RDONLY | O_LARGEFILE, 0644, TAR_GNU) == -1)
 		return -1;
 	removeEOT(charTarFile);
@@ -451,7 +854,8 @@ int twrpTar::createTar() {
 
 	DataManager::GetValue(TW_USE_COMPRESSION_VAR, use_compression);
 	if (use_compression) {
-		string cmd = "pigz - > '" + tarfn + "'";
+		// -X appends a block index so that restore can inflate on all cores
+		string cmd = "pigz -X - > '" + tarfn + "'";
 		p = popen(cmd.c_str(), "w");
 		fd = fileno(p);
 		if (!p) return -1;
@@ -464,6 +868,13 @@ int twrpTar::createTar() {
 		if (tar_open(&t, charTarFile, &type, O_WRONLY | O_CREAT | O_LARGEFILE, 0644, TAR_GNU) == -1)
 			return -1;
 	}
+	string index_fn = tarfn + ".idx";
+	tar_index = fopen(index_fn.c_str(), "w");
+	if (tar_index == NULL)
+		LOGINFO("Unable to create '%s', selective restore will scan the archive\n", index_fn.c_str());
+	tar_index_tar = t;
+	tar_index_offset = 0;
+	tar_index_entry = -1;
 	return 0;
 }
 
@@ -536,6 +947,10 @@ int twrpTar::closeTar(bool gzip) {
 		tar_close(t);
 		return -1;
 	}
+	if (tar_index != NULL) {
+		fclose(tar_index);
+		tar_index = NULL;
+	}
 	if (tar_close(t) != 0) {
 		LOGERR("Unable to close tar archive: '%s'\n", tarfn.c_str());
 		return -1;
@@ -564,7 +979,7 @@ int twrpTar::removeEOT(string tarFile) {
 }
 
 int twrpTar::compress(string fn) {
-	string cmd = "pigz " + fn;
+	string cmd = "pigz -X " + fn;
 	p = popen(cmd.c_str(), "r");
 	if (!p) return -1;
 	char buffer[128];
@@ -578,17 +993,24 @@ int twrpTar::compress(string fn) {
 }
 
 int twrpTar::extractTGZ() {
-	string splatrootdir(tardir);
 	bool gzip = true;
-	char* splatCharRootDir = (char*) splatrootdir.c_str();
+	if (verify_md5) {
+		// The digest covers the compressed file, which pigz reads on its own
+		twrpDigest md5sum;
+		md5sum.setfn(tarfn);
+		if (md5sum.verify_md5digest() != 0) {
+			LOGERR("MD5 failed to match on '%s'.\n", tarfn.c_str());
+			return -1;
+		}
+	}
 	if (openTar(gzip) == -1)
 		return -1;
-	int ret = tar_extract_all(t, splatCharRootDir);
+	int ret = extractEntries();
 	if (tar_close(t) != 0) {
 		LOGERR("Unable to close tar file\n");
 		return -1;
 	}
-	return 0;
+	return ret;
 }
 
 int twrpTar::entryExists(string entry) {
@@ -609,5 +1031,7 @@ int twrpTar::entryExists(string entry) {
 }
 
 extern "C" ssize_t write_tar(int fd, const void *buffer, size_t size) {
+	if (tar_index != NULL)
+		index_block(buffer, size);
 	return (ssize_t) write_libtar_buffer(fd, buffer, size);
 }
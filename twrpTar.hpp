@@ -32,6 +32,7 @@ using namespace std;
 
 class twrpTar {
 	public:
+		twrpTar();
 		int extract();
 		int compress(string fn);
 		int uncompress(string fn);
@@ -46,12 +47,22 @@ class twrpTar {
 		int splitArchiveFork();
                 void setfn(string fn);
                 void setdir(string dir);
+		void setremap(string root); // entries stored under root are extracted relative to tardir instead
+		void setverify(bool verify); // check the archive against its .md5 file while extracting
+		void setpaths(vector<string> restore_paths); // only extract these absolute paths and what is below them, seeking via the .idx sidecar
 	private:
 		int createTGZ();
 		int create();
 		int Split_Archive();
 		int removeEOT(string tarFile);
 		int extractTar();
+		int extractEntries();
+		int extractEntry();
+		int extractSelected();
+		int readIndex(vector<unsigned long long>& offsets);
+		string entryName(const char* filename);
+		bool isSelected(string name);
+		static string normalizePath(string path);
 		int tarDirs(bool include_root);
 		int Generate_Multiple_Archives(string Path);
 		string Strip_Root_Dir(string Path);
@@ -67,4 +78,7 @@ class twrpTar {
 		string tardir;
 		string tarfn;
 		string basefn;
+		string remap_root;
+		bool verify_md5;
+		vector<string> paths;
 }; 
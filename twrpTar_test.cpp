@@ -0,0 +1,152 @@
+/*
+        Copyright 2012 bigbiff/Dees_Troy TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Restores backup archives the way MultiROM::extractBackupFile does and
+// checks where the files end up.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include "twrpTar.hpp"
+#include "data.hpp"
+#include "twrp-functions.hpp"
+
+// twrpTar only needs these few recovery services; keep the test standalone.
+extern "C" void gui_print(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+int DataManager::GetValue(const string varName, int& value)
+{
+	value = 0;
+	return 0;
+}
+
+unsigned long TWFunc::Get_File_Size(string Path)
+{
+	struct stat st;
+	return stat(Path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+unsigned long long TWFunc::Get_Folder_Size(const string& Path, bool Display_Error)
+{
+	return 0;
+}
+
+int TWFunc::read_file(string fn, string& results)
+{
+	return -1;
+}
+
+int TWFunc::write_file(string fn, string& line)
+{
+	return -1;
+}
+
+static int failed = 0;
+
+static void check(bool ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok)
+		failed = 1;
+}
+
+static bool exists(const string& path)
+{
+	struct stat st;
+	return lstat(path.c_str(), &st) == 0;
+}
+
+static void write_test_file(const string& path)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd >= 0) {
+		write(fd, "twrp\n", 5);
+		close(fd);
+	}
+}
+
+// Stores realdir in fn with entry names starting at savedir.
+static bool make_archive(const string& fn, const string& realdir, const string& savedir)
+{
+	TAR *t;
+	if (tar_open(&t, (char*) fn.c_str(), NULL, O_WRONLY | O_CREAT | O_TRUNC, 0644, TAR_GNU) != 0)
+		return false;
+	bool ok = tar_append_tree(t, (char*) realdir.c_str(), (char*) savedir.c_str()) == 0
+		&& tar_append_eof(t) == 0;
+	return tar_close(t) == 0 && ok;
+}
+
+static bool restore(const string& fn, const string& dir, bool split)
+{
+	twrpTar tar;
+	tar.setdir(dir);
+	if (split)
+		tar.setremap("/data");
+	tar.setfn(fn);
+	tar.setverify(false);
+	return tar.extract() == 0;
+}
+
+int main(int argc, char **argv)
+{
+	char tmpl[] = "/tmp/twrptar_test.XXXXXX";
+	if (mkdtemp(tmpl) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	string root = tmpl;
+	string src = root + "/src";
+
+	// /data/data/com.example/foo, as found on a real /data partition.
+	mkdir(src.c_str(), 0755);
+	mkdir((src + "/data").c_str(), 0755);
+	mkdir((src + "/data/com.example").c_str(), 0755);
+	write_test_file(src + "/data/com.example/foo");
+
+	// A single data.ext4.win stores names relative to the partition root.
+	string single = root + "/data.ext4.win";
+	string out = root + "/single";
+	mkdir(out.c_str(), 0755);
+	check(make_archive(single, src + "/data", "data"), "create single archive");
+	check(restore(single, out, false), "extract single archive");
+	check(exists(out + "/data/com.example/foo"), "single archive keeps nested data/");
+	check(!exists(out + "/com.example"), "single archive is not remapped");
+
+	// Split parts store the full path, so /data is stripped on restore.
+	string part = root + "/data.ext4.win000";
+	out = root + "/split";
+	mkdir(out.c_str(), 0755);
+	check(make_archive(part, src + "/data", "data/data"), "create split archive");
+	check(restore(part, out, true), "extract split archive");
+	check(exists(out + "/data/com.example/foo"), "split archive lands under the target");
+
+	string cmd = "rm -rf " + root;
+	system(cmd.c_str());
+	return failed;
+}
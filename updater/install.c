@@ -36,6 +36,7 @@
 #include "mtdutils/mounts.h"
 #include "mtdutils/mtdutils.h"
 #include "updater.h"
+#include "install.h"
 #include "applypatch/applypatch.h"
 
 #ifdef USE_EXT4
@@ -578,6 +579,151 @@ done:
     return StringValue(result);
 }
 
+// set_perm_batch(<set_perm or set_perm_recursive call>, ...)
+//
+// Internal; BatchSetPermStatements() replaces runs of consecutive
+// set_perm and set_perm_recursive statements with one of these so the
+// trees they cover are walked once.  If an argument doesn't parse or a
+// change fails, the original statements are run one by one instead so
+// the script aborts at the same statement with the same message.
+static Value* SetPermBatchFn(const char* name, State* state,
+                             int argc, Expr* argv[]) {
+    int count = 0;
+    int i, j;
+    for (i = 0; i < argc; ++i) {
+        count += argv[i]->argc - (argv[i]->fn == SetPermFn &&
+                strcmp(argv[i]->name, "set_perm_recursive") == 0 ? 4 : 3);
+    }
+
+    DirPermissionRule* rules = malloc(count * sizeof(DirPermissionRule));
+    int n = 0;
+    bool ok = (rules != NULL);
+    for (i = 0; ok && i < argc; ++i) {
+        Expr* call = argv[i];
+        bool recursive = (strcmp(call->name, "set_perm_recursive") == 0);
+        int first = recursive ? 4 : 3;
+        unsigned long v[4];
+        char* end;
+
+        for (j = 0; ok && j < first; ++j) {
+            const char* arg = call->argv[j]->name;
+            v[j] = strtoul(arg, &end, 0);
+            ok = (*end == '\0' && arg[0] != 0);
+        }
+        for (j = first; ok && j < call->argc; ++j) {
+            DirPermissionRule* r = rules + n++;
+            r->path = call->argv[j]->name;
+            r->uid = v[0];
+            r->gid = v[1];
+            r->dirMode = v[2];
+            r->fileMode = recursive ? v[3] : v[2];
+            r->recursive = recursive;
+        }
+    }
+
+    if (ok && dirSetHierarchyPermissionsBatch(rules, n) == 0) {
+        free(rules);
+        return StringValue(strdup(""));
+    }
+    free(rules);
+
+    Value* result = NULL;
+    for (i = 0; i < argc; ++i) {
+        FreeValue(result);
+        result = EvaluateValue(state, argv[i]);
+        if (result == NULL) return NULL;
+    }
+    return result;
+}
+
+static bool IsBatchableSetPerm(Expr* e) {
+    if (e->fn != SetPermFn) return false;
+    int min_args = strcmp(e->name, "set_perm_recursive") == 0 ? 5 : 4;
+    if (e->argc < min_args) return false;
+    int i;
+    for (i = 0; i < e->argc; ++i) {
+        if (e->argv[i]->fn != Literal) return false;
+    }
+    return true;
+}
+
+// Flatten a chain of ';' sequences into its statements, batching the
+// set_perm calls nested in each statement (e.g. inside if/else) too.
+static void CollectStatements(Expr* e, Expr*** list, int* count, int* size) {
+    if (e->fn == SequenceFn) {
+        CollectStatements(e->argv[0], list, count, size);
+        CollectStatements(e->argv[1], list, count, size);
+        return;
+    }
+    BatchSetPermStatements(e);
+    if (*count == *size) {
+        *size = *size ? *size * 2 : 16;
+        *list = realloc(*list, *size * sizeof(Expr*));
+    }
+    (*list)[(*count)++] = e;
+}
+
+static Expr* NewExpr(Function fn, const char* name, int argc, Expr** argv) {
+    Expr* e = malloc(sizeof(Expr));
+    e->fn = fn;
+    e->name = strdup(name);
+    e->argc = argc;
+    e->argv = argv;
+    e->start = argv[0]->start;
+    e->end = argv[argc-1]->end;
+    return e;
+}
+
+void BatchSetPermStatements(Expr* root) {
+    if (root->fn != SequenceFn) {
+        int i;
+        for (i = 0; i < root->argc; ++i) {
+            BatchSetPermStatements(root->argv[i]);
+        }
+        return;
+    }
+
+    Expr** list = NULL;
+    int count = 0, size = 0;
+    CollectStatements(root, &list, &count, &size);
+
+    // Merge each run of two or more set_perm statements that has at
+    // least one set_perm_recursive in it.
+    int in = 0, out = 0, batches = 0;
+    while (in < count) {
+        int run = 0, recursive = 0;
+        while (in + run < count && IsBatchableSetPerm(list[in + run])) {
+            if (strcmp(list[in + run]->name, "set_perm_recursive") == 0) {
+                ++recursive;
+            }
+            ++run;
+        }
+        if (run >= 2 && recursive > 0) {
+            Expr** calls = malloc(run * sizeof(Expr*));
+            memcpy(calls, list + in, run * sizeof(Expr*));
+            list[out++] = NewExpr(SetPermBatchFn, "set_perm_batch", run, calls);
+            in += run;
+            ++batches;
+        } else {
+            list[out++] = list[in++];
+        }
+    }
+
+    if (batches > 0) {
+        // Rebuild the sequence in place, since the parent points at root.
+        Expr* seq = list[0];
+        int i;
+        for (i = 1; i < out; ++i) {
+            Expr** pair = malloc(2 * sizeof(Expr*));
+            pair[0] = seq;
+            pair[1] = list[i];
+            seq = NewExpr(SequenceFn, ";", 2, pair);
+        }
+        *root = *seq;
+    }
+    free(list);
+}
+
 
 Value* GetPropFn(const char* name, State* state, int argc, Expr* argv[]) {
     if (argc != 1) {
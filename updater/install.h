@@ -17,6 +17,12 @@
 #ifndef _UPDATER_INSTALL_H_
 #define _UPDATER_INSTALL_H_
 
+#include "edify/expr.h"
+
 void RegisterInstallFunctions();
 
+// Merge runs of set_perm/set_perm_recursive statements in the parsed
+// script so that each run is applied in one walk of the filesystem.
+void BatchSetPermStatements(Expr* root);
+
 #endif
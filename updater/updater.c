@@ -104,6 +104,7 @@ int main(int argc, char** argv) {
         fprintf(stderr, "%d parse errors\n", error_count);
         return 6;
     }
+    BatchSetPermStatements(root);
 
 #ifdef HAVE_SELINUX
     struct selinux_opt seopts[] = {
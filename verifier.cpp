@@ -105,13 +105,40 @@ exit:
     return NULL;
 }
 
+// Checks the RSA signature at the end of the EOCD record against the
+// SHA-1 of the signed part of the package.  Frees eocd.
+static int check_signature(RSAPublicKey* loadedKeys, int numKeys,
+                           unsigned char* eocd, size_t eocd_size,
+                           const uint8_t* sha1) {
+    int i;
+
+    for (i = 0; i < numKeys; ++i) {
+        // The 6 bytes is the "(signature_start) $ff $ff (comment_size)" that
+        // the signing tool appends after the signature itself.
+		int dees = RSA_verify(loadedKeys+i, eocd + eocd_size - 6 - RSANUMBYTES,
+                       RSANUMBYTES, sha1);
+        if (dees) {
+            LOGI("whole-file signature verified against key %d\n", i);
+            free(eocd);
+            return VERIFY_SUCCESS;
+        }
+		LOGI("i: %i, eocd_size: %i, RSANUMBYTES: %i, returned %i\n", i, eocd_size, RSANUMBYTES, dees);
+    }
+    free(eocd);
+    LOGE("failed to verify whole-file signature\n");
+    return VERIFY_FAILURE;
+}
+
 // Look for an RSA signature embedded in the .ZIP file comment given
 // the path to the zip.  Verify it matches one of the given public
-// keys.
+// keys.  If digest is given, it is the SHA-1 of the first digest_len
+// bytes of the file, already computed by the caller, and the file is
+// not hashed again.
 //
 // Return VERIFY_SUCCESS, VERIFY_FAILURE (if any error is encountered
 // or no key matches the signature).
-int verify_file(const char* path) {
+static int verify_package(const char* path, const uint8_t* digest,
+                          size_t digest_len) {
     //ui->SetProgress(0.0);
 
 	int numKeys;
@@ -231,6 +258,17 @@ int verify_file(const char* path) {
         }
     }
 
+    if (digest != NULL) {
+        fclose(f);
+        if (digest_len != signed_len) {
+            LOGE("digest covers %zu bytes, signature %zu\n", digest_len,
+                 signed_len);
+            free(eocd);
+            return VERIFY_FAILURE;
+        }
+        return check_signature(loadedKeys, numKeys, eocd, eocd_size, digest);
+    }
+
 #define BUFFER_SIZE 4096
 
     SHA_CTX ctx;
@@ -264,20 +302,15 @@ int verify_file(const char* path) {
     fclose(f);
     free(buffer);
 
-    const uint8_t* sha1 = SHA_final(&ctx);
-    for (i = 0; i < numKeys; ++i) {
-        // The 6 bytes is the "(signature_start) $ff $ff (comment_size)" that
-        // the signing tool appends after the signature itself.
-		int dees = RSA_verify(loadedKeys+i, eocd + eocd_size - 6 - RSANUMBYTES,
-                       RSANUMBYTES, sha1);
-        if (dees) {
-            LOGI("whole-file signature verified against key %d\n", i);
-            free(eocd);
-            return VERIFY_SUCCESS;
-        }
-		LOGI("i: %i, eocd_size: %i, RSANUMBYTES: %i, returned %i\n", i, eocd_size, RSANUMBYTES, dees);
-    }
-    free(eocd);
-    LOGE("failed to verify whole-file signature\n");
-    return VERIFY_FAILURE;
+    return check_signature(loadedKeys, numKeys, eocd, eocd_size,
+                           SHA_final(&ctx));
+}
+
+int verify_file(const char* path) {
+    return verify_package(path, NULL, 0);
+}
+
+int verify_file_digest(const char* path, const uint8_t* sha1,
+                       size_t signed_len) {
+    return verify_package(path, sha1, signed_len);
 }
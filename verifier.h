@@ -30,6 +30,12 @@ static const float VERIFICATION_PROGRESS_FRACTION = 0.25;
  */
 int verify_file(const char* path);
 
+/* Same as verify_file(), with the SHA-1 of the first signed_len bytes
+ * of the file already computed (e.g. while it was being received).
+ */
+int verify_file_digest(const char* path, const uint8_t* sha1,
+                       size_t signed_len);
+
 #define VERIFY_SUCCESS        0
 #define VERIFY_FAILURE        1
 